@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+//////////////////////////////////////////////////////////////////////////
+//  Coroutine core
+//
+//  Task<T>         Lazily started coroutine that produces a T. Await it
+//                  from another coroutine, or Detach it to let it run on
+//                  its own.
+//  Completion<T>   One-shot rendezvous between an asynchronous operation
+//                  and the coroutine that waits for it. Complete may be
+//                  called from any thread, before or after the coroutine
+//                  suspends; the coroutine resumes inline on the thread
+//                  that completes it, so there is no extra thread hop.
+//                  When two parties may finish the operation (the real
+//                  completion and a cancellation), each calls Claim
+//                  first and only the winner calls Complete.
+//
+//  This header has no Windows dependencies; MFAwaitable.h builds the
+//  Media Foundation awaiters on top of it.
+//
+//  Coroutines here do not throw: an exception escaping a Task terminates
+//  the process, like an unhandled exception in a work queue callback.
+//////////////////////////////////////////////////////////////////////////
+
+namespace Async
+{
+    template<class T>
+    class Task
+    {
+    public:
+
+        struct promise_type
+        {
+            T m_value{};
+            std::coroutine_handle<> m_continuation;
+            bool m_detached = false;
+
+            Task get_return_object(void)
+            {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend(void) noexcept
+            {
+                return {};
+            }
+
+            struct FinalAwaiter
+            {
+                bool await_ready(void) noexcept
+                {
+                    return false;
+                }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                {
+                    promise_type& promise = h.promise();
+                    if (promise.m_continuation)
+                    {
+                        // Resume whoever awaited us, on this thread.
+                        return promise.m_continuation;
+                    }
+                    if (promise.m_detached)
+                    {
+                        // Nobody owns a detached task; it frees itself.
+                        h.destroy();
+                    }
+                    return std::noop_coroutine();
+                }
+
+                void await_resume(void) noexcept
+                {
+                }
+            };
+
+            FinalAwaiter final_suspend(void) noexcept
+            {
+                return {};
+            }
+
+            void return_value(T value)
+            {
+                m_value = std::move(value);
+            }
+
+            void unhandled_exception(void)
+            {
+                std::terminate();
+            }
+        };
+
+        Task(Task&& other) noexcept :
+            m_h(std::exchange(other.m_h, nullptr))
+        {
+        }
+
+        ~Task(void)
+        {
+            if (m_h)
+            {
+                m_h.destroy();
+            }
+        }
+
+        // Awaiting a task starts it; the awaiting coroutine resumes when
+        // the task completes.
+        bool await_ready(void) const noexcept
+        {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            m_h.promise().m_continuation = awaiting;
+            return m_h;
+        }
+
+        T await_resume(void)
+        {
+            return std::move(m_h.promise().m_value);
+        }
+
+        // Starts the task on the calling thread and lets it run to
+        // completion on its own. It runs synchronously up to its first
+        // suspension; its frame is freed when it finishes.
+        void Detach(void) &&
+        {
+            std::coroutine_handle<promise_type> h = std::exchange(m_h, nullptr);
+            h.promise().m_detached = true;
+            h.resume();
+        }
+
+    private:
+
+        explicit Task(std::coroutine_handle<promise_type> h) :
+            m_h(h)
+        {
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        std::coroutine_handle<promise_type> m_h;
+    };
+
+
+    template<class T>
+    class Completion
+    {
+    public:
+
+        Completion(void) :
+            m_state(Empty),
+            m_claimed(false)
+        {
+        }
+
+        // Returns true for the first caller only. Whoever gets true must
+        // call Complete; the others must not.
+        bool Claim(void)
+        {
+            return !m_claimed.exchange(true, std::memory_order_acq_rel);
+        }
+
+        // Stores the result and resumes the waiting coroutine, if there is
+        // one, before returning. Call exactly once.
+        void Complete(T value)
+        {
+            m_value = std::move(value);
+
+            if (m_state.exchange(Completed, std::memory_order_acq_rel) == Waiting)
+            {
+                m_waiter.resume();
+            }
+        }
+
+        bool await_ready(void) const noexcept
+        {
+            return m_state.load(std::memory_order_acquire) == Completed;
+        }
+
+        // Returns false, and so does not suspend, if the operation has
+        // already completed.
+        bool await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            m_waiter = h;
+
+            int expected = Empty;
+            return m_state.compare_exchange_strong(expected, Waiting, std::memory_order_acq_rel, std::memory_order_acquire);
+        }
+
+        T await_resume(void)
+        {
+            return std::move(m_value);
+        }
+
+    private:
+
+        enum
+        {
+            Empty,
+            Waiting,
+            Completed
+        };
+
+        Completion(const Completion&) = delete;
+        Completion& operator=(const Completion&) = delete;
+
+        std::atomic<int> m_state;
+        std::atomic<bool> m_claimed;
+        std::coroutine_handle<> m_waiter;
+        T m_value{};
+    };
+}
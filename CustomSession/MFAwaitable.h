@@ -0,0 +1,400 @@
+#pragma once
+#include "Coroutine.h"
+#include <memory>
+#include <mutex>
+#include <new>
+#include <windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <wrl/client.h>
+
+//////////////////////////////////////////////////////////////////////////
+//  Media Foundation awaiters
+//
+//  co_await adapters for the Begin/End asynchronous pattern:
+//
+//      MediaEventResult ev = co_await MFAsync::GetEventAsync(pSession);
+//      ObjectResult obj = co_await MFAsync::CreateObjectFromURLAsync(pResolver, url, flags);
+//      WorkItemResult wi = co_await MFAsync::ResumeOnWorkQueueAsync(queue);
+//
+//  The operation is started when the awaiter is created, so create it in
+//  the co_await expression. The coroutine resumes on the Media Foundation
+//  thread that runs the completion callback.
+//
+//  Source resolution can be cancelled from another thread through a
+//  CCancelCreateObject; the coroutine then resumes on the cancelling
+//  thread with MF_E_OPERATION_CANCELLED.
+//////////////////////////////////////////////////////////////////////////
+
+namespace MFAsync
+{
+    struct MediaEventResult
+    {
+        HRESULT hr = S_OK;
+        Microsoft::WRL::ComPtr<IMFMediaEvent> pEvent;
+    };
+
+    struct ObjectResult
+    {
+        HRESULT hr = S_OK;
+        MF_OBJECT_TYPE ObjectType = MF_OBJECT_INVALID;
+        Microsoft::WRL::ComPtr<IUnknown> pObject;
+    };
+
+    struct WorkItemResult
+    {
+        HRESULT hr = S_OK;
+    };
+
+    // Called with the result of an operation that was cancelled but
+    // completed anyway, which nobody is waiting for.
+    inline void DiscardResult(MediaEventResult&)
+    {
+    }
+
+    inline void DiscardResult(WorkItemResult&)
+    {
+    }
+
+    inline void DiscardResult(ObjectResult& result)
+    {
+        // A source that nobody will use still has to be shut down.
+        Microsoft::WRL::ComPtr<IMFMediaSource> pSource;
+        if (result.pObject && SUCCEEDED(result.pObject.As(&pSource)))
+        {
+            (void)pSource->Shutdown();
+        }
+    }
+
+
+    // Callback of a pending operation, as seen by a canceller.
+    class CAwaitCallbackBase : public IMFAsyncCallback
+    {
+    public:
+
+        // Resumes the waiting coroutine with hrCancel, unless the
+        // operation has already completed.
+        virtual void Cancel(HRESULT hrCancel) = 0;
+    };
+
+
+    //////////////////////////////////////////////////////////////////////////
+    //  CAwaitCallback [template]
+    //
+    //  Description:
+    //  IMFAsyncCallback that finishes the operation with EndFn and hands
+    //  the result to the waiting coroutine.
+    //////////////////////////////////////////////////////////////////////////
+
+    template<class TResult, class EndFn>
+    class CAwaitCallback : public CAwaitCallbackBase
+    {
+    public:
+
+        explicit CAwaitCallback(EndFn end) :
+            m_nRefCount(1),
+            m_end(std::move(end))
+        {
+        }
+
+        Async::Completion<TResult>& GetCompletion(void)
+        {
+            return m_completion;
+        }
+
+        // IUnknown
+        STDMETHODIMP_(ULONG) AddRef(void)override
+        {
+            return InterlockedIncrement(&m_nRefCount);
+        }
+
+        STDMETHODIMP_(ULONG) Release(void)override
+        {
+            ULONG uCount = InterlockedDecrement(&m_nRefCount);
+            if (uCount == 0)
+            {
+                delete this;
+            }
+            return uCount;
+        }
+
+        STDMETHODIMP QueryInterface(REFIID iid, void** ppv)override
+        {
+            if (!ppv)
+            {
+                return E_POINTER;
+            }
+            if (iid == __uuidof(IUnknown) || iid == __uuidof(IMFAsyncCallback))
+            {
+                *ppv = static_cast<IMFAsyncCallback*>(this);
+            }
+            else
+            {
+                *ppv = NULL;
+                return E_NOINTERFACE;
+            }
+            AddRef();
+            return S_OK;
+        }
+
+        // IMFAsyncCallback
+        STDMETHODIMP GetParameters(DWORD*, DWORD*)override
+        {
+            // Implementation of this method is optional.
+            return E_NOTIMPL;
+        }
+
+        STDMETHODIMP Invoke(IMFAsyncResult* pAsyncResult)override
+        {
+            TResult result;
+            m_end(pAsyncResult, result);
+
+            // May resume the coroutine right here.
+            if (m_completion.Claim())
+            {
+                m_completion.Complete(std::move(result));
+            }
+            else
+            {
+                DiscardResult(result);
+            }
+            return S_OK;
+        }
+
+        void Cancel(HRESULT hrCancel)override
+        {
+            if (m_completion.Claim())
+            {
+                TResult result;
+                result.hr = hrCancel;
+                m_completion.Complete(std::move(result));
+            }
+        }
+
+    private:
+
+        virtual ~CAwaitCallback(void)
+        {
+        }
+
+        long m_nRefCount;
+        EndFn m_end;
+        Async::Completion<TResult> m_completion;
+    };
+
+
+    //////////////////////////////////////////////////////////////////////////
+    //  CAsyncAwaiter [template]
+    //
+    //  Description:
+    //  Awaiter for one Begin/End operation. BeginFn receives the callback
+    //  to pass to the Begin method and returns its HRESULT; EndFn receives
+    //  the IMFAsyncResult and fills in the TResult. If Begin fails, the
+    //  coroutine does not suspend and gets a TResult carrying that error.
+    //////////////////////////////////////////////////////////////////////////
+
+    template<class TResult>
+    class CAsyncAwaiter
+    {
+    public:
+
+        template<class BeginFn, class EndFn>
+        CAsyncAwaiter(BeginFn begin, EndFn end) :
+            m_hrBegin(S_OK),
+            m_pCompletion(NULL)
+        {
+            CAwaitCallback<TResult, EndFn>* pCallback = new (std::nothrow) CAwaitCallback<TResult, EndFn>(std::move(end));
+            if (pCallback == NULL)
+            {
+                m_hrBegin = E_OUTOFMEMORY;
+                return;
+            }
+
+            m_pCallback.Attach(pCallback);
+            m_pCompletion = &pCallback->GetCompletion();
+
+            m_hrBegin = begin(static_cast<CAwaitCallbackBase*>(pCallback));
+        }
+
+        bool await_ready(void) const noexcept
+        {
+            return FAILED(m_hrBegin) || m_pCompletion->await_ready();
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            return m_pCompletion->await_suspend(h);
+        }
+
+        TResult await_resume(void)
+        {
+            if (FAILED(m_hrBegin))
+            {
+                TResult result;
+                result.hr = m_hrBegin;
+                return result;
+            }
+            return m_pCompletion->await_resume();
+        }
+
+    private:
+
+        HRESULT m_hrBegin;
+        Microsoft::WRL::ComPtr<IMFAsyncCallback> m_pCallback;   // Keeps the completion alive.
+        Async::Completion<TResult>* m_pCompletion;
+    };
+
+
+    // Waits for the next event of an event generator (BeginGetEvent).
+    inline CAsyncAwaiter<MediaEventResult> GetEventAsync(IMFMediaEventGenerator* pGenerator)
+    {
+        Microsoft::WRL::ComPtr<IMFMediaEventGenerator> pGen(pGenerator);
+
+        return CAsyncAwaiter<MediaEventResult>(
+            [pGen](IMFAsyncCallback* pCallback)
+            {
+                return pGen->BeginGetEvent(pCallback, NULL);
+            },
+            [pGen](IMFAsyncResult* pResult, MediaEventResult& result)
+            {
+                result.hr = pGen->EndGetEvent(pResult, &result.pEvent);
+            });
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //  CCancelCreateObject
+    //
+    //  Description:
+    //  Cancels a CreateObjectFromURLAsync operation from any thread. The
+    //  awaiter records the resolver's cancel cookie here when it starts
+    //  the operation. Cancel passes the cookie to CancelObjectCreation and
+    //  resumes the coroutine, because the resolver does not invoke the
+    //  callback of a cancelled operation. If the operation completes
+    //  anyway, the first of the two wins. Cancelling before the operation
+    //  starts makes it fail at once.
+    //////////////////////////////////////////////////////////////////////////
+
+    class CCancelCreateObject
+    {
+    public:
+
+        CCancelCreateObject(void) :
+            m_bCancelled(false)
+        {
+        }
+
+        void Cancel(void)
+        {
+            Microsoft::WRL::ComPtr<IMFSourceResolver> pResolver;
+            Microsoft::WRL::ComPtr<IUnknown> pCancelCookie;
+            Microsoft::WRL::ComPtr<CAwaitCallbackBase> pCallback;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+
+                m_bCancelled = true;
+                pResolver.Swap(m_pResolver);
+                pCancelCookie.Swap(m_pCancelCookie);
+                pCallback.Swap(m_pCallback);
+            }
+
+            // Outside the lock: Cancel may resume the coroutine here.
+            if (pResolver)
+            {
+                (void)pResolver->CancelObjectCreation(pCancelCookie.Get());
+                pCallback->Cancel(MF_E_OPERATION_CANCELLED);
+            }
+        }
+
+        bool IsCancelled(void)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_bCancelled;
+        }
+
+        // Called by CreateObjectFromURLAsync once the operation has started.
+        void Started(IMFSourceResolver* pResolver, IUnknown* pCancelCookie, CAwaitCallbackBase* pCallback)
+        {
+            bool bCancelled = false;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+
+                m_pResolver = pResolver;
+                m_pCancelCookie = pCancelCookie;
+                m_pCallback = pCallback;
+                bCancelled = m_bCancelled;
+            }
+
+            // Cancelled while the operation was being started.
+            if (bCancelled)
+            {
+                Cancel();
+            }
+        }
+
+    private:
+
+        CCancelCreateObject(const CCancelCreateObject&) = delete;
+        CCancelCreateObject& operator=(const CCancelCreateObject&) = delete;
+
+        std::mutex m_lock;
+        bool m_bCancelled;
+        Microsoft::WRL::ComPtr<IMFSourceResolver> m_pResolver;
+        Microsoft::WRL::ComPtr<IUnknown> m_pCancelCookie;
+        Microsoft::WRL::ComPtr<CAwaitCallbackBase> m_pCallback;
+    };
+
+
+    // Resolves a URL (BeginCreateObjectFromURL). The URL is copied by the
+    // resolver, so it only has to live until this call returns. If pCancel
+    // is not NULL, the operation can be cancelled through it; it only has
+    // to live until this call returns as well.
+    inline CAsyncAwaiter<ObjectResult> CreateObjectFromURLAsync(
+        IMFSourceResolver* pResolver,
+        PCWSTR pwszURL,
+        DWORD dwFlags,
+        IPropertyStore* pProps = NULL,
+        CCancelCreateObject* pCancel = NULL)
+    {
+        Microsoft::WRL::ComPtr<IMFSourceResolver> pRes(pResolver);
+
+        return CAsyncAwaiter<ObjectResult>(
+            [pRes, pwszURL, dwFlags, pProps, pCancel](CAwaitCallbackBase* pCallback)
+            {
+                if (pCancel == NULL)
+                {
+                    return pRes->BeginCreateObjectFromURL(pwszURL, dwFlags, pProps, NULL, pCallback, NULL);
+                }
+
+                if (pCancel->IsCancelled())
+                {
+                    return MF_E_OPERATION_CANCELLED;
+                }
+
+                Microsoft::WRL::ComPtr<IUnknown> pCancelCookie;
+                HRESULT hr = pRes->BeginCreateObjectFromURL(pwszURL, dwFlags, pProps, &pCancelCookie, pCallback, NULL);
+                if (SUCCEEDED(hr))
+                {
+                    pCancel->Started(pRes.Get(), pCancelCookie.Get(), pCallback);
+                }
+                return hr;
+            },
+            [pRes](IMFAsyncResult* pResult, ObjectResult& result)
+            {
+                result.hr = pRes->EndCreateObjectFromURL(pResult, &result.ObjectType, &result.pObject);
+            });
+    }
+
+    // Continues the coroutine on a work queue (MFPutWorkItem).
+    inline CAsyncAwaiter<WorkItemResult> ResumeOnWorkQueueAsync(DWORD dwQueue = MFASYNC_CALLBACK_QUEUE_STANDARD)
+    {
+        return CAsyncAwaiter<WorkItemResult>(
+            [dwQueue](IMFAsyncCallback* pCallback)
+            {
+                return MFPutWorkItem(dwQueue, pCallback, NULL);
+            },
+            [](IMFAsyncResult* pResult, WorkItemResult& result)
+            {
+                result.hr = pResult->GetStatus();
+            });
+    }
+}
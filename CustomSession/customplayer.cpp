@@ -12,50 +12,6 @@
 #pragma comment(lib, "shlwapi")
 
 
-//  Create a media source from a URL.
-static Microsoft::WRL::ComPtr<IMFMediaSource> CreateMediaSource(PCWSTR sURL)
-{
-    // Create the source resolver.
-    Microsoft::WRL::ComPtr<IMFSourceResolver> pSourceResolver;
-    HRESULT hr = MFCreateSourceResolver(&pSourceResolver);
-    if (FAILED(hr))
-    {
-        return nullptr;
-    }
-
-    // Use the source resolver to create the media source.
-
-    // Note: For simplicity this sample uses the synchronous method to create 
-    // the media source. However, creating a media source can take a noticeable
-    // amount of time, especially for a network source. For a more responsive 
-    // UI, use the asynchronous BeginCreateObjectFromURL method.
-
-    MF_OBJECT_TYPE ObjectType = MF_OBJECT_INVALID;
-    Microsoft::WRL::ComPtr<IUnknown> pSource;
-    hr = pSourceResolver->CreateObjectFromURL(
-        sURL,                       // URL of the source.
-        MF_RESOLUTION_MEDIASOURCE,  // Create a source object.
-        NULL,                       // Optional property store.
-        &ObjectType,        // Receives the created object type. 
-        &pSource            // Receives a pointer to the media source.
-    );
-    if (FAILED(hr))
-    {
-        return nullptr;
-    }
-
-    // Get the IMFMediaSource interface from the media source.
-    Microsoft::WRL::ComPtr<IMFMediaSource> ppSource;
-    
-    hr = pSource.As(&ppSource);
-    if (FAILED(hr))
-    {
-        return nullptr;
-    }
-
-    return ppSource;
-}
-
 static  Microsoft::WRL::ComPtr<IMFTopologyNode> CreateSourceNode(
     const Microsoft::WRL::ComPtr<IMFMediaSource> &pSource,          // Media source.
     const Microsoft::WRL::ComPtr<IMFPresentationDescriptor> &pPD,   // Presentation descriptor.
@@ -92,59 +48,6 @@ static  Microsoft::WRL::ComPtr<IMFTopologyNode> CreateSourceNode(
     return pNode;
 }
 
-//  Create an activation object for a renderer, based on the stream media type.
-static Microsoft::WRL::ComPtr<IMFActivate> CreateMediaSinkActivate(
-    const Microsoft::WRL::ComPtr<IMFStreamDescriptor> &pSourceSD,     // Pointer to the stream descriptor.
-    HWND hVideoWindow                  // Handle to the video clipping window.
-)
-{
-    // Get the media type handler for the stream.
-    Microsoft::WRL::ComPtr<IMFMediaTypeHandler> pHandler;
-    HRESULT hr = pSourceSD->GetMediaTypeHandler(&pHandler);
-    if (FAILED(hr))
-    {
-        return nullptr;
-    }
-
-    // Get the major media type.
-    GUID guidMajorType;
-    hr = pHandler->GetMajorType(&guidMajorType);
-    if (FAILED(hr))
-    {
-        return nullptr;
-    }
-
-    // Create an IMFActivate object for the renderer, based on the media type.
-    if (MFMediaType_Audio == guidMajorType)
-    {
-        // Create the audio renderer.
-        Microsoft::WRL::ComPtr<IMFActivate> pActivate;
-        hr = MFCreateAudioRendererActivate(&pActivate);
-        if (FAILED(hr))
-        {
-            return nullptr;
-        }
-        return pActivate;
-    }
-    else if (MFMediaType_Video == guidMajorType)
-    {
-        // Create the video renderer.
-        Microsoft::WRL::ComPtr<IMFActivate> pActivate;
-        hr = MFCreateVideoRendererActivate(hVideoWindow, &pActivate);
-        if (FAILED(hr))
-        {
-            return nullptr;
-        }
-        return pActivate;
-    }
-    else
-    {
-        // Unknown stream type. 
-        return nullptr;
-        // Optionally, you could deselect this stream instead of failing.
-    }
-}
-
 static Microsoft::WRL::ComPtr<IMFTopologyNode> CreateOutputNode(
     const Microsoft::WRL::ComPtr<IMFActivate> &pActivate,     // Media sink activation object.
     DWORD dwId                  // Identifier of the stream sink.
@@ -172,7 +75,9 @@ static Microsoft::WRL::ComPtr<IMFTopologyNode> CreateOutputNode(
         return nullptr;
     }
 
-    hr = pNode->SetUINT32(MF_TOPONODE_NOSHUTDOWN_ON_REMOVE, FALSE);
+    // The renderer is shared by the topologies of the session, so the
+    // session must not shut it down when a topology is removed.
+    hr = pNode->SetUINT32(MF_TOPONODE_NOSHUTDOWN_ON_REMOVE, TRUE);
     if (FAILED(hr))
     {
         return nullptr;
@@ -186,18 +91,27 @@ static Microsoft::WRL::ComPtr<IMFTopologyNode> CreateOutputNode(
 //
 //  For each stream, this function does the following:
 //
-//    1. Creates a source node associated with the stream. 
-//    2. Creates an output node for the renderer. 
+//    1. Creates an output node for the renderer. 
+//    2. Creates a source node associated with the stream. 
 //    3. Connects the two nodes.
 //
 //  The media session will add any decoders that are needed.
+//
+//  Returns S_FALSE and adds nothing for a stream that is not selected.
+//  A stream whose type is not in selection (subtitles, data, or a type
+//  the player was told to leave out) is deselected first, so the source
+//  does not read it and the session loads no decoder for it. On failure
+//  no part of the branch is left in the topology.
 
 static HRESULT AddBranchToPartialTopology(
     const Microsoft::WRL::ComPtr<IMFTopology> &pTopology,         // Topology.
     const Microsoft::WRL::ComPtr<IMFMediaSource> &pSource,        // Media source.
     const Microsoft::WRL::ComPtr<IMFPresentationDescriptor> &pPD, // Presentation descriptor.
     DWORD iStream,                  // Stream index.
-    HWND hVideoWnd)                 // Window for video playback.
+    SessionSinks &sinks,            // Renderers of the session; taken from the pool on first use.
+    CRendererPool &pool,            // Video renderers between sessions.
+    DWORD &cVideoStreams,           // Video branches added so far.
+    DWORD selection)                // StreamSelection flags.
 {
     BOOL fSelected = FALSE;
     Microsoft::WRL::ComPtr<IMFStreamDescriptor> pSD;
@@ -208,21 +122,8 @@ static HRESULT AddBranchToPartialTopology(
     }
     if (!fSelected)
     {
-        // else: If not selected, don't add the branch. 
-        return E_FAIL;
-    }
-
-    auto pSourceNode = CreateSourceNode(pSource, pPD, pSD);
-    if (!pSourceNode) 
-    {
-        return E_FAIL;
-    }
-
-    // Add the node to the topology.
-    hr = pTopology->AddNode(pSourceNode.Get());
-    if (FAILED(hr))
-    {
-        return hr;
+        // The source does not deliver this stream.
+        return S_FALSE;
     }
 
     // Get the media type handler for the stream.
@@ -241,52 +142,64 @@ static HRESULT AddBranchToPartialTopology(
         return hr;
     }
 
+    const bool bRender =
+        (MFMediaType_Audio == guidMajorType && (selection & SelectAudio) != 0) ||
+        (MFMediaType_Video == guidMajorType && (selection & SelectVideo) != 0);
+    if (!bRender)
+    {
+        hr = pPD->DeselectStream(iStream);
+        return FAILED(hr) ? hr : S_FALSE;
+    }
+
     // Create an IMFActivate object for the renderer, based on the media type.
     Microsoft::WRL::ComPtr<IMFTopologyNode> pOutputNode;
     if (MFMediaType_Audio == guidMajorType)
     {
-        // Create the audio renderer.
-        Microsoft::WRL::ComPtr<IMFActivate> pSinkActivate;
-        hr = MFCreateAudioRendererActivate(&pSinkActivate);
-        if (FAILED(hr))
+        // Create the audio renderer. The session activates it once and
+        // gets the same renderer from this object for later topologies.
+        if (!sinks.pAudioActivate)
         {
-            return hr;
+            hr = MFCreateAudioRendererActivate(&sinks.pAudioActivate);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
         }
 
-        pOutputNode = CreateOutputNode(pSinkActivate, 0);
+        pOutputNode = CreateOutputNode(sinks.pAudioActivate, 0);
         if (!pOutputNode) {
             return E_FAIL;
         }
     }
     else if (MFMediaType_Video == guidMajorType)
     {
-#if 0
-        // Create the video renderer.
-        Microsoft::WRL::ComPtr<IMFActivate> pSinkActivate;
-        hr = MFCreateVideoRendererActivate(hVideoWindow, &pSinkActivate);
-        if (FAILED(hr))
+        // Create the node.
+        if (FAILED(hr = MFCreateTopologyNode(MF_TOPOLOGY_OUTPUT_NODE, &pOutputNode)))
         {
             return hr;
         }
 
-        pOutputNode = CreateOutputNode(pSinkActivate, 0);
-        if (!pOutputNode) {
-            return E_FAIL;
-        }
-#else
-        // Create the node.
-        if (FAILED(hr = MFCreateTopologyNode(MF_TOPOLOGY_OUTPUT_NODE, &pOutputNode)))
+        // Reuse the session's renderer for this role, so that it keeps
+        // running when the session moves on to the next playlist item.
+        // A new session takes a reset one from the pool. The ordinal is
+        // only used up once the branch is in the topology, so the next
+        // video stream gets the renderer of a branch that failed.
+        const StreamRole role = { MFMediaType_Video, cVideoStreams };
+        if (sinks.VideoSinks.size() <= role.Ordinal)
         {
-            return hr;
+            sinks.VideoSinks.resize(role.Ordinal + 1);
         }
 
-        Microsoft::WRL::ComPtr<IMFMediaSink> pSink;
-        if (FAILED(hr = CreateCustomVideoRenderer(IID_PPV_ARGS(&pSink)))) {
-            return hr;
+        Microsoft::WRL::ComPtr<IMFMediaSink> &pVideoSink = sinks.VideoSinks[role.Ordinal];
+        if (!pVideoSink)
+        {
+            if (FAILED(hr = pool.Acquire(role, &pVideoSink))) {
+                return hr;
+            }
         }
 
         Microsoft::WRL::ComPtr<IMFStreamSink> pSSink;
-        if (FAILED(hr = pSink->GetStreamSinkByIndex(0, &pSSink))) {
+        if (FAILED(hr = pVideoSink->GetStreamSinkByIndex(0, &pSSink))) {
             return hr;
         }
 
@@ -303,32 +216,40 @@ static HRESULT AddBranchToPartialTopology(
             return hr;
         }
 
-        hr = pOutputNode->SetUINT32(MF_TOPONODE_NOSHUTDOWN_ON_REMOVE, FALSE);
+        hr = pOutputNode->SetUINT32(MF_TOPONODE_NOSHUTDOWN_ON_REMOVE, TRUE);
         if (FAILED(hr))
         {
             return hr;
         }
-#endif
     }
-    else
+
+    auto pSourceNode = CreateSourceNode(pSource, pPD, pSD);
+    if (!pSourceNode) 
     {
-        // Unknown stream type. 
         return E_FAIL;
-        // Optionally, you could deselect this stream instead of failing.
     }
 
-    // Add the node to the topology.
-    hr = pTopology->AddNode(pOutputNode.Get());
+    // Add the nodes to the topology and connect the source node to the
+    // output node.
+    hr = pTopology->AddNode(pSourceNode.Get());
+    if (SUCCEEDED(hr))
+    {
+        hr = pTopology->AddNode(pOutputNode.Get());
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pSourceNode->ConnectOutput(0, pOutputNode.Get(), 0);
+    }
     if (FAILED(hr))
     {
+        (void)pTopology->RemoveNode(pSourceNode.Get());
+        (void)pTopology->RemoveNode(pOutputNode.Get());
         return hr;
     }
 
-    // Connect the source node to the output node.
-    hr = pSourceNode->ConnectOutput(0, pOutputNode.Get(), 0);
-    if (FAILED(hr))
+    if (MFMediaType_Video == guidMajorType)
     {
-        return hr;
+        cVideoStreams++;
     }
 
     return S_OK;
@@ -336,10 +257,15 @@ static HRESULT AddBranchToPartialTopology(
 
 
 //  Create a playback topology from a media source.
+//
+//  A stream that cannot be rendered does not fail the topology: it is
+//  deselected and the others play. Fails only if no stream is left.
 static Microsoft::WRL::ComPtr<IMFTopology> CreatePlaybackTopology(
     const Microsoft::WRL::ComPtr<IMFMediaSource> &pSource,          // Media source.
     const Microsoft::WRL::ComPtr<IMFPresentationDescriptor> &pPD,   // Presentation descriptor.
-    HWND hVideoWnd                   // Video window.
+    SessionSinks &sinks,             // Renderers of the session.
+    CRendererPool &pool,             // Video renderers between sessions.
+    DWORD selection                  // StreamSelection flags.
 )
 {
     // Create a new topology.
@@ -359,15 +285,27 @@ static Microsoft::WRL::ComPtr<IMFTopology> CreatePlaybackTopology(
     }
 
     // For each stream, create the topology nodes and add them to the topology.
+    DWORD cVideoStreams = 0;
+    DWORD cBranches = 0;
     for (DWORD i = 0; i < cSourceStreams; i++)
     {
-        hr = AddBranchToPartialTopology(pTopology, pSource, pPD, i, hVideoWnd);
+        hr = AddBranchToPartialTopology(pTopology, pSource, pPD, i, sinks, pool, cVideoStreams, selection);
         if (FAILED(hr))
         {
-            return nullptr;
+            // For example a video renderer that could not be created.
+            (void)pPD->DeselectStream(i);
+        }
+        else if (hr == S_OK)
+        {
+            cBranches++;
         }
     }
 
+    if (cBranches == 0)
+    {
+        return nullptr;
+    }
+
     return pTopology;
 }
 
@@ -383,7 +321,7 @@ static Microsoft::WRL::ComPtr<IMFPresentationDescriptor> GetPresentationDescript
     }
 
     Microsoft::WRL::ComPtr<IMFPresentationDescriptor> pPD;
-    if (var.vt == VT_UNKNOWN)
+    if (var.vt != VT_UNKNOWN || var.punkVal == NULL)
     {
         hr = MF_E_INVALIDTYPE;
     }
@@ -400,6 +338,102 @@ static Microsoft::WRL::ComPtr<IMFPresentationDescriptor> GetPresentationDescript
     return pPD;
 }
 
+static HRESULT GetEventTopologyId(
+    const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent,
+    TOPOID *pTopologyId
+)
+{
+    PROPVARIANT var;
+    HRESULT hr = pEvent->GetValue(&var);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Topology events carry the topology as their value.
+    Microsoft::WRL::ComPtr<IMFTopology> pTopology;
+    if (var.vt != VT_UNKNOWN || var.punkVal == NULL)
+    {
+        hr = MF_E_INVALIDTYPE;
+    }
+    else
+    {
+        hr = var.punkVal->QueryInterface(IID_PPV_ARGS(&pTopology));
+    }
+    PropVariantClear(&var);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pTopology->GetTopologyID(pTopologyId);
+    }
+    return hr;
+}
+
+//  Find the key frame nearest to hnsPosition, through the source's
+//  IMFSeekInfo. Fails if the source cannot tell.
+static HRESULT GetNearestKeyFrame(
+    const Microsoft::WRL::ComPtr<IMFMediaSource> &pSource,
+    MFTIME hnsPosition,
+    MFTIME *phnsKeyFrame
+)
+{
+    Microsoft::WRL::ComPtr<IMFSeekInfo> pSeekInfo;
+    HRESULT hr = MFGetService(pSource.Get(), MF_SCRUBBING_SERVICE, IID_PPV_ARGS(&pSeekInfo));
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    PROPVARIANT varPosition;
+    PROPVARIANT varPrevious;
+    PROPVARIANT varNext;
+    PropVariantInit(&varPosition);
+    PropVariantInit(&varPrevious);
+    PropVariantInit(&varNext);
+
+    varPosition.vt = VT_I8;
+    varPosition.hVal.QuadPart = hnsPosition;
+
+    hr = pSeekInfo->GetNearestKeyFrames(&GUID_NULL, &varPosition, &varPrevious, &varNext);
+    if (SUCCEEDED(hr))
+    {
+        if (varPrevious.vt != VT_I8 || varNext.vt != VT_I8)
+        {
+            hr = MF_E_INVALIDTYPE;
+        }
+        else if (hnsPosition - varPrevious.hVal.QuadPart <= varNext.hVal.QuadPart - hnsPosition)
+        {
+            *phnsKeyFrame = varPrevious.hVal.QuadPart;
+        }
+        else
+        {
+            *phnsKeyFrame = varNext.hVal.QuadPart;
+        }
+    }
+
+    PropVariantClear(&varPrevious);
+    PropVariantClear(&varNext);
+    return hr;
+}
+
+void SessionSinks::Release(CRendererPool &pool)
+{
+    for (DWORD i = 0; i < VideoSinks.size(); i++)
+    {
+        if (VideoSinks[i])
+        {
+            pool.Return(StreamRole{ MFMediaType_Video, i }, VideoSinks[i]);
+        }
+    }
+    VideoSinks.clear();
+
+    if (pAudioActivate)
+    {
+        (void)pAudioActivate->ShutdownObject();
+        pAudioActivate.Reset();
+    }
+}
+
 //  Static class method to create the CPlayer object.
 
 HRESULT CPlayer::CreateInstance(
@@ -436,8 +470,13 @@ HRESULT CPlayer::Initialize()
     HRESULT hr = MFStartup(MF_VERSION);
     if (SUCCEEDED(hr))
     {
-        m_hCloseEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
-        if (m_hCloseEvent == NULL)
+        m_pClosing.reset(new (std::nothrow) CSessionCloser::Group());
+        m_pRenderers.reset(new (std::nothrow) CRendererPool());
+        if (!m_pClosing || !m_pRenderers)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+        else if (m_pClosing->hIdle == NULL)
         {
             hr = HRESULT_FROM_WIN32(GetLastError());
         }
@@ -449,10 +488,36 @@ CPlayer::CPlayer(HWND hVideo, HWND hEvent) :
     m_pSession(NULL),
     m_pSource(NULL),
     m_pVideoDisplay(NULL),
+    m_bWakePending(false),
+    m_cEventsCoalesced(0),
     m_hwndVideo(hVideo),
     m_hwndEvent(hEvent),
     m_state(Closed),
-    m_hCloseEvent(NULL),
+    m_iPlaylist(0),
+    m_nextTopologyId(0),
+    m_bPreloading(false),
+    m_bSeekInFlight(false),
+    m_bSeekIssued(false),
+    m_bSeekPending(false),
+    m_hnsPendingSeek(0),
+    m_pendingSeekMode(SeekKeyFrame),
+    m_bRateChangePending(false),
+    m_bRestartAfterRate(false),
+    m_pendingRate(1.0f),
+    m_bPendingThin(FALSE),
+    m_hnsRateRestart(0),
+    m_cPendingSteps(0),
+    m_hnsOpenStart(0),
+    m_hnsSeekStart(0),
+    m_bSeekStarted(false),
+    m_cSeeksElided(0),
+    m_flRate(1.0f),
+    m_bThinned(FALSE),
+    m_bStepMode(false),
+    m_streamSelection(SelectAll),
+    m_msResolved(0),
+    m_msTopologySet(0),
+    m_msTopologyReady(0),
     m_nRefCount(1)
 {
 }
@@ -480,12 +545,21 @@ CPlayer::~CPlayer()
 
 HRESULT CPlayer::QueryInterface(REFIID riid, void** ppv)
 {
-    static const QITAB qit[] = 
+    if (ppv == NULL)
+    {
+        return E_POINTER;
+    }
+    if (riid == IID_IUnknown)
+    {
+        *ppv = static_cast<IUnknown*>(this);
+    }
+    else
     {
-        QITABENT(CPlayer, IMFAsyncCallback),
-        { 0 }
-    };
-    return QISearch(this, qit, riid, ppv);
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
 }
 
 ULONG CPlayer::AddRef()
@@ -505,437 +579,1663 @@ ULONG CPlayer::Release()
 
 //  Open a URL for playback.
 HRESULT CPlayer::OpenURL(const WCHAR *sURL)
+{
+    return OpenPlaylist(std::vector<std::wstring>(1, sURL));
+}
+
+//  Open a list of URLs for playback, one after the other.
+HRESULT CPlayer::OpenPlaylist(const std::vector<std::wstring> &urls)
 {
     // 1. Create a new media session.
-    // 2. Create the media source.
+    // 2. Create the media source [asynchronous].
     // 3. Create the topology.
     // 4. Queue the topology [asynchronous]
     // 5. Start playback [asynchronous - does not happen in this method.]
+    //
+    // Steps 2 to 4 run in OpenURLAsync, which returns to the caller as
+    // soon as the source resolver is started. The UI thread never waits
+    // for the source. Opening another file while one is still resolving
+    // cancels the first one (CloseSession).
+    //
+    // Once the first item plays, PreloadNext resolves the next one and
+    // queues its topology behind the current one, and so on, so the
+    // session goes from one item to the next without a gap.
 
-    m_state = Closed;
-
-    // Create the media session.
-    HRESULT hr = CreateSession();
-    if (FAILED(hr))
+    if (urls.empty())
     {
-        return hr;
+        return E_INVALIDARG;
     }
 
-    // Create the media source.
-    m_pSource = CreateMediaSource(sURL);
-    if (!m_pSource)
-    {
-        return E_FAIL;
-    }
+    m_state = Closed;
 
-    // Create the presentation descriptor for the media source.
-    Microsoft::WRL::ComPtr<IMFPresentationDescriptor> pSourcePD;
-    hr = m_pSource->CreatePresentationDescriptor(&pSourcePD);
+    // Create the media session.
+    HRESULT hr = CreateSession();
     if (FAILED(hr))
     {
         return hr;
     }
 
-    // Create a partial topology.
-    auto  pTopology = CreatePlaybackTopology(m_pSource.Get(), pSourcePD, m_hwndVideo);
-    if (!pTopology)
-    {
-        return E_FAIL;
-    }
-
-    // Set the topology on the media session.
-    hr = m_pSession->SetTopology(0, pTopology.Get());
-    if (FAILED(hr))
     {
-        return hr;
+        CAutoLock lock(&m_csPlayer);
+        m_playlist = urls;
+        m_iPlaylist = 0;
     }
 
     m_state = OpenPending;
 
-    // If SetTopology succeeds, the media session will queue an 
-    // MESessionTopologySet event.
+    m_hnsOpenStart = MFGetSystemTime();
+    m_msResolved = 0;
+    m_msTopologySet = 0;
+    m_msTopologyReady = 0;
+
+    OpenURLAsync(m_pSession, urls[0]).Detach();
 
     return S_OK;
 }
 
-//  Pause playback.
-HRESULT CPlayer::Pause()    
+//  Coroutine: resolves a URL into a media source for pSession. The
+//  resolution can be cancelled by CloseSession; the result is then
+//  MF_E_OPERATION_CANCELLED.
+Async::Task<MFAsync::ObjectResult> CPlayer::ResolveSourceAsync(Microsoft::WRL::ComPtr<IMFMediaSession> pSession, std::wstring url)
 {
-    if (m_state != Started)
+    MFAsync::ObjectResult created;
+
+    // Create the source resolver.
+    Microsoft::WRL::ComPtr<IMFSourceResolver> pSourceResolver;
+    created.hr = MFCreateSourceResolver(&pSourceResolver);
+
+    // Register the resolution, so that CloseSession can cancel it.
+    std::shared_ptr<MFAsync::CCancelCreateObject> pCancel;
+    if (SUCCEEDED(created.hr))
     {
-        return MF_E_INVALIDREQUEST;
+        pCancel.reset(new (std::nothrow) MFAsync::CCancelCreateObject());
+        if (!pCancel)
+        {
+            created.hr = E_OUTOFMEMORY;
+        }
     }
-    if (m_pSession == NULL || m_pSource == NULL)
+
+    if (SUCCEEDED(created.hr))
     {
-        return E_UNEXPECTED;
+        CAutoLock lock(&m_csPlayer);
+
+        if (m_pSession != pSession)
+        {
+            created.hr = MF_E_SHUTDOWN;
+            co_return created;
+        }
+
+        m_pOpenCancel = pCancel;
     }
 
-    HRESULT hr = m_pSession->Pause();
-    if (SUCCEEDED(hr))
+    // Use the source resolver to create the media source. Resuming here
+    // happens on the resolver's callback thread, or on the thread that
+    // cancels the resolution.
+    if (SUCCEEDED(created.hr))
     {
-        m_state = Paused;
+        created = co_await MFAsync::CreateObjectFromURLAsync(
+            pSourceResolver.Get(),
+            url.c_str(),                // URL of the source.
+            MF_RESOLUTION_MEDIASOURCE,  // Create a source object.
+            NULL,
+            pCancel.get()
+            );
+
+        CAutoLock lock(&m_csPlayer);
+
+        if (m_pOpenCancel == pCancel)
+        {
+            m_pOpenCancel.reset();
+        }
     }
 
-    return hr;
+    co_return created;
 }
 
-// Stop playback.
-HRESULT CPlayer::Stop()
+//  Create the playback topology for a source of pSession. All the
+//  topologies of a session share its renderers.
+HRESULT CPlayer::CreateTopology(
+    const Microsoft::WRL::ComPtr<IMFMediaSession> &pSession,
+    const Microsoft::WRL::ComPtr<IMFMediaSource> &pSource,
+    const Microsoft::WRL::ComPtr<IMFPresentationDescriptor> &pPD,
+    Microsoft::WRL::ComPtr<IMFTopology> *ppTopology)
 {
-    if (m_state != Started && m_state != Paused)
+    // Build the topology without the lock; creating a renderer can take
+    // a while. A session builds one topology at a time: a preload starts
+    // only once the session's first topology is ready, and m_bPreloading
+    // lets one run at a time. An open of a new session may overlap a
+    // preload of the old one; the check below drops what the old one
+    // added.
+    SessionSinks before;
     {
-        return MF_E_INVALIDREQUEST;
+        CAutoLock lock(&m_csPlayer);
+        before = m_sinks;
     }
-    if (m_pSession == NULL)
+
+    SessionSinks sinks = before;
+    *ppTopology = CreatePlaybackTopology(pSource, pPD, sinks, *m_pRenderers, m_streamSelection);
+
+    CAutoLock lock(&m_csPlayer);
+
+    if (m_pSession != pSession)
     {
-        return E_UNEXPECTED;
+        // The session was closed meanwhile and has handed its renderers
+        // to its closer. Renderers added here belong to nobody.
+        SessionSinks added;
+        for (size_t i = 0; i < sinks.VideoSinks.size(); i++)
+        {
+            if (i >= before.VideoSinks.size() || sinks.VideoSinks[i] != before.VideoSinks[i])
+            {
+                added.VideoSinks.resize(i + 1);
+                added.VideoSinks[i] = sinks.VideoSinks[i];
+            }
+        }
+        if (sinks.pAudioActivate != before.pAudioActivate)
+        {
+            added.pAudioActivate = sinks.pAudioActivate;
+        }
+        added.Release(*m_pRenderers);
+        ppTopology->Reset();
+        return MF_E_SHUTDOWN;
     }
 
-    HRESULT hr = m_pSession->Stop();
+    m_sinks = sinks;
+
+    return *ppTopology ? S_OK : E_FAIL;
+}
+
+//  Coroutine for OpenURL: resolves the source and queues the topology.
+Async::Task<HRESULT> CPlayer::OpenURLAsync(Microsoft::WRL::ComPtr<IMFMediaSession> pSession, std::wstring url)
+{
+    Microsoft::WRL::ComPtr<CPlayer> pThis(this);
+
+    MFAsync::ObjectResult created = co_await ResolveSourceAsync(pSession, url);
+    HRESULT hr = created.hr;
+
+    // Get the IMFMediaSource interface from the media source.
+    Microsoft::WRL::ComPtr<IMFMediaSource> pSource;
     if (SUCCEEDED(hr))
     {
-        m_state = Stopped;
+        hr = created.pObject.As(&pSource);
     }
-    return hr;
-}
+
+    if (SUCCEEDED(hr))
+    {
+        CAutoLock lock(&m_csPlayer);
+
+        if (m_pSession != pSession)
+        {
+            // The session was closed or replaced while we were resolving.
+            (void)pSource->Shutdown();
+            co_return MF_E_SHUTDOWN;
+        }
+
+        m_pSource = pSource;
+        MarkOpenStage(m_msResolved);
+    }
+
+    // Create the presentation descriptor for the media source.
+    Microsoft::WRL::ComPtr<IMFPresentationDescriptor> pSourcePD;
+    if (SUCCEEDED(hr))
+    {
+        hr = pSource->CreatePresentationDescriptor(&pSourcePD);
+    }
+
+    // Create a partial topology.
+    Microsoft::WRL::ComPtr<IMFTopology> pTopology;
+    if (SUCCEEDED(hr))
+    {
+        hr = CreateTopology(pSession, pSource, pSourcePD, &pTopology);
+    }
+
+    // Set the topology on the media session.
+    // If SetTopology succeeds, the media session will queue an 
+    // MESessionTopologySet event.
+    if (SUCCEEDED(hr))
+    {
+        hr = pSession->SetTopology(0, pTopology.Get());
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        MarkOpenStage(m_msTopologySet);
+    }
+
+    if (FAILED(hr) && GetSession() == pSession)
+    {
+        m_state = Ready;
+        PostErrorToUI(hr);
+    }
+
+    co_return hr;
+}
+
+//  Start preloading the next playlist item, unless there is none or it
+//  is already preloaded.
+void CPlayer::PreloadNext()
+{
+    Microsoft::WRL::ComPtr<IMFMediaSession> pSession;
+    std::wstring url;
+    {
+        CAutoLock lock(&m_csPlayer);
+
+        if (!m_pSession || m_bPreloading || m_nextTopologyId != 0 || m_iPlaylist + 1 >= m_playlist.size())
+        {
+            return;
+        }
+
+        m_bPreloading = true;
+        pSession = m_pSession;
+        url = m_playlist[m_iPlaylist + 1];
+    }
+
+    PreloadNextAsync(pSession, url).Detach();
+}
+
+//  Coroutine: resolves the next playlist item and queues its topology
+//  behind the current one.
+Async::Task<HRESULT> CPlayer::PreloadNextAsync(Microsoft::WRL::ComPtr<IMFMediaSession> pSession, std::wstring url)
+{
+    Microsoft::WRL::ComPtr<CPlayer> pThis(this);
+
+    MFAsync::ObjectResult created = co_await ResolveSourceAsync(pSession, url);
+    HRESULT hr = created.hr;
+
+    Microsoft::WRL::ComPtr<IMFMediaSource> pSource;
+    if (SUCCEEDED(hr))
+    {
+        hr = created.pObject.As(&pSource);
+    }
+
+    Microsoft::WRL::ComPtr<IMFPresentationDescriptor> pSourcePD;
+    if (SUCCEEDED(hr))
+    {
+        hr = pSource->CreatePresentationDescriptor(&pSourcePD);
+    }
+
+    Microsoft::WRL::ComPtr<IMFTopology> pTopology;
+    if (SUCCEEDED(hr))
+    {
+        hr = CreateTopology(pSession, pSource, pSourcePD, &pTopology);
+    }
+
+    TOPOID topologyId = 0;
+    if (SUCCEEDED(hr))
+    {
+        hr = pTopology->GetTopologyID(&topologyId);
+    }
+
+    // Record the item before queuing it, so that the session cannot
+    // start it before AdvancePlaylist knows about it.
+    if (SUCCEEDED(hr))
+    {
+        CAutoLock lock(&m_csPlayer);
+
+        if (m_pSession != pSession)
+        {
+            hr = MF_E_SHUTDOWN;
+        }
+        else
+        {
+            m_pNextSource = pSource;
+            m_nextTopologyId = topologyId;
+        }
+    }
+
+    // Queue the topology. Without MFSESSION_SETTOPOLOGY_IMMEDIATE the
+    // session resolves it now and starts it when the current one ends.
+    if (SUCCEEDED(hr))
+    {
+        hr = pSession->SetTopology(0, pTopology.Get());
+    }
+
+    bool bCurrent = false;
+    {
+        CAutoLock lock(&m_csPlayer);
+
+        bCurrent = (m_pSession == pSession);
+        if (bCurrent)
+        {
+            m_bPreloading = false;
+
+            if (FAILED(hr) && m_nextTopologyId == topologyId)
+            {
+                m_pNextSource.Reset();
+                m_nextTopologyId = 0;
+            }
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        if (pSource)
+        {
+            (void)pSource->Shutdown();
+        }
+
+        // The current item plays on; playback stops after it.
+        if (bCurrent && hr != MF_E_OPERATION_CANCELLED)
+        {
+            PostErrorToUI(hr);
+        }
+    }
+
+    co_return hr;
+}
+
+//  The session has started the topology topologyId. If that is the
+//  preloaded playlist item, it is now the current one.
+void CPlayer::AdvancePlaylist(TOPOID topologyId)
+{
+    Microsoft::WRL::ComPtr<IMFMediaSource> pEndedSource;
+    {
+        CAutoLock lock(&m_csPlayer);
+
+        if (m_nextTopologyId == 0 || m_nextTopologyId != topologyId)
+        {
+            return;
+        }
+
+        pEndedSource.Swap(m_pSource);
+        m_pSource.Swap(m_pNextSource);
+        m_nextTopologyId = 0;
+        m_iPlaylist++;
+    }
+
+    // The previous topology has ended, so its source is done.
+    if (pEndedSource)
+    {
+        (void)pEndedSource->Shutdown();
+    }
+
+    PreloadNext();
+}
+
+//  Pause playback.
+HRESULT CPlayer::Pause()    
+{
+    if (m_state != Started)
+    {
+        return MF_E_INVALIDREQUEST;
+    }
+    if (m_pSession == NULL || GetSource() == NULL)
+    {
+        return E_UNEXPECTED;
+    }
+
+    HRESULT hr = m_pSession->Pause();
+    if (SUCCEEDED(hr))
+    {
+        m_state = Paused;
+    }
+
+    return hr;
+}
+
+// Stop playback.
+HRESULT CPlayer::Stop()
+{
+    if (m_state != Started && m_state != Paused)
+    {
+        return MF_E_INVALIDREQUEST;
+    }
+    if (m_pSession == NULL)
+    {
+        return E_UNEXPECTED;
+    }
+
+    // A rate change still waiting for the clock to stop sets its rate
+    // but does not start again.
+    {
+        CAutoLock lock(&m_csPlayer);
+        m_bRestartAfterRate = false;
+    }
+
+    HRESULT hr = m_pSession->Stop();
+    if (SUCCEEDED(hr))
+    {
+        m_state = Stopped;
+    }
+    return hr;
+}
 
 //  Repaint the video window. Call this method on WM_PAINT.
 
 HRESULT CPlayer::Repaint()
 {
+    CAutoLock lock(&m_csPlayer);
+
+    if (m_pVideoDisplay)
+    {
+        return m_pVideoDisplay->RepaintVideo();
+    }
+    else
+    {
+        return S_OK;
+    }
+}
+
+//  Resize the video rectangle.
+//
+//  Call this method if the size of the video window changes.
+
+HRESULT CPlayer::ResizeVideo(WORD width, WORD height)
+{
+    CAutoLock lock(&m_csPlayer);
+
     if (m_pVideoDisplay)
     {
-        return m_pVideoDisplay->RepaintVideo();
+        // Set the destination rectangle.
+        // Leave the default source rectangle (0,0,1,1).
+
+        RECT rcDest = { 0, 0, width, height };
+
+        return m_pVideoDisplay->SetVideoPosition(NULL, &rcDest);
+    }
+    else
+    {
+        return S_OK;
+    }
+}
+
+BOOL CPlayer::HasVideo()
+{
+    CAutoLock lock(&m_csPlayer);
+    return (m_pVideoDisplay != NULL);
+}
+
+//  Coroutine that pulls the events of one media session.
+//
+//  It handles each event on the thread that delivers it, so session
+//  setup (topology ready -> start) needs no round trip through the UI
+//  thread, and then forwards the event to the UI. It ends after
+//  MESessionClosed, which is always the session's last event.
+
+Async::Task<HRESULT> CPlayer::RunSessionEvents(Microsoft::WRL::ComPtr<IMFMediaSession> pSession, std::shared_ptr<CSessionCloser> pCloser)
+{
+    Microsoft::WRL::ComPtr<CPlayer> pThis(this);
+    HRESULT hr = S_OK;
+
+    for (;;)
+    {
+        // Get the event from the event queue.
+        MFAsync::MediaEventResult next = co_await MFAsync::GetEventAsync(pSession.Get());
+        hr = next.hr;
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        // Get the event type. 
+        MediaEventType meType = MEUnknown;  // Event type
+        hr = next.pEvent->GetType(&meType);
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        if (meType == MESessionClosed)
+        {
+            break;
+        }
+
+        // Once the application has closed this session, it may already
+        // be opening the next one, and the remaining events of this
+        // session do not concern it.
+
+        if (GetSession() == pSession)
+        {
+            HRESULT hrDispatch = DispatchSessionEvent(next.pEvent, meType);
+
+            PostEventToUI(next.pEvent, meType);
+
+            if (FAILED(hrDispatch))
+            {
+                PostErrorToUI(hrDispatch);
+            }
+        }
+    }
+
+    // No more events will come from this session, either because it was
+    // closed or because the queue failed. Release the player first, so
+    // that its last reference is never released on this thread.
+    pThis.Reset();
+
+    // Shuts the session down now if it has been closed.
+    pCloser->EventsEnded();
+
+    co_return hr;
+}
+
+//  Runs the player's handler for a session event.
+HRESULT CPlayer::DispatchSessionEvent(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent, MediaEventType meType)
+{
+    // Get the event status. If the operation that triggered the event 
+    // did not succeed, the status is a failure code. The UI reports it
+    // when it receives the event.
+    HRESULT hrStatus = S_OK;
+    HRESULT hr = pEvent->GetStatus(&hrStatus);
+
+    // A seek is over when the session has started, or failed to. Play
+    // and a rate change restart start the session too; those starts do
+    // not complete a seek.
+    // A rate change may be waiting for the clock to stop, and steps for
+    // it to pause.
+    HRESULT hrStopped = S_OK;
+    if (meType == MESessionStopped)
+    {
+        hrStopped = OnSessionStopped(FAILED(hr) ? hr : hrStatus);
+    }
+    else if (meType == MESessionPaused)
+    {
+        hrStopped = OnSessionPaused(FAILED(hr) ? hr : hrStatus);
+    }
+
+    if (meType == MESessionStarted)
+    {
+        bool bSeek = false;
+        {
+            CAutoLock lock(&m_csPlayer);
+            bSeek = m_bSeekIssued;
+            m_bSeekIssued = false;
+        }
+
+        if (bSeek)
+        {
+            m_bSeekStarted = SUCCEEDED(hr) && SUCCEEDED(hrStatus);
+            OnSeekCompleted();
+        }
+    }
+
+    if (FAILED(hr) || FAILED(hrStatus))
+    {
+        return S_OK;
+    }
+
+    switch(meType)
+    {
+        case MESessionTopologyStatus:
+            hr = OnTopologyStatus(pEvent);
+            break;
+
+        case MEEndOfPresentation:
+            hr = OnPresentationEnded(pEvent);
+            break;
+
+        case MENewPresentation:
+            hr = OnNewPresentation(pEvent);
+            break;
+
+        default:
+            hr = OnSessionEvent(pEvent, meType);
+            break;
+    }
+
+    return FAILED(hrStopped) ? hrStopped : hr;
+}
+
+//  Forward a session event to the application.
+void CPlayer::PostEventToUI(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent, MediaEventType meType)
+{
+    HRESULT hrStatus = S_OK;
+    HRESULT hr = pEvent->GetStatus(&hrStatus);
+    if (FAILED(hr))
+    {
+        hrStatus = hr;
+    }
+
+    QueueUIEvent(meType, hrStatus);
+}
+
+//  Report an error of the player's own to the application.
+void CPlayer::PostErrorToUI(HRESULT hrError)
+{
+    QueueUIEvent(MEError, hrError);
+}
+
+//  Queue an event for HandleEvents and wake the UI thread.
+void CPlayer::QueueUIEvent(MediaEventType meType, HRESULT hrStatus)
+{
+    // The wake-up alone makes the UI refresh, which is all a successful
+    // event asks for. If the ring is full, the UI is far behind and will
+    // report an earlier failure anyway.
+    const UIEvent ev = { meType, hrStatus };
+    if (SUCCEEDED(hrStatus) || !m_uiEvents.TryPush(ev))
+    {
+        m_cEventsCoalesced++;
+    }
+
+    WakeUI();
+}
+
+//  Post WM_APP_PLAYER_EVENT unless one is already on its way.
+void CPlayer::WakeUI()
+{
+    if (!m_bWakePending.exchange(true))
+    {
+        if (!PostMessage(m_hwndEvent, WM_APP_PLAYER_EVENT, 0, 0))
+        {
+            m_bWakePending = false;
+        }
+    }
+}
+
+Microsoft::WRL::ComPtr<IMFMediaSession> CPlayer::GetSession()
+{
+    CAutoLock lock(&m_csPlayer);
+    return m_pSession;
+}
+
+Microsoft::WRL::ComPtr<IMFMediaSource> CPlayer::GetSource()
+{
+    CAutoLock lock(&m_csPlayer);
+    return m_pSource;
+}
+
+//  Record that the current open has reached a stage.
+void CPlayer::MarkOpenStage(std::atomic<DWORD> &msStage)
+{
+    const DWORD msElapsed = (DWORD)((MFGetSystemTime() - m_hnsOpenStart) / 10000);
+
+    // A stage that was reached never reads 0.
+    msStage = (msElapsed > 0) ? msElapsed : 1;
+}
+
+//  Get the open timings of the current (or last) file.
+void CPlayer::GetOpenTimings(OpenTimings *pTimings) const
+{
+    pTimings->msResolved = m_msResolved;
+    pTimings->msTopologySet = m_msTopologySet;
+    pTimings->msTopologyReady = m_msTopologyReady;
+}
+
+//  Drain the events forwarded to the UI. Call on WM_APP_PLAYER_EVENT.
+//
+//  The player has already handled the events; the UI only has to report
+//  a failure. Returns the first failure of the batch, or S_OK.
+
+HRESULT CPlayer::HandleEvents()
+{
+    // Clear the flag before draining: an event queued from now on posts
+    // a new message instead of being left behind.
+    m_bWakePending = false;
+
+    HRESULT hr = S_OK;
+
+    UIEvent ev;
+    while (m_uiEvents.TryPop(&ev))
+    {
+        if (SUCCEEDED(hr))
+        {
+            hr = ev.hrStatus;
+        }
+        else
+        {
+            m_cEventsCoalesced++;
+        }
+    }
+
+    return hr;
+}
+
+//  Release all resources held by this object.
+HRESULT CPlayer::Shutdown()
+{
+    // Close the session
+    HRESULT hr = CloseSession();
+
+    // Let the sessions that are still closing shut down before Media
+    // Foundation does. This is the only place that waits for them.
+    if (m_pClosing)
+    {
+        while (m_pClosing->cClosing != 0)
+        {
+            if (WaitForSingleObject(m_pClosing->hIdle, 5000) == WAIT_TIMEOUT)
+            {
+                // A source or sink that does not finish shutting down
+                // must not hang the application on exit. It may still be
+                // using its renderer and Media Foundation, so leave both
+                // running.
+                return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+            }
+        }
+    }
+
+    // The closed sessions have given their renderers back by now.
+    if (m_pRenderers)
+    {
+        m_pRenderers->Shutdown();
+    }
+
+    // Shutdown the Media Foundation platform
+    MFShutdown();
+
+    return hr;
+}
+
+/// Protected methods
+
+HRESULT CPlayer::OnTopologyStatus(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent)
+{
+    UINT32 status; 
+
+    HRESULT hr = pEvent->GetUINT32(MF_EVENT_TOPOLOGY_STATUS, &status);
+    if (SUCCEEDED(hr) && (status == MF_TOPOSTATUS_STARTED_SOURCE))
+    {
+        TOPOID topologyId = 0;
+        if (SUCCEEDED(GetEventTopologyId(pEvent, &topologyId)))
+        {
+            AdvancePlaylist(topologyId);
+        }
+    }
+    else if (SUCCEEDED(hr) && (status == MF_TOPOSTATUS_READY) && (m_state == OpenPending))
+    {
+        // A preloaded playlist item also becomes ready, while the current
+        // one is playing; the session starts it by itself.
+
+        // Get the IMFVideoDisplayControl interface from EVR. This call is
+        // expected to fail if the media file does not have a video stream.
+
+        auto pSession = GetSession();
+        if (!pSession)
+        {
+            return MF_E_SHUTDOWN;
+        }
+
+        Microsoft::WRL::ComPtr<IMFVideoDisplayControl> pVideoDisplay;
+        (void)MFGetService(pSession.Get(), MR_VIDEO_RENDER_SERVICE, 
+                IID_PPV_ARGS(&pVideoDisplay));
+
+        {
+            CAutoLock lock(&m_csPlayer);
+            m_pVideoDisplay = pVideoDisplay;
+        }
+
+        if (m_msTopologyReady == 0)
+        {
+            MarkOpenStage(m_msTopologyReady);
+        }
+
+        hr = StartPlayback();
+        if (SUCCEEDED(hr))
+        {
+            PreloadNext();
+        }
+    }
+    return hr;
+}
+
+
+//  Handler for MEEndOfPresentation event.
+HRESULT CPlayer::OnPresentationEnded(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent)
+{
+    // With a playlist item queued, the session goes straight on to it.
+    {
+        CAutoLock lock(&m_csPlayer);
+        if (m_nextTopologyId != 0)
+        {
+            return S_OK;
+        }
+    }
+
+    // The session puts itself into the stopped state automatically.
+    m_state = Stopped;
+    return S_OK;
+}
+
+//  Handler for MENewPresentation event.
+//
+//  This event is sent if the media source has a new presentation, which 
+//  requires a new topology. 
+
+HRESULT CPlayer::OnNewPresentation(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent)
+{
+    auto pPD = GetPresentationDescriptor(pEvent);
+    if (!pPD) {
+        return E_FAIL;
+    }
+
+    auto pSession = GetSession();
+    auto pSource = GetSource();
+    if (!pSession || !pSource)
+    {
+        return MF_E_SHUTDOWN;
+    }
+
+    // Create a partial topology.
+    Microsoft::WRL::ComPtr<IMFTopology> pTopology;
+    auto hr = CreateTopology(pSession, pSource, pPD, &pTopology);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Set the topology on the media session.
+    hr = pSession->SetTopology(0, pTopology.Get());
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_state = OpenPending;
+    return S_OK;
+}
+
+//  Create a new instance of the media session.
+HRESULT CPlayer::CreateSession()
+{
+    // Close the old session, if any.
+    HRESULT hr = CloseSession();
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+
+    assert(m_state == Closed);
+
+    // Create the media session.
+    {
+        Microsoft::WRL::ComPtr<IMFMediaSession> pSession;
+        hr = MFCreateMediaSession(NULL, &pSession);
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+
+        std::shared_ptr<CSessionCloser> pCloser(new (std::nothrow) CSessionCloser(pSession, m_pClosing, m_pRenderers));
+        if (!pCloser)
+        {
+            (void)pSession->Shutdown();
+            hr = E_OUTOFMEMORY;
+            goto done;
+        }
+
+        CAutoLock lock(&m_csPlayer);
+        m_pSession = pSession;
+        m_pCloser = pCloser;
+    }
+
+    m_state = Ready;
+
+    // Start pulling events from the media session
+    RunSessionEvents(m_pSession, m_pCloser).Detach();
+
+done:
+    return hr;
+}
+
+//  Close the media session. 
+HRESULT CPlayer::CloseSession()
+{
+    //  The IMFMediaSession::Close method is asynchronous, and so is this
+    //  method: it starts the close and returns. The session's
+    //  CSessionCloser shuts the source and the session down once
+    //  MESessionClosed, the last event the session fires, has arrived.
+    //  Meanwhile the application may create and open a new session.
+
+    HRESULT hr = S_OK;
+
+    // Detach the session first, so that an open still resolving its
+    // source sees that it is gone and shuts the source down itself.
+    Microsoft::WRL::ComPtr<IMFMediaSession> pSession;
+    SessionResources resources;
+    std::shared_ptr<CSessionCloser> pCloser;
+    std::shared_ptr<MFAsync::CCancelCreateObject> pOpenCancel;
+    {
+        CAutoLock lock(&m_csPlayer);
+        pSession.Swap(m_pSession);
+        resources.pSource.Swap(m_pSource);
+        resources.pNextSource.Swap(m_pNextSource);
+        resources.Sinks = m_sinks;
+        m_sinks = SessionSinks();
+        pCloser.swap(m_pCloser);
+        pOpenCancel.swap(m_pOpenCancel);
+        m_pVideoDisplay.Reset();
+        m_nextTopologyId = 0;
+        m_bPreloading = false;
+        m_bSeekInFlight = false;
+        m_bSeekIssued = false;
+        m_bSeekPending = false;
+        m_bRateChangePending = false;
+        m_cPendingSteps = 0;
+    }
+    m_bStepMode = false;    // The pool resets the renderer.
+
+    // Cancel a source resolution that is still running instead of
+    // waiting for it. Its coroutine resumes right here with
+    // MF_E_OPERATION_CANCELLED and finds the session gone.
+    if (pOpenCancel)
+    {
+        pOpenCancel->Cancel();
+    }
+
+    if (pSession)
+    {
+        hr = pSession->Close();
+        if (FAILED(hr))
+        {
+            // No MESessionClosed will come. Shutting the session down
+            // ends its event coroutine instead.
+            (void)pSession->Shutdown();
+        }
+
+        pCloser->CloseRequested(resources);
+    }
+
+    m_state = Closed;
+    return hr;
+}
+
+CSessionCloser::Group::Group() :
+    cClosing(0),
+    hIdle(CreateEvent(NULL, FALSE, FALSE, NULL))
+{
+}
+
+CSessionCloser::Group::~Group()
+{
+    if (hIdle)
+    {
+        CloseHandle(hIdle);
+    }
+}
+
+CSessionCloser::CSessionCloser(
+    const Microsoft::WRL::ComPtr<IMFMediaSession> &pSession,
+    const std::shared_ptr<Group> &pGroup,
+    const std::shared_ptr<CRendererPool> &pRenderers) :
+    m_pSession(pSession),
+    m_pGroup(pGroup),
+    m_pRenderers(pRenderers),
+    m_bCloseRequested(false),
+    m_bEventsEnded(false)
+{
+}
+
+//  The application has closed the session, which owns resources.
+void CSessionCloser::CloseRequested(const SessionResources &resources)
+{
+    m_pGroup->cClosing++;
+
+    bool bFinish = false;
+    {
+        CAutoLock lock(&m_lock);
+        m_resources = resources;
+        m_bCloseRequested = true;
+        bFinish = m_bEventsEnded;
+    }
+
+    if (bFinish)
+    {
+        Finish();
+    }
+}
+
+//  The session will send no more events.
+void CSessionCloser::EventsEnded()
+{
+    bool bFinish = false;
+    {
+        CAutoLock lock(&m_lock);
+        m_bEventsEnded = true;
+        bFinish = m_bCloseRequested;
+    }
+
+    if (bFinish)
+    {
+        Finish();
+    }
+}
+
+void CSessionCloser::Finish()
+{
+    FinishAsync(shared_from_this()).Detach();
+}
+
+//  Shuts the session down on a work queue thread. EventsEnded runs on the
+//  thread that delivered the session's last event, and the session must
+//  not be shut down from inside its own callback.
+Async::Task<HRESULT> CSessionCloser::FinishAsync(std::shared_ptr<CSessionCloser> pThis)
+{
+    // If the work item cannot be queued, finish here rather than never.
+    MFAsync::WorkItemResult wi = co_await MFAsync::ResumeOnWorkQueueAsync();
+
+    // Shut down the media sources. (Synchronous operation, no events.)
+    SessionResources &resources = pThis->m_resources;
+    if (resources.pSource)
+    {
+        (void)resources.pSource->Shutdown();
+    }
+    if (resources.pNextSource)
+    {
+        (void)resources.pNextSource->Shutdown();
+    }
+
+    // Shut down the media session. (Synchronous operation, no events.)
+    (void)pThis->m_pSession->Shutdown();
+    pThis->m_pSession.Reset();
+
+    // The session does not shut down the renderers; its topologies share
+    // them (MF_TOPONODE_NOSHUTDOWN_ON_REMOVE). The video renderers go
+    // back to the pool for the next session.
+    resources.Sinks.Release(*pThis->m_pRenderers);
+    resources = SessionResources();
+
+    // Keep the group alive until the event is set.
+    std::shared_ptr<Group> pGroup = pThis->m_pGroup;
+    pThis.reset();
+    if (--pGroup->cClosing == 0)
+    {
+        SetEvent(pGroup->hIdle);
+    }
+
+    co_return wi.hr;
+}
+
+CRendererPool::CRendererPool() :
+    m_bShutdown(false)
+{
+}
+
+//  Take the idle renderer for role, or create one if there is none.
+HRESULT CRendererPool::Acquire(const StreamRole &role, Microsoft::WRL::ComPtr<IMFMediaSink> *ppSink)
+{
+    {
+        CAutoLock lock(&m_lock);
+
+        if (m_bShutdown)
+        {
+            return MF_E_SHUTDOWN;
+        }
+
+        for (size_t i = 0; i < m_idle.size(); i++)
+        {
+            if (m_idle[i].Role == role)
+            {
+                *ppSink = m_idle[i].pSink;
+                m_idle.erase(m_idle.begin() + i);
+                return S_OK;
+            }
+        }
+    }
+
+    // Create it without the lock; this sets up the device.
+    return CreateCustomVideoRenderer(IID_PPV_ARGS(ppSink->ReleaseAndGetAddressOf()));
+}
+
+//  Reset a renderer that its session no longer uses and keep it for the
+//  next session. The session must be shut down already.
+void CRendererPool::Return(const StreamRole &role, const Microsoft::WRL::ComPtr<IMFMediaSink> &pSink)
+{
+    Microsoft::WRL::ComPtr<ICustomVideoRendererControl> pControl;
+    HRESULT hr = pSink.As(&pControl);
+    if (SUCCEEDED(hr))
+    {
+        hr = pControl->Reset();
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        CAutoLock lock(&m_lock);
+
+        bool bHaveRole = false;
+        for (const Entry &entry : m_idle)
+        {
+            bHaveRole = bHaveRole || (entry.Role == role);
+        }
+
+        if (!m_bShutdown && !bHaveRole)
+        {
+            m_idle.push_back(Entry{ role, pSink });
+            return;
+        }
+    }
+
+    // Broken, surplus or too late: nobody will use it again.
+    (void)pSink->Shutdown();
+}
+
+//  Shut down the idle renderers. Renderers returned later are shut down
+//  right away.
+void CRendererPool::Shutdown()
+{
+    std::vector<Entry> idle;
+    {
+        CAutoLock lock(&m_lock);
+        m_bShutdown = true;
+        idle.swap(m_idle);
+    }
+
+    for (const Entry &entry : idle)
+    {
+        (void)entry.pSink->Shutdown();
+    }
+}
+
+//  Start playback from the current position. 
+HRESULT CPlayer::StartPlayback(const PROPVARIANT *pvarStart)
+{
+    // Called from the UI thread (Play) and from the event pump.
+    auto pSession = GetSession();
+    if (!pSession)
+    {
+        return MF_E_SHUTDOWN;
+    }
+
+    // Starting the clock takes the renderer out of step mode, and the
+    // steps still waiting for the pause are moot.
+    m_bStepMode = false;
+    {
+        CAutoLock lock(&m_csPlayer);
+        m_cPendingSteps = 0;
+    }
+
+    // VT_EMPTY starts from the current position.
+    PROPVARIANT varStart;
+    PropVariantInit(&varStart);
+
+    HRESULT hr = pSession->Start(&GUID_NULL, pvarStart ? pvarStart : &varStart);
+    if (SUCCEEDED(hr))
+    {
+        // Note: Start is an asynchronous operation. However, we
+        // can treat our state as being already started. If Start
+        // fails later, we'll get an MESessionStarted event with
+        // an error code, and we will update our state then.
+        m_state = Started;
+    }
+    PropVariantClear(&varStart);
+    return hr;
+}
+
+//  Start playback from paused or stopped.
+HRESULT CPlayer::Play()
+{
+    if (m_state != Paused && m_state != Stopped)
+    {
+        return MF_E_INVALIDREQUEST;
+    }
+    if (m_pSession == NULL || GetSource() == NULL)
+    {
+        return E_UNEXPECTED;
+    }
+    return StartPlayback();
+}
+
+//  Seek to hnsPosition and play from there.
+//
+//  Seeks are coalesced for scrubbing: while one is in flight, a new
+//  request only replaces the pending target, and the latest target is
+//  issued when the session has started at the previous one. The targets
+//  that were replaced are counted in GetElidedSeekCount.
+//
+//  SeekKeyFrame starts at the key frame nearest to hnsPosition, so the
+//  first frame needs no decoding beyond itself. SeekAccurate starts at
+//  hnsPosition: the source still starts at the key frame before it, and
+//  the renderer drops the frames that end before hnsPosition. A source
+//  without key frame information always seeks accurately.
+HRESULT CPlayer::Seek(MFTIME hnsPosition, SeekMode mode)
+{
+    if (m_state != Started && m_state != Paused && m_state != Stopped)
+    {
+        return MF_E_INVALIDREQUEST;
+    }
+
+    if (m_pSession == NULL || GetSource() == NULL)
+    {
+        return E_UNEXPECTED;
+    }
+
+    if (hnsPosition < 0)
+    {
+        hnsPosition = 0;
+    }
+
+    {
+        CAutoLock lock(&m_csPlayer);
+
+        if (m_bSeekInFlight)
+        {
+            if (m_bSeekPending)
+            {
+                m_cSeeksElided++;
+            }
+            m_bSeekPending = true;
+            m_hnsPendingSeek = hnsPosition;
+            m_pendingSeekMode = mode;
+            return S_OK;
+        }
+
+        m_bSeekInFlight = true;
     }
-    else
+
+    HRESULT hr = IssueSeek(hnsPosition, mode);
+    if (FAILED(hr))
     {
-        return S_OK;
+        CAutoLock lock(&m_csPlayer);
+        m_bSeekInFlight = false;
     }
+    return hr;
 }
 
-//  Resize the video rectangle.
-//
-//  Call this method if the size of the video window changes.
-
-HRESULT CPlayer::ResizeVideo(WORD width, WORD height)
+//  Start the session at a seek target. Called with a seek in flight.
+HRESULT CPlayer::IssueSeek(MFTIME hnsPosition, SeekMode mode)
 {
-    if (m_pVideoDisplay)
+    auto pSource = GetSource();
+    if (pSource == NULL)
     {
-        // Set the destination rectangle.
-        // Leave the default source rectangle (0,0,1,1).
+        return E_UNEXPECTED;
+    }
 
-        RECT rcDest = { 0, 0, width, height };
+    MFTIME hnsStart = hnsPosition;
+    if (mode == SeekKeyFrame)
+    {
+        (void)GetNearestKeyFrame(pSource, hnsPosition, &hnsStart);
+    }
 
-        return m_pVideoDisplay->SetVideoPosition(NULL, &rcDest);
+    m_bSeekStarted = false;
+    m_hnsSeekStart = MFGetSystemTime();
+
+    // Set before Start: its MESessionStarted may arrive before Start
+    // returns.
+    {
+        CAutoLock lock(&m_csPlayer);
+        m_bSeekIssued = true;
     }
-    else
+
+    PROPVARIANT varStart;
+    PropVariantInit(&varStart);
+    varStart.vt = VT_I8;
+    varStart.hVal.QuadPart = hnsStart;
+
+    HRESULT hr = StartPlayback(&varStart);
+    if (FAILED(hr))
     {
-        return S_OK;
+        CAutoLock lock(&m_csPlayer);
+        m_bSeekIssued = false;
     }
+    return hr;
 }
 
-//  Callback for the asynchronous BeginGetEvent method.
-
-HRESULT CPlayer::Invoke(IMFAsyncResult *pResult)
+//  The seek in flight has completed (MESessionStarted, with any status).
+//  Issue the latest pending target, if there is one.
+void CPlayer::OnSeekCompleted()
 {
-    // Get the event from the event queue.
-    Microsoft::WRL::ComPtr<IMFMediaEvent> pEvent;
-    HRESULT hr = m_pSession->EndGetEvent(pResult, &pEvent);
-    if (FAILED(hr))
+    for (;;)
     {
-        return hr;
+        MFTIME hnsPosition = 0;
+        SeekMode mode = SeekKeyFrame;
+        {
+            CAutoLock lock(&m_csPlayer);
+
+            if (!m_bSeekInFlight)
+            {
+                return;
+            }
+            if (!m_bSeekPending)
+            {
+                m_bSeekInFlight = false;
+                return;
+            }
+
+            m_bSeekPending = false;
+            hnsPosition = m_hnsPendingSeek;
+            mode = m_pendingSeekMode;
+        }
+
+        if (SUCCEEDED(IssueSeek(hnsPosition, mode)))
+        {
+            return;
+        }
+
+        // That one failed to start; there is no event to wait for, so
+        // go on with whatever was requested meanwhile.
     }
+}
 
-    // Get the event type. 
-    MediaEventType meType = MEUnknown;  // Event type
-    hr = pEvent->GetType(&meType);
-    if (FAILED(hr))
+//  Change the playback rate.
+//
+//  A rate the whole pipeline plays unthinned is set as it is. A faster
+//  one (the renderer caps unthinned playback at RATE_MAX_UNTHINNED) asks
+//  the session for key frames only. Negative rates play in reverse if
+//  the source supports it. Changing direction or thinning needs a
+//  stopped clock, so while playing that stops the session and returns;
+//  on MESessionStopped OnSessionStopped changes the rate and starts
+//  again at the same position. GetRate reports the new rate from then.
+HRESULT CPlayer::SetRate(float flRate)
+{
+    auto pSession = GetSession();
+    if (!pSession)
     {
-        return hr;
+        return MF_E_SHUTDOWN;
     }
 
-    if (meType == MESessionClosed)
+    Microsoft::WRL::ComPtr<IMFRateSupport> pRateSupport;
+    HRESULT hr = MFGetService(pSession.Get(), MF_RATE_CONTROL_SERVICE, IID_PPV_ARGS(&pRateSupport));
+
+    Microsoft::WRL::ComPtr<IMFRateControl> pRateControl;
+    if (SUCCEEDED(hr))
     {
-        // The session was closed. 
-        // The application is waiting on the m_hCloseEvent event handle. 
-        SetEvent(m_hCloseEvent);
+        hr = MFGetService(pSession.Get(), MF_RATE_CONTROL_SERVICE, IID_PPV_ARGS(&pRateControl));
     }
-    else
+
+    BOOL bThin = FALSE;
+    if (SUCCEEDED(hr))
     {
-        // For all other events, get the next event in the queue.
-        hr = m_pSession->BeginGetEvent(this, NULL);
+        hr = pRateSupport->IsRateSupported(FALSE, flRate, NULL);
         if (FAILED(hr))
         {
-            return hr;
+            bThin = TRUE;
+            hr = pRateSupport->IsRateSupported(TRUE, flRate, NULL);
         }
     }
 
-    // Check the application state. 
-
-    // If a call to IMFMediaSession::Close is pending, it means the 
-    // application is waiting on the m_hCloseEvent event and
-    // the application's message loop is blocked. 
+    if (SUCCEEDED(hr))
+    {
+        hr = pRateControl->SetRate(bThin, flRate);
 
-    // Otherwise, post a private window message to the application. 
+        if (hr == MF_E_UNSUPPORTED_RATE_TRANSITION && m_state == Started)
+        {
+            // Stop is asynchronous, and the rate can only change once
+            // the clock has stopped. OnSessionStopped sets it and starts
+            // again at the current position.
+            MFTIME hnsPosition = 0;
+            hr = GetPosition(&hnsPosition);
+            if (SUCCEEDED(hr))
+            {
+                CAutoLock lock(&m_csPlayer);
+                m_bRateChangePending = true;
+                m_bRestartAfterRate = true;
+                m_pendingRate = flRate;
+                m_bPendingThin = bThin;
+                m_hnsRateRestart = hnsPosition;
+            }
+            if (SUCCEEDED(hr))
+            {
+                hr = pSession->Stop();
+                if (FAILED(hr))
+                {
+                    CAutoLock lock(&m_csPlayer);
+                    m_bRateChangePending = false;
+                }
+            }
+            return hr;
+        }
+    }
 
-    if (m_state != Closing)
+    if (SUCCEEDED(hr))
     {
-        // Leave a reference count on the event.
-        pEvent.Get()->AddRef();
-
-        PostMessage(m_hwndEvent, WM_APP_PLAYER_EVENT, 
-                (WPARAM)pEvent.Get(), (LPARAM)meType);
+        m_flRate = flRate;
+        m_bThinned = bThin;
     }
 
-    return S_OK;
+    return hr;
 }
 
-HRESULT CPlayer::HandleEvent(UINT_PTR pEventPtr)
+//  The session has stopped. If SetRate stopped it to change the rate,
+//  set the rate now and start again where playback was.
+HRESULT CPlayer::OnSessionStopped(HRESULT hrStatus)
 {
-    Microsoft::WRL::ComPtr<IMFMediaEvent> pEvent = (IMFMediaEvent*)pEventPtr;
-    if (pEvent == NULL)
+    float flRate = 1.0f;
+    BOOL bThin = FALSE;
+    bool bRestart = false;
+    MFTIME hnsPosition = 0;
     {
-        return E_POINTER;
+        CAutoLock lock(&m_csPlayer);
+
+        if (!m_bRateChangePending)
+        {
+            return S_OK;
+        }
+
+        m_bRateChangePending = false;
+        flRate = m_pendingRate;
+        bThin = m_bPendingThin;
+        bRestart = m_bRestartAfterRate;
+        hnsPosition = m_hnsRateRestart;
     }
 
-    // Get the event type.
-    MediaEventType meType = MEUnknown;
-    HRESULT hr = pEvent->GetType(&meType);
-    if (FAILED(hr))
+    // The session did not stop, so it plays on at the old rate.
+    if (FAILED(hrStatus))
     {
-        return hr;
+        return S_OK;
     }
 
-    // Get the event status. If the operation that triggered the event 
-    // did not succeed, the status is a failure code.
-    HRESULT hrStatus = S_OK;
-    hr = pEvent->GetStatus(&hrStatus);
+    auto pSession = GetSession();
+    if (!pSession)
+    {
+        return MF_E_SHUTDOWN;
+    }
 
-    // Check if the async operation succeeded.
-    if (SUCCEEDED(hr) && FAILED(hrStatus)) 
+    Microsoft::WRL::ComPtr<IMFRateControl> pRateControl;
+    HRESULT hr = MFGetService(pSession.Get(), MF_RATE_CONTROL_SERVICE, IID_PPV_ARGS(&pRateControl));
+    if (SUCCEEDED(hr))
     {
-        hr = hrStatus;
+        hr = pRateControl->SetRate(bThin, flRate);
     }
-    if (FAILED(hr))
+    if (SUCCEEDED(hr))
     {
-        return hr;
+        m_flRate = flRate;
+        m_bThinned = bThin;
     }
 
-    switch(meType)
+    // Play on even if the rate could not be set; the caller reports why.
+    if (bRestart)
     {
-        case MESessionTopologyStatus:
-            hr = OnTopologyStatus(pEvent);
-            break;
-
-        case MEEndOfPresentation:
-            hr = OnPresentationEnded(pEvent);
-            break;
-
-        case MENewPresentation:
-            hr = OnNewPresentation(pEvent);
-            break;
+        PROPVARIANT varStart;
+        PropVariantInit(&varStart);
+        varStart.vt = VT_I8;
+        varStart.hVal.QuadPart = hnsPosition;
 
-        default:
-            hr = OnSessionEvent(pEvent, meType);
-            break;
+        HRESULT hrStart = StartPlayback(&varStart);
+        if (SUCCEEDED(hr))
+        {
+            hr = hrStart;
+        }
     }
 
     return hr;
 }
 
-//  Release all resources held by this object.
-HRESULT CPlayer::Shutdown()
+//  Show the next video frame.
+//
+//  The first Step while playing puts the renderer in step mode and
+//  pauses. The renderer can only step once the clock has paused, so
+//  that step, and any requested before MESessionPaused, run in
+//  OnSessionPaused. While paused in step mode the renderer keeps the
+//  frames the decoder has ready, and each Step presents one of them, so
+//  stepping forward decodes nothing. Play, a seek or a rate change
+//  leaves step mode.
+HRESULT CPlayer::Step()
 {
-    // Close the session
-    HRESULT hr = CloseSession();
+    if (m_state != Started && m_state != Paused)
+    {
+        return MF_E_INVALIDREQUEST;
+    }
 
-    // Shutdown the Media Foundation platform
-    MFShutdown();
+    Microsoft::WRL::ComPtr<ICustomVideoRendererControl> pControl;
+    HRESULT hr = GetRendererControl(&pControl);
 
-    if (m_hCloseEvent)
+    // In step mode the renderer holds the frames that arrive once it has
+    // paused instead of presenting them.
+    if (SUCCEEDED(hr) && !m_bStepMode)
     {
-        CloseHandle(m_hCloseEvent);
-        m_hCloseEvent = NULL;
+        hr = pControl->SetStepMode(TRUE);
+        if (SUCCEEDED(hr))
+        {
+            m_bStepMode = true;
+        }
     }
 
-    return hr;
-}
+    if (FAILED(hr))
+    {
+        return hr;
+    }
 
-/// Protected methods
+    if (m_state == Started)
+    {
+        // Queue the step before pausing: MESessionPaused may arrive
+        // before Pause returns.
+        {
+            CAutoLock lock(&m_csPlayer);
+            m_cPendingSteps++;
+        }
 
-HRESULT CPlayer::OnTopologyStatus(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent)
-{
-    UINT32 status; 
+        hr = Pause();
+        if (FAILED(hr))
+        {
+            CAutoLock lock(&m_csPlayer);
+            m_cPendingSteps = 0;
+        }
+        return hr;
+    }
 
-    HRESULT hr = pEvent->GetUINT32(MF_EVENT_TOPOLOGY_STATUS, &status);
-    if (SUCCEEDED(hr) && (status == MF_TOPOSTATUS_READY))
     {
-        // Get the IMFVideoDisplayControl interface from EVR. This call is
-        // expected to fail if the media file does not have a video stream.
+        CAutoLock lock(&m_csPlayer);
 
-        (void)MFGetService(m_pSession.Get(), MR_VIDEO_RENDER_SERVICE, 
-                IID_PPV_ARGS(&m_pVideoDisplay));
+        if (m_cPendingSteps != 0)
+        {
+            // Still pausing; this one runs after the others.
+            m_cPendingSteps++;
+            return S_OK;
+        }
+    }
 
-        hr = StartPlayback();
+    // After a Pause of the application's own, the renderer may not have
+    // paused yet; then there is nothing to step.
+    hr = pControl->Step(NULL);
+    if (hr == MF_E_INVALIDREQUEST)
+    {
+        hr = S_FALSE;
     }
     return hr;
 }
 
-
-//  Handler for MEEndOfPresentation event.
-HRESULT CPlayer::OnPresentationEnded(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent)
-{
-    // The session puts itself into the stopped state automatically.
-    m_state = Stopped;
-    return S_OK;
-}
-
-//  Handler for MENewPresentation event.
-//
-//  This event is sent if the media source has a new presentation, which 
-//  requires a new topology. 
-
-HRESULT CPlayer::OnNewPresentation(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent)
+//  The session has paused. Run the steps requested while it was pausing.
+HRESULT CPlayer::OnSessionPaused(HRESULT hrStatus)
 {
-    auto pPD = GetPresentationDescriptor(pEvent);
-    if (!pPD) {
-        return E_FAIL;
+    UINT32 cSteps = 0;
+    {
+        CAutoLock lock(&m_csPlayer);
+        cSteps = m_cPendingSteps;
+        m_cPendingSteps = 0;
     }
 
-    // Create a partial topology.
-    auto pTopology = CreatePlaybackTopology(m_pSource.Get(), pPD,  m_hwndVideo);
-    if (!pTopology)
+    // The session did not pause, so there is nothing to step.
+    if (cSteps == 0 || FAILED(hrStatus))
     {
-        return E_FAIL;
+        return S_OK;
     }
 
-    // Set the topology on the media session.
-    auto hr = m_pSession->SetTopology(0, pTopology.Get());
-    if (FAILED(hr))
+    Microsoft::WRL::ComPtr<ICustomVideoRendererControl> pControl;
+    HRESULT hr = GetRendererControl(&pControl);
+
+    // S_FALSE means the renderer has no frame yet; it presents the next
+    // one that arrives.
+    for (UINT32 i = 0; SUCCEEDED(hr) && i < cSteps; i++)
     {
-        return hr;
+        hr = pControl->Step(NULL);
     }
 
-    m_state = OpenPending;
-    return S_OK;
+    return hr;
 }
 
-//  Create a new instance of the media session.
-HRESULT CPlayer::CreateSession()
+//  Get the control interface of the first video renderer.
+HRESULT CPlayer::GetRendererControl(ICustomVideoRendererControl **ppControl)
 {
-    // Close the old session, if any.
-    HRESULT hr = CloseSession();
-    if (FAILED(hr))
+    Microsoft::WRL::ComPtr<IMFMediaSink> pVideoSink;
     {
-        goto done;
+        CAutoLock lock(&m_csPlayer);
+        if (!m_sinks.VideoSinks.empty())
+        {
+            pVideoSink = m_sinks.VideoSinks[0];
+        }
+    }
+    if (!pVideoSink)
+    {
+        return MF_E_NOT_FOUND;
     }
 
-    assert(m_state == Closed);
+    return pVideoSink->QueryInterface(IID_PPV_ARGS(ppControl));
+}
 
-    // Create the media session.
-    hr = MFCreateMediaSession(NULL, &m_pSession);
-    if (FAILED(hr))
+//  Get the presentation time.
+HRESULT CPlayer::GetPosition(MFTIME *phnsPosition)
+{
+    auto pSession = GetSession();
+    if (!pSession)
     {
-        goto done;
+        return MF_E_SHUTDOWN;
     }
 
-    // Start pulling events from the media session
-    hr = m_pSession->BeginGetEvent((IMFAsyncCallback*)this, NULL);
-    if (FAILED(hr))
+    Microsoft::WRL::ComPtr<IMFClock> pClock;
+    HRESULT hr = pSession->GetClock(&pClock);
+
+    Microsoft::WRL::ComPtr<IMFPresentationClock> pPresentationClock;
+    if (SUCCEEDED(hr))
     {
-        goto done;
+        hr = pClock.As(&pPresentationClock);
     }
 
-    m_state = Ready;
+    if (SUCCEEDED(hr))
+    {
+        hr = pPresentationClock->GetTime(phnsPosition);
+    }
 
-done:
     return hr;
 }
 
-//  Close the media session. 
-HRESULT CPlayer::CloseSession()
+//  Get the time from the last Seek to the first video frame at the new
+//  position. Returns S_FALSE and 0 until that frame has arrived.
+HRESULT CPlayer::GetSeekLatency(MFTIME *phnsLatency)
 {
-    //  The IMFMediaSession::Close method is asynchronous, but the 
-    //  CPlayer::CloseSession method waits on the MESessionClosed event.
-    //  
-    //  MESessionClosed is guaranteed to be the last event that the 
-    //  media session fires.
-
-    HRESULT hr = S_OK;
+    *phnsLatency = 0;
 
-    m_pVideoDisplay.Reset();
-
-    // First close the media session.
-    if (m_pSession)
+    const MFTIME hnsSeekStart = m_hnsSeekStart;
+    if (hnsSeekStart == 0 || !m_bSeekStarted)
     {
-        DWORD dwWaitResult = 0;
-
-        m_state = Closing;
-
-        hr = m_pSession->Close();
-        // Wait for the close operation to complete
-        if (SUCCEEDED(hr))
-        {
-            dwWaitResult = WaitForSingleObject(m_hCloseEvent, 5000);
-            if (dwWaitResult == WAIT_TIMEOUT)
-            {
-                assert(FALSE);
-            }
-            // Now there will be no more events from this session.
-        }
+        return S_FALSE;
     }
 
-    // Complete shutdown operations.
-    if (SUCCEEDED(hr))
+    Microsoft::WRL::ComPtr<IMFMediaSink> pVideoSink;
     {
-        // Shut down the media source. (Synchronous operation, no events.)
-        if (m_pSource)
-        {
-            (void)m_pSource->Shutdown();
-        }
-        // Shut down the media session. (Synchronous operation, no events.)
-        if (m_pSession)
+        CAutoLock lock(&m_csPlayer);
+        if (!m_sinks.VideoSinks.empty())
         {
-            (void)m_pSession->Shutdown();
+            pVideoSink = m_sinks.VideoSinks[0];
         }
     }
+    if (!pVideoSink)
+    {
+        return S_FALSE;
+    }
 
-    m_pSession.Reset();
-    m_state = Closed;
-    return hr;
-}
-
-//  Start playback from the current position. 
-HRESULT CPlayer::StartPlayback()
-{
-    assert(m_pSession != NULL);
+    Microsoft::WRL::ComPtr<IMFStreamSink> pStreamSink;
+    HRESULT hr = pVideoSink->GetStreamSinkByIndex(0, &pStreamSink);
 
-    PROPVARIANT varStart;
-    PropVariantInit(&varStart);
+    Microsoft::WRL::ComPtr<ICustomVideoRendererStatistics> pStats;
+    if (SUCCEEDED(hr))
+    {
+        hr = MFGetService(pStreamSink.Get(), __uuidof(ICustomVideoRendererStatistics), IID_PPV_ARGS(&pStats));
+    }
 
-    HRESULT hr = m_pSession->Start(&GUID_NULL, &varStart);
+    UINT64 hnsFirstFrame = 0;
     if (SUCCEEDED(hr))
     {
-        // Note: Start is an asynchronous operation. However, we
-        // can treat our state as being already started. If Start
-        // fails later, we'll get an MESessionStarted event with
-        // an error code, and we will update our state then.
-        m_state = Started;
+        hr = pStats->GetCounter(CVR_COUNTER_FIRST_FRAME_TIME, &hnsFirstFrame);
     }
-    PropVariantClear(&varStart);
-    return hr;
-}
 
-//  Start playback from paused or stopped.
-HRESULT CPlayer::Play()
-{
-    if (m_state != Paused && m_state != Stopped)
+    if (FAILED(hr))
     {
-        return MF_E_INVALIDREQUEST;
+        return hr;
     }
-    if (m_pSession == NULL || m_pSource == NULL)
+
+    // The renderer clears the time when the clock starts, which is before
+    // MESessionStarted; 0 means no frame yet.
+    if ((MFTIME)hnsFirstFrame < hnsSeekStart)
     {
-        return E_UNEXPECTED;
+        return S_FALSE;
     }
-    return StartPlayback();
+
+    *phnsLatency = (MFTIME)hnsFirstFrame - hnsSeekStart;
+    return S_OK;
 }
@@ -21,12 +21,31 @@
 #include <mferror.h>
 #include <evr.h>
 #include <wrl/client.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
 #include "resource.h"
+#include "MFAwaitable.h"
+#include "../CustomVideoRenderer/CritSec.h"
+#include "../CustomVideoRenderer/LockFreeQueue.h"
 
 
 const UINT WM_APP_PLAYER_EVENT = WM_APP + 1;   
 
-// WPARAM = IMFMediaEvent*, WPARAM = MediaEventType
+// No parameters: call CPlayer::HandleEvents.
+//
+// The player handles session events itself, on the Media Foundation
+// thread that delivers them, and then forwards them to the UI. Errors of
+// its own (a failed open, a failed handler) are forwarded as MEError
+// events that carry the failure code as their status.
+//
+// Forwarded events go into a lock-free ring that the UI drains in
+// batches. Only one WM_APP_PLAYER_EVENT is outstanding at a time, however
+// many events arrive before the UI gets to it. Since the UI only reports
+// failures and then refreshes from the player state, an event that
+// succeeded is coalesced into the wake-up and never queued, and a batch
+// reports only its first failure.
 
 enum PlayerState
 {
@@ -36,10 +55,144 @@ enum PlayerState
     Started,        // Session is playing a file.
     Paused,         // Session is paused.
     Stopped,        // Session is stopped (ready to play). 
-    Closing         // Application has closed the session, but is waiting for MESessionClosed.
 };
 
-class CPlayer : public IMFAsyncCallback
+// Which streams of a file the player renders. The others are
+// deselected, so the source does not read them and no decoder is loaded
+// for them.
+enum StreamSelection
+{
+    SelectVideo = 0x1,
+    SelectAudio = 0x2,
+    SelectAll   = SelectVideo | SelectAudio,
+};
+
+enum SeekMode
+{
+    SeekKeyFrame = 0,   // Start at the nearest key frame: fast, for scrubbing.
+    SeekAccurate,       // Start at the exact position; the frames before it are decoded and dropped.
+};
+
+// What a renderer is for: the n-th stream of a major type in the
+// topology. {MFMediaType_Video, 0} is the main video.
+struct StreamRole
+{
+    GUID    MajorType;
+    DWORD   Ordinal;
+
+    bool operator==(const StreamRole &other) const
+    {
+        return MajorType == other.MajorType && Ordinal == other.Ordinal;
+    }
+};
+
+//  Video renderers kept between sessions, keyed by stream role.
+//
+//  Creating a CustomVideoRenderer sets up its device, buffer pool and
+//  media type from scratch. A session takes its renderers from the pool
+//  instead (Acquire), and when it is closed they come back (Return) and
+//  are reset, so the next file starts with a warm renderer. The pool
+//  keeps one idle renderer per role; Shutdown shuts the idle ones down.
+
+class CRendererPool
+{
+public:
+    CRendererPool();
+
+    HRESULT Acquire(const StreamRole &role, Microsoft::WRL::ComPtr<IMFMediaSink> *ppSink);
+    void    Return(const StreamRole &role, const Microsoft::WRL::ComPtr<IMFMediaSink> &pSink);
+    void    Shutdown();
+
+private:
+    struct Entry
+    {
+        StreamRole                              Role;
+        Microsoft::WRL::ComPtr<IMFMediaSink>    pSink;
+    };
+
+    CCritSec            m_lock;
+    std::vector<Entry>  m_idle;
+    bool                m_bShutdown;
+};
+
+// Renderers shared by all the topologies of one session, so that the
+// session can go from one playlist item to the next without tearing
+// them down.
+struct SessionSinks
+{
+    std::vector<Microsoft::WRL::ComPtr<IMFMediaSink>>   VideoSinks;     // By video stream ordinal.
+    Microsoft::WRL::ComPtr<IMFActivate>                 pAudioActivate;
+
+    // Gives the video renderers back to the pool and shuts the audio
+    // renderer down.
+    void Release(CRendererPool &pool);
+};
+
+// What a closed session leaves to shut down.
+struct SessionResources
+{
+    Microsoft::WRL::ComPtr<IMFMediaSource>  pSource;
+    Microsoft::WRL::ComPtr<IMFMediaSource>  pNextSource;    // Preloaded playlist item.
+    SessionSinks                            Sinks;
+};
+
+//  Finishes closing one media session in the background.
+//
+//  The source and the session may only be shut down after the session
+//  has closed (MESessionClosed), so CloseSession does not wait for that:
+//  it calls IMFMediaSession::Close, hands the sources and renderers over
+//  with CloseRequested and returns. When the session's event coroutine sees
+//  the last event it calls EventsEnded. Whichever of the two calls comes
+//  second queues a work item that shuts the source and the session down
+//  and gives the renderers back to the player's pool. The session is
+//  never shut down from inside its own event callback.
+//
+//  Sessions that are still closing are counted in a Group, so that the
+//  player can wait for them before it shuts Media Foundation down.
+
+class CSessionCloser : public std::enable_shared_from_this<CSessionCloser>
+{
+public:
+    struct Group
+    {
+        Group();
+        ~Group();
+
+        std::atomic<LONG>   cClosing;   // Sessions closed but not shut down yet.
+        HANDLE              hIdle;      // Set when cClosing drops to 0.
+    };
+
+    CSessionCloser(
+        const Microsoft::WRL::ComPtr<IMFMediaSession> &pSession,
+        const std::shared_ptr<Group> &pGroup,
+        const std::shared_ptr<CRendererPool> &pRenderers);
+
+    void CloseRequested(const SessionResources &resources);
+    void EventsEnded();
+
+private:
+    void Finish();
+    static Async::Task<HRESULT> FinishAsync(std::shared_ptr<CSessionCloser> pThis);
+
+    CCritSec                                m_lock;
+    Microsoft::WRL::ComPtr<IMFMediaSession> m_pSession;
+    SessionResources                        m_resources;
+    std::shared_ptr<Group>                  m_pGroup;
+    std::shared_ptr<CRendererPool>          m_pRenderers;
+    bool                                    m_bCloseRequested;
+    bool                                    m_bEventsEnded;
+};
+
+// Time from OpenURL to each stage of opening the file, in milliseconds.
+// A stage that has not been reached yet reads 0.
+struct OpenTimings
+{
+    DWORD msResolved;           // The source resolver created the media source.
+    DWORD msTopologySet;        // The partial topology was queued on the session.
+    DWORD msTopologyReady;      // The session resolved the topology (MF_TOPOSTATUS_READY).
+};
+
+class CPlayer : public IUnknown
 {
 public:
     static HRESULT CreateInstance(HWND hVideo, HWND hEvent, CPlayer **ppPlayer);
@@ -49,28 +202,33 @@ public:
     STDMETHODIMP_(ULONG) AddRef()override;
     STDMETHODIMP_(ULONG) Release()override;
 
-    // IMFAsyncCallback methods
-    STDMETHODIMP  GetParameters(DWORD*, DWORD*)override
-    {
-        // Implementation of this method is optional.
-        return E_NOTIMPL;
-    }
-    STDMETHODIMP  Invoke(IMFAsyncResult* pAsyncResult)override;
-
     // Playback
     HRESULT       OpenURL(const WCHAR *sURL);
+    HRESULT       OpenPlaylist(const std::vector<std::wstring> &urls);
     HRESULT       Play();
     HRESULT       Pause();
     HRESULT       Stop();
+    HRESULT       Seek(MFTIME hnsPosition, SeekMode mode);
+    HRESULT       GetPosition(MFTIME *phnsPosition);
+    HRESULT       GetSeekLatency(MFTIME *phnsLatency);
+    UINT64        GetElidedSeekCount() const { return m_cSeeksElided; }
+    HRESULT       SetRate(float flRate);
+    float         GetRate() const { return m_flRate; }
+    BOOL          IsThinned() const { return m_bThinned; }
+    HRESULT       Step();
+    void          SetStreamSelection(DWORD selection) { m_streamSelection = selection; }     // For files opened from now on.
+    DWORD         GetStreamSelection() const { return m_streamSelection; }
     HRESULT       Shutdown();
-    HRESULT       HandleEvent(UINT_PTR pUnkPtr);
+    HRESULT       HandleEvents();
     PlayerState   GetState() const { return m_state; }
+    void          GetOpenTimings(OpenTimings *pTimings) const;
+    UINT64        GetCoalescedEventCount() const { return m_cEventsCoalesced; }
 
     // Video functionality
     HRESULT       Repaint();
     HRESULT       ResizeVideo(WORD width, WORD height);
 
-    BOOL          HasVideo() const { return (m_pVideoDisplay != NULL);  }
+    BOOL          HasVideo();
 
 protected:
 
@@ -83,7 +241,38 @@ protected:
     HRESULT Initialize();
     HRESULT CreateSession();
     HRESULT CloseSession();
-    HRESULT StartPlayback();
+    HRESULT StartPlayback(const PROPVARIANT *pvarStart = NULL);
+    HRESULT GetRendererControl(ICustomVideoRendererControl **ppControl);
+    HRESULT IssueSeek(MFTIME hnsPosition, SeekMode mode);
+    void    OnSeekCompleted();
+    HRESULT OnSessionStopped(HRESULT hrStatus);
+    HRESULT OnSessionPaused(HRESULT hrStatus);
+
+    HRESULT CreateTopology(
+        const Microsoft::WRL::ComPtr<IMFMediaSession> &pSession,
+        const Microsoft::WRL::ComPtr<IMFMediaSource> &pSource,
+        const Microsoft::WRL::ComPtr<IMFPresentationDescriptor> &pPD,
+        Microsoft::WRL::ComPtr<IMFTopology> *ppTopology);
+    void    PreloadNext();
+    void    AdvancePlaylist(TOPOID topologyId);
+
+    // Coroutines. Each one holds a reference on the player while it runs
+    // (ResolveSourceAsync through the coroutine that awaits it).
+    Async::Task<MFAsync::ObjectResult> ResolveSourceAsync(Microsoft::WRL::ComPtr<IMFMediaSession> pSession, std::wstring url);
+    Async::Task<HRESULT> OpenURLAsync(Microsoft::WRL::ComPtr<IMFMediaSession> pSession, std::wstring url);
+    Async::Task<HRESULT> PreloadNextAsync(Microsoft::WRL::ComPtr<IMFMediaSession> pSession, std::wstring url);
+    Async::Task<HRESULT> RunSessionEvents(Microsoft::WRL::ComPtr<IMFMediaSession> pSession, std::shared_ptr<CSessionCloser> pCloser);
+
+    HRESULT DispatchSessionEvent(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent, MediaEventType meType);
+    void    PostEventToUI(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent, MediaEventType meType);
+    void    PostErrorToUI(HRESULT hrError);
+    void    QueueUIEvent(MediaEventType meType, HRESULT hrStatus);
+    void    WakeUI();
+
+    Microsoft::WRL::ComPtr<IMFMediaSession> GetSession();
+    Microsoft::WRL::ComPtr<IMFMediaSource>  GetSource();
+
+    void    MarkOpenStage(std::atomic<DWORD> &msStage);
 
     // Media event handlers
     virtual HRESULT OnTopologyStatus(const Microsoft::WRL::ComPtr<IMFMediaEvent> &pEvent);
@@ -99,14 +288,87 @@ protected:
 protected:
     long                    m_nRefCount;        // Reference count.
 
+    // m_pSession and everything down to m_cPendingSteps are written under
+    // m_csPlayer. Only the UI thread writes m_pSession, so it may read it
+    // without the lock; every other access takes it.
+    CCritSec                m_csPlayer;
     Microsoft::WRL::ComPtr<IMFMediaSession>         m_pSession;
     Microsoft::WRL::ComPtr<IMFMediaSource>          m_pSource;
     Microsoft::WRL::ComPtr<IMFVideoDisplayControl>  m_pVideoDisplay;
+    std::shared_ptr<MFAsync::CCancelCreateObject>   m_pOpenCancel;  // Source resolution in progress, if any.
+    std::shared_ptr<CSessionCloser>                 m_pCloser;      // Closes m_pSession.
+    SessionSinks                                    m_sinks;        // Renderers of m_pSession.
+
+    // Playlist. m_pSource plays m_playlist[m_iPlaylist]; the next item is
+    // preloaded into m_pNextSource and queued as topology m_nextTopologyId.
+    std::vector<std::wstring>                       m_playlist;
+    size_t                                          m_iPlaylist;
+    Microsoft::WRL::ComPtr<IMFMediaSource>          m_pNextSource;
+    TOPOID                                          m_nextTopologyId;   // 0 if nothing is queued.
+    bool                                            m_bPreloading;
+
+    // Seek coalescing. One seek is in flight until its MESessionStarted;
+    // the seeks requested meanwhile collapse into the latest one.
+    // m_bSeekIssued tells that MESessionStarted apart from the one of a
+    // plain Play or a rate change restart.
+    bool                                            m_bSeekInFlight;
+    bool                                            m_bSeekIssued;
+    bool                                            m_bSeekPending;
+    MFTIME                                          m_hnsPendingSeek;
+    SeekMode                                        m_pendingSeekMode;
+
+    // A rate change that needs a stopped clock. SetRate stops the
+    // session; on MESessionStopped the rate is set and, unless Stop was
+    // called meanwhile, playback restarts at m_hnsRateRestart.
+    bool                                            m_bRateChangePending;
+    bool                                            m_bRestartAfterRate;
+    float                                           m_pendingRate;
+    BOOL                                            m_bPendingThin;
+    MFTIME                                          m_hnsRateRestart;
+
+    // Steps requested while the session was pausing. The renderer can
+    // only step once it has paused, so they run on MESessionPaused.
+    UINT32                                          m_cPendingSteps;
+
+    // Open timings. OpenURL sets the start time before the open begins.
+    std::atomic<MFTIME>     m_hnsOpenStart;
+    std::atomic<DWORD>      m_msResolved;
+    std::atomic<DWORD>      m_msTopologySet;
+    std::atomic<DWORD>      m_msTopologyReady;
+
+    // Seek latency. Seek sets the start time; the renderer reports when
+    // the first frame at the new position arrived.
+    std::atomic<MFTIME>     m_hnsSeekStart;     // 0 if there was no seek.
+    std::atomic<bool>       m_bSeekStarted;     // MESessionStarted seen since the last seek.
+    std::atomic<UINT64>     m_cSeeksElided;     // Seeks replaced by a later one before they were issued.
+
+    // Playback rate last set with SetRate.
+    std::atomic<float>      m_flRate;
+    std::atomic<BOOL>       m_bThinned;         // Key frames only.
+
+    // The renderer holds decoded frames for Step until playback starts.
+    std::atomic<bool>       m_bStepMode;
+
+    // StreamSelection flags for the next topology.
+    std::atomic<DWORD>      m_streamSelection;
+
+    // Events forwarded to the UI (PostEventToUI, HandleEvents).
+    struct UIEvent
+    {
+        MediaEventType  meType;
+        HRESULT         hrStatus;
+    };
+    static const size_t UI_EVENT_QUEUE_CAPACITY = 64;
+
+    CLockFreeQueue<UIEvent, UI_EVENT_QUEUE_CAPACITY> m_uiEvents;
+    std::atomic<bool>       m_bWakePending;     // A WM_APP_PLAYER_EVENT is on its way.
+    std::atomic<UINT64>     m_cEventsCoalesced; // Events not queued or not reported separately.
 
     HWND                    m_hwndVideo;        // Video window.
     HWND                    m_hwndEvent;        // App window to receive events.
-    PlayerState             m_state;            // Current state of the media session.
-    HANDLE                  m_hCloseEvent;      // Event to wait on while closing.
+    std::atomic<PlayerState> m_state;           // Current state of the media session.
+    std::shared_ptr<CSessionCloser::Group> m_pClosing;  // Sessions still closing.
+    std::shared_ptr<CRendererPool>  m_pRenderers;       // Video renderers between sessions.
 };
 
 #endif PLAYER_H
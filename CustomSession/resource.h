@@ -5,5 +5,6 @@
 #define IDC_EDIT_URL                    1000
 #define ID_FILE_OPENFILE                32771
 #define ID_FILE_OPENURL                 32772
+#define ID_FILE_VIDEOONLY               32773
 #define IDC_STATIC                      -1
 
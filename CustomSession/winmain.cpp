@@ -7,6 +7,7 @@
 
 #include "CustomPlayer.h"
 #include <string>
+#include <vector>
 
 PCWSTR szTitle = L"BasicPlayback";
 PCWSTR szWindowClass = L"MFBASICPLAYBACK";
@@ -30,10 +31,12 @@ HRESULT             AllocGetWindowText(HWND hwnd, WCHAR **pszText, DWORD *pcchLe
 LRESULT             OnCreateWindow(HWND hwnd);
 void                OnFileOpen(HWND hwnd);
 void                OnOpenURL(HWND hwnd);
-void                OnPlayerEvent(HWND hwnd, WPARAM pUnkPtr);
+void                OnVideoOnly(HWND hwnd);
+void                OnPlayerEvent(HWND hwnd);
 void                OnPaint(HWND hwnd);
 void                OnResize(WORD width, WORD height);
 void                OnKeyPress(WPARAM key);
+void                OnKeyDown(HWND hwnd, WPARAM key);
 
 // OpenUrlDialogInfo: Contains data passed to the "Open URL" dialog proc.
 struct OpenUrlDialogInfo
@@ -134,6 +137,9 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
                 case ID_FILE_OPENURL:
                     OnOpenURL(hwnd);
                     break;
+                case ID_FILE_VIDEOONLY:
+                    OnVideoOnly(hwnd);
+                    break;
 
                 default:
                     return DefWindowProc(hwnd, message, wParam, lParam);
@@ -160,8 +166,12 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
             OnKeyPress(wParam);
             break;
 
+        case WM_KEYDOWN:
+            OnKeyDown(hwnd, wParam);
+            break;
+
         case WM_APP_PLAYER_EVENT:
-            OnPlayerEvent(hwnd, wParam);
+            OnPlayerEvent(hwnd);
             break;
 
         default:
@@ -170,7 +180,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
     return 0;
 }
 
-static HRESULT OpenDialog(HWND hwnd, std::wstring &result)
+static HRESULT OpenDialog(HWND hwnd, std::vector<std::wstring> &result)
 {
     // Create the FileOpenDialog object.
     Microsoft::WRL::ComPtr<IFileOpenDialog> pFileOpen;
@@ -181,6 +191,18 @@ static HRESULT OpenDialog(HWND hwnd, std::wstring &result)
         return hr;
     }
 
+    // Several files make a playlist.
+    FILEOPENDIALOGOPTIONS options;
+    hr = pFileOpen->GetOptions(&options);
+    if (SUCCEEDED(hr))
+    {
+        hr = pFileOpen->SetOptions(options | FOS_ALLOWMULTISELECT);
+    }
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
     // Show the Open dialog box.
     hr = pFileOpen->Show(NULL);
     if (hr == HRESULT_FROM_WIN32(ERROR_CANCELLED))
@@ -193,23 +215,40 @@ static HRESULT OpenDialog(HWND hwnd, std::wstring &result)
         return hr;
     }
 
-    // Get the file name from the dialog box.
-    Microsoft::WRL::ComPtr<IShellItem> pItem;
-    hr = pFileOpen->GetResult(&pItem);
+    // Get the file names from the dialog box, in the order shown.
+    Microsoft::WRL::ComPtr<IShellItemArray> pItems;
+    hr = pFileOpen->GetResults(&pItems);
     if (FAILED(hr))
     {
         return hr;
     }
 
-    PWSTR pszFilePath = NULL;
-    hr = pItem->GetDisplayName(SIGDN_FILESYSPATH, &pszFilePath);
+    DWORD cItems = 0;
+    hr = pItems->GetCount(&cItems);
     if (FAILED(hr))
     {
-        // when break, wrong thread
         return hr;
     }
-    result = pszFilePath;
-    CoTaskMemFree(pszFilePath);
+
+    for (DWORD i = 0; i < cItems; i++)
+    {
+        Microsoft::WRL::ComPtr<IShellItem> pItem;
+        hr = pItems->GetItemAt(i, &pItem);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        PWSTR pszFilePath = NULL;
+        hr = pItem->GetDisplayName(SIGDN_FILESYSPATH, &pszFilePath);
+        if (FAILED(hr))
+        {
+            // when break, wrong thread
+            return hr;
+        }
+        result.push_back(pszFilePath);
+        CoTaskMemFree(pszFilePath);
+    }
 
     return S_OK;
 }
@@ -217,11 +256,17 @@ static HRESULT OpenDialog(HWND hwnd, std::wstring &result)
 //  Open an audio/video file.
 void OnFileOpen(HWND hwnd)
 {
-    std::wstring filePath;
-    auto hr = OpenDialog(hwnd, filePath);
+    std::vector<std::wstring> files;
+    auto hr = OpenDialog(hwnd, files);
     if (SUCCEEDED(hr)) {
-        // Display the file name to the user.
-        hr = g_pPlayer->OpenURL(filePath.c_str());
+        if (files.empty())
+        {
+            // The user canceled the dialog.
+            return;
+        }
+
+        // Play the files one after the other.
+        hr = g_pPlayer->OpenPlaylist(files);
         if (SUCCEEDED(hr))
         {
             UpdateUI(hwnd, OpenPending);
@@ -266,6 +311,17 @@ void OnOpenURL(HWND hwnd)
     CoTaskMemFree(url.pszURL);
 }
 
+//  Handler for the "Video Only" command. Toggles between playing every
+//  stream and playing video only, which skips the audio decoder. Takes
+//  effect with the next file opened.
+void OnVideoOnly(HWND hwnd)
+{
+    const bool bVideoOnly = g_pPlayer->GetStreamSelection() != SelectVideo;
+    g_pPlayer->SetStreamSelection(bVideoOnly ? SelectVideo : SelectAll);
+
+    CheckMenuItem(GetMenu(hwnd), ID_FILE_VIDEOONLY, MF_BYCOMMAND | (bVideoOnly ? MF_CHECKED : MF_UNCHECKED));
+}
+
 //  Handler for WM_CREATE message.
 LRESULT OnCreateWindow(HWND hwnd)
 {
@@ -330,13 +386,64 @@ void OnKeyPress(WPARAM key)
                 g_pPlayer->Play();
             }
             break;
+
+        // ']' and '[' double and halve the playback rate, '=' goes back
+        // to 1x and 'r' reverses the direction.
+        case ']':
+            g_pPlayer->SetRate(g_pPlayer->GetRate() * 2.0f);
+            break;
+
+        case '[':
+            g_pPlayer->SetRate(g_pPlayer->GetRate() / 2.0f);
+            break;
+
+        case '=':
+            g_pPlayer->SetRate(1.0f);
+            break;
+
+        case 'r':
+        case 'R':
+            g_pPlayer->SetRate(-g_pPlayer->GetRate());
+            break;
+
+        // '.' shows the next frame, pausing first if playing.
+        case '.':
+            g_pPlayer->Step();
+            break;
+    }
+}
+
+// Handler for WM_KEYDOWN messages.
+// Left and right arrows seek 10 seconds to the nearest key frame; with
+// Shift held down they seek to the exact position.
+void OnKeyDown(HWND hwnd, WPARAM key)
+{
+    const MFTIME SEEK_STEP = 10 * 10000000LL;
+
+    if (key != VK_LEFT && key != VK_RIGHT)
+    {
+        return;
+    }
+
+    MFTIME hnsPosition = 0;
+    if (FAILED(g_pPlayer->GetPosition(&hnsPosition)))
+    {
+        return;
+    }
+
+    hnsPosition += (key == VK_LEFT) ? -SEEK_STEP : SEEK_STEP;
+
+    const SeekMode mode = (GetKeyState(VK_SHIFT) < 0) ? SeekAccurate : SeekKeyFrame;
+    if (SUCCEEDED(g_pPlayer->Seek(hnsPosition, mode)))
+    {
+        UpdateUI(hwnd, g_pPlayer->GetState());
     }
 }
 
 // Handler for Media Session events.
-void OnPlayerEvent(HWND hwnd, WPARAM pUnkPtr)
+void OnPlayerEvent(HWND hwnd)
 {
-    HRESULT hr = g_pPlayer->HandleEvent(pUnkPtr);
+    HRESULT hr = g_pPlayer->HandleEvents();
     if (FAILED(hr))
     {
         NotifyError(hwnd, L"An error occurred.", hr);
@@ -349,17 +456,12 @@ void OnPlayerEvent(HWND hwnd, WPARAM pUnkPtr)
 
 void UpdateUI(HWND hwnd, PlayerState state)
 {
-    BOOL bWaiting = FALSE;
     BOOL bPlayback = FALSE;
 
     assert(g_pPlayer != NULL);
 
     switch (state)
     {
-        case OpenPending:
-            bWaiting = TRUE;
-            break;
-
         case Started:
             bPlayback = TRUE;
             break;
@@ -369,11 +471,43 @@ void UpdateUI(HWND hwnd, PlayerState state)
             break;
     }
 
+    // The open commands stay enabled while a file is opening: opening
+    // another one cancels the pending open.
     HMENU hMenu = GetMenu(hwnd);
-    UINT  uEnable = MF_BYCOMMAND | (bWaiting ? MF_GRAYED : MF_ENABLED);
+    EnableMenuItem(hMenu, ID_FILE_OPENFILE, MF_BYCOMMAND | MF_ENABLED);
+    EnableMenuItem(hMenu, ID_FILE_OPENURL, MF_BYCOMMAND | MF_ENABLED);
+
+    // Show how long the last open took.
+    OpenTimings timings;
+    g_pPlayer->GetOpenTimings(&timings);
+
+    // And how long the last seek took to show its first frame, and how
+    // many seeks scrubbing has skipped.
+    MFTIME hnsSeekLatency = 0;
+    if (g_pPlayer->GetSeekLatency(&hnsSeekLatency) != S_OK)
+    {
+        hnsSeekLatency = -1;
+    }
 
-    EnableMenuItem(hMenu, ID_FILE_OPENFILE, uEnable);
-    EnableMenuItem(hMenu, ID_FILE_OPENURL, uEnable);
+    const size_t TITLE_LEN = 256;
+    WCHAR title[TITLE_LEN];
+    if (timings.msTopologyReady != 0 && hnsSeekLatency >= 0 &&
+        SUCCEEDED(StringCchPrintf(title, TITLE_LEN, L"%s (resolve %u ms, topology set %u ms, topology ready %u ms, seek %u ms, %I64u seeks elided)",
+                szTitle, timings.msResolved, timings.msTopologySet, timings.msTopologyReady, (DWORD)(hnsSeekLatency / 10000),
+                g_pPlayer->GetElidedSeekCount())))
+    {
+        SetWindowText(hwnd, title);
+    }
+    else if (timings.msTopologyReady != 0 &&
+        SUCCEEDED(StringCchPrintf(title, TITLE_LEN, L"%s (resolve %u ms, topology set %u ms, topology ready %u ms)",
+                szTitle, timings.msResolved, timings.msTopologySet, timings.msTopologyReady)))
+    {
+        SetWindowText(hwnd, title);
+    }
+    else
+    {
+        SetWindowText(hwnd, szTitle);
+    }
 
     if (bPlayback && g_pPlayer->HasVideo())
     {
@@ -0,0 +1,183 @@
+#pragma once
+#include <mfapi.h>
+#include <mfobjects.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+//////////////////////////////////////////////////////////////////////////
+//  CAsyncCallback [template]
+//
+//  Description:
+//  Helper class that routes IMFAsyncCallback::Invoke calls to the parent
+//  class, either to a method or to a small callable (typically a lambda).
+//
+//  Usage:
+//  Add this class as a member variable. In the parent class constructor,
+//  initialize the CAsyncCallback class like this:
+//      m_cb(this, &CYourClass::OnInvoke)
+//  or
+//      m_cb(this, [this](IMFAsyncResult* pResult) { return OnInvoke(pResult); })
+//  where
+//      m_cb       = CAsyncCallback object
+//      CYourClass = parent class
+//      OnInvoke   = Method in the parent class to receive Invoke calls.
+//
+//  The callable is stored inline, so binding one never allocates. Its
+//  size is checked at compile time against InlineSize.
+//
+//  Reference counting is delegated to the parent, so the parent must
+//  outlive any pending work item that holds the callback.
+//
+//  GetParameters reports the flags and work queue set with SetParameters,
+//  so Media Foundation can dispatch short, non-blocking callbacks on its
+//  fast path (MFASYNC_FAST_IO_PROCESSING_CALLBACK) and keep blocking ones
+//  off the shared queues (MFASYNC_BLOCKING_CALLBACK). By default it
+//  returns E_NOTIMPL, which gives the platform defaults.
+//////////////////////////////////////////////////////////////////////////
+
+// T: Type of the parent object
+template<class T, size_t InlineSize = 4 * sizeof(void*)>
+class CAsyncCallback : public IMFAsyncCallback
+{
+public:
+
+    typedef HRESULT(T::*InvokeFn)(IMFAsyncResult* pAsyncResult);
+
+    CAsyncCallback(T* pParent, InvokeFn fn) :
+        CAsyncCallback(pParent, MethodThunk{ pParent, fn })
+    {
+    }
+
+    template<class Fn>
+    CAsyncCallback(T* pParent, Fn fn) :
+        m_pParent(pParent),
+        m_pInvoke(&InvokeStored<Fn>),
+        m_pDestroy(&DestroyStored<Fn>),
+        m_hasParameters(false),
+        m_dwFlags(0),
+        m_dwQueue(MFASYNC_CALLBACK_QUEUE_STANDARD)
+    {
+        static_assert(sizeof(Fn) <= InlineSize, "Callable is too large to be stored inline; raise InlineSize");
+        static_assert(alignof(Fn) <= alignof(Storage), "Callable is over-aligned for the inline storage");
+
+        new (&m_storage) Fn(std::move(fn));
+    }
+
+    ~CAsyncCallback(void)
+    {
+        m_pDestroy(&m_storage);
+    }
+
+    // Sets what GetParameters reports. dwFlags is a combination of the
+    // MFASYNC_* callback flags; dwQueue is the work queue to dispatch on.
+    void SetParameters(DWORD dwFlags, DWORD dwQueue)
+    {
+        m_dwFlags = dwFlags;
+        m_dwQueue = dwQueue;
+        m_hasParameters = true;
+    }
+
+    DWORD GetQueue(void) const
+    {
+        return m_dwQueue;
+    }
+
+    // IUnknown
+    STDMETHODIMP_(ULONG) AddRef(void)
+    {
+        // Delegate to parent class.
+        return m_pParent->AddRef();
+    }
+
+    STDMETHODIMP_(ULONG) Release(void)
+    {
+        // Delegate to parent class.
+        return m_pParent->Release();
+    }
+
+    STDMETHODIMP QueryInterface(REFIID iid, __RPC__deref_out _Result_nullonfailure_ void** ppv)
+    {
+        if (!ppv)
+        {
+            return E_POINTER;
+        }
+        if (iid == __uuidof(IUnknown))
+        {
+            *ppv = static_cast<IUnknown*>(static_cast<IMFAsyncCallback*>(this));
+        }
+        else if (iid == __uuidof(IMFAsyncCallback))
+        {
+            *ppv = static_cast<IMFAsyncCallback*>(this);
+        }
+        else
+        {
+            *ppv = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    // IMFAsyncCallback methods
+    STDMETHODIMP GetParameters(__RPC__out DWORD* pdwFlags, __RPC__out DWORD* pdwQueue)
+    {
+        if (!m_hasParameters)
+        {
+            // Implementation of this method is optional.
+            return E_NOTIMPL;
+        }
+
+        if (pdwFlags == NULL || pdwQueue == NULL)
+        {
+            return E_POINTER;
+        }
+
+        *pdwFlags = m_dwFlags;
+        *pdwQueue = m_dwQueue;
+        return S_OK;
+    }
+
+    STDMETHODIMP Invoke(__RPC__in_opt IMFAsyncResult* pAsyncResult)
+    {
+        return m_pInvoke(&m_storage, pAsyncResult);
+    }
+
+private:
+
+    CAsyncCallback(const CAsyncCallback&) = delete;
+    CAsyncCallback& operator=(const CAsyncCallback&) = delete;
+
+    struct MethodThunk
+    {
+        T* pParent;
+        InvokeFn fn;
+
+        HRESULT operator()(IMFAsyncResult* pAsyncResult) const
+        {
+            return (pParent->*fn)(pAsyncResult);
+        }
+    };
+
+    typedef typename std::aligned_storage<InlineSize, alignof(void*)>::type Storage;
+
+    template<class Fn>
+    static HRESULT InvokeStored(void* pStorage, IMFAsyncResult* pAsyncResult)
+    {
+        return (*static_cast<Fn*>(pStorage))(pAsyncResult);
+    }
+
+    template<class Fn>
+    static void DestroyStored(void* pStorage)
+    {
+        static_cast<Fn*>(pStorage)->~Fn();
+    }
+
+    T* m_pParent;
+    Storage m_storage;
+    HRESULT(*m_pInvoke)(void* pStorage, IMFAsyncResult* pAsyncResult);
+    void(*m_pDestroy)(void* pStorage);
+    bool m_hasParameters;
+    DWORD m_dwFlags;
+    DWORD m_dwQueue;
+};
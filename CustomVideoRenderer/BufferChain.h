@@ -0,0 +1,218 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "FrameLayout.h"
+
+//////////////////////////////////////////////////////////////////////////
+//  CBufferChainView
+//
+//  Description:
+//  Read view over the buffers of one sample, in order, as if they were a
+//  single byte range. Stages walk the segments where they are instead of
+//  asking for a contiguous copy first:
+//
+//      GetContiguous(offset, cb)   Pointer to the range if it lies inside
+//                                  one segment, else nullptr.
+//      CopyTo(offset, pDest, cb)   Gathers a range that spans segments.
+//
+//  A kernel that needs a range in one piece tries GetContiguous first and
+//  only gathers with CopyTo when that fails. MapFramePlanes does this
+//  plane by plane, so only the planes that straddle two buffers are
+//  copied.
+//
+//  The view does not own the memory; the caller keeps the buffers locked
+//  while it is in use. Segments are held inline, so building a view does
+//  not allocate. This header has no Windows dependencies.
+//////////////////////////////////////////////////////////////////////////
+
+struct BufferSegment
+{
+    uint8_t* pData;
+    size_t cbLength;
+};
+
+class CBufferChainView
+{
+public:
+
+    static const uint32_t MaxSegments = 16;
+
+    CBufferChainView(void) :
+        m_cSegments(0),
+        m_cbTotal(0)
+    {
+    }
+
+    // Adds a segment at the end. Returns false if the view is full.
+    bool Append(uint8_t* pData, size_t cbLength)
+    {
+        if (m_cSegments == MaxSegments)
+        {
+            return false;
+        }
+
+        m_segments[m_cSegments].pData = pData;
+        m_segments[m_cSegments].cbLength = cbLength;
+        m_cSegments++;
+        m_cbTotal += cbLength;
+        return true;
+    }
+
+    void Clear(void)
+    {
+        m_cSegments = 0;
+        m_cbTotal = 0;
+    }
+
+    uint32_t GetSegmentCount(void) const
+    {
+        return m_cSegments;
+    }
+
+    const BufferSegment& GetSegment(uint32_t i) const
+    {
+        return m_segments[i];
+    }
+
+    size_t GetTotalLength(void) const
+    {
+        return m_cbTotal;
+    }
+
+    uint8_t* GetContiguous(size_t offset, size_t cb) const
+    {
+        for (uint32_t i = 0; i < m_cSegments; i++)
+        {
+            const BufferSegment& segment = m_segments[i];
+            if (offset < segment.cbLength)
+            {
+                return (cb <= segment.cbLength - offset) ? segment.pData + offset : nullptr;
+            }
+            offset -= segment.cbLength;
+        }
+        return nullptr;
+    }
+
+    // Copies up to cb bytes starting at offset into pDest. Returns the
+    // number of bytes copied, which is less than cb only at the end of
+    // the chain.
+    size_t CopyTo(size_t offset, uint8_t* pDest, size_t cb) const
+    {
+        size_t cbCopied = 0;
+
+        for (uint32_t i = 0; i < m_cSegments && cbCopied < cb; i++)
+        {
+            const BufferSegment& segment = m_segments[i];
+            if (offset >= segment.cbLength)
+            {
+                offset -= segment.cbLength;
+                continue;
+            }
+
+            size_t cbChunk = segment.cbLength - offset;
+            if (cbChunk > cb - cbCopied)
+            {
+                cbChunk = cb - cbCopied;
+            }
+
+            memcpy(pDest + cbCopied, segment.pData + offset, cbChunk);
+            cbCopied += cbChunk;
+            offset = 0;
+        }
+
+        return cbCopied;
+    }
+
+private:
+
+    BufferSegment m_segments[MaxSegments];
+    uint32_t m_cSegments;
+    size_t m_cbTotal;
+};
+
+
+// Bytes a plane of plan covers: from its lowest row in memory to the end
+// of its highest row.
+inline void GetPlaneRange(const FrameBufferPlan& plan, uint32_t i, size_t* pOffset, size_t* pcb)
+{
+    const int64_t lastRow = (int64_t)plan.Stride[i] * (plan.Rows[i] - 1);
+    const int64_t first = plan.Offset[i] + (lastRow < 0 ? lastRow : 0);
+    const int64_t end = plan.Offset[i] + (lastRow > 0 ? lastRow : 0) + plan.RowBytes[i];
+
+    *pOffset = (size_t)first;
+    *pcb = (size_t)(end - first);
+}
+
+//-------------------------------------------------------------------
+// Name: FindSplitPlanes
+// Description: Returns a mask with bit i set for each plane of source
+//              (offsets into the chain) that does not lie inside one
+//              segment.
+//-------------------------------------------------------------------
+
+inline uint32_t FindSplitPlanes(const CBufferChainView& view, const FrameBufferPlan& source)
+{
+    uint32_t mask = 0;
+
+    for (uint32_t i = 0; i < source.cPlanes; i++)
+    {
+        size_t offset = 0;
+        size_t cb = 0;
+        GetPlaneRange(source, i, &offset, &cb);
+
+        if (view.GetContiguous(offset, cb) == nullptr)
+        {
+            mask |= 1u << i;
+        }
+    }
+
+    return mask;
+}
+
+//-------------------------------------------------------------------
+// Name: MapFramePlanes
+// Description: Fills in the planes of a frame laid out in the chain as
+//              source. Planes inside one segment are used where they
+//              are. The others are gathered row by row into pGather,
+//              at the places target gives them; pGather may be null if
+//              FindSplitPlanes returned 0.
+//-------------------------------------------------------------------
+
+inline void MapFramePlanes(
+    const CBufferChainView& view,
+    const FrameBufferPlan& source,
+    const FrameBufferPlan& target,
+    uint8_t* pGather,
+    FrameLayout* pLayout)
+{
+    FrameLayout layout = {};
+    layout.cPlanes = source.cPlanes;
+
+    for (uint32_t i = 0; i < source.cPlanes; i++)
+    {
+        size_t offset = 0;
+        size_t cb = 0;
+        GetPlaneRange(source, i, &offset, &cb);
+
+        uint8_t* pPlane = view.GetContiguous(offset, cb);
+        if (pPlane != nullptr)
+        {
+            layout.Planes[i] = { pPlane + (source.Offset[i] - (int64_t)offset), source.Stride[i], source.RowBytes[i], source.Rows[i] };
+            continue;
+        }
+
+        uint8_t* pTop = pGather + target.Offset[i];
+        for (uint32_t row = 0; row < source.Rows[i]; row++)
+        {
+            (void)view.CopyTo(
+                (size_t)(source.Offset[i] + (int64_t)source.Stride[i] * row),
+                pTop + (int64_t)target.Stride[i] * row,
+                source.RowBytes[i]);
+        }
+
+        layout.Planes[i] = { pTop, target.Stride[i], target.RowBytes[i], target.Rows[i] };
+    }
+
+    *pLayout = layout;
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////
+//  Locks
+//
+//  CCritSec      Recursive exclusive lock (CRITICAL_SECTION on Windows).
+//  CRWLock       Non-recursive reader/writer lock (SRWLOCK on Windows).
+//
+//  RAII guards:
+//  CAutoLock           Exclusive ownership of a CCritSec.
+//  CAutoExclusiveLock  Exclusive (writer) ownership of a CRWLock.
+//  CAutoSharedLock     Shared (reader) ownership of a CRWLock.
+//
+//  On other platforms the standard library provides the primitives, so
+//  code built on these classes can be exercised outside of Windows.
+//
+//  The guards take an optional call site name, LOCK_SITE("..."), used by
+//  the contention statistics in LockStats.h.
+//////////////////////////////////////////////////////////////////////////
+
+#include "LockStats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <mutex>
+#include <shared_mutex>
+#endif
+
+#ifndef _Acquires_lock_
+#define _Acquires_lock_(lock)
+#endif
+#ifndef _Releases_lock_
+#define _Releases_lock_(lock)
+#endif
+#ifndef _Acquires_shared_lock_
+#define _Acquires_shared_lock_(lock)
+#endif
+#ifndef _Releases_shared_lock_
+#define _Releases_shared_lock_(lock)
+#endif
+#ifndef _When_
+#define _When_(expr, annotes)
+#endif
+
+
+class CCritSec
+{
+public:
+#ifdef _WIN32
+    CCritSec(void) :
+        m_cs()
+    {
+        InitializeCriticalSection(&m_cs);
+    }
+
+    ~CCritSec(void)
+    {
+        DeleteCriticalSection(&m_cs);
+    }
+
+    _Acquires_lock_(this->m_cs)
+        void Lock(void)
+        {
+            EnterCriticalSection(&m_cs);
+        }
+
+    _Releases_lock_(this->m_cs)
+        void Unlock(void)
+        {
+            LeaveCriticalSection(&m_cs);
+        }
+
+    _When_(return != 0, _Acquires_lock_(this->m_cs))
+        bool TryLock(void)
+        {
+            return TryEnterCriticalSection(&m_cs) != FALSE;
+        }
+private:
+    CRITICAL_SECTION m_cs;
+#else
+    CCritSec(void)
+    {
+    }
+
+    void Lock(void)
+    {
+        m_cs.lock();
+    }
+
+    void Unlock(void)
+    {
+        m_cs.unlock();
+    }
+
+    bool TryLock(void)
+    {
+        return m_cs.try_lock();
+    }
+private:
+    std::recursive_mutex m_cs;
+#endif
+
+    CCritSec(const CCritSec&) = delete;
+    CCritSec& operator=(const CCritSec&) = delete;
+};
+
+
+class CAutoLock
+{
+public:
+    _Acquires_lock_(this->m_pLock->m_cs)
+        CAutoLock(CCritSec* pLock, LockStats::SiteId site = LockStats::SiteId()) :
+            m_pLock(pLock),
+            m_probe(site)
+    {
+        m_probe.Enter([this]() { return m_pLock->TryLock(); }, [this]() { m_pLock->Lock(); });
+    }
+
+    _Releases_lock_(this->m_pLock->m_cs)
+        ~CAutoLock(void)
+        {
+            m_probe.Leave();
+            m_pLock->Unlock();
+        }
+private:
+    CCritSec* m_pLock;
+    CLockProbe m_probe;
+};
+
+
+// CRWLock is not recursive: a thread must not take it again, in either
+// mode, while it already holds it. Keep the guarded sections short and
+// do not call out of the object while holding it.
+class CRWLock
+{
+public:
+#ifdef _WIN32
+    CRWLock(void)
+    {
+        InitializeSRWLock(&m_lock);
+    }
+
+    _Acquires_lock_(this->m_lock)
+        void Lock(void)
+        {
+            AcquireSRWLockExclusive(&m_lock);
+        }
+
+    _Releases_lock_(this->m_lock)
+        void Unlock(void)
+        {
+            ReleaseSRWLockExclusive(&m_lock);
+        }
+
+    _Acquires_shared_lock_(this->m_lock)
+        void LockShared(void)
+        {
+            AcquireSRWLockShared(&m_lock);
+        }
+
+    _Releases_shared_lock_(this->m_lock)
+        void UnlockShared(void)
+        {
+            ReleaseSRWLockShared(&m_lock);
+        }
+
+    _When_(return != 0, _Acquires_lock_(this->m_lock))
+        bool TryLock(void)
+        {
+            return TryAcquireSRWLockExclusive(&m_lock) != FALSE;
+        }
+
+    _When_(return != 0, _Acquires_shared_lock_(this->m_lock))
+        bool TryLockShared(void)
+        {
+            return TryAcquireSRWLockShared(&m_lock) != FALSE;
+        }
+private:
+    SRWLOCK m_lock;
+#else
+    CRWLock(void)
+    {
+    }
+
+    void Lock(void)
+    {
+        m_lock.lock();
+    }
+
+    void Unlock(void)
+    {
+        m_lock.unlock();
+    }
+
+    void LockShared(void)
+    {
+        m_lock.lock_shared();
+    }
+
+    void UnlockShared(void)
+    {
+        m_lock.unlock_shared();
+    }
+
+    bool TryLock(void)
+    {
+        return m_lock.try_lock();
+    }
+
+    bool TryLockShared(void)
+    {
+        return m_lock.try_lock_shared();
+    }
+private:
+    std::shared_timed_mutex m_lock;
+#endif
+
+    CRWLock(const CRWLock&) = delete;
+    CRWLock& operator=(const CRWLock&) = delete;
+};
+
+
+class CAutoExclusiveLock
+{
+public:
+    _Acquires_lock_(this->m_pLock->m_lock)
+        CAutoExclusiveLock(CRWLock* pLock, LockStats::SiteId site = LockStats::SiteId()) :
+            m_pLock(pLock),
+            m_probe(site)
+    {
+        m_probe.Enter([this]() { return m_pLock->TryLock(); }, [this]() { m_pLock->Lock(); });
+    }
+
+    _Releases_lock_(this->m_pLock->m_lock)
+        ~CAutoExclusiveLock(void)
+        {
+            m_probe.Leave();
+            m_pLock->Unlock();
+        }
+private:
+    CRWLock* m_pLock;
+    CLockProbe m_probe;
+};
+
+
+class CAutoSharedLock
+{
+public:
+    _Acquires_shared_lock_(this->m_pLock->m_lock)
+        CAutoSharedLock(CRWLock* pLock, LockStats::SiteId site = LockStats::SiteId()) :
+            m_pLock(pLock),
+            m_probe(site)
+    {
+        m_probe.Enter([this]() { return m_pLock->TryLockShared(); }, [this]() { m_pLock->LockShared(); });
+    }
+
+    _Releases_shared_lock_(this->m_pLock->m_lock)
+        ~CAutoSharedLock(void)
+        {
+            m_probe.Leave();
+            m_pLock->UnlockShared();
+        }
+private:
+    CRWLock* m_pLock;
+    CLockProbe m_probe;
+};
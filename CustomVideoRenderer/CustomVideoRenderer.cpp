@@ -1,10 +1,25 @@
 #include "CustomVideoRenderer.h"
+#include "StreamState.h"
+#include "CritSec.h"
+#include "SampleCredits.h"
+#include "AsyncCallback.h"
+#include "MediaEventQueue.h"
+#include "DeviceCache.h"
+#include "FrameLayout.h"
+#include "FrameBufferPool.h"
+#include "MemoryBudget.h"
+#include "BufferChain.h"
+#include "RateThinning.h"
+#include "FrameStepQueue.h"
 #include <mfidl.h>
 #include <mfapi.h>
 #include <Mferror.h>
 #include <wrl/client.h>
 #include <wmcodecdsp.h> // for MEDIASUBTYPE_V216
 #include <string>
+#include <atomic>
+#include <cfloat>
+#include <climits>
 #include <Strsafe.h>
 
 #include <d3d11.h>
@@ -15,12 +30,17 @@
 
 // Control how we batch work from the decoder.
 // On receiving a sample we request another one if the number on the queue is
-// less than the hi water threshold.
+// less than the hi water threshold. Under memory pressure the memory budget
+// lowers the threshold, down to one frame.
 // When displaying samples (removing them from the sample queue) we request
 // another one if the number of falls below the lo water threshold
 //
 #define SAMPLE_QUEUE_HIWATER_THRESHOLD 3
 
+// Frames a paused stream may hold for frame stepping. Requests stop at
+// the hi water mark; the rest is room for samples we did not ask for.
+#define STEP_QUEUE_SIZE (SAMPLE_QUEUE_HIWATER_THRESHOLD * 2)
+
 
 GUID const* const s_pVideoFormats[] =
 {
@@ -71,54 +91,6 @@ const FormatEntry s_DXGIFormatMapping[] =
 };
 
 
-// State enum: Defines the current state of the stream.
-enum class State
-{
-    State_TypeNotSet = 0,   // No media type is set
-    State_Ready,            // Media type is set, Start has never been called.
-    State_Started,
-    State_Paused,
-    State_Stopped,
-
-    State_Count             // Number of states
-};
-
-
-// StreamOperation: Defines various operations that can be performed on the stream.
-enum class StreamOperation
-{
-    OpSetMediaType = 0,
-    OpStart,
-    OpRestart,
-    OpPause,
-    OpStop,
-    OpProcessSample,
-    OpPlaceMarker,
-
-    Op_Count                // Number of operations
-};
-
-
-BOOL ValidStateMatrix[State::State_Count][StreamOperation::Op_Count] =
-{
-    // States:    Operations:
-    //            SetType   Start     Restart   Pause     Stop      Sample    Marker
-    /* NotSet */  TRUE,     FALSE,    FALSE,    FALSE,    FALSE,    FALSE,    FALSE,
-
-    /* Ready */   TRUE,     TRUE,     TRUE,     TRUE,     TRUE,     FALSE,    TRUE,
-
-    /* Start */   TRUE,     TRUE,     FALSE,    TRUE,     TRUE,     TRUE,     TRUE,
-
-    /* Pause */   TRUE,     TRUE,     TRUE,     TRUE,     TRUE,     TRUE,     TRUE,
-
-    /* Stop */    TRUE,     TRUE,     FALSE,    FALSE,    TRUE,     FALSE,    TRUE
-
-    // Note about states:
-    // 1. OnClockRestart should only be called from paused state.
-    // 2. While paused, the sink accepts samples but does not process them.
-
-};
-
 // https://msdn.microsoft.com/en-us/library/windows/desktop/ee663602(v=vs.85).aspx
 #ifndef IF_EQUAL_RETURN
 #define IF_EQUAL_RETURN(param, val) if(val == param) return L#val
@@ -334,11 +306,7 @@ done:
 
 static HRESULT ValidateOperation(State state, StreamOperation op)
 {
-    HRESULT hr = S_OK;
-
-    BOOL bTransitionAllowed = ValidStateMatrix[(int)state][(int)op];
-
-    if (bTransitionAllowed)
+    if (GetTransition(state, op).Allowed)
     {
         return S_OK;
     }
@@ -349,145 +317,6 @@ static HRESULT ValidateOperation(State state, StreamOperation op)
 }
 
 
-class CCritSec
-{
-public:
-    CCritSec(void) :
-        m_cs()
-    {
-        InitializeCriticalSection(&m_cs);
-    }
-
-    ~CCritSec(void)
-    {
-        DeleteCriticalSection(&m_cs);
-    }
-
-    _Acquires_lock_(this->m_cs)
-        void Lock(void)
-        {
-            EnterCriticalSection(&m_cs);
-        }
-
-    _Releases_lock_(this->m_cs)
-        void Unlock(void)
-        {
-            LeaveCriticalSection(&m_cs);
-        }
-private:
-    CRITICAL_SECTION m_cs;
-};
-
-
-class CAutoLock
-{
-public:
-    _Acquires_lock_(this->m_pLock->m_cs)
-        CAutoLock(CCritSec* pLock) :
-            m_pLock(pLock)
-    {
-        m_pLock->Lock();
-    }
-
-    _Releases_lock_(this->m_pLock->m_cs)
-        ~CAutoLock(void)
-        {
-            m_pLock->Unlock();
-        }
-private:
-    CCritSec* m_pLock;
-};
-
-
-//////////////////////////////////////////////////////////////////////////
-//  CAsyncCallback [template]
-//
-//  Description:
-//  Helper class that routes IMFAsyncCallback::Invoke calls to a class
-//  method on the parent class.
-//
-//  Usage:
-//  Add this class as a member variable. In the parent class constructor,
-//  initialize the CAsyncCallback class like this:
-//      m_cb(this, &CYourClass::OnInvoke)
-//  where
-//      m_cb       = CAsyncCallback object
-//      CYourClass = parent class
-//      OnInvoke   = Method in the parent class to receive Invoke calls.
-//
-//  The parent's OnInvoke method (you can name it anything you like) must
-//  have a signature that matches the InvokeFn typedef below.
-//////////////////////////////////////////////////////////////////////////
-
-// T: Type of the parent object
-template<class T>
-class CAsyncCallback : public IMFAsyncCallback
-{
-public:
-
-    typedef HRESULT(T::*InvokeFn)(IMFAsyncResult* pAsyncResult);
-
-    CAsyncCallback(T* pParent, InvokeFn fn) :
-        m_pParent(pParent),
-        m_pInvokeFn(fn)
-    {
-    }
-
-    // IUnknown
-    STDMETHODIMP_(ULONG) AddRef(void)
-    {
-        // Delegate to parent class.
-        return m_pParent->AddRef();
-    }
-
-    STDMETHODIMP_(ULONG) Release(void)
-    {
-        // Delegate to parent class.
-        return m_pParent->Release();
-    }
-
-    STDMETHODIMP QueryInterface(REFIID iid, __RPC__deref_out _Result_nullonfailure_ void** ppv)
-    {
-        if (!ppv)
-        {
-            return E_POINTER;
-        }
-        if (iid == __uuidof(IUnknown))
-        {
-            *ppv = static_cast<IUnknown*>(static_cast<IMFAsyncCallback*>(this));
-        }
-        else if (iid == __uuidof(IMFAsyncCallback))
-        {
-            *ppv = static_cast<IMFAsyncCallback*>(this);
-        }
-        else
-        {
-            *ppv = NULL;
-            return E_NOINTERFACE;
-        }
-        AddRef();
-        return S_OK;
-    }
-
-    // IMFAsyncCallback methods
-    STDMETHODIMP GetParameters(__RPC__out DWORD* pdwFlags, __RPC__out DWORD* pdwQueue)
-    {
-        // Implementation of this method is optional.
-        return E_NOTIMPL;
-    }
-
-    STDMETHODIMP Invoke(__RPC__in_opt IMFAsyncResult* pAsyncResult)
-    {
-        return (m_pParent->*m_pInvokeFn)(pAsyncResult);
-    }
-
-private:
-
-    T* m_pParent;
-    InvokeFn m_pInvokeFn;
-};
-
-
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Wrapper class for D3D11 Device and D3D11 Video device used for DXVA to Software decode switch
 class CPrivate_ID3D11VideoDevice : public ID3D11VideoDevice
@@ -1055,90 +884,91 @@ public:
 };
 
 
-class CustomVideoStreamSink: public IMFStreamSink, public IMFMediaTypeHandler, public IMFGetService
-{
-    ULONG m_nRefCount = 1;
-
-    const DWORD                 STREAM_ID;
-    CCritSec&                   m_critSec;                      // critical section for thread safety
-    Microsoft::WRL::ComPtr<IMFMediaSink>               m_pSink; 
-    bool m_IsShutdown = false;
-    Microsoft::WRL::ComPtr<IMFMediaType> m_pCurrentType;
-    Microsoft::WRL::ComPtr<IMFMediaEventQueue> m_pEventQueue;
-
-    State m_state = State::State_TypeNotSet;
-
-    struct sFraction
-    {
-        DWORD Numerator;
-        DWORD Denominator;
-    };
-    sFraction m_imageBytesPP = { 1, 1 };
-    DXGI_FORMAT                 m_dxgiFormat = DXGI_FORMAT_UNKNOWN;
+//////////////////////////////////////////////////////////////////////////
+//  Shared D3D11 device
+//
+//  Every stream sink used to create its own D3D11 device and DXGI device
+//  manager, which dominates startup time and memory with many players in
+//  one process. Sinks now lease a SharedD3DDevice from a process-wide
+//  CDeviceCache keyed by adapter and driver type; the device is created
+//  by CD3D11DeviceFactory on first use and released with the last lease.
+//////////////////////////////////////////////////////////////////////////
 
-    DWORD                       m_WorkQueueId=0;                  // ID of the work queue for asynchronous operations.
-    CAsyncCallback<CustomVideoStreamSink> m_WorkQueueCB;                  // Callback for the work queue.
-    DWORD m_cOutstandingSampleRequests = 0;
+struct SharedD3DDevice
+{
+    Microsoft::WRL::ComPtr<ID3D11Device> pDevice;
+    Microsoft::WRL::ComPtr<ID3D11DeviceContext> pImmediateContext;
+    Microsoft::WRL::ComPtr<IMFDXGIDeviceManager> pDXGIManager;
+    UINT ResetToken = 0;
+};
 
-    Microsoft::WRL::ComPtr<IMFDXGIDeviceManager> m_pDXGIManager;
-    Microsoft::WRL::ComPtr<ID3D11Device> m_pD3D11Device;
-    Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_pD3DImmediateContext;
+class CD3D11DeviceFactory : public CDeviceCache<SharedD3DDevice>::IFactory
+{
     BOOL m_useDebugLayer = FALSE;
-    UINT m_DeviceResetToken = 0;
 
 public:
-    CustomVideoStreamSink(DWORD dwStreamId, CCritSec& critSec
-            , IMFMediaSink *parent)
-        : STREAM_ID(dwStreamId)
-          , m_critSec(critSec)
-          , m_pSink(parent)
-          , m_WorkQueueCB(this, &CustomVideoStreamSink::RequestSamples)
-    {
-        MFCreateEventQueue(&m_pEventQueue);
-
-        CreateDXGIManagerAndDevice(D3D_DRIVER_TYPE_HARDWARE);
-    }
 
-    HRESULT CreateDXGIManagerAndDevice(D3D_DRIVER_TYPE DriverType)
+    int32_t CreateDevice(const DeviceCacheKey& key, SharedD3DDevice* pShared)override
     {
         HRESULT hr = S_OK;
 
         D3D_FEATURE_LEVEL featureLevels[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0, D3D_FEATURE_LEVEL_10_1, D3D_FEATURE_LEVEL_10_0, D3D_FEATURE_LEVEL_9_3, D3D_FEATURE_LEVEL_9_2, D3D_FEATURE_LEVEL_9_1 };
         D3D_FEATURE_LEVEL featureLevel;
+        const D3D_DRIVER_TYPE DriverType = (D3D_DRIVER_TYPE)key.DriverType;
+
+        Microsoft::WRL::ComPtr<IDXGIAdapter> pAdapter;
+        Microsoft::WRL::ComPtr<ID3D11Device> pD3D11Device;
 
         do
         {
-            m_pD3D11Device.Reset();
+            hr = FindAdapter(key.AdapterId, &pAdapter);
+            if (FAILED(hr))
+            {
+                break;
+            }
+
             if (D3D_DRIVER_TYPE_WARP == DriverType)
             {
-                ID3D11Device* pD3D11Device = NULL;
+                // A hardware device whose CreateVideoDecoder fails, so that
+                // decoding falls back to software.
+                ID3D11Device* pReal = NULL;
 
-                hr = D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, m_useDebugLayer, featureLevels, ARRAYSIZE(featureLevels), D3D11_SDK_VERSION, &pD3D11Device, &featureLevel, NULL);
+                hr = D3D11CreateDevice(pAdapter.Get(), pAdapter ? D3D_DRIVER_TYPE_UNKNOWN : D3D_DRIVER_TYPE_HARDWARE, NULL, m_useDebugLayer, featureLevels, ARRAYSIZE(featureLevels), D3D11_SDK_VERSION, &pReal, &featureLevel, NULL);
 
                 if (SUCCEEDED(hr))
                 {
-                    m_pD3D11Device = new CPrivate_ID3D11Device(pD3D11Device);
-                    if (NULL == m_pD3D11Device)
+                    // The wrapper takes over our reference on pReal.
+                    CPrivate_ID3D11Device* pPrivate = new (std::nothrow) CPrivate_ID3D11Device(pReal);
+                    if (NULL == pPrivate)
                     {
-                        E_OUTOFMEMORY;
+                        pReal->Release();
+                        hr = E_OUTOFMEMORY;
+                        break;
                     }
+                    pD3D11Device.Attach(pPrivate);
                 }
-                // SafeRelease(pD3D11Device);
             }
             else
             {
-                for (DWORD dwCount = 0; dwCount < ARRAYSIZE(featureLevels); dwCount++)
+                // An explicit adapter requires D3D_DRIVER_TYPE_UNKNOWN.
+                const D3D_DRIVER_TYPE createType = pAdapter ? D3D_DRIVER_TYPE_UNKNOWN : DriverType;
+
+                // One call lets the runtime pick the highest level. Fall back
+                // to trying the levels one by one if that fails (older
+                // runtimes reject 11_1) or gives no video device.
+                hr = D3D11CreateDevice(pAdapter.Get(), createType, NULL, m_useDebugLayer, featureLevels, ARRAYSIZE(featureLevels), D3D11_SDK_VERSION, &pD3D11Device, &featureLevel, NULL);
+                if (SUCCEEDED(hr))
+                {
+                    hr = HasVideoDevice(pD3D11Device.Get());
+                }
+
+                for (DWORD dwCount = 0; FAILED(hr) && dwCount < ARRAYSIZE(featureLevels); dwCount++)
                 {
-                    hr = D3D11CreateDevice(NULL, DriverType, NULL, m_useDebugLayer, &featureLevels[dwCount], 1, D3D11_SDK_VERSION, &m_pD3D11Device, &featureLevel, NULL);
+                    pD3D11Device.Reset();
+                    hr = D3D11CreateDevice(pAdapter.Get(), createType, NULL, m_useDebugLayer, &featureLevels[dwCount], 1, D3D11_SDK_VERSION, &pD3D11Device, &featureLevel, NULL);
                     if (SUCCEEDED(hr))
                     {
-                        Microsoft::WRL::ComPtr<ID3D11VideoDevice> pDX11VideoDevice;
-                        hr = m_pD3D11Device->QueryInterface(__uuidof(ID3D11VideoDevice), (void**)&pDX11VideoDevice);
-
-                        if (SUCCEEDED(hr))
-                        {
-                            break;
-                        }
+                        hr = HasVideoDevice(pD3D11Device.Get());
                     }
                 }
             }
@@ -1148,173 +978,626 @@ public:
                 break;
             }
 
-            if (NULL == m_pDXGIManager) {
+            SharedD3DDevice shared;
+            shared.pDevice = pD3D11Device;
 
-                UINT resetToken;
-                hr = MFCreateDXGIDeviceManager(&resetToken, &m_pDXGIManager);
-                if (FAILED(hr))
-                {
-                    break;
-                }
-                m_DeviceResetToken = resetToken;
+            hr = MFCreateDXGIDeviceManager(&shared.ResetToken, &shared.pDXGIManager);
+            if (FAILED(hr))
+            {
+                break;
             }
 
-            hr = m_pDXGIManager->ResetDevice(m_pD3D11Device.Get(), m_DeviceResetToken);
+            hr = shared.pDXGIManager->ResetDevice(shared.pDevice.Get(), shared.ResetToken);
             if (FAILED(hr))
             {
                 break;
             }
 
-            //SafeRelease(m_pD3DImmediateContext);
-            m_pD3D11Device->GetImmediateContext(&m_pD3DImmediateContext);
+            shared.pDevice->GetImmediateContext(&shared.pImmediateContext);
 
-            // Need to explitly set the multithreaded mode for this device
+            // The device is shared by every sink in the process, so it has
+            // to be multithread protected.
             Microsoft::WRL::ComPtr<ID3D10Multithread> pMultiThread;
-            hr = m_pD3DImmediateContext.As(&pMultiThread);
+            hr = shared.pImmediateContext.As(&pMultiThread);
             if (FAILED(hr))
             {
                 break;
             }
 
             pMultiThread->SetMultithreadProtected(TRUE);
-        } while (FALSE);
 
-        /*
-        SafeRelease(pTempAdapter);
-        SafeRelease(pMultiThread);
-        SafeRelease(pDXGIDev);
-        SafeRelease(pAdapter);
-        SafeRelease(pDXGIOutput);
-        */
+            *pShared = std::move(shared);
+        } while (FALSE);
 
         return hr;
     }
 
-    HRESULT CheckShutdown(void) const
+private:
+
+    static HRESULT HasVideoDevice(ID3D11Device* pDevice)
     {
-        if (m_IsShutdown)
-        {
-            return MF_E_SHUTDOWN;
-        }
-        else
-        {
-            return S_OK;
-        }
+        Microsoft::WRL::ComPtr<ID3D11VideoDevice> pDX11VideoDevice;
+        return pDevice->QueryInterface(__uuidof(ID3D11VideoDevice), (void**)&pDX11VideoDevice);
     }
 
-    //+-------------------------------------------------------------------------
-    //
-    //  Member:     NeedMoreSamples
-    //
-    //  Synopsis:   Returns true if the number of samples in flight
-    //              (queued + requested) is less than the max allowed
-    //
-    //--------------------------------------------------------------------------
-    BOOL NeedMoreSamples(void)
+    //-------------------------------------------------------------------
+    // Name: FindAdapter
+    // Description: Finds the adapter with the given LUID. An ID of 0
+    //              returns no adapter, which selects the default one.
+    //-------------------------------------------------------------------
+
+    static HRESULT FindAdapter(uint64_t adapterId, _Outptr_result_maybenull_ IDXGIAdapter** ppAdapter)
     {
-        const DWORD cSamplesInFlight = /*m_SamplesToProcess.GetCount() +*/ m_cOutstandingSampleRequests;
+        *ppAdapter = NULL;
 
-        return cSamplesInFlight < SAMPLE_QUEUE_HIWATER_THRESHOLD;
-    }
+        if (adapterId == 0)
+        {
+            return S_OK;
+        }
 
-    HRESULT RequestSamples(IMFAsyncResult* pAsyncResult)
-    {
-        HRESULT hr = S_OK;
+        Microsoft::WRL::ComPtr<IDXGIFactory1> pFactory;
+        HRESULT hr = CreateDXGIFactory1(IID_PPV_ARGS(&pFactory));
 
-        while (NeedMoreSamples())
+        for (UINT i = 0; SUCCEEDED(hr); i++)
         {
-            hr = CheckShutdown();
+            Microsoft::WRL::ComPtr<IDXGIAdapter1> pAdapter;
+            hr = pFactory->EnumAdapters1(i, &pAdapter);
             if (FAILED(hr))
             {
                 break;
             }
 
-            m_cOutstandingSampleRequests++;
-
-            hr = QueueEvent(MEStreamSinkRequestSample, GUID_NULL, S_OK, NULL);
+            DXGI_ADAPTER_DESC1 desc;
+            hr = pAdapter->GetDesc1(&desc);
+            if (SUCCEEDED(hr) && ((uint64_t)(uint32_t)desc.AdapterLuid.HighPart << 32 | desc.AdapterLuid.LowPart) == adapterId)
+            {
+                *ppAdapter = pAdapter.Detach();
+                return S_OK;
+            }
         }
 
-        hr=QueueRequest();
-
-        return hr;
+        return (hr == DXGI_ERROR_NOT_FOUND) ? MF_E_NOT_FOUND : hr;
     }
+};
 
-    const INT64 interval = 1000 / 30;
-    HRESULT QueueRequest()
-    {
-        HRESULT hr = S_OK;
+static CDeviceCache<SharedD3DDevice>& GetSharedDeviceCache(void)
+{
+    static CD3D11DeviceFactory s_factory;
+    static CDeviceCache<SharedD3DDevice> s_cache(&s_factory);
+    return s_cache;
+}
 
-        if (SUCCEEDED(hr))
-        {
-            MFWORKITEM_KEY cancelKey;
-            hr = MFScheduleWorkItem(&m_WorkQueueCB, nullptr, -interval, &cancelKey);
-        }
 
-        return hr;
-    }
+//////////////////////////////////////////////////////////////////////////
+//  CSampleBufferChain
+//
+//  Description:
+//  Locks every buffer of a sample and exposes them as a CBufferChainView,
+//  so stages can read a multi-buffer sample in place instead of calling
+//  ConvertToContiguousBuffer. The buffers are unlocked on destruction.
+//////////////////////////////////////////////////////////////////////////
 
-    //-------------------------------------------------------------------
-    // Name: Pause
-    // Description: Called when the presentation clock pauses.
-    //-------------------------------------------------------------------
+class CSampleBufferChain
+{
+public:
 
-    HRESULT Pause(void)
+    CSampleBufferChain(void)
     {
-        CAutoLock lock(&m_critSec);
-
-        HRESULT hr = ValidateOperation(m_state, StreamOperation::OpPause);
-
-        if (SUCCEEDED(hr))
-        {
-            m_state = State::State_Paused;
-            //hr = QueueAsyncOperation(StreamOperation::OpPause);
-        }
+    }
 
-        return hr;
+    ~CSampleBufferChain(void)
+    {
+        Unlock();
     }
 
-    /*
-    HRESULT Preroll(void)
+    HRESULT Lock(IMFSample* pSample)
     {
-        HRESULT hr = S_OK;
+        Unlock();
 
-        CAutoLock lock(&m_critSec);
+        DWORD cBuffers = 0;
+        HRESULT hr = pSample->GetBufferCount(&cBuffers);
 
-        hr = CheckShutdown();
+        if (SUCCEEDED(hr) && cBuffers > CBufferChainView::MaxSegments)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW);
+        }
 
-        if (SUCCEEDED(hr))
+        for (DWORD i = 0; SUCCEEDED(hr) && i < cBuffers; i++)
         {
-            m_fPrerolling = TRUE;
-            m_fWaitingForOnClockStart = TRUE;
+            Microsoft::WRL::ComPtr<IMFMediaBuffer> pBuffer;
+            hr = pSample->GetBufferByIndex(i, &pBuffer);
 
-            // Kick things off by requesting a sample...
-            m_cOutstandingSampleRequests++;
+            BYTE* pData = NULL;
+            DWORD cbCurrent = 0;
+            if (SUCCEEDED(hr))
+            {
+                hr = pBuffer->Lock(&pData, NULL, &cbCurrent);
+            }
 
-            hr = QueueEvent(MEStreamSinkRequestSample, GUID_NULL, hr, NULL);
+            if (SUCCEEDED(hr))
+            {
+                m_pBuffers[m_view.GetSegmentCount()] = pBuffer;
+                (void)m_view.Append(pData, cbCurrent);
+            }
+        }
+
+        if (FAILED(hr))
+        {
+            Unlock();
         }
 
         return hr;
     }
-    */
-
-    //-------------------------------------------------------------------
-    // Name: Restart
-    // Description: Called when the presentation clock restarts.
-    //-------------------------------------------------------------------
 
-    HRESULT Restart(void)
+    const CBufferChainView& View(void) const
     {
-        CAutoLock lock(&m_critSec);
+        return m_view;
+    }
 
-        HRESULT hr = ValidateOperation(m_state, StreamOperation::OpRestart);
+private:
 
-        if (SUCCEEDED(hr))
+    CSampleBufferChain(const CSampleBufferChain&) = delete;
+    CSampleBufferChain& operator=(const CSampleBufferChain&) = delete;
+
+    void Unlock(void)
+    {
+        for (uint32_t i = 0; i < m_view.GetSegmentCount(); i++)
         {
-            m_state = State::State_Started;
-            //hr = QueueAsyncOperation(OpRestart);
+            m_pBuffers[i]->Unlock();
+            m_pBuffers[i].Reset();
         }
-
-        return hr;
+        m_view.Clear();
+    }
+
+    CBufferChainView m_view;
+    Microsoft::WRL::ComPtr<IMFMediaBuffer> m_pBuffers[CBufferChainView::MaxSegments];
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Stream sink configuration
+//
+//  Read from the attributes passed to CreateCustomVideoRendererEx; see
+//  CustomVideoRenderer.h.
+//////////////////////////////////////////////////////////////////////////
+
+struct StreamSinkConfig
+{
+    bool SystemMemory = false;          // No D3D device; frames arrive in system memory.
+    Microsoft::WRL::ComPtr<ICustomVideoRendererFrameCallback> pFrameCallback;
+
+    HRESULT Load(IMFAttributes* pAttributes)
+    {
+        if (pAttributes == NULL)
+        {
+            return S_OK;
+        }
+
+        SystemMemory = MFGetAttributeUINT32(pAttributes, CVR_ATTRIBUTE_SYSTEM_MEMORY, FALSE) != FALSE;
+
+        HRESULT hr = pAttributes->GetUnknown(CVR_ATTRIBUTE_FRAME_CALLBACK, IID_PPV_ARGS(&pFrameCallback));
+        if (hr == MF_E_ATTRIBUTENOTFOUND)
+        {
+            hr = S_OK;
+        }
+        return hr;
+    }
+};
+
+// What the system-memory path needs to know about the current media type.
+struct SystemMemoryFormat
+{
+    const FrameFormatInfo* pInfo = NULL;    // NULL if the type has no plane layout we know.
+    GUID Subtype = GUID_NULL;
+    UINT32 Width = 0;
+    UINT32 Height = 0;
+    LONG DefaultStride = 0;                 // Stride of a contiguous buffer; negative for bottom-up.
+
+    HRESULT Load(IMFMediaType* pMediaType)
+    {
+        HRESULT hr = pMediaType->GetGUID(MF_MT_SUBTYPE, &Subtype);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = MFGetAttributeSize(pMediaType, MF_MT_FRAME_SIZE, &Width, &Height);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            UINT32 stride = 0;
+            if (SUCCEEDED(pMediaType->GetUINT32(MF_MT_DEFAULT_STRIDE, &stride)))
+            {
+                DefaultStride = (LONG)stride;
+            }
+            else
+            {
+                hr = MFGetStrideForBitmapInfoHeader(Subtype.Data1, Width, &DefaultStride);
+            }
+        }
+
+        pInfo = SUCCEEDED(hr) ? FindFrameFormat(Subtype.Data1) : NULL;
+        return hr;
+    }
+};
+
+
+class CustomVideoStreamSink: public IMFStreamSink, public IMFMediaTypeHandler, public IMFGetService
+    , public ICustomVideoRendererStatistics
+{
+    ULONG m_nRefCount = 1;
+
+    const DWORD                 STREAM_ID;
+
+    // Locking:
+    //   m_csState      serializes control operations (state transitions,
+    //                  media type changes, the request scheduler).
+    //   m_rwTypeAndSink guards m_pCurrentType, m_FrameFormat and m_pSink.
+    //                  The getters only read them and take it shared.
+    // Lock order is m_csState, then m_rwTypeAndSink.
+    // ProcessSample only reads m_state and m_IsShutdown, which are atomic;
+    // in system-memory mode it also copies m_FrameFormat under a shared
+    // lock. The event queue and its event pool are lock-free, and
+    // m_pEventQueue is set once in Initialize, before the stream is
+    // handed out, so the IMFMediaEventGenerator methods take none of
+    // them either.
+    CCritSec                    m_csState;
+    CRWLock                     m_rwTypeAndSink;
+    Microsoft::WRL::ComPtr<IMFMediaSink>               m_pSink; 
+    std::atomic<bool> m_IsShutdown{ false };
+    Microsoft::WRL::ComPtr<IMFMediaType> m_pCurrentType;
+    SystemMemoryFormat m_FrameFormat;                           // Derived from m_pCurrentType.
+    Microsoft::WRL::ComPtr<CMediaEventQueue> m_pEventQueue;
+
+    std::atomic<State> m_state{ State::State_TypeNotSet };      // Written under m_csState.
+    TransitionTrace<64> m_Trace;                                // Recent state transitions, for debugging.
+
+    DXGI_FORMAT                 m_dxgiFormat = DXGI_FORMAT_UNKNOWN;
+
+    DWORD                       m_WorkQueueId=0;                  // ID of the work queue for asynchronous operations.
+    CAsyncCallback<CustomVideoStreamSink> m_WorkQueueCB;                  // Callback for the work queue.
+    CSampleRequestCredits m_SampleCredits;                      // One credit per MEStreamSinkRequestSample in flight.
+    bool m_IsSchedulerActive = false;                           // True while the request work item may re-arm itself.
+    MFWORKITEM_KEY m_SchedulerKey = 0;                          // Cancel key of the pending request work item.
+
+    CDeviceCache<SharedD3DDevice>::Lease m_DeviceLease;        // Shared D3D11 device and DXGI manager; released with the sink.
+    const StreamSinkConfig m_Config;
+    CFrameBufferPool m_FramePool;                               // Padded buffers for frames gathered from several buffers.
+    size_t m_cbPooledFrame = 0;                                 // Size m_FramePool is reserved for; 0 if none.
+    CMemoryBudgetAccount m_Budget{ CMemoryGovernor::Process() };  // Charged with frames in flight and m_FramePool.
+    std::atomic<UINT64> m_cbFrame{ 0 };                         // Bytes of one sample of the current type; 0 if unknown.
+    std::atomic<UINT64> m_cFramesDelivered{ 0 };
+    std::atomic<UINT64> m_cFramesFailed{ 0 };
+    std::atomic<UINT64> m_cContiguousCopies{ 0 };
+
+    // Seeking. Start sets the position; ProcessSample drops the samples
+    // that end before it, which the source delivers when it has to start
+    // decoding at an earlier key frame.
+    std::atomic<LONGLONG> m_hnsStartPosition{ LLONG_MIN };
+    std::atomic<bool> m_IsFirstFramePending{ false };
+    std::atomic<UINT64> m_hnsFirstFrameTime{ 0 };
+    std::atomic<UINT64> m_cSamplesBeforeStart{ 0 };
+
+    // Playback rate. Above 1x the thinner drops frames so that the sink
+    // converts them at the normal frame rate.
+    CRateThinner m_RateThinner;
+    std::atomic<UINT64> m_cSamplesThinned{ 0 };
+
+    // Frame stepping. In step mode a paused stream holds the samples it
+    // receives, and Step presents them one at a time. Both are written
+    // under m_csState; ProcessSample takes it only in step mode.
+    std::atomic<bool> m_IsStepMode{ false };
+    CFrameStepQueue<Microsoft::WRL::ComPtr<IMFSample>, STEP_QUEUE_SIZE> m_StepQueue;
+    std::atomic<UINT64> m_cFramesStepped{ 0 };
+
+public:
+    CustomVideoStreamSink(DWORD dwStreamId, IMFMediaSink *parent, const StreamSinkConfig& config)
+        : STREAM_ID(dwStreamId)
+          , m_pSink(parent)
+          , m_Config(config)
+          , m_WorkQueueCB(this, [this](IMFAsyncResult* pResult) { return RequestSamples(pResult); })
+    {
+        // The request work item runs on a private queue instead of
+        // competing with the standard queue's other work. It is not a
+        // fast-IO callback: it re-arms itself under m_csState, which Stop,
+        // Flush and SetCurrentMediaType may hold for a while.
+        DWORD dwQueue = 0;
+        if (SUCCEEDED(MFAllocateWorkQueue(&dwQueue)))
+        {
+            m_WorkQueueId = dwQueue;
+            m_WorkQueueCB.SetParameters(0, m_WorkQueueId);
+        }
+
+        // Without a device manager to hand out, the topology keeps the
+        // decoder in system memory.
+        if (!m_Config.SystemMemory)
+        {
+            AcquireDevice(D3D_DRIVER_TYPE_HARDWARE);
+        }
+    }
+
+    //-------------------------------------------------------------------
+    // Name: Initialize
+    // Description: Creates the event queue, with one pooled event per
+    //              request the stream keeps in flight. The stream is
+    //              unusable if this fails, so the sink gives it up.
+    //-------------------------------------------------------------------
+
+    HRESULT Initialize(void)
+    {
+        return CMediaEventQueue::CreateInstance(SAMPLE_QUEUE_HIWATER_THRESHOLD, &m_pEventQueue);
+    }
+
+    //-------------------------------------------------------------------
+    // Name: AcquireDevice
+    // Description: Leases the process-wide device for the default adapter
+    //              and DriverType, creating it if no sink holds one yet.
+    //-------------------------------------------------------------------
+
+    HRESULT AcquireDevice(D3D_DRIVER_TYPE DriverType)
+    {
+        const DeviceCacheKey key = { 0, DriverType };
+
+        return GetSharedDeviceCache().Acquire(key, &m_DeviceLease);
+    }
+
+    HRESULT CheckShutdown(void) const
+    {
+        if (m_IsShutdown)
+        {
+            return MF_E_SHUTDOWN;
+        }
+        else
+        {
+            return S_OK;
+        }
+    }
+
+    //+-------------------------------------------------------------------------
+    //
+    //  Member:     RequestSamples
+    //
+    //  Synopsis:   Tops the requests in flight up to the queue depth the
+    //              memory budget allows (at most the hi water threshold).
+    //              The credits are granted in one step before any event is
+    //              sent, so a sample that arrives while we are still
+    //              queueing always finds its credit.
+    //
+    //--------------------------------------------------------------------------
+    HRESULT RequestSamples(IMFAsyncResult* pAsyncResult)
+    {
+        HRESULT hr = CheckShutdown();
+
+        if (SUCCEEDED(hr))
+        {
+            // Frames held for stepping count against the depth, so a
+            // paused stream stops asking once it has enough decoded.
+            const uint32_t cDepth = GetQueueDepth();
+            const uint32_t cHeld = m_StepQueue.GetCount();
+            uint32_t epoch = 0;
+            const uint32_t cRequests = m_SampleCredits.GrantUpTo(cDepth > cHeld ? cDepth - cHeld : 0, &epoch);
+
+            if (cRequests != 0)
+            {
+                uint32_t cQueued = 0;
+                hr = QueueRequestEvents(cRequests, &cQueued);
+
+                if (cQueued < cRequests)
+                {
+                    // Give back the credits of the requests that were never
+                    // sent, unless a flush has taken them back meanwhile.
+                    (void)m_SampleCredits.Refund(cRequests - cQueued, epoch);
+                }
+            }
+
+            UpdateBudgetCharge();
+        }
+
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::RequestSamples m_csState"));
+
+        if (m_IsSchedulerActive)
+        {
+            hr = QueueRequest();
+        }
+
+        return hr;
+    }
+
+    // Frames we may keep in flight. A shrinking depth takes effect as
+    // samples arrive: no new requests are sent until we are below it.
+    uint32_t GetQueueDepth(void) const
+    {
+        return m_Budget.GetDepth(m_cbFrame, SAMPLE_QUEUE_HIWATER_THRESHOLD);
+    }
+
+    // Charges the memory budget with the frames in flight or held for
+    // stepping, and the pool.
+    void UpdateBudgetCharge(void)
+    {
+        m_Budget.SetCharge((m_SampleCredits.Outstanding() + m_StepQueue.GetCount()) * m_cbFrame + m_FramePool.GetBytesAllocated());
+    }
+
+    //-------------------------------------------------------------------
+    // Name: QueueRequestEvents
+    // Description: Queues cRequests MEStreamSinkRequestSample events.
+    //              *pcQueued receives the number actually queued.
+    //-------------------------------------------------------------------
+
+    HRESULT QueueRequestEvents(uint32_t cRequests, _Out_ uint32_t* pcQueued)
+    {
+        *pcQueued = 0;
+
+        HRESULT hr = CheckShutdown();
+
+        for (uint32_t i = 0; SUCCEEDED(hr) && i < cRequests; i++)
+        {
+            hr = m_pEventQueue->QueueEventParamVar(MEStreamSinkRequestSample, GUID_NULL, S_OK, NULL);
+
+            if (SUCCEEDED(hr))
+            {
+                (*pcQueued)++;
+            }
+        }
+
+        return hr;
+    }
+
+    const INT64 interval = 1000 / 30;
+    HRESULT QueueRequest()
+    {
+        HRESULT hr = S_OK;
+
+        if (SUCCEEDED(hr))
+        {
+            MFWORKITEM_KEY cancelKey;
+            hr = MFScheduleWorkItem(&m_WorkQueueCB, nullptr, -interval, &cancelKey);
+            if (SUCCEEDED(hr))
+            {
+                m_SchedulerKey = cancelKey;
+            }
+        }
+
+        return hr;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: StartScheduler / StopScheduler
+    // Description: Arms or cancels the periodic sample request work item.
+    //              Caller holds m_csState.
+    //-------------------------------------------------------------------
+
+    HRESULT StartScheduler(void)
+    {
+        if (m_IsSchedulerActive)
+        {
+            return S_OK;
+        }
+
+        m_IsSchedulerActive = true;
+
+        HRESULT hr = QueueRequest();
+        if (FAILED(hr))
+        {
+            m_IsSchedulerActive = false;
+        }
+
+        return hr;
+    }
+
+    void StopScheduler(void)
+    {
+        m_IsSchedulerActive = false;
+
+        if (m_SchedulerKey != 0)
+        {
+            // The work item may already be running; it sees the flag and
+            // does not re-arm itself.
+            (void)MFCancelWorkItem(m_SchedulerKey);
+            m_SchedulerKey = 0;
+        }
+    }
+
+    //-------------------------------------------------------------------
+    // Name: ApplyTransition
+    // Description: Moves the stream to the state the transition table
+    //              gives for the operation, then runs its hooks.
+    //              Caller holds m_csState.
+    //-------------------------------------------------------------------
+
+    HRESULT ApplyTransition(StreamOperation op)
+    {
+        TransitionHooks hooks = { this };
+
+        return ApplyStreamTransition(m_state, op, m_Trace, hooks, MF_E_INVALIDREQUEST);
+    }
+
+    // The side effects ApplyStreamTransition runs for a transition.
+    struct TransitionHooks
+    {
+        CustomVideoStreamSink* pStream;
+
+        HRESULT Flush(void)             { return pStream->Flush(); }
+        void StopScheduler(void)        { pStream->StopScheduler(); }
+        HRESULT StartScheduler(void)    { return pStream->StartScheduler(); }
+    };
+
+    //-------------------------------------------------------------------
+    // Name: Pause
+    // Description: Called when the presentation clock pauses.
+    //-------------------------------------------------------------------
+
+    HRESULT Pause(void)
+    {
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::Pause m_csState"));
+
+        return ApplyTransition(StreamOperation::OpPause);
+    }
+
+    /*
+    HRESULT Preroll(void)
+    {
+        HRESULT hr = S_OK;
+
+        CAutoLock lock(&m_critSec);
+
+        hr = CheckShutdown();
+
+        if (SUCCEEDED(hr))
+        {
+            m_fPrerolling = TRUE;
+            m_fWaitingForOnClockStart = TRUE;
+
+            // Kick things off by requesting a sample...
+            m_cOutstandingSampleRequests++;
+
+            hr = QueueEvent(MEStreamSinkRequestSample, GUID_NULL, hr, NULL);
+        }
+
+        return hr;
+    }
+    */
+
+    //-------------------------------------------------------------------
+    // Name: Reset
+    // Description: Takes the stream out of its session so that another
+    //              session can use it. Stops requesting samples, gives
+    //              back the outstanding requests and cancels the old
+    //              session's event subscription. The media type, the
+    //              device and the frame buffers stay.
+    //-------------------------------------------------------------------
+
+    HRESULT Reset(void)
+    {
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::Reset m_csState"));
+
+        HRESULT hr = CheckShutdown();
+
+        if (SUCCEEDED(hr))
+        {
+            hr = ApplyTransition(StreamOperation::OpReset);
+        }
+
+        // The scheduler is stopped, so nothing queues events now.
+        if (SUCCEEDED(hr))
+        {
+            m_pEventQueue->Reset();
+            m_hnsStartPosition = LLONG_MIN;
+            m_RateThinner.SetRate(1.0f);       // A new clock starts at 1x.
+            m_IsStepMode = false;
+        }
+
+        return hr;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: Restart
+    // Description: Called when the presentation clock restarts.
+    //-------------------------------------------------------------------
+
+    HRESULT Restart(void)
+    {
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::Restart m_csState"));
+
+        return ApplyTransition(StreamOperation::OpRestart);
     }
 
     //-------------------------------------------------------------------
@@ -1322,288 +1605,915 @@ public:
     // Description: Shuts down the stream sink.
     //-------------------------------------------------------------------
 
-    HRESULT Shutdown(void)
+    HRESULT Shutdown(void)
+    {
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::Shutdown m_csState"));
+
+        m_IsShutdown = true;
+
+        StopScheduler();
+
+        // The queue fails every call from now on and completes a pending
+        // BeginGetEvent with MF_E_SHUTDOWN. The pointer itself stays valid
+        // until the destructor, so callers never race with its release.
+        if (m_pEventQueue)
+        {
+            m_pEventQueue->Shutdown();
+        }
+
+        if (m_WorkQueueId != 0)
+        {
+            MFUnlockWorkQueue(m_WorkQueueId);
+            m_WorkQueueId = 0;
+        }
+
+        //m_SamplesToProcess.Clear();
+        m_StepQueue.Clear();
+        m_IsStepMode = false;
+
+        {
+            CAutoExclusiveLock lockType(&m_rwTypeAndSink, LOCK_SITE("CustomVideoStreamSink::Shutdown m_rwTypeAndSink"));
+
+            m_pSink.Reset();
+            m_pCurrentType.Reset();
+        }
+        //SafeRelease(m_pByteStream);
+        //SafeRelease(m_pPresenter);
+
+        return MF_E_SHUTDOWN;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: Start
+    // Description: Called when the presentation clock starts.
+    // Note: Start time can be PRESENTATION_CURRENT_POSITION meaning
+    //       resume from the last current position.
+    //-------------------------------------------------------------------
+
+    HRESULT Start(MFTIME start)
+    {
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::Start m_csState"));
+
+        HRESULT hr = S_OK;
+
+        do
+        {
+            hr = CheckShutdown();
+            if (FAILED(hr))
+            {
+                break;
+            }
+
+            if (start != PRESENTATION_CURRENT_POSITION)
+            {
+                // We're starting from a "new" position
+                m_hnsStartPosition = start;
+
+                // Frames held for stepping belong to the old position.
+                m_StepQueue.Clear();
+            }
+            m_RateThinner.Reset();
+            m_hnsFirstFrameTime = 0;
+            m_IsFirstFramePending = true;
+
+            // Arms the request scheduler.
+            hr = ApplyTransition(StreamOperation::OpStart);
+            if (FAILED(hr))
+            {
+                break;
+            }
+
+            // Playing on from a pause shows the frames held for stepping
+            // first. Samples that arrive meanwhile wait for m_csState.
+            (void)PresentHeldFrames();
+            m_IsStepMode = false;
+
+            hr = QueueEvent(MEStreamSinkStarted, GUID_NULL, hr, NULL);
+
+        } while (FALSE);
+
+        //m_fWaitingForOnClockStart = FALSE;
+
+        return hr;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: IsSeekStart
+    // Description: True if starting the clock at start moves the active
+    //              stream to a new position. Resuming from a pause is not
+    //              a seek.
+    //-------------------------------------------------------------------
+
+    bool IsSeekStart(MFTIME start) const
+    {
+        return ::IsSeekStart(m_state.load(std::memory_order_acquire), start != PRESENTATION_CURRENT_POSITION);
+    }
+
+    //-------------------------------------------------------------------
+    // Name: SetRate
+    // Description: Called when the presentation clock changes its rate.
+    //-------------------------------------------------------------------
+
+    HRESULT SetRate(float flRate)
+    {
+        HRESULT hr = CheckShutdown();
+
+        if (SUCCEEDED(hr))
+        {
+            m_RateThinner.SetRate(flRate);
+        }
+
+        return hr;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: SetStepMode
+    // Description: Turns frame stepping on or off. Turning it off
+    //              presents the frames held so far, in order.
+    //-------------------------------------------------------------------
+
+    HRESULT SetStepMode(bool bStepMode)
+    {
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::SetStepMode m_csState"));
+
+        HRESULT hr = CheckShutdown();
+
+        if (SUCCEEDED(hr) && !bStepMode)
+        {
+            hr = PresentHeldFrames();
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            m_IsStepMode = bStepMode;
+        }
+
+        return hr;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: Step
+    // Description: Presents the oldest frame held for stepping. With no
+    //              frame held, returns S_FALSE and the next frame that
+    //              arrives is presented instead. The request scheduler
+    //              refills the queue behind it.
+    //-------------------------------------------------------------------
+
+    HRESULT Step(_Out_opt_ UINT32* pcHeld)
+    {
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::Step m_csState"));
+
+        HRESULT hr = CheckShutdown();
+
+        if (SUCCEEDED(hr) && !m_IsStepMode)
+        {
+            hr = MF_E_INVALIDREQUEST;
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = ApplyTransition(StreamOperation::OpStep);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            Microsoft::WRL::ComPtr<IMFSample> pFrame;
+            if (m_StepQueue.Step(&pFrame))
+            {
+                UpdateBudgetCharge();
+                ++m_cFramesStepped;
+                hr = PresentSample(pFrame.Get());
+            }
+            else
+            {
+                hr = S_FALSE;
+            }
+        }
+
+        if (pcHeld != NULL)
+        {
+            *pcHeld = m_StepQueue.GetCount();
+        }
+
+        return hr;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: PresentHeldFrames
+    // Description: Presents the frames held for stepping, oldest first.
+    //              Caller holds m_csState, so samples arriving in step
+    //              mode cannot overtake them.
+    //-------------------------------------------------------------------
+
+    HRESULT PresentHeldFrames(void)
+    {
+        Microsoft::WRL::ComPtr<IMFSample> frames[STEP_QUEUE_SIZE];
+        const size_t cFrames = m_StepQueue.Take(frames, STEP_QUEUE_SIZE);
+
+        UpdateBudgetCharge();
+
+        HRESULT hr = S_OK;
+
+        for (size_t i = 0; i < cFrames; i++)
+        {
+            const HRESULT hrPresent = PresentSample(frames[i].Get());
+            if (SUCCEEDED(hr))
+            {
+                hr = hrPresent;
+            }
+        }
+
+        return hr;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: Stop
+    // Description: Called when the presentation clock stops.
+    //-------------------------------------------------------------------
+
+    HRESULT Stop(void)
+    {
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::Stop m_csState"));
+
+        return ApplyTransition(StreamOperation::OpStop);
+    }
+
+    // IUnknown
+    STDMETHODIMP_(ULONG) AddRef(void)override
+    {
+        return InterlockedIncrement(&m_nRefCount);
+    }
+
+    STDMETHODIMP QueryInterface(REFIID iid, __RPC__deref_out _Result_nullonfailure_ void** ppv)override
+    {
+        if (!ppv)
+        {
+            return E_POINTER;
+        }
+        if (iid == IID_IUnknown)
+        {
+            *ppv = static_cast<IUnknown*>(static_cast<IMFStreamSink*>(this));
+        }
+        else if (iid == __uuidof(IMFStreamSink))
+        {
+            *ppv = static_cast<IMFStreamSink*>(this);
+        }
+        else if (iid == __uuidof(IMFMediaEventGenerator))
+        {
+            *ppv = static_cast<IMFMediaEventGenerator*>(this);
+        }
+        else if (iid == __uuidof(IMFMediaTypeHandler))
+        {
+            *ppv = static_cast<IMFMediaTypeHandler*>(this);
+        }
+        else if (iid == __uuidof(IMFGetService))
+        {
+            *ppv = static_cast<IMFGetService*>(this);
+        }
+        else if (iid == __uuidof(ICustomVideoRendererStatistics))
+        {
+            *ppv = static_cast<ICustomVideoRendererStatistics*>(this);
+        }
+        else
+        {
+            *ppv = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    STDMETHODIMP_(ULONG) Release(void)override
+    {
+        ULONG uCount = InterlockedDecrement(&m_nRefCount);
+        if (uCount == 0)
+        {
+            delete this;
+        }
+        // For thread safety, return a temporary variable.
+        return uCount;
+    }
+
+    // ICustomVideoRendererStatistics
+    STDMETHODIMP GetCounter(CVR_COUNTER counter, _Out_ UINT64* pValue)override
+    {
+        if (pValue == NULL)
+        {
+            return E_POINTER;
+        }
+
+        switch (counter)
+        {
+        case CVR_COUNTER_SAMPLES_RECEIVED:
+            *pValue = m_count;
+            break;
+
+        case CVR_COUNTER_SAMPLE_REQUESTS_OUTSTANDING:
+            *pValue = m_SampleCredits.Outstanding();
+            break;
+
+        case CVR_COUNTER_SAMPLE_REQUESTS_GRANTED:
+            *pValue = m_SampleCredits.TotalGranted();
+            break;
+
+        case CVR_COUNTER_SAMPLE_REQUESTS_CONSUMED:
+            *pValue = m_SampleCredits.TotalConsumed();
+            break;
+
+        case CVR_COUNTER_SAMPLE_REQUESTS_REFUNDED:
+            *pValue = m_SampleCredits.TotalRefunded();
+            break;
+
+        case CVR_COUNTER_SAMPLES_UNSOLICITED:
+            *pValue = m_SampleCredits.TotalUnsolicited();
+            break;
+
+        case CVR_COUNTER_FRAMES_DELIVERED:
+            *pValue = m_cFramesDelivered;
+            break;
+
+        case CVR_COUNTER_FRAMES_FAILED:
+            *pValue = m_cFramesFailed;
+            break;
+
+        case CVR_COUNTER_MEMORY_CHARGED:
+            *pValue = m_Budget.GetCharge();
+            break;
+
+        case CVR_COUNTER_QUEUE_DEPTH:
+            *pValue = GetQueueDepth();
+            break;
+
+        case CVR_COUNTER_CONTIGUOUS_COPIES:
+            *pValue = m_cContiguousCopies;
+            break;
+
+        case CVR_COUNTER_SAMPLES_BEFORE_START:
+            *pValue = m_cSamplesBeforeStart;
+            break;
+
+        case CVR_COUNTER_FIRST_FRAME_TIME:
+            *pValue = m_hnsFirstFrameTime;
+            break;
+
+        case CVR_COUNTER_SAMPLES_THINNED:
+            *pValue = m_cSamplesThinned;
+            break;
+
+        case CVR_COUNTER_FRAMES_STEPPED:
+            *pValue = m_cFramesStepped;
+            break;
+
+        case CVR_COUNTER_FRAMES_HELD:
+            *pValue = m_StepQueue.GetCount();
+            break;
+
+        default:
+            return E_INVALIDARG;
+        }
+
+        return S_OK;
+    }
+
+    STDMETHODIMP GetLockSiteCount(_Out_ UINT32* pcSites)override
+    {
+        if (pcSites == NULL)
+        {
+            return E_POINTER;
+        }
+
+#ifdef CVR_LOCK_STATS
+        *pcSites = LockStats::GetSiteCount();
+#else
+        *pcSites = 0;
+#endif
+        return S_OK;
+    }
+
+    STDMETHODIMP GetLockSiteStats(UINT32 dwIndex, _Out_ CVR_LOCK_SITE_STATS* pStats)override
     {
-        CAutoLock lock(&m_critSec);
+        if (pStats == NULL)
+        {
+            return E_POINTER;
+        }
 
-        m_IsShutdown = TRUE;
+#ifdef CVR_LOCK_STATS
+        static_assert(CVR_LOCK_HISTOGRAM_BUCKETS == LockStats::HistogramBuckets, "Histogram layouts must match");
 
-        if (m_pEventQueue)
+        LockStats::SiteSnapshot snapshot;
+        if (!LockStats::GetSiteSnapshot(dwIndex, &snapshot))
         {
-            m_pEventQueue->Shutdown();
+            return MF_E_INVALIDINDEX;
         }
 
-        MFUnlockWorkQueue(m_WorkQueueId);
+        ZeroMemory(pStats, sizeof(*pStats));
+        (void)StringCchCopyA(pStats->szName, ARRAYSIZE(pStats->szName), snapshot.Name);
+        pStats->cAcquires = snapshot.Acquires;
+        pStats->cContended = snapshot.Contended;
+        pStats->hnsWaitTotal = snapshot.WaitNs / 100;
+        pStats->hnsHoldTotal = snapshot.HoldNs / 100;
+        for (DWORD i = 0; i < CVR_LOCK_HISTOGRAM_BUCKETS; i++)
+        {
+            pStats->WaitHistogram[i] = snapshot.WaitHistogram[i];
+            pStats->HoldHistogram[i] = snapshot.HoldHistogram[i];
+        }
+        return S_OK;
+#else
+        (void)dwIndex;
+        return MF_E_INVALIDINDEX;
+#endif
+    }
 
-        //m_SamplesToProcess.Clear();
+    // IMFGetService
+    STDMETHODIMP GetService(__RPC__in REFGUID guidService, __RPC__in REFIID riid, __RPC__deref_out_opt LPVOID* ppvObject)override
+    {
+        HRESULT hr = S_OK;
 
-        m_pSink.Reset();
-        m_pEventQueue.Reset();
-        //SafeRelease(m_pByteStream);
-        //SafeRelease(m_pPresenter);
-        m_pCurrentType.Reset();
+        if (guidService == MR_VIDEO_ACCELERATION_SERVICE)
+        {
+            if (riid == __uuidof(IMFDXGIDeviceManager))
+            {
+                // In system-memory mode there is no lease, so no manager.
+                IMFDXGIDeviceManager* pDXGIManager = m_DeviceLease ? m_DeviceLease.Get().pDXGIManager.Get() : NULL;
+                if (NULL != pDXGIManager)
+                {
+                    *ppvObject = pDXGIManager;
+                    ((IUnknown*)*ppvObject)->AddRef();
+                }
+                else
+                {
+                    hr = E_NOINTERFACE;
+                }
+            }
+            else
+            {
+                hr = E_NOINTERFACE;
+            }
+        }
+        else if (guidService == __uuidof(ICustomVideoRendererStatistics))
+        {
+            hr = QueryInterface(riid, ppvObject);
+        }
+        else
+        {
+            hr = MF_E_UNSUPPORTED_SERVICE;
+        }
 
-        return MF_E_SHUTDOWN;
+        return hr;
     }
 
-    //-------------------------------------------------------------------
-    // Name: Start
-    // Description: Called when the presentation clock starts.
-    // Note: Start time can be PRESENTATION_CURRENT_POSITION meaning
-    //       resume from the last current position.
-    //-------------------------------------------------------------------
+    // IMFStreamSink
+    STDMETHODIMP Flush(void)override
+    {
+        // Held frames are dropped too. The pipeline calls Flush without
+        // m_csState; the Stop and Reset hooks call it with it held.
+        {
+            CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::Flush m_csState"));
+            m_StepQueue.Clear();
+        }
 
-    HRESULT Start(MFTIME start)
+        // The pipeline discards the requests that are still pending, so
+        // their credits go back and the next RequestSamples tops up again.
+        // Only a real discard gets here (the pipeline's flush, a seek,
+        // Stop or Reset); after a pause the requests stay outstanding and
+        // refunding them would ask for the same samples twice.
+        (void)m_SampleCredits.Flush();
+        UpdateBudgetCharge();
+        m_RateThinner.Reset();
+
+        return S_OK;
+    }
+
+    STDMETHODIMP GetIdentifier(__RPC__out DWORD* pdwIdentifier)override
     {
-        CAutoLock lock(&m_critSec);
+        return E_FAIL;
+    }
 
-        HRESULT hr = S_OK;
+    STDMETHODIMP GetMediaSink(__RPC__deref_out_opt IMFMediaSink** ppMediaSink)override
+    {
+        CAutoSharedLock lock(&m_rwTypeAndSink, LOCK_SITE("CustomVideoStreamSink::GetMediaSink m_rwTypeAndSink"));
 
-        do
+        if (ppMediaSink == NULL)
         {
-            hr = ValidateOperation(m_state, StreamOperation::OpStart);
-            if (FAILED(hr))
-            {
-                break;
-            }
+            return E_POINTER;
+        }
 
-            if (start != PRESENTATION_CURRENT_POSITION)
-            {
-                // We're starting from a "new" position
-                //m_StartTime = start;        // Cache the start time.
-            }
+        HRESULT hr = CheckShutdown();
 
-            m_state = State::State_Started;
-            //hr = QueueAsyncOperation(OpStart);
+        if (SUCCEEDED(hr))
+        {
+            *ppMediaSink = m_pSink.Get();
+            (*ppMediaSink)->AddRef();
+        }
 
-            hr = CheckShutdown();
-            if (SUCCEEDED(hr))
-            {
-                hr = QueueEvent(MEStreamSinkStarted, GUID_NULL, hr, NULL);
-            }
+        return hr;
+    }
 
-            {
-                hr=QueueRequest();
-            }
+    STDMETHODIMP GetMediaTypeHandler(__RPC__deref_out_opt IMFMediaTypeHandler** ppHandler)override
+    {
+        CAutoSharedLock lock(&m_rwTypeAndSink, LOCK_SITE("CustomVideoStreamSink::GetMediaTypeHandler m_rwTypeAndSink"));
 
-        } while (FALSE);
+        if (ppHandler == NULL)
+        {
+            return E_POINTER;
+        }
 
-        //m_fWaitingForOnClockStart = FALSE;
+        HRESULT hr = CheckShutdown();
+
+        // This stream object acts as its own type handler, so we QI ourselves.
+        if (SUCCEEDED(hr))
+        {
+            hr = this->QueryInterface(IID_IMFMediaTypeHandler, (void**)ppHandler);
+        }
 
         return hr;
     }
 
     //-------------------------------------------------------------------
-    // Name: Stop
-    // Description: Called when the presentation clock stops.
+    // Name: PlaceMarker
+    // Description: Samples are presented, or held for stepping, as they
+    //              arrive, so every sample before the marker has been
+    //              processed by now: the marker is acknowledged at once
+    //              with MEStreamSinkMarker carrying the context value.
     //-------------------------------------------------------------------
 
-    HRESULT Stop(void)
+    STDMETHODIMP PlaceMarker(MFSTREAMSINK_MARKER_TYPE eMarkerType, __RPC__in const PROPVARIANT* pvarMarkerValue, __RPC__in const PROPVARIANT* pvarContextValue)override
     {
-        CAutoLock lock(&m_critSec);
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::PlaceMarker m_csState"));
 
-        HRESULT hr = ValidateOperation(m_state, StreamOperation::OpStop);
+        HRESULT hr = CheckShutdown();
 
         if (SUCCEEDED(hr))
         {
-            m_state = State::State_Stopped;
-            //hr = QueueAsyncOperation(StreamOperation::OpStop);
+            hr = ApplyTransition(StreamOperation::OpPlaceMarker);
         }
 
-        return hr;
-    }
+        if (SUCCEEDED(hr))
+        {
+            hr = QueueEvent(MEStreamSinkMarker, GUID_NULL, S_OK, pvarContextValue);
+        }
 
-    // IUnknown
-    STDMETHODIMP_(ULONG) AddRef(void)override
-    {
-        return InterlockedIncrement(&m_nRefCount);
+        return hr;
     }
 
-    STDMETHODIMP QueryInterface(REFIID iid, __RPC__deref_out _Result_nullonfailure_ void** ppv)override
+    std::atomic<int> m_count{ 0 };
+    STDMETHODIMP ProcessSample(__RPC__in_opt IMFSample* pSample)override
     {
-        if (!ppv)
-        {
-            return E_POINTER;
-        }
-        if (iid == IID_IUnknown)
+        // No lock on the sample path: the state is read atomically. A
+        // concurrent Stop or Shutdown may still win the race, in which case
+        // the sample is simply not presented.
+        HRESULT hrState = CheckShutdown();
+        if (SUCCEEDED(hrState))
         {
-            *ppv = static_cast<IUnknown*>(static_cast<IMFStreamSink*>(this));
+            hrState = ValidateOperation(m_state.load(std::memory_order_acquire), StreamOperation::OpProcessSample);
         }
-        else if (iid == __uuidof(IMFStreamSink))
+        if (FAILED(hrState))
         {
-            *ppv = static_cast<IMFStreamSink*>(this);
+            return hrState;
         }
-        else if (iid == __uuidof(IMFMediaEventGenerator))
+
+        ++m_count;
+
+        // A sample we did not ask for (for example one that was already in
+        // flight when a flush refunded its request) is still presented, it
+        // just does not change the balance.
+        (void)m_SampleCredits.Consume();
+
+        // Frames before the start position were only decoded to reach it,
+        // and faster than 1x only some frames are shown. Drop the others
+        // before locking or converting anything.
+        LONGLONG hnsTime = 0;
+        LONGLONG hnsDuration = 0;
+        const bool bHasTime = SUCCEEDED(pSample->GetSampleTime(&hnsTime));
+        if (!bHasTime || FAILED(pSample->GetSampleDuration(&hnsDuration)))
         {
-            *ppv = static_cast<IMFMediaEventGenerator*>(this);
+            hnsDuration = 0;
         }
-        else if (iid == __uuidof(IMFMediaTypeHandler))
+
+        if (bHasTime && IsBeforeStart(hnsTime, hnsDuration))
         {
-            *ppv = static_cast<IMFMediaTypeHandler*>(this);
+            ++m_cSamplesBeforeStart;
+            return S_OK;
         }
-        else if (iid == __uuidof(IMFGetService))
+
+        if (bHasTime && m_RateThinner.ShouldDrop(hnsTime, hnsDuration))
         {
-            *ppv = static_cast<IMFGetService*>(this);
+            ++m_cSamplesThinned;
+            return S_OK;
         }
-        else
+
+        bool expected = true;
+        if (m_IsFirstFramePending.compare_exchange_strong(expected, false, std::memory_order_relaxed))
         {
-            *ppv = NULL;
-            return E_NOINTERFACE;
+            m_hnsFirstFrameTime = (UINT64)MFGetSystemTime();
         }
-        AddRef();
-        return S_OK;
-    }
 
-    STDMETHODIMP_(ULONG) Release(void)override
-    {
-        ULONG uCount = InterlockedDecrement(&m_nRefCount);
-        if (uCount == 0)
+        // In step mode a paused stream holds the frame for Step instead.
+        if (m_IsStepMode.load(std::memory_order_acquire))
         {
-            delete this;
+            CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::ProcessSample m_csState"));
+
+            if (m_IsStepMode && m_state.load(std::memory_order_relaxed) == State::State_Paused)
+            {
+                Microsoft::WRL::ComPtr<IMFSample> pFrame = pSample;
+                const FrameStepAction action = m_StepQueue.Offer(pFrame);
+                UpdateBudgetCharge();
+
+                if (action == FrameStepAction::Hold)
+                {
+                    return S_OK;
+                }
+
+                if (action == FrameStepAction::Present)
+                {
+                    ++m_cFramesStepped;
+                }
+
+                return PresentSample(pFrame.Get());
+            }
         }
-        // For thread safety, return a temporary variable.
-        return uCount;
+
+        return PresentSample(pSample);
     }
 
-    // IMFGetService
-    STDMETHODIMP GetService(__RPC__in REFGUID guidService, __RPC__in REFIID riid, __RPC__deref_out_opt LPVOID* ppvObject)override
+    //-------------------------------------------------------------------
+    // Name: PresentSample
+    // Description: Hands a sample's frame on: to the frame callback in
+    //              system-memory mode, or as D3D11 textures. A frame
+    //              that cannot be handed on is counted in
+    //              CVR_COUNTER_FRAMES_FAILED.
+    //-------------------------------------------------------------------
+
+    HRESULT PresentSample(IMFSample* pSample)
     {
         HRESULT hr = S_OK;
 
-        if (guidService == MR_VIDEO_ACCELERATION_SERVICE)
+        do
         {
-            if (riid == __uuidof(IMFDXGIDeviceManager))
+            DWORD cBuffers = 0;
+            hr = pSample->GetBufferCount(&cBuffers);
+            if (FAILED(hr))
+            {
+                break;
+            }
+
+            if (m_Config.SystemMemory)
             {
-                if (NULL != m_pDXGIManager)
+                if (1 == cBuffers)
                 {
-                    *ppvObject = m_pDXGIManager.Get();
-                    ((IUnknown*)*ppvObject)->AddRef();
+                    Microsoft::WRL::ComPtr<IMFMediaBuffer> pBuffer;
+                    hr = pSample->GetBufferByIndex(0, &pBuffer);
+                    if (SUCCEEDED(hr))
+                    {
+                        hr = DeliverSystemMemoryFrame(pSample, pBuffer.Get());
+                    }
                 }
                 else
                 {
-                    hr = E_NOINTERFACE;
+                    hr = DeliverBufferChain(pSample);
                 }
+                break;
             }
-            else
+
+            // On the GPU path every buffer is a texture of its own (several
+            // for multi-view video), so there is nothing to join: look at
+            // each one where it is.
+            for (DWORD i = 0; SUCCEEDED(hr) && i < cBuffers; i++)
+            {
+                Microsoft::WRL::ComPtr<IMFMediaBuffer> pBuffer;
+                hr = pSample->GetBufferByIndex(i, &pBuffer);
+                if (FAILED(hr))
+                {
+                    break;
+                }
+
+                Microsoft::WRL::ComPtr<IMFDXGIBuffer> pDXGIBuffer;
+                hr = pBuffer.As(&pDXGIBuffer);
+                if (FAILED(hr))
+                {
+                    break;
+                }
+
+                Microsoft::WRL::ComPtr<ID3D11Texture2D> pTexture2D;
+                hr = pDXGIBuffer->GetResource(IID_PPV_ARGS(&pTexture2D));
+                if (FAILED(hr))
+                {
+                    break;
+                }
+
+                D3D11_TEXTURE2D_DESC desc;
+                pTexture2D->GetDesc(&desc);
+            }
+
+        } while (false);
+
+        if (FAILED(hr))
+        {
+            ++m_cFramesFailed;
+        }
+
+        return hr;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: IsBeforeStart
+    // Description: True if the sample ends at or before the position the
+    //              clock was started at. A sample without a duration is
+    //              compared by its start time. In reverse playback,
+    //              "before" is later in the stream.
+    //-------------------------------------------------------------------
+
+    bool IsBeforeStart(LONGLONG hnsTime, LONGLONG hnsDuration) const
+    {
+        const LONGLONG hnsStart = m_hnsStartPosition.load(std::memory_order_relaxed);
+        if (hnsStart == LLONG_MIN)
+        {
+            return false;
+        }
+
+        if (m_RateThinner.GetRate() < 0)
+        {
+            return hnsTime > hnsStart;
+        }
+
+        if (hnsDuration > 0)
+        {
+            return hnsTime + hnsDuration <= hnsStart;
+        }
+
+        return hnsTime < hnsStart;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: DeliverSystemMemoryFrame
+    // Description: Locks a system-memory buffer in place and hands its
+    //              planes to the frame callback. Lock2D gives the
+    //              buffer's own stride without a copy; a buffer without
+    //              IMF2DBuffer is read with Lock and the media type's
+    //              default stride.
+    //-------------------------------------------------------------------
+
+    HRESULT DeliverSystemMemoryFrame(IMFSample* pSample, IMFMediaBuffer* pBuffer)
+    {
+        const SystemMemoryFormat format = GetFrameFormat();
+
+        if (format.pInfo == NULL)
+        {
+            return MF_E_INVALIDMEDIATYPE;
+        }
+
+        BYTE* pScanline0 = NULL;
+        LONG lStride = 0;
+        BYTE* pBufferStart = NULL;              // Stays NULL if the bounds are unknown.
+        DWORD cbBuffer = 0;
+
+        Microsoft::WRL::ComPtr<IMF2DBuffer> p2DBuffer;
+        Microsoft::WRL::ComPtr<IMF2DBuffer2> p2DBuffer2;
+        HRESULT hr = S_OK;
+
+        if (SUCCEEDED(pBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer2))))
+        {
+            hr = p2DBuffer2->Lock2DSize(MF2DBuffer_LockFlags_Read, &pScanline0, &lStride, &pBufferStart, &cbBuffer);
+            p2DBuffer = p2DBuffer2;
+        }
+        else if (SUCCEEDED(pBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer))))
+        {
+            hr = p2DBuffer->Lock2D(&pScanline0, &lStride);
+        }
+        else
+        {
+            hr = pBuffer->Lock(&pBufferStart, NULL, &cbBuffer);
+            if (SUCCEEDED(hr))
             {
-                hr = E_NOINTERFACE;
+                lStride = format.DefaultStride;
+                pScanline0 = (lStride < 0) ? pBufferStart + (INT64)(-lStride) * (format.Height - 1) : pBufferStart;
             }
         }
+
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        FrameLayout layout;
+        if (DescribeFrame(*format.pInfo, pScanline0, lStride, format.Width, format.Height, pBufferStart, cbBuffer, &layout))
+        {
+            hr = DeliverFrame(pSample, format, layout);
+        }
         else
         {
-            hr = MF_E_UNSUPPORTED_SERVICE;
+            hr = MF_E_BUFFERTOOSMALL;
         }
 
-        return hr;
-    }
+        if (p2DBuffer)
+        {
+            p2DBuffer->Unlock2D();
+        }
+        else
+        {
+            pBuffer->Unlock();
+        }
 
-    // IMFStreamSink
-    STDMETHODIMP Flush(void)override
-    {
-        return S_OK;
+        return hr;
     }
 
-    STDMETHODIMP GetIdentifier(__RPC__out DWORD* pdwIdentifier)override
-    {
-        return E_FAIL;
-    }
+    //-------------------------------------------------------------------
+    // Name: DeliverBufferChain
+    // Description: Delivers a sample made of several system-memory
+    //              buffers. Each plane that lies inside one buffer is
+    //              read in place. Only the planes split across buffers
+    //              are gathered, row by row into a pooled buffer with
+    //              padded strides; such frames are counted in
+    //              CVR_COUNTER_CONTIGUOUS_COPIES.
+    //-------------------------------------------------------------------
 
-    STDMETHODIMP GetMediaSink(__RPC__deref_out_opt IMFMediaSink** ppMediaSink)override
+    HRESULT DeliverBufferChain(IMFSample* pSample)
     {
-        CAutoLock lock(&m_critSec);
+        const SystemMemoryFormat format = GetFrameFormat();
 
-        if (ppMediaSink == NULL)
+        if (format.pInfo == NULL)
         {
-            return E_POINTER;
+            return MF_E_INVALIDMEDIATYPE;
         }
 
-        HRESULT hr = CheckShutdown();
-
-        if (SUCCEEDED(hr))
+        CSampleBufferChain chain;
+        HRESULT hr = chain.Lock(pSample);
+        if (FAILED(hr))
         {
-            *ppMediaSink = m_pSink.Get();
-            (*ppMediaSink)->AddRef();
+            return hr;
         }
 
-        return hr;
-    }
-
-    STDMETHODIMP GetMediaTypeHandler(__RPC__deref_out_opt IMFMediaTypeHandler** ppHandler)override
-    {
-        CAutoLock lock(&m_critSec);
+        const CBufferChainView& view = chain.View();
 
-        if (ppHandler == NULL)
+        FrameBufferPlan source;
+        FrameBufferPlan target;
+        if (!PlanFrame(*format.pInfo, false, format.DefaultStride, format.Width, format.Height, &source) ||
+            !PlanFrame(*format.pInfo, true, 0, format.Width, format.Height, &target))
         {
-            return E_POINTER;
+            return MF_E_INVALIDMEDIATYPE;
         }
 
-        HRESULT hr = CheckShutdown();
+        if (view.GetTotalLength() < source.cbSize)
+        {
+            return MF_E_BUFFERTOOSMALL;
+        }
 
-        // This stream object acts as its own type handler, so we QI ourselves.
-        if (SUCCEEDED(hr))
+        // Planes that lie inside one buffer are read where they are; only
+        // a plane that straddles two buffers is gathered.
+        CFrameBufferPool::Lease gathered;
+        if (FindSplitPlanes(view, source) != 0)
         {
-            hr = this->QueryInterface(IID_IMFMediaTypeHandler, (void**)ppHandler);
+            gathered = m_FramePool.Acquire(target.cbSize);
+            if (!gathered)
+            {
+                return E_OUTOFMEMORY;
+            }
+            ++m_cContiguousCopies;
         }
 
-        return hr;
-    }
+        FrameLayout layout;
+        MapFramePlanes(view, source, target, gathered.Data(), &layout);
 
-    STDMETHODIMP PlaceMarker(MFSTREAMSINK_MARKER_TYPE eMarkerType, __RPC__in const PROPVARIANT* pvarMarkerValue, __RPC__in const PROPVARIANT* pvarContextValue)override
-    {
-        return E_FAIL;
+        return DeliverFrame(pSample, format, layout);
     }
 
-    int m_count = 0;
-    STDMETHODIMP ProcessSample(__RPC__in_opt IMFSample* pSample)override
+    SystemMemoryFormat GetFrameFormat(void)
     {
-        ++m_count;
+        CAutoSharedLock lock(&m_rwTypeAndSink, LOCK_SITE("CustomVideoStreamSink::GetFrameFormat m_rwTypeAndSink"));
 
-        m_cOutstandingSampleRequests--;
-
-        // do something
-        do
-        {
-            DWORD cBuffers = 0;
-            auto hr = pSample->GetBufferCount(&cBuffers);
-            if (FAILED(hr))
-            {
-                return hr;
-            }
+        return m_FrameFormat;
+    }
 
-            Microsoft::WRL::ComPtr<IMFMediaBuffer> pBuffer;
-            if (1 == cBuffers)
-            {
-                hr = pSample->GetBufferByIndex(0, &pBuffer);
-            }
-            else
-            {
-                hr = pSample->ConvertToContiguousBuffer(&pBuffer);
-            }
-            if (FAILED(hr))
-            {
-                return hr;
-            }
+    //-------------------------------------------------------------------
+    // Name: DeliverFrame
+    // Description: Hands the planes of a locked frame to the frame
+    //              callback.
+    //-------------------------------------------------------------------
 
-            Microsoft::WRL::ComPtr<IMFDXGIBuffer> pDXGIBuffer;
-            hr = pBuffer.As(&pDXGIBuffer);
-            if (FAILED(hr))
-            {
-                break;
-            }
+    HRESULT DeliverFrame(IMFSample* pSample, const SystemMemoryFormat& format, const FrameLayout& layout)
+    {
+        HRESULT hr = S_OK;
 
-            Microsoft::WRL::ComPtr<ID3D11Texture2D> pTexture2D;
-            hr = pDXGIBuffer->GetResource(IID_PPV_ARGS(&pTexture2D));
-            if (FAILED(hr))
+        if (m_Config.pFrameCallback)
+        {
+            CVR_FRAME frame = {};
+            frame.Subtype = format.Subtype;
+            frame.Width = format.Width;
+            frame.Height = format.Height;
+            frame.cPlanes = layout.cPlanes;
+            for (UINT32 i = 0; i < layout.cPlanes; i++)
             {
-                break;
+                frame.pPlane[i] = layout.Planes[i].pData;
+                frame.lStride[i] = layout.Planes[i].Stride;
             }
+            (void)pSample->GetSampleTime(&frame.hnsSampleTime);
+            (void)pSample->GetSampleDuration(&frame.hnsDuration);
 
-            D3D11_TEXTURE2D_DESC desc;
-            pTexture2D->GetDesc(&desc);
-
-        } while (false);
+            hr = m_Config.pFrameCallback->OnFrame(&frame);
+            ++m_cFramesDelivered;
+        }
 
-        return  S_OK;
+        return hr;
     }
 
     // IMFMediaEventGenerator (from IMFStreamSink)
@@ -1611,7 +2521,6 @@ public:
     {
         HRESULT hr = S_OK;
 
-        CAutoLock lock(&m_critSec);
         hr = CheckShutdown();
 
         if (SUCCEEDED(hr))
@@ -1626,7 +2535,6 @@ public:
     {
         HRESULT hr = S_OK;
 
-        CAutoLock lock(&m_critSec);
         hr = CheckShutdown();
 
         if (SUCCEEDED(hr))
@@ -1639,33 +2547,14 @@ public:
 
     STDMETHODIMP GetEvent(DWORD dwFlags, __RPC__deref_out_opt IMFMediaEvent** ppEvent)override
     {
-        // NOTE:
-        // GetEvent can block indefinitely, so we don't hold the lock.
-        // This requires some juggling with the event queue pointer.
-
-        HRESULT hr = S_OK;
-
-        Microsoft::WRL::ComPtr<IMFMediaEventQueue> pQueue;
-
-        { // scope for lock
+        // GetEvent can block indefinitely. Shutdown wakes it with
+        // MF_E_SHUTDOWN.
 
-            CAutoLock lock(&m_critSec);
-
-            // Check shutdown
-            hr = CheckShutdown();
-
-            // Get the pointer to the event queue.
-            if (SUCCEEDED(hr))
-            {
-                pQueue = m_pEventQueue;
-            }
-
-        }   // release lock
+        HRESULT hr = CheckShutdown();
 
-            // Now get the event.
         if (SUCCEEDED(hr))
         {
-            hr = pQueue->GetEvent(dwFlags, ppEvent);
+            hr = m_pEventQueue->GetEvent(dwFlags, ppEvent);
         }
 
         return hr;
@@ -1675,7 +2564,6 @@ public:
     {
         HRESULT hr = S_OK;
 
-        CAutoLock lock(&m_critSec);
         hr = CheckShutdown();
 
         if (SUCCEEDED(hr))
@@ -1689,7 +2577,7 @@ public:
     // IMFMediaTypeHandler
     STDMETHODIMP GetCurrentMediaType(_Outptr_ IMFMediaType** ppMediaType)override
     {
-        CAutoLock lock(&m_critSec);
+        CAutoSharedLock lock(&m_rwTypeAndSink, LOCK_SITE("CustomVideoStreamSink::GetCurrentMediaType m_rwTypeAndSink"));
 
         if (ppMediaType == NULL)
         {
@@ -1728,6 +2616,8 @@ public:
             return hr;
         }
 
+        CAutoSharedLock lock(&m_rwTypeAndSink, LOCK_SITE("CustomVideoStreamSink::GetMajorType m_rwTypeAndSink"));
+
         if (m_pCurrentType == NULL)
         {
             return MF_E_NOT_INITIALIZED;
@@ -1848,6 +2738,13 @@ public:
 
             auto name = GetGUIDName(subType);
 
+            // The system-memory path has to know the plane layout.
+            if (m_Config.SystemMemory && FindFrameFormat(subType.Data1) == NULL)
+            {
+                hr = MF_E_INVALIDMEDIATYPE;
+                break;
+            }
+
             hr = MF_E_INVALIDMEDIATYPE; // This will be set to OK if we find the subtype is accepted
 
             for (DWORD i = 0; i < s_dwNumVideoFormats; i++)
@@ -1901,9 +2798,8 @@ public:
 
         HRESULT hr = S_OK;
         MFRatio fps = { 0, 0 };
-        GUID guidSubtype = GUID_NULL;
 
-        CAutoLock lock(&m_critSec);
+        CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::SetCurrentMediaType m_csState"));
 
         do
         {
@@ -1925,55 +2821,58 @@ public:
                 break;
             }
 
-            m_pCurrentType = pMediaType;
-
-            pMediaType->GetGUID(MF_MT_SUBTYPE, &guidSubtype);
-
-            auto name = GetGUIDName(guidSubtype);
+            // Describe the frames first, so a type we cannot describe
+            // leaves the current type and its format as they were.
+            SystemMemoryFormat format;
+            hr = format.Load(pMediaType);
+            if (FAILED(hr))
+            {
+                break;
+            }
 
-            if ((guidSubtype == MFVideoFormat_NV12) ||
-                (guidSubtype == MFVideoFormat_YV12) ||
-                (guidSubtype == MFVideoFormat_IYUV) ||
-                (guidSubtype == MFVideoFormat_YVU9) ||
-                (guidSubtype == MFVideoFormat_I420))
             {
-                m_imageBytesPP.Numerator = 3;
-                m_imageBytesPP.Denominator = 2;
+                CAutoExclusiveLock lockType(&m_rwTypeAndSink, LOCK_SITE("CustomVideoStreamSink::SetCurrentMediaType m_rwTypeAndSink"));
+
+                m_pCurrentType = pMediaType;
+                m_FrameFormat = format;
             }
-            else if ((guidSubtype == MFVideoFormat_YUY2) ||
-                (guidSubtype == MFVideoFormat_RGB555) ||
-                (guidSubtype == MFVideoFormat_RGB565) ||
-                (guidSubtype == MFVideoFormat_UYVY) ||
-                (guidSubtype == MFVideoFormat_YVYU) ||
-                (guidSubtype == MEDIASUBTYPE_V216))
+
+            // Size the buffers DeliverBufferChain gathers frames into for
+            // the new format now, so that the frames that follow do not
+            // allocate, and give up the old format's buffers. The budget
+            // decides how many we can afford.
+            FrameBufferPlan padded;
+            const size_t cbPooledFrame = (m_Config.SystemMemory && format.pInfo != NULL &&
+                PlanFrame(*format.pInfo, true, 0, format.Width, format.Height, &padded)) ? padded.cbSize : 0;
+
+            if (m_cbPooledFrame != 0 && m_cbPooledFrame != cbPooledFrame)
             {
-                m_imageBytesPP.Numerator = 2;
-                m_imageBytesPP.Denominator = 1;
+                m_FramePool.Retire(m_cbPooledFrame);
             }
-            else if (guidSubtype == MFVideoFormat_RGB24)
+            if (cbPooledFrame != 0)
             {
-                m_imageBytesPP.Numerator = 3;
-                m_imageBytesPP.Denominator = 1;
+                (void)m_FramePool.Reserve(cbPooledFrame, m_Budget.GetDepth(cbPooledFrame, SAMPLE_QUEUE_HIWATER_THRESHOLD));
             }
-            else if (guidSubtype == MFVideoFormat_RGB32)
+            m_cbPooledFrame = cbPooledFrame;
+
+            // Frames in flight are charged at the size of a sample buffer
+            // of the new format, as PlanFrame lays it out. Media Foundation
+            // sizes the formats the system-memory path does not describe.
+            FrameBufferPlan sample;
+            UINT32 cbImage = 0;
+            if (format.pInfo != NULL && PlanFrame(*format.pInfo, false, format.DefaultStride, format.Width, format.Height, &sample))
             {
-                m_imageBytesPP.Numerator = 4;
-                m_imageBytesPP.Denominator = 1;
+                m_cbFrame = sample.cbSize;
             }
-            else if (guidSubtype == MFVideoFormat_v410)
+            else if (SUCCEEDED(MFCalculateImageSize(format.Subtype, format.Width, format.Height, &cbImage)))
             {
-                m_imageBytesPP.Numerator = 5;
-                m_imageBytesPP.Denominator = 4;
+                m_cbFrame = cbImage;
             }
-            else // includes:
-                 // MFVideoFormat_RGB8
-                 // MFVideoFormat_AYUV
-                 // MFVideoFormat_NV11
+            else
             {
-                // This is just a fail-safe
-                m_imageBytesPP.Numerator = 1;
-                m_imageBytesPP.Denominator = 1;
+                m_cbFrame = 0;          // Unknown size: the budget does not limit the depth.
             }
+            UpdateBudgetCharge();
 
             /*
             pMediaType->GetUINT32(MF_MT_INTERLACE_MODE, &m_unInterlaceMode);
@@ -2023,15 +2922,9 @@ public:
             }
             */
 
-            if (State::State_Started != m_state && State::State_Paused != m_state)
-            {
-                m_state = State::State_Ready;
-            }
-            else
-            {
-                //Flush all current samples in the Queue as this is a format change
-                hr = Flush();
-            }
+            // Flushes all current samples in the queue if this is a format
+            // change while streaming.
+            hr = ApplyTransition(StreamOperation::OpSetMediaType);
         } while (FALSE);
 
         return hr;
@@ -2039,13 +2932,14 @@ public:
 };
 
 
-class CustomVideoRenderer : public IMFMediaSink, public IMFClockStateSink
+class CustomVideoRenderer : public IMFMediaSink, public IMFClockStateSink, public ICustomVideoRendererControl
+    , public IMFGetService, public IMFRateSupport
 {
     ULONG m_nRefCount = 1;
     Microsoft::WRL::ComPtr<CustomVideoStreamSink> m_pStream;
-    CCritSec m_csStreamSinkAndScheduler;
-    bool m_IsShutdown = false;
-    CCritSec m_csMediaSink;
+    std::atomic<bool> m_IsShutdown{ false };
+    CCritSec m_csMediaSink;                     // serializes clock notifications and control calls
+    CRWLock m_rwStreamAndClock;                 // guards m_pStream and m_pClock; getters take it shared
     const DWORD STREAM_ID = 1;
     Microsoft::WRL::ComPtr<IMFPresentationClock> m_pClock;
     DWORD m_key = 0;
@@ -2054,11 +2948,23 @@ class CustomVideoRenderer : public IMFMediaSink, public IMFClockStateSink
     {
     }
 
-    HRESULT Initialize()
+    HRESULT Initialize(IMFAttributes* pAttributes)
     {
-        auto p=new CustomVideoStreamSink(STREAM_ID, m_csStreamSinkAndScheduler, this);
+        StreamSinkConfig config;
+        HRESULT hr = config.Load(pAttributes);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        auto p=new CustomVideoStreamSink(STREAM_ID, this, config);
 
-        auto hr=p->QueryInterface(IID_IMFStreamSink, &m_pStream);
+        hr = p->Initialize();
+
+        if (SUCCEEDED(hr))
+        {
+            hr=p->QueryInterface(IID_IMFStreamSink, &m_pStream);
+        }
 
         if (p) {
             p->Release();
@@ -2084,7 +2990,7 @@ class CustomVideoRenderer : public IMFMediaSink, public IMFClockStateSink
 
 public:
     // Static method to create the object.
-    static HRESULT CreateInstance(_In_ REFIID iid, _COM_Outptr_ void** ppSink)
+    static HRESULT CreateInstance(_In_opt_ IMFAttributes* pAttributes, _In_ REFIID iid, _COM_Outptr_ void** ppSink)
     {
         if (ppSink == NULL)
         {
@@ -2103,7 +3009,7 @@ public:
 
         if (SUCCEEDED(hr))
         {
-            hr = pSink->Initialize();
+            hr = pSink->Initialize(pAttributes);
         }
 
         if (SUCCEEDED(hr))
@@ -2141,6 +3047,18 @@ public:
         {
             *ppv = static_cast<IMFMediaSink*>(this);
         }
+        else if (iid == __uuidof(ICustomVideoRendererControl))
+        {
+            *ppv = static_cast<ICustomVideoRendererControl*>(this);
+        }
+        else if (iid == __uuidof(IMFGetService))
+        {
+            *ppv = static_cast<IMFGetService*>(this);
+        }
+        else if (iid == __uuidof(IMFRateSupport))
+        {
+            *ppv = static_cast<IMFRateSupport*>(this);
+        }
         else
         {
             *ppv = NULL;
@@ -2169,7 +3087,7 @@ public:
 
     STDMETHODIMP GetCharacteristics(__RPC__out DWORD* pdwCharacteristics)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoSharedLock lock(&m_rwStreamAndClock, LOCK_SITE("CustomVideoRenderer::GetCharacteristics m_rwStreamAndClock"));
 
         if (pdwCharacteristics == NULL)
         {
@@ -2190,7 +3108,7 @@ public:
 
     STDMETHODIMP GetPresentationClock(__RPC__deref_out_opt IMFPresentationClock** ppPresentationClock)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoSharedLock lock(&m_rwStreamAndClock, LOCK_SITE("CustomVideoRenderer::GetPresentationClock m_rwStreamAndClock"));
 
         if (ppPresentationClock == NULL)
         {
@@ -2219,7 +3137,7 @@ public:
     STDMETHODIMP GetStreamSinkById(DWORD dwStreamSinkIdentifier
             , __RPC__deref_out_opt IMFStreamSink** ppStreamSink)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoSharedLock lock(&m_rwStreamAndClock, LOCK_SITE("CustomVideoRenderer::GetStreamSinkById m_rwStreamAndClock"));
 
         if (ppStreamSink == NULL)
         {
@@ -2240,13 +3158,13 @@ public:
             (*ppStreamSink)->AddRef();
         }
 
-        return E_FAIL;
+        return hr;
     }
 
     STDMETHODIMP GetStreamSinkByIndex(DWORD dwIndex
             , __RPC__deref_out_opt IMFStreamSink** ppStreamSink)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoSharedLock lock(&m_rwStreamAndClock, LOCK_SITE("CustomVideoRenderer::GetStreamSinkByIndex m_rwStreamAndClock"));
 
         if (ppStreamSink == NULL)
         {
@@ -2271,7 +3189,7 @@ public:
 
     STDMETHODIMP GetStreamSinkCount(__RPC__out DWORD* pcStreamSinkCount)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoSharedLock lock(&m_rwStreamAndClock, LOCK_SITE("CustomVideoRenderer::GetStreamSinkCount m_rwStreamAndClock"));
 
         if (pcStreamSinkCount == NULL)
         {
@@ -2295,7 +3213,7 @@ public:
 
     STDMETHODIMP SetPresentationClock(__RPC__in_opt IMFPresentationClock* pPresentationClock)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::SetPresentationClock m_csMediaSink"));
 
         HRESULT hr = CheckShutdown();
 
@@ -2322,6 +3240,7 @@ public:
         {
             // Release the pointer to the old clock.
             // Store the pointer to the new clock.
+            CAutoExclusiveLock lockClock(&m_rwStreamAndClock, LOCK_SITE("CustomVideoRenderer::SetPresentationClock m_rwStreamAndClock"));
             m_pClock = pPresentationClock;
         }
 
@@ -2330,11 +3249,11 @@ public:
 
     STDMETHODIMP Shutdown(void)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::Shutdown m_csMediaSink"));
 
         HRESULT hr = MF_E_SHUTDOWN;
 
-        m_IsShutdown = TRUE;
+        m_IsShutdown = true;
 
         if (m_pStream != NULL)
         {
@@ -2348,8 +3267,12 @@ public:
         }
         */
 
-        m_pClock.Reset();
-        m_pStream.Reset();
+        {
+            CAutoExclusiveLock lockStream(&m_rwStreamAndClock, LOCK_SITE("CustomVideoRenderer::Shutdown m_rwStreamAndClock"));
+
+            m_pClock.Reset();
+            m_pStream.Reset();
+        }
         //SafeRelease(m_pPresenter);
 
         /*
@@ -2363,10 +3286,140 @@ public:
         return hr;
     }
 
+    // IMFGetService
+    STDMETHODIMP GetService(__RPC__in REFGUID guidService, __RPC__in REFIID riid, __RPC__deref_out_opt LPVOID* ppvObject)override
+    {
+        if (ppvObject == NULL)
+        {
+            return E_POINTER;
+        }
+
+        *ppvObject = NULL;
+
+        if (guidService == MF_RATE_CONTROL_SERVICE)
+        {
+            return QueryInterface(riid, ppvObject);
+        }
+
+        return MF_E_UNSUPPORTED_SERVICE;
+    }
+
+    // IMFRateSupport
+    //
+    // The sink presents samples as they arrive and thins them to the
+    // normal frame rate, so any rate works in either direction. Unthinned
+    // playback is capped at RATE_MAX_UNTHINNED, beyond which the session
+    // should send key frames only; whether reverse works is up to the
+    // source.
+    STDMETHODIMP GetSlowestRate(MFRATE_DIRECTION eDirection, BOOL fThin, _Out_ float* pflRate)override
+    {
+        if (pflRate == NULL)
+        {
+            return E_POINTER;
+        }
+
+        *pflRate = 0.0f;
+        return CheckShutdown();
+    }
+
+    STDMETHODIMP GetFastestRate(MFRATE_DIRECTION eDirection, BOOL fThin, _Out_ float* pflRate)override
+    {
+        if (pflRate == NULL)
+        {
+            return E_POINTER;
+        }
+
+        const float flFastest = fThin ? FLT_MAX : RATE_MAX_UNTHINNED;
+        *pflRate = (eDirection == MFRATE_REVERSE) ? -flFastest : flFastest;
+        return CheckShutdown();
+    }
+
+    STDMETHODIMP IsRateSupported(BOOL fThin, float flRate, __RPC__inout_opt float* pflNearestSupportedRate)override
+    {
+        HRESULT hr = CheckShutdown();
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        const float flFastest = fThin ? FLT_MAX : RATE_MAX_UNTHINNED;
+        float flNearest = flRate;
+
+        if (flRate > flFastest)
+        {
+            flNearest = flFastest;
+            hr = MF_E_UNSUPPORTED_RATE;
+        }
+        else if (flRate < -flFastest)
+        {
+            flNearest = -flFastest;
+            hr = MF_E_UNSUPPORTED_RATE;
+        }
+
+        if (pflNearestSupportedRate != NULL)
+        {
+            *pflNearestSupportedRate = flNearest;
+        }
+
+        return hr;
+    }
+
+    // ICustomVideoRendererControl
+    STDMETHODIMP Reset(void)override
+    {
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::Reset m_csMediaSink"));
+
+        HRESULT hr = CheckShutdown();
+
+        // Leave the old session's clock; the next session sets its own.
+        if (SUCCEEDED(hr) && m_pClock)
+        {
+            (void)m_pClock->RemoveClockStateSink(this);
+
+            CAutoExclusiveLock lockClock(&m_rwStreamAndClock, LOCK_SITE("CustomVideoRenderer::Reset m_rwStreamAndClock"));
+            m_pClock.Reset();
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pStream->Reset();
+        }
+
+        return hr;
+    }
+
+    STDMETHODIMP SetStepMode(BOOL fStepMode)override
+    {
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::SetStepMode m_csMediaSink"));
+
+        HRESULT hr = CheckShutdown();
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pStream->SetStepMode(fStepMode != FALSE);
+        }
+
+        return hr;
+    }
+
+    STDMETHODIMP Step(_Out_opt_ UINT32* pcHeld)override
+    {
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::Step m_csMediaSink"));
+
+        HRESULT hr = CheckShutdown();
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pStream->Step(pcHeld);
+        }
+
+        return hr;
+    }
+
     // IMFClockStateSink methods
     STDMETHODIMP OnClockPause(MFTIME hnsSystemTime)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::OnClockPause m_csMediaSink"));
 
         HRESULT hr = CheckShutdown();
 
@@ -2380,7 +3433,7 @@ public:
 
     STDMETHODIMP OnClockRestart(MFTIME hnsSystemTime)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::OnClockRestart m_csMediaSink"));
 
         HRESULT hr = CheckShutdown();
 
@@ -2394,20 +3447,22 @@ public:
 
     STDMETHODIMP OnClockSetRate(MFTIME hnsSystemTime, float flRate)override
     {
-        /*
-        if (m_pScheduler != NULL)
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::OnClockSetRate m_csMediaSink"));
+
+        HRESULT hr = CheckShutdown();
+
+        if (SUCCEEDED(hr))
         {
-            // Tell the scheduler about the new rate.
-            m_pScheduler->SetClockRate(flRate);
+            // Tell the stream about the new rate.
+            hr = m_pStream->SetRate(flRate);
         }
-        */
 
-        return S_OK;
+        return hr;
     }
 
     STDMETHODIMP OnClockStart(MFTIME hnsSystemTime, LONGLONG llClockStartOffset)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::OnClockStart m_csMediaSink"));
 
         HRESULT hr = CheckShutdown();
         if (FAILED(hr))
@@ -2418,7 +3473,7 @@ public:
         // Check if the clock is already active (not stopped).
         // And if the clock position changes while the clock is active, it
         // is a seek request. We need to flush all pending samples.
-        //if (m_pStream->IsActive() && llClockStartOffset != PRESENTATION_CURRENT_POSITION)
+        if (m_pStream->IsSeekStart(llClockStartOffset))
         {
             // This call blocks until the scheduler threads discards all scheduled samples.
             hr = m_pStream->Flush();
@@ -2444,7 +3499,7 @@ public:
 
     STDMETHODIMP OnClockStop(MFTIME hnsSystemTime)override
     {
-        CAutoLock lock(&m_csMediaSink);
+        CAutoLock lock(&m_csMediaSink, LOCK_SITE("CustomVideoRenderer::OnClockStop m_csMediaSink"));
 
         HRESULT hr = CheckShutdown();
 
@@ -2471,5 +3526,16 @@ public:
 
 STDAPI CreateCustomVideoRenderer(REFIID riid, void **ppvObject)
 {
-    return CustomVideoRenderer::CreateInstance(riid, ppvObject);
+    return CustomVideoRenderer::CreateInstance(NULL, riid, ppvObject);
+}
+
+STDAPI CreateCustomVideoRendererEx(IMFAttributes* pAttributes, REFIID riid, void **ppvObject)
+{
+    return CustomVideoRenderer::CreateInstance(pAttributes, riid, ppvObject);
+}
+
+STDAPI SetCustomVideoRendererMemoryBudget(UINT64 cbBudget)
+{
+    CMemoryGovernor::Process().SetBudget(cbBudget);
+    return S_OK;
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <windows.h>
+#include <unknwn.h>
 
 // {8C5C51AD-F400-4B2A-BD36-4990D07420B4}
 DEFINE_GUID(CLSID_CustomVideoRenderer, 
@@ -7,3 +8,157 @@ DEFINE_GUID(CLSID_CustomVideoRenderer,
 
 STDAPI CreateCustomVideoRenderer(REFIID riid, void **ppvObject);
 
+
+//////////////////////////////////////////////////////////////////////////
+//  Creation attributes
+//
+//  CreateCustomVideoRendererEx takes an optional attribute store:
+//
+//  CVR_ATTRIBUTE_SYSTEM_MEMORY     UINT32. Nonzero selects system-memory
+//                                  mode: the renderer creates no D3D
+//                                  device and exposes no DXGI device
+//                                  manager, so the decoder delivers
+//                                  system-memory buffers. Frames are read
+//                                  in place through IMF2DBuffer::Lock2D.
+//  CVR_ATTRIBUTE_FRAME_CALLBACK    IUnknown. An
+//                                  ICustomVideoRendererFrameCallback that
+//                                  receives every system-memory frame.
+//////////////////////////////////////////////////////////////////////////
+
+struct IMFAttributes;
+
+// {785BF0A0-0203-4C08-B771-8A5091952186}
+DEFINE_GUID(CVR_ATTRIBUTE_SYSTEM_MEMORY,
+0x785bf0a0, 0x203, 0x4c08, 0xb7, 0x71, 0x8a, 0x50, 0x91, 0x95, 0x21, 0x86);
+
+// {F26F1BB9-FA4F-48F4-91F7-359A7EE1B047}
+DEFINE_GUID(CVR_ATTRIBUTE_FRAME_CALLBACK,
+0xf26f1bb9, 0xfa4f, 0x48f4, 0x91, 0xf7, 0x35, 0x9a, 0x7e, 0xe1, 0xb0, 0x47);
+
+STDAPI CreateCustomVideoRendererEx(_In_opt_ IMFAttributes* pAttributes, REFIID riid, void **ppvObject);
+
+// Sets the bytes that all renderers in the process may hold in frames,
+// shared fairly between them. 0 (the default) means unlimited. Takes
+// effect for renderers that already exist as their queues refill.
+STDAPI SetCustomVideoRendererMemoryBudget(UINT64 cbBudget);
+
+// One system-memory frame. The planes point into the locked sample buffer
+// and are valid only until OnFrame returns.
+typedef struct _CVR_FRAME
+{
+    GUID        Subtype;                        // MF_MT_SUBTYPE of the stream.
+    UINT32      Width;
+    UINT32      Height;
+    UINT32      cPlanes;                        // 1 (packed), 2 (NV12, P010) or 3 (I420, YV12).
+    BYTE*       pPlane[3];                      // First byte of the top row of each plane, in memory order.
+    LONG        lStride[3];                     // Negative for bottom-up images.
+    LONGLONG    hnsSampleTime;
+    LONGLONG    hnsDuration;
+} CVR_FRAME;
+
+MIDL_INTERFACE("C405B077-19AC-4F3A-9867-58090C75F611")
+ICustomVideoRendererFrameCallback : public IUnknown
+{
+public:
+    // Called on the thread that delivers the sample; keep it short.
+    virtual HRESULT STDMETHODCALLTYPE OnFrame(_In_ const CVR_FRAME* pFrame) = 0;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Control interface
+//
+//  The media sink exposes ICustomVideoRendererControl through
+//  QueryInterface.
+//
+//  Reset takes the renderer out of the session that used it, so that the
+//  next session can use it instead of creating a new one. It detaches
+//  from the presentation clock, stops requesting samples and cancels the
+//  old session's event subscription. The D3D device, the frame buffers
+//  and the current media type stay, so the next file with the same format
+//  negotiates nothing new. Call it after the old session is shut down;
+//  the topology must set MF_TOPONODE_NOSHUTDOWN_ON_REMOVE, or the session
+//  shuts the renderer down with itself.
+//
+//  SetStepMode(TRUE) turns on frame stepping. While the clock is paused
+//  the renderer then keeps requesting samples up to its queue depth but
+//  holds them instead of presenting them. Step presents the oldest held
+//  frame and returns the number still held; with none held it returns
+//  S_FALSE and the next frame to arrive is presented. The decoder refills
+//  the queue in the background, so a step costs no decoding. Step fails
+//  with MF_E_INVALIDREQUEST unless the renderer is paused in step mode.
+//  Starting the clock ends step mode. Playing on from the pause, or
+//  SetStepMode(FALSE), presents the held frames in order; a seek or a
+//  stop drops them.
+//////////////////////////////////////////////////////////////////////////
+
+MIDL_INTERFACE("69457096-9608-4F90-AD65-812E95320CE6")
+ICustomVideoRendererControl : public IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE Reset(void) = 0;
+    virtual HRESULT STDMETHODCALLTYPE SetStepMode(BOOL fStepMode) = 0;
+    virtual HRESULT STDMETHODCALLTYPE Step(_Out_opt_ UINT32* pcHeld) = 0;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Statistics service
+//
+//  The stream sink exposes ICustomVideoRendererStatistics through
+//  IMFGetService. The service GUID is the interface IID:
+//
+//      MFGetService(pStreamSink, __uuidof(ICustomVideoRendererStatistics),
+//              IID_PPV_ARGS(&pStats));
+//////////////////////////////////////////////////////////////////////////
+
+typedef enum _CVR_COUNTER
+{
+    CVR_COUNTER_SAMPLES_RECEIVED = 0,           // Samples passed to ProcessSample.
+    CVR_COUNTER_SAMPLE_REQUESTS_OUTSTANDING,    // MEStreamSinkRequestSample events not yet answered.
+    CVR_COUNTER_SAMPLE_REQUESTS_GRANTED,        // Total requests sent.
+    CVR_COUNTER_SAMPLE_REQUESTS_CONSUMED,       // Total requests answered by a sample.
+    CVR_COUNTER_SAMPLE_REQUESTS_REFUNDED,       // Total requests voided by a flush or a failed send.
+    CVR_COUNTER_SAMPLES_UNSOLICITED,            // Samples that arrived with no request outstanding.
+    CVR_COUNTER_FRAMES_DELIVERED,               // System-memory frames handed to the frame callback.
+    CVR_COUNTER_FRAMES_FAILED,                  // Frames that could not be handed on (the frame callback or the buffer failed).
+    CVR_COUNTER_MEMORY_CHARGED,                 // Bytes charged to the memory budget.
+    CVR_COUNTER_QUEUE_DEPTH,                    // Frames the sink may currently keep in flight.
+    CVR_COUNTER_CONTIGUOUS_COPIES,              // Multi-buffer samples with a plane that spanned buffers and was gathered.
+    CVR_COUNTER_SAMPLES_BEFORE_START,           // Samples dropped because they end before the start position (accurate seek).
+    CVR_COUNTER_FIRST_FRAME_TIME,               // MFGetSystemTime when the first frame after the last start arrived; 0 until then.
+    CVR_COUNTER_SAMPLES_THINNED,                // Samples dropped to keep the frame rate at normal speed while playing faster.
+    CVR_COUNTER_FRAMES_STEPPED,                 // Frames presented by Step.
+    CVR_COUNTER_FRAMES_HELD,                    // Frames held for stepping.
+
+    CVR_COUNTER_COUNT
+} CVR_COUNTER;
+
+#define CVR_LOCK_SITE_NAME_MAX      64
+#define CVR_LOCK_HISTOGRAM_BUCKETS  16
+
+// Contention statistics of one named lock call site, summed over all
+// threads. Histogram bucket 0 counts times below 1 microsecond, bucket i
+// counts [2^(i-1), 2^i) microseconds, the last bucket is open-ended.
+typedef struct _CVR_LOCK_SITE_STATS
+{
+    CHAR    szName[CVR_LOCK_SITE_NAME_MAX];
+    UINT64  cAcquires;
+    UINT64  cContended;
+    UINT64  hnsWaitTotal;                       // 100-nanosecond units.
+    UINT64  hnsHoldTotal;                       // 100-nanosecond units.
+    UINT64  WaitHistogram[CVR_LOCK_HISTOGRAM_BUCKETS];
+    UINT64  HoldHistogram[CVR_LOCK_HISTOGRAM_BUCKETS];
+} CVR_LOCK_SITE_STATS;
+
+MIDL_INTERFACE("29A99B66-192D-45FA-9143-FCE17B8380BC")
+ICustomVideoRendererStatistics : public IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE GetCounter(CVR_COUNTER counter, _Out_ UINT64* pValue) = 0;
+
+    // Lock statistics are process-wide. GetLockSiteCount reports 0 sites
+    // unless the renderer was built with CVR_LOCK_STATS.
+    virtual HRESULT STDMETHODCALLTYPE GetLockSiteCount(_Out_ UINT32* pcSites) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetLockSiteStats(UINT32 dwIndex, _Out_ CVR_LOCK_SITE_STATS* pStats) = 0;
+};
@@ -0,0 +1,238 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  CDeviceCache [template]
+//
+//  Description:
+//  Process-wide cache of devices shared by every renderer instance.
+//
+//  A device is identified by a DeviceCacheKey (adapter and driver type).
+//  The first Acquire for a key asks the factory to create the device;
+//  later Acquires hand out the same device and bump its user count. Each
+//  Acquire returns a Lease, and when the last lease for a key goes away
+//  the cache drops the device, so the next Acquire creates a fresh one.
+//  A failed creation is not cached.
+//
+//  TDevice is a copyable bundle of reference-counted handles (for the
+//  renderer: the D3D11 device, its context and the DXGI manager). The
+//  lease keeps its own copy, so reading it never takes the cache lock.
+//
+//  Creation goes through IFactory, and the cache is portable C++, so the
+//  caching and lifetime rules can be exercised with a fake factory
+//  without Direct3D.
+//////////////////////////////////////////////////////////////////////////
+
+struct DeviceCacheKey
+{
+    uint64_t AdapterId;     // Adapter LUID; 0 selects the default adapter.
+    int32_t  DriverType;    // D3D_DRIVER_TYPE.
+
+    bool operator==(const DeviceCacheKey& other) const
+    {
+        return AdapterId == other.AdapterId && DriverType == other.DriverType;
+    }
+};
+
+template<class TDevice>
+class CDeviceCache
+{
+public:
+
+    class IFactory
+    {
+    public:
+
+        virtual ~IFactory(void)
+        {
+        }
+
+        // Creates the device for key. Returns an HRESULT: negative on failure.
+        virtual int32_t CreateDevice(const DeviceCacheKey& key, TDevice* pDevice) = 0;
+    };
+
+
+    // One user's share of a cached device. Move-only; releases the share
+    // when reset or destroyed.
+    class Lease
+    {
+    public:
+
+        Lease(void) :
+            m_pCache(nullptr),
+            m_key()
+        {
+        }
+
+        Lease(Lease&& other) noexcept :
+            m_pCache(std::exchange(other.m_pCache, nullptr)),
+            m_key(other.m_key),
+            m_device(std::move(other.m_device))
+        {
+        }
+
+        Lease& operator=(Lease&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Reset();
+                m_pCache = std::exchange(other.m_pCache, nullptr);
+                m_key = other.m_key;
+                m_device = std::move(other.m_device);
+            }
+            return *this;
+        }
+
+        ~Lease(void)
+        {
+            Reset();
+        }
+
+        explicit operator bool(void) const
+        {
+            return m_pCache != nullptr;
+        }
+
+        const TDevice& Get(void) const
+        {
+            return m_device;
+        }
+
+        void Reset(void)
+        {
+            if (m_pCache != nullptr)
+            {
+                m_device = TDevice();
+                std::exchange(m_pCache, nullptr)->Release(m_key);
+            }
+        }
+
+    private:
+
+        friend class CDeviceCache;
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        CDeviceCache* m_pCache;
+        DeviceCacheKey m_key;
+        TDevice m_device;
+    };
+
+
+    explicit CDeviceCache(IFactory* pFactory) :
+        m_pFactory(pFactory),
+        m_cCreated(0)
+    {
+    }
+
+    //-------------------------------------------------------------------
+    // Name: Acquire
+    // Description: Returns a lease on the device for key, creating the
+    //              device on first use. Concurrent first users wait for
+    //              one creation instead of each creating a device.
+    //-------------------------------------------------------------------
+
+    int32_t Acquire(const DeviceCacheKey& key, Lease* pLease)
+    {
+        pLease->Reset();
+
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        Entry* pEntry = Find(key);
+
+        if (pEntry == nullptr)
+        {
+            TDevice device;
+            const int32_t hr = m_pFactory->CreateDevice(key, &device);
+            if (hr < 0)
+            {
+                return hr;
+            }
+
+            m_cCreated++;
+            m_entries.push_back(Entry{ key, std::move(device), 0 });
+            pEntry = &m_entries.back();
+        }
+
+        pEntry->cUsers++;
+
+        pLease->m_pCache = this;
+        pLease->m_key = key;
+        pLease->m_device = pEntry->Device;
+        return 0;
+    }
+
+    // Number of live leases on the device for key.
+    uint32_t GetUserCount(const DeviceCacheKey& key)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        Entry* pEntry = Find(key);
+        return pEntry != nullptr ? pEntry->cUsers : 0;
+    }
+
+    // Number of devices the factory has created so far.
+    uint32_t GetCreateCount(void)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        return m_cCreated;
+    }
+
+private:
+
+    struct Entry
+    {
+        DeviceCacheKey Key;
+        TDevice Device;
+        uint32_t cUsers;
+    };
+
+    CDeviceCache(const CDeviceCache&) = delete;
+    CDeviceCache& operator=(const CDeviceCache&) = delete;
+
+    // There is one entry per adapter and driver type in use, so a linear
+    // search is all this needs. Caller holds m_lock.
+    Entry* Find(const DeviceCacheKey& key)
+    {
+        for (Entry& entry : m_entries)
+        {
+            if (entry.Key == key)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    void Release(const DeviceCacheKey& key)
+    {
+        TDevice device;     // Released after the lock is dropped.
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                if (m_entries[i].Key == key)
+                {
+                    if (--m_entries[i].cUsers == 0)
+                    {
+                        device = std::move(m_entries[i].Device);
+                        m_entries.erase(m_entries.begin() + i);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    IFactory* m_pFactory;
+    std::mutex m_lock;
+    std::vector<Entry> m_entries;
+    uint32_t m_cCreated;
+};
@@ -0,0 +1,539 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include "FrameLayout.h"
+
+//////////////////////////////////////////////////////////////////////////
+//  CFrameBufferPool
+//
+//  Description:
+//  Pool of 64-byte-aligned buffers for frames the renderer produces on
+//  the CPU (for example a decoded frame gathered from a multi-buffer
+//  sample into the padded layout PlanFrame describes).
+//
+//  Buffers are grouped in size classes. A class is created for the size
+//  of the negotiated format (Reserve, called when the media type is set)
+//  and holds up to SlotsPerClass buffers. Acquire hands out the smallest
+//  class that fits; released buffers go back on the class's free list.
+//  When the format changes, Retire gives up the old format's class: its
+//  idle buffers are freed at once, the leased ones when they come back,
+//  and the class can then be reused for another size.
+//  The free list is a lock-free stack of slot indices with a tag
+//  against ABA, so once the pool is warm, Acquire and Release neither
+//  lock nor allocate.
+//
+//  A buffer is held through a Lease. Copying a lease adds a reference;
+//  the buffer returns to the pool when the last lease goes away. When a
+//  class is exhausted, or no class is big enough and none can be added,
+//  Acquire falls back to a one-off allocation that is freed on release.
+//
+//  GetBytesAllocated reports the memory the pool holds, for the memory
+//  budget. GetAllocationCount counts every buffer allocation. CNoAllocationScope
+//  uses it to check that a stretch of steady-state frames allocated
+//  nothing.
+//
+//  The pool must outlive every lease. This header has no Windows
+//  dependencies.
+//////////////////////////////////////////////////////////////////////////
+
+class CFrameBufferPool
+{
+public:
+
+    static const size_t Alignment = 64;
+    static const uint32_t ClassCount = 8;
+    static const uint32_t SlotsPerClass = 16;
+
+private:
+
+    struct Buffer
+    {
+        std::atomic<uint32_t> cRef;
+        uint32_t ClassIndex;            // ClassCount for a one-off buffer.
+        uint32_t SlotIndex;
+        size_t cbCapacity;
+        CFrameBufferPool* pPool;
+
+        uint8_t* Data(void)
+        {
+            return reinterpret_cast<uint8_t*>(this) + HeaderSize;
+        }
+    };
+
+    // The header sits in front of the data and keeps it aligned.
+    static const size_t HeaderSize = (sizeof(Buffer) + Alignment - 1) / Alignment * Alignment;
+
+public:
+
+    class Lease
+    {
+    public:
+
+        Lease(void) :
+            m_pBuffer(nullptr)
+        {
+        }
+
+        Lease(const Lease& other) :
+            m_pBuffer(other.m_pBuffer)
+        {
+            if (m_pBuffer != nullptr)
+            {
+                m_pBuffer->cRef.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        Lease(Lease&& other) noexcept :
+            m_pBuffer(std::exchange(other.m_pBuffer, nullptr))
+        {
+        }
+
+        Lease& operator=(Lease other) noexcept
+        {
+            std::swap(m_pBuffer, other.m_pBuffer);
+            return *this;
+        }
+
+        ~Lease(void)
+        {
+            Reset();
+        }
+
+        explicit operator bool(void) const
+        {
+            return m_pBuffer != nullptr;
+        }
+
+        uint8_t* Data(void) const
+        {
+            return m_pBuffer != nullptr ? m_pBuffer->Data() : nullptr;
+        }
+
+        size_t Capacity(void) const
+        {
+            return m_pBuffer != nullptr ? m_pBuffer->cbCapacity : 0;
+        }
+
+        void Reset(void)
+        {
+            Buffer* pBuffer = std::exchange(m_pBuffer, nullptr);
+            if (pBuffer != nullptr && pBuffer->cRef.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                pBuffer->pPool->Recycle(pBuffer);
+            }
+        }
+
+    private:
+
+        friend class CFrameBufferPool;
+
+        explicit Lease(Buffer* pBuffer) :
+            m_pBuffer(pBuffer)
+        {
+        }
+
+        Buffer* m_pBuffer;
+    };
+
+
+    CFrameBufferPool(void) :
+        m_cAllocations(0),
+        m_cbAllocated(0)
+    {
+    }
+
+    ~CFrameBufferPool(void)
+    {
+        for (SizeClass& sizeClass : m_classes)
+        {
+            const uint32_t cSlots = sizeClass.cSlots.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < cSlots; i++)
+            {
+                FreeBuffer(sizeClass.Slots[i].pBuffer);
+            }
+        }
+    }
+
+    //-------------------------------------------------------------------
+    // Name: Reserve
+    // Description: Makes sure a size class for cbSize exists and holds
+    //              at least cBuffers buffers. Call it when the format is
+    //              negotiated, so that the frames that follow do not
+    //              allocate. Returns false if that was not possible.
+    //-------------------------------------------------------------------
+
+    bool Reserve(size_t cbSize, uint32_t cBuffers)
+    {
+        const uint32_t iClass = FindOrAddClass(cbSize);
+        if (iClass == ClassCount)
+        {
+            return false;
+        }
+
+        SizeClass& sizeClass = m_classes[iClass];
+
+        while (sizeClass.cSlots.load(std::memory_order_acquire) < cBuffers)
+        {
+            uint32_t iSlot = 0;
+            Buffer* pBuffer = AllocateSlot(iClass, &iSlot);
+            if (pBuffer == nullptr)
+            {
+                return false;
+            }
+            Push(sizeClass, iSlot);
+        }
+
+        return true;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: Retire
+    // Description: Gives up the class Reserve made for cbSize. Acquire
+    //              no longer uses it; its idle buffers are freed now and
+    //              the leased ones when their last lease goes away. Once
+    //              all are freed the class can hold another size. The
+    //              caller makes sure no Acquire for cbSize is in progress
+    //              (the sink retires the old size on a format change).
+    //-------------------------------------------------------------------
+
+    void Retire(size_t cbSize)
+    {
+        std::lock_guard<std::mutex> lock(m_addClassLock);
+
+        const size_t cbClass = AlignUp(cbSize, ClassGranularity);
+
+        for (SizeClass& sizeClass : m_classes)
+        {
+            if (sizeClass.cbSize.load(std::memory_order_relaxed) == cbClass && !sizeClass.IsRetired.load(std::memory_order_relaxed))
+            {
+                sizeClass.IsRetired.store(true, std::memory_order_seq_cst);
+                (void)TryReclaim(sizeClass);
+            }
+        }
+    }
+
+    // Returns a buffer of at least cbSize bytes, or an empty lease if
+    // memory is exhausted.
+    Lease Acquire(size_t cbSize)
+    {
+        Buffer* pBuffer = nullptr;
+        const uint32_t iClass = FindOrAddClass(cbSize);
+
+        if (iClass != ClassCount)
+        {
+            SizeClass& sizeClass = m_classes[iClass];
+
+            uint32_t iSlot = Pop(sizeClass);
+            if (iSlot != NoSlot)
+            {
+                pBuffer = sizeClass.Slots[iSlot].pBuffer;
+            }
+            else
+            {
+                pBuffer = AllocateSlot(iClass, &iSlot);
+            }
+        }
+
+        if (pBuffer == nullptr)
+        {
+            pBuffer = AllocateBuffer(cbSize, ClassCount, NoSlot);
+        }
+
+        if (pBuffer == nullptr)
+        {
+            return Lease();
+        }
+
+        pBuffer->cRef.store(1, std::memory_order_relaxed);
+        return Lease(pBuffer);
+    }
+
+    // Number of buffers allocated since the pool was created.
+    uint64_t GetAllocationCount(void) const
+    {
+        return m_cAllocations.load(std::memory_order_relaxed);
+    }
+
+    // Bytes of buffer memory currently allocated, pooled or not.
+    uint64_t GetBytesAllocated(void) const
+    {
+        return m_cbAllocated.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    static const uint32_t NoSlot = UINT32_MAX;
+    static const size_t ClassGranularity = 4096;
+
+    struct Slot
+    {
+        Buffer* pBuffer = nullptr;              // Written once, before the slot is first pushed.
+        std::atomic<uint32_t> Next{ 0 };        // Free list link: slot index + 1, or 0.
+    };
+
+    struct SizeClass
+    {
+        std::atomic<size_t> cbSize{ 0 };        // 0 while the class is unused.
+        std::atomic<bool> IsRetired{ false };   // Retire gave the class up; Acquire skips it.
+        std::atomic<uint64_t> Head{ 0 };        // Tag in the high half, slot index + 1 in the low half.
+        std::atomic<uint32_t> cSlots{ 0 };      // Slots that were given a buffer.
+        std::atomic<uint32_t> cFreed{ 0 };      // Slots whose buffer was freed, or never allocated.
+        Slot Slots[SlotsPerClass];
+    };
+
+    CFrameBufferPool(const CFrameBufferPool&) = delete;
+    CFrameBufferPool& operator=(const CFrameBufferPool&) = delete;
+
+    static size_t AlignUp(size_t cb, size_t alignment)
+    {
+        return (cb + alignment - 1) / alignment * alignment;
+    }
+
+    // Smallest class that fits cbSize, adding one if none does. Returns
+    // ClassCount if all classes are taken by smaller sizes.
+    uint32_t FindOrAddClass(size_t cbSize)
+    {
+        uint32_t iClass = FindClass(cbSize);
+
+        if (iClass == ClassCount)
+        {
+            std::lock_guard<std::mutex> lock(m_addClassLock);
+
+            iClass = FindClass(cbSize);
+            for (uint32_t i = 0; iClass == ClassCount && i < ClassCount; i++)
+            {
+                if (m_classes[i].cbSize.load(std::memory_order_relaxed) == 0 || TryReclaim(m_classes[i]))
+                {
+                    m_classes[i].cbSize.store(AlignUp(cbSize, ClassGranularity), std::memory_order_release);
+                    iClass = i;
+                }
+            }
+        }
+
+        return iClass;
+    }
+
+    uint32_t FindClass(size_t cbSize) const
+    {
+        uint32_t iBest = ClassCount;
+        size_t cbBest = SIZE_MAX;
+
+        for (uint32_t i = 0; i < ClassCount; i++)
+        {
+            const size_t cbClass = m_classes[i].cbSize.load(std::memory_order_acquire);
+            if (cbClass >= cbSize && cbClass < cbBest && !m_classes[i].IsRetired.load(std::memory_order_acquire))
+            {
+                iBest = i;
+                cbBest = cbClass;
+            }
+        }
+
+        return iBest;
+    }
+
+    // Gives a new slot of class iClass a buffer. The buffer belongs to
+    // the caller until it is pushed or recycled.
+    Buffer* AllocateSlot(uint32_t iClass, uint32_t* piSlot)
+    {
+        SizeClass& sizeClass = m_classes[iClass];
+
+        uint32_t iSlot = sizeClass.cSlots.load(std::memory_order_relaxed);
+        do
+        {
+            if (iSlot >= SlotsPerClass)
+            {
+                return nullptr;
+            }
+        } while (!sizeClass.cSlots.compare_exchange_weak(iSlot, iSlot + 1, std::memory_order_acq_rel));
+
+        Buffer* pBuffer = AllocateBuffer(sizeClass.cbSize.load(std::memory_order_relaxed), iClass, iSlot);
+        sizeClass.Slots[iSlot].pBuffer = pBuffer;
+
+        if (pBuffer == nullptr)
+        {
+            // The slot stays empty; the destructor skips it.
+            sizeClass.cFreed.fetch_add(1, std::memory_order_acq_rel);
+            return nullptr;
+        }
+
+        *piSlot = iSlot;
+        return pBuffer;
+    }
+
+    Buffer* AllocateBuffer(size_t cbCapacity, uint32_t iClass, uint32_t iSlot)
+    {
+        void* pMemory = ::operator new(HeaderSize + cbCapacity, std::align_val_t(Alignment), std::nothrow);
+        if (pMemory == nullptr)
+        {
+            return nullptr;
+        }
+
+        m_cAllocations.fetch_add(1, std::memory_order_relaxed);
+        m_cbAllocated.fetch_add(HeaderSize + cbCapacity, std::memory_order_relaxed);
+
+        Buffer* pBuffer = new (pMemory) Buffer;
+        pBuffer->cRef.store(0, std::memory_order_relaxed);
+        pBuffer->ClassIndex = iClass;
+        pBuffer->SlotIndex = iSlot;
+        pBuffer->cbCapacity = cbCapacity;
+        pBuffer->pPool = this;
+        return pBuffer;
+    }
+
+    void FreeBuffer(Buffer* pBuffer)
+    {
+        if (pBuffer != nullptr)
+        {
+            m_cbAllocated.fetch_sub(HeaderSize + pBuffer->cbCapacity, std::memory_order_relaxed);
+            pBuffer->~Buffer();
+            ::operator delete(pBuffer, std::align_val_t(Alignment));
+        }
+    }
+
+    void Recycle(Buffer* pBuffer)
+    {
+        if (pBuffer->ClassIndex == ClassCount)
+        {
+            FreeBuffer(pBuffer);
+            return;
+        }
+
+        SizeClass& sizeClass = m_classes[pBuffer->ClassIndex];
+
+        if (sizeClass.IsRetired.load(std::memory_order_seq_cst))
+        {
+            FreeSlot(sizeClass, pBuffer->SlotIndex);
+        }
+        else
+        {
+            // If Retire runs meanwhile, the buffer stays on the free list
+            // until TryReclaim drains it.
+            Push(sizeClass, pBuffer->SlotIndex);
+        }
+    }
+
+    void FreeSlot(SizeClass& sizeClass, uint32_t iSlot)
+    {
+        FreeBuffer(std::exchange(sizeClass.Slots[iSlot].pBuffer, nullptr));
+        sizeClass.cFreed.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    //-------------------------------------------------------------------
+    // Name: TryReclaim
+    // Description: Frees the idle buffers of a retired class. Once every
+    //              buffer of the class is freed, marks it unused and
+    //              returns true. Caller holds m_addClassLock.
+    //-------------------------------------------------------------------
+
+    bool TryReclaim(SizeClass& sizeClass)
+    {
+        if (!sizeClass.IsRetired.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+
+        uint32_t iSlot = Pop(sizeClass);
+        while (iSlot != NoSlot)
+        {
+            FreeSlot(sizeClass, iSlot);
+            iSlot = Pop(sizeClass);
+        }
+
+        if (sizeClass.cFreed.load(std::memory_order_acquire) != sizeClass.cSlots.load(std::memory_order_acquire))
+        {
+            return false;           // Some buffers are still leased.
+        }
+
+        sizeClass.cSlots.store(0, std::memory_order_relaxed);
+        sizeClass.cFreed.store(0, std::memory_order_relaxed);
+        sizeClass.cbSize.store(0, std::memory_order_relaxed);
+        sizeClass.IsRetired.store(false, std::memory_order_release);
+        return true;
+    }
+
+    static void Push(SizeClass& sizeClass, uint32_t iSlot)
+    {
+        uint64_t head = sizeClass.Head.load(std::memory_order_relaxed);
+        uint64_t newHead;
+
+        do
+        {
+            sizeClass.Slots[iSlot].Next.store((uint32_t)head, std::memory_order_relaxed);
+            newHead = (((head >> 32) + 1) << 32) | (iSlot + 1);
+        } while (!sizeClass.Head.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    static uint32_t Pop(SizeClass& sizeClass)
+    {
+        uint64_t head = sizeClass.Head.load(std::memory_order_acquire);
+        uint64_t newHead;
+
+        do
+        {
+            const uint32_t top = (uint32_t)head;
+            if (top == 0)
+            {
+                return NoSlot;
+            }
+
+            // The tag changes on every push and pop, so a slot that was
+            // popped and pushed again in between makes the CAS fail.
+            const uint32_t next = sizeClass.Slots[top - 1].Next.load(std::memory_order_relaxed);
+            newHead = (((head >> 32) + 1) << 32) | next;
+        } while (!sizeClass.Head.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire));
+
+        return (uint32_t)head - 1;
+    }
+
+    SizeClass m_classes[ClassCount];
+    std::mutex m_addClassLock;                  // Serializes adding a class; lookups do not take it.
+    std::atomic<uint64_t> m_cAllocations;
+    std::atomic<uint64_t> m_cbAllocated;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//  CNoAllocationScope
+//
+//  Description:
+//  Test hook: records the pool's allocation count on construction.
+//  AllocationCount() reports how many buffers were allocated since; in
+//  debug builds the destructor asserts that there were none.
+//
+//      CNoAllocationScope scope(pool);
+//      for (...) { ProcessFrame(); }
+//////////////////////////////////////////////////////////////////////////
+
+class CNoAllocationScope
+{
+public:
+
+    explicit CNoAllocationScope(const CFrameBufferPool& pool) :
+        m_pool(pool),
+        m_cStart(pool.GetAllocationCount())
+    {
+    }
+
+    ~CNoAllocationScope(void)
+    {
+        assert(AllocationCount() == 0);
+    }
+
+    uint64_t AllocationCount(void) const
+    {
+        return m_pool.GetAllocationCount() - m_cStart;
+    }
+
+private:
+
+    CNoAllocationScope(const CNoAllocationScope&) = delete;
+    CNoAllocationScope& operator=(const CNoAllocationScope&) = delete;
+
+    const CFrameBufferPool& m_pool;
+    const uint64_t m_cStart;
+};
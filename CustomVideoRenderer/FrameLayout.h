@@ -0,0 +1,284 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+//////////////////////////////////////////////////////////////////////////
+//  Frame layout
+//
+//  Describes where the planes of an uncompressed video frame are in
+//  memory, given what IMF2DBuffer::Lock2D returns: the first scan line
+//  and the stride. The system-memory path hands these planes to the
+//  frame callback without copying.
+//
+//  Formats are identified by the Data1 member of the Media Foundation
+//  subtype GUID: the FOURCC for YUV formats, the D3DFORMAT value for RGB
+//  formats. This header has no Windows dependencies.
+//
+//  Frames the renderer lays out itself (PlanFrame, padded) use padded
+//  strides: a multiple of 64 bytes that is never a multiple of 4 KiB.
+//  With a power-of-two width (2048, 4096) the natural stride is a
+//  multiple of 4 KiB, so the rows a vertical filter reads together land
+//  in the same cache set and alias at 4 KiB in the load/store unit. For
+//  the same reason the planes start at different offsets within a 4 KiB
+//  page, so a row of Y and the matching row of UV do not alias.
+//////////////////////////////////////////////////////////////////////////
+
+constexpr uint32_t MakeFourCC(char a, char b, char c, char d)
+{
+    return (uint32_t)(uint8_t)a | ((uint32_t)(uint8_t)b << 8) | ((uint32_t)(uint8_t)c << 16) | ((uint32_t)(uint8_t)d << 24);
+}
+
+enum class FramePlaneLayout
+{
+    Packed,                 // One plane (RGB, YUY2, AYUV, ...).
+    SemiPlanar420,          // Luma plane, then one interleaved chroma plane at half height (NV12, P010).
+    Planar420               // Luma plane, then two chroma planes at half width and height (I420, YV12).
+};
+
+struct FrameFormatInfo
+{
+    uint32_t Format;            // Subtype Data1.
+    FramePlaneLayout Layout;
+    uint32_t BitsPerPixel;      // Packed: bits per pixel. Planar: bits per luma sample.
+    uint32_t WidthAlign;        // The width must be a multiple of this.
+    bool BottomUpAllowed;       // May be stored bottom-up, with a negative stride.
+};
+
+struct FramePlane
+{
+    uint8_t* pData;             // First byte of the top row.
+    int32_t Stride;             // Bytes from one row to the next; negative for bottom-up.
+    uint32_t RowBytes;          // Bytes of image data per row.
+    uint32_t Rows;
+};
+
+struct FrameLayout
+{
+    uint32_t cPlanes;
+    FramePlane Planes[3];       // In memory order; YV12 stores V before U.
+};
+
+// Planes of a frame as offsets into a buffer that does not exist yet.
+struct FrameBufferPlan
+{
+    uint32_t cPlanes;
+    int64_t Offset[3];          // Top row of each plane, from the start of the buffer.
+    int32_t Stride[3];
+    uint32_t RowBytes[3];
+    uint32_t Rows[3];
+    size_t cbSize;              // Bytes the buffer needs.
+};
+
+const uint32_t FrameRowAlign = 64;              // Cache line.
+const uint32_t FrameAliasPeriod = 4096;         // Page; also the 4K-aliasing period.
+const uint32_t FramePlaneStagger = 1024 + 64;   // Offset of each plane's base within a page.
+
+
+// Returns the description of a format, or nullptr if the system-memory
+// path cannot describe it.
+inline const FrameFormatInfo* FindFrameFormat(uint32_t format)
+{
+    static const FrameFormatInfo s_formats[] =
+    {
+        { MakeFourCC('N', 'V', '1', '2'), FramePlaneLayout::SemiPlanar420, 8, 2, false },
+        { MakeFourCC('P', '0', '1', '0'), FramePlaneLayout::SemiPlanar420, 16, 2, false },
+        { MakeFourCC('I', '4', '2', '0'), FramePlaneLayout::Planar420, 8, 2, false },
+        { MakeFourCC('I', 'Y', 'U', 'V'), FramePlaneLayout::Planar420, 8, 2, false },
+        { MakeFourCC('Y', 'V', '1', '2'), FramePlaneLayout::Planar420, 8, 2, false },
+        { MakeFourCC('Y', 'U', 'Y', '2'), FramePlaneLayout::Packed, 16, 2, false },
+        { MakeFourCC('U', 'Y', 'V', 'Y'), FramePlaneLayout::Packed, 16, 2, false },
+        { MakeFourCC('Y', 'V', 'Y', 'U'), FramePlaneLayout::Packed, 16, 2, false },
+        { MakeFourCC('A', 'Y', 'U', 'V'), FramePlaneLayout::Packed, 32, 1, false },
+        { 20 /* D3DFMT_R8G8B8 */,         FramePlaneLayout::Packed, 24, 1, true },
+        { 21 /* D3DFMT_A8R8G8B8 */,       FramePlaneLayout::Packed, 32, 1, true },
+        { 22 /* D3DFMT_X8R8G8B8 */,       FramePlaneLayout::Packed, 32, 1, true },
+        { 23 /* D3DFMT_R5G6B5 */,         FramePlaneLayout::Packed, 16, 1, true },
+        { 24 /* D3DFMT_X1R5G5B5 */,       FramePlaneLayout::Packed, 16, 1, true },
+    };
+
+    for (const FrameFormatInfo& info : s_formats)
+    {
+        if (info.Format == format)
+        {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+// Row pitch for rowBytes bytes of pixels: rounded up to a cache line,
+// then one more cache line if that is a multiple of 4 KiB.
+inline uint32_t GetPaddedStride(uint64_t rowBytes)
+{
+    uint64_t stride = (rowBytes + FrameRowAlign - 1) / FrameRowAlign * FrameRowAlign;
+    if (stride % FrameAliasPeriod == 0)
+    {
+        stride += FrameRowAlign;
+    }
+    return (uint32_t)stride;
+}
+
+//-------------------------------------------------------------------
+// Name: PlanFrame
+// Description: Fills in the planes of a width x height frame. With
+//              padded false this is the layout of a contiguous buffer
+//              with the given luma stride, as IMFMediaBuffer::Lock
+//              returns it: the chroma planes follow the luma plane
+//              directly. With padded true the stride is ignored, every
+//              plane gets a padded stride and each plane's base is
+//              staggered within a 4 KiB page.
+//-------------------------------------------------------------------
+
+inline bool PlanFrame(
+    const FrameFormatInfo& info,
+    bool padded,
+    int32_t stride,
+    uint32_t width,
+    uint32_t height,
+    FrameBufferPlan* pPlan)
+{
+    if (width == 0 || height == 0 || (width % info.WidthAlign) != 0)
+    {
+        return false;
+    }
+
+    const uint64_t lumaRowBytes = (uint64_t)width * info.BitsPerPixel / 8;
+    const uint32_t chromaRows = (height + 1) / 2;
+
+    if (padded)
+    {
+        stride = (int32_t)GetPaddedStride(lumaRowBytes);
+    }
+    else if (stride < 0 && !info.BottomUpAllowed)
+    {
+        return false;
+    }
+
+    const uint64_t absStride = stride < 0 ? (uint64_t)(-(int64_t)stride) : (uint64_t)stride;
+    if (absStride < lumaRowBytes)
+    {
+        return false;
+    }
+
+    FrameBufferPlan plan = {};
+    plan.Stride[0] = stride;
+    plan.RowBytes[0] = (uint32_t)lumaRowBytes;
+    plan.Rows[0] = height;
+    plan.cPlanes = 1;
+
+    if (info.Layout == FramePlaneLayout::SemiPlanar420)
+    {
+        plan.Stride[1] = stride;
+        plan.RowBytes[1] = (uint32_t)lumaRowBytes;
+        plan.Rows[1] = chromaRows;
+        plan.cPlanes = 2;
+    }
+    else if (info.Layout == FramePlaneLayout::Planar420)
+    {
+        if ((stride % 2) != 0)
+        {
+            return false;
+        }
+
+        const uint32_t chromaRowBytes = (uint32_t)(lumaRowBytes / 2);
+        const int32_t chromaStride = padded ? (int32_t)GetPaddedStride(chromaRowBytes) : stride / 2;
+
+        for (uint32_t i = 1; i < 3; i++)
+        {
+            plan.Stride[i] = chromaStride;
+            plan.RowBytes[i] = chromaRowBytes;
+            plan.Rows[i] = chromaRows;
+        }
+        plan.cPlanes = 3;
+    }
+
+    uint64_t cbSize = 0;
+    for (uint32_t i = 0; i < plan.cPlanes; i++)
+    {
+        const uint64_t cbPlane = (uint64_t)(plan.Stride[i] < 0 ? -(int64_t)plan.Stride[i] : plan.Stride[i]) * plan.Rows[i];
+        uint64_t base = cbSize;
+
+        if (padded && i > 0)
+        {
+            base = (cbSize + FrameAliasPeriod - 1) / FrameAliasPeriod * FrameAliasPeriod + FramePlaneStagger * i;
+        }
+
+        // A bottom-up plane's top row is its last row in memory.
+        plan.Offset[i] = (int64_t)base + (plan.Stride[i] < 0 ? (int64_t)cbPlane + plan.Stride[i] : 0);
+        cbSize = base + cbPlane;
+    }
+    plan.cbSize = (size_t)cbSize;
+
+    *pPlan = plan;
+    return true;
+}
+
+// Turns a plan into plane pointers for the buffer at pBase.
+inline void ApplyFramePlan(const FrameBufferPlan& plan, uint8_t* pBase, FrameLayout* pLayout)
+{
+    FrameLayout layout = {};
+    layout.cPlanes = plan.cPlanes;
+
+    for (uint32_t i = 0; i < plan.cPlanes; i++)
+    {
+        layout.Planes[i] = { pBase + plan.Offset[i], plan.Stride[i], plan.RowBytes[i], plan.Rows[i] };
+    }
+
+    *pLayout = layout;
+}
+
+//-------------------------------------------------------------------
+// Name: DescribeFrame
+// Description: Fills in the planes of a width x height frame whose top
+//              row is at pScanline0. Chroma planes follow the luma
+//              plane and use the same stride (semi-planar) or half of
+//              it (planar), as Lock2D lays them out.
+//
+//              If pBufferStart is not null, every byte of every plane
+//              must lie inside [pBufferStart, pBufferStart + cbBuffer).
+//              Returns false if the frame is malformed or does not fit.
+//-------------------------------------------------------------------
+
+inline bool DescribeFrame(
+    const FrameFormatInfo& info,
+    uint8_t* pScanline0,
+    int32_t stride,
+    uint32_t width,
+    uint32_t height,
+    const uint8_t* pBufferStart,
+    size_t cbBuffer,
+    FrameLayout* pLayout)
+{
+    FrameBufferPlan plan;
+    if (pScanline0 == nullptr || !PlanFrame(info, false, stride, width, height, &plan))
+    {
+        return false;
+    }
+
+    // The plan is relative to the start of the buffer; pScanline0 is the
+    // top row of the first plane.
+    FrameLayout layout;
+    ApplyFramePlan(plan, pScanline0 - plan.Offset[0], &layout);
+
+    if (pBufferStart != nullptr)
+    {
+        const uintptr_t bufferBegin = (uintptr_t)pBufferStart;
+        const uintptr_t bufferEnd = bufferBegin + cbBuffer;
+
+        for (uint32_t i = 0; i < layout.cPlanes; i++)
+        {
+            const FramePlane& plane = layout.Planes[i];
+            const int64_t lastRowOffset = (int64_t)plane.Stride * (plane.Rows - 1);
+            const uintptr_t first = (uintptr_t)plane.pData + (lastRowOffset < 0 ? lastRowOffset : 0);
+            const uintptr_t last = (uintptr_t)plane.pData + (lastRowOffset > 0 ? lastRowOffset : 0) + plane.RowBytes;
+
+            if (first < bufferBegin || last > bufferEnd || first > last)
+            {
+                return false;
+            }
+        }
+    }
+
+    *pLayout = layout;
+    return true;
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+//////////////////////////////////////////////////////////////////////////
+//  CFrameStepQueue [template]
+//
+//  Description:
+//  Frames a paused stream holds for frame stepping, oldest first.
+//
+//  In step mode the sink keeps requesting samples while paused, but
+//  offers each one to the queue instead of presenting it, so the frames
+//  the decoder has ready wait here already decoded. Each Step hands back
+//  the oldest one to present. A Step that finds the queue empty is
+//  remembered, and the next frame offered is presented at once instead
+//  of being held.
+//
+//  A frame offered to a full queue (one that arrived without being asked
+//  for) pushes the oldest frame out to be presented, so no frame is lost
+//  and the order is kept.
+//
+//  Not thread-safe: the caller serializes all calls except GetCount,
+//  which may be read from any thread. This header has no Windows
+//  dependencies.
+//////////////////////////////////////////////////////////////////////////
+
+enum class FrameStepAction
+{
+    Hold,           // The queue kept the frame.
+    Present,        // A Step was waiting for this frame; present it.
+    Evict           // The queue was full; the frame now holds the oldest one, present that.
+};
+
+template <class T, size_t N>
+class CFrameStepQueue
+{
+    static_assert(N != 0, "CFrameStepQueue needs room for one frame");
+
+public:
+
+    CFrameStepQueue(void) :
+        m_iHead(0),
+        m_cSteps(0),
+        m_cFrames(0)
+    {
+    }
+
+    // Offers a frame that just arrived. On Hold the queue has taken it
+    // and frame is left empty.
+    FrameStepAction Offer(T& frame)
+    {
+        if (m_cSteps != 0)
+        {
+            m_cSteps--;
+            return FrameStepAction::Present;
+        }
+
+        const size_t cFrames = GetCount();
+
+        if (cFrames == N)
+        {
+            std::swap(frame, m_frames[m_iHead]);
+            m_iHead = (m_iHead + 1) % N;
+            return FrameStepAction::Evict;
+        }
+
+        m_frames[(m_iHead + cFrames) % N] = std::move(frame);
+        frame = T();
+        m_cFrames.store((uint32_t)(cFrames + 1), std::memory_order_relaxed);
+        return FrameStepAction::Hold;
+    }
+
+    // Moves the oldest frame to *pFrame and returns true, or, if there is
+    // none, remembers the step for the next frame offered and returns
+    // false. At most N steps are remembered.
+    bool Step(T* pFrame)
+    {
+        if (GetCount() == 0)
+        {
+            if (m_cSteps < N)
+            {
+                m_cSteps++;
+            }
+            return false;
+        }
+
+        *pFrame = Pop();
+        return true;
+    }
+
+    // Moves up to cMax frames to pFrames, oldest first, forgets the
+    // remembered steps and returns the number moved.
+    size_t Take(T* pFrames, size_t cMax)
+    {
+        size_t cTaken = 0;
+
+        while (cTaken < cMax && GetCount() != 0)
+        {
+            pFrames[cTaken++] = Pop();
+        }
+
+        m_cSteps = 0;
+        return cTaken;
+    }
+
+    // Drops the held frames and the remembered steps.
+    void Clear(void)
+    {
+        while (GetCount() != 0)
+        {
+            (void)Pop();
+        }
+
+        m_cSteps = 0;
+    }
+
+    uint32_t GetCount(void) const
+    {
+        return m_cFrames.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    CFrameStepQueue(const CFrameStepQueue&) = delete;
+    CFrameStepQueue& operator=(const CFrameStepQueue&) = delete;
+
+    T Pop(void)
+    {
+        T frame = std::move(m_frames[m_iHead]);
+        m_frames[m_iHead] = T();
+        m_iHead = (m_iHead + 1) % N;
+        m_cFrames.store(GetCount() - 1, std::memory_order_relaxed);
+        return frame;
+    }
+
+    T m_frames[N];
+    size_t m_iHead;
+    size_t m_cSteps;
+    std::atomic<uint32_t> m_cFrames;    // Written by the caller's thread, read by any.
+};
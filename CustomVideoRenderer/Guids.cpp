@@ -0,0 +1,5 @@
+// Defines the GUIDs declared with DEFINE_GUID in CustomVideoRenderer.h.
+// Every other translation unit only sees their declarations.
+#include <windows.h>
+#include <initguid.h>
+#include "CustomVideoRenderer.h"
@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//////////////////////////////////////////////////////////////////////////
+//  CLockFreeQueue [template]
+//
+//  Description:
+//  Bounded lock-free FIFO over a preallocated ring of N cells (Vyukov's
+//  bounded queue). Any number of threads may push and pop concurrently;
+//  neither operation allocates or blocks. TryPush fails when the ring is
+//  full, TryPop when it is empty.
+//
+//  Each cell carries a sequence number that says whose turn it is: a
+//  pusher owns the cell when the sequence equals its ticket, a popper
+//  when it equals ticket + 1. Publishing a value is a release store of
+//  the sequence, so the value is visible to the thread that claims it.
+//
+//  T must be cheap to copy (the media event queue stores raw pointers).
+//  This header has no Windows dependencies.
+//////////////////////////////////////////////////////////////////////////
+
+template<class T, size_t N>
+class CLockFreeQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "CLockFreeQueue size must be a power of two");
+
+public:
+
+    CLockFreeQueue(void) :
+        m_enqueuePos(0),
+        m_dequeuePos(0)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            m_cells[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool TryPush(const T& value)
+    {
+        Cell* pCell = nullptr;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            pCell = &m_cells[pos & (N - 1)];
+            const size_t seq = pCell->Sequence.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+            if (dif == 0)
+            {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0)
+            {
+                return false;       // Full.
+            }
+            else
+            {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        pCell->Value = value;
+        pCell->Sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T* pValue)
+    {
+        Cell* pCell = nullptr;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            pCell = &m_cells[pos & (N - 1)];
+            const size_t seq = pCell->Sequence.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (dif == 0)
+            {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0)
+            {
+                return false;       // Empty.
+            }
+            else
+            {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        *pValue = pCell->Value;
+        pCell->Sequence.store(pos + N, std::memory_order_release);
+        return true;
+    }
+
+    // True if the oldest cell holds no published value. Exact only when
+    // nobody is pushing or popping; otherwise a snapshot.
+    bool IsEmpty(void) const
+    {
+        const size_t pos = m_dequeuePos.load(std::memory_order_acquire);
+        const size_t seq = m_cells[pos & (N - 1)].Sequence.load(std::memory_order_acquire);
+        return (intptr_t)seq - (intptr_t)(pos + 1) < 0;
+    }
+
+private:
+
+    struct Cell
+    {
+        std::atomic<size_t> Sequence;
+        T Value;
+    };
+
+    CLockFreeQueue(const CLockFreeQueue&) = delete;
+    CLockFreeQueue& operator=(const CLockFreeQueue&) = delete;
+
+    // Pushers and poppers work on different counters; keep them on
+    // different cache lines.
+    Cell m_cells[N];
+    alignas(64) std::atomic<size_t> m_enqueuePos;
+    alignas(64) std::atomic<size_t> m_dequeuePos;
+};
@@ -0,0 +1,198 @@
+#include "LockStats.h"
+
+#ifdef CVR_LOCK_STATS
+
+#include <atomic>
+#include <chrono>
+
+namespace LockStats
+{
+    namespace
+    {
+        // Counters of one thread. Only the owning thread writes them, so a
+        // relaxed load + store is enough; readers may see a slightly stale
+        // value but never a torn one.
+        struct SiteCounters
+        {
+            std::atomic<uint64_t> Acquires;
+            std::atomic<uint64_t> Contended;
+            std::atomic<uint64_t> WaitNs;
+            std::atomic<uint64_t> HoldNs;
+            std::atomic<uint64_t> WaitHistogram[HistogramBuckets];
+            std::atomic<uint64_t> HoldHistogram[HistogramBuckets];
+        };
+
+        struct ThreadBlock
+        {
+            std::atomic<bool>   InUse;
+            ThreadBlock*        pNext;      // Immutable once the block is published.
+            SiteCounters        Sites[MaxSites];
+        };
+
+        std::atomic<const char*>    s_siteNames[MaxSites];
+        std::atomic<uint32_t>       s_siteCount(0);
+        std::atomic<ThreadBlock*>   s_blocks(nullptr);
+
+        inline void Add(std::atomic<uint64_t>& counter, uint64_t value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        uint32_t Bucket(uint64_t ns)
+        {
+            uint64_t us = ns / 1000;
+            uint32_t bucket = 0;
+            while (us != 0 && bucket < HistogramBuckets - 1)
+            {
+                us >>= 1;
+                bucket++;
+            }
+            return bucket;
+        }
+
+        // Blocks are never freed. A thread that exits hands its block back
+        // (keeping the counts) and the next new thread reuses it, so the
+        // list is bounded by the peak number of concurrent threads.
+        ThreadBlock* ClaimBlock(void)
+        {
+            for (ThreadBlock* p = s_blocks.load(std::memory_order_acquire); p != nullptr; p = p->pNext)
+            {
+                bool expected = false;
+                if (!p->InUse.load(std::memory_order_relaxed) &&
+                    p->InUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                {
+                    return p;
+                }
+            }
+
+            ThreadBlock* p = new ThreadBlock();
+            p->InUse.store(true, std::memory_order_relaxed);
+
+            ThreadBlock* head = s_blocks.load(std::memory_order_relaxed);
+            do
+            {
+                p->pNext = head;
+            } while (!s_blocks.compare_exchange_weak(head, p, std::memory_order_release, std::memory_order_relaxed));
+
+            return p;
+        }
+
+        struct ThreadSlot
+        {
+            ThreadBlock* pBlock = nullptr;
+
+            ~ThreadSlot(void)
+            {
+                if (pBlock != nullptr)
+                {
+                    pBlock->InUse.store(false, std::memory_order_release);
+                }
+            }
+        };
+
+        thread_local ThreadSlot t_slot;
+
+        SiteCounters* CountersFor(SiteId site)
+        {
+            if (site.Index >= MaxSites)
+            {
+                return nullptr;
+            }
+            if (t_slot.pBlock == nullptr)
+            {
+                t_slot.pBlock = ClaimBlock();
+            }
+            return &t_slot.pBlock->Sites[site.Index];
+        }
+    }
+
+    SiteId RegisterSite(const char* name)
+    {
+        const uint32_t index = s_siteCount.fetch_add(1, std::memory_order_relaxed);
+        if (index >= MaxSites)
+        {
+            return SiteId();
+        }
+
+        s_siteNames[index].store(name, std::memory_order_release);
+        return SiteId(index);
+    }
+
+    uint32_t GetSiteCount(void)
+    {
+        const uint32_t count = s_siteCount.load(std::memory_order_relaxed);
+        return (count < MaxSites) ? count : MaxSites;
+    }
+
+    bool GetSiteSnapshot(uint32_t index, SiteSnapshot* pSnapshot)
+    {
+        if (index >= GetSiteCount() || pSnapshot == nullptr)
+        {
+            return false;
+        }
+
+        const char* name = s_siteNames[index].load(std::memory_order_acquire);
+        if (name == nullptr)
+        {
+            return false;
+        }
+
+        *pSnapshot = SiteSnapshot();
+        pSnapshot->Name = name;
+
+        for (ThreadBlock* p = s_blocks.load(std::memory_order_acquire); p != nullptr; p = p->pNext)
+        {
+            const SiteCounters& c = p->Sites[index];
+
+            pSnapshot->Acquires += c.Acquires.load(std::memory_order_relaxed);
+            pSnapshot->Contended += c.Contended.load(std::memory_order_relaxed);
+            pSnapshot->WaitNs += c.WaitNs.load(std::memory_order_relaxed);
+            pSnapshot->HoldNs += c.HoldNs.load(std::memory_order_relaxed);
+
+            for (uint32_t i = 0; i < HistogramBuckets; i++)
+            {
+                pSnapshot->WaitHistogram[i] += c.WaitHistogram[i].load(std::memory_order_relaxed);
+                pSnapshot->HoldHistogram[i] += c.HoldHistogram[i].load(std::memory_order_relaxed);
+            }
+        }
+
+        return true;
+    }
+
+    uint64_t Now(void)
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void RecordAcquire(SiteId site, bool contended, uint64_t waitNs)
+    {
+        SiteCounters* c = CountersFor(site);
+        if (c == nullptr)
+        {
+            return;
+        }
+
+        Add(c->Acquires, 1);
+        if (contended)
+        {
+            Add(c->Contended, 1);
+            Add(c->WaitNs, waitNs);
+        }
+        Add(c->WaitHistogram[Bucket(waitNs)], 1);
+    }
+
+    void RecordRelease(SiteId site, uint64_t holdNs)
+    {
+        SiteCounters* c = CountersFor(site);
+        if (c == nullptr)
+        {
+            return;
+        }
+
+        Add(c->HoldNs, holdNs);
+        Add(c->HoldHistogram[Bucket(holdNs)], 1);
+    }
+}
+
+#endif
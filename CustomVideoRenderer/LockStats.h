@@ -0,0 +1,149 @@
+#pragma once
+#include <cstdint>
+
+//////////////////////////////////////////////////////////////////////////
+//  Lock contention statistics
+//
+//  Opt-in instrumentation for the guards in CritSec.h. Build with
+//  CVR_LOCK_STATS defined (CMake option CVR_LOCK_STATS) to record, for
+//  every named call site:
+//
+//      - how often the lock was acquired,
+//      - how often the acquisition had to wait (contended),
+//      - log2 histograms of the wait time and of the hold time.
+//
+//  Recording is lock-free: each thread owns a block of counters that only
+//  it writes, and readers sum the blocks of all threads.
+//
+//  Name a call site with LOCK_SITE:
+//
+//      CAutoLock lock(&m_csState, LOCK_SITE("CustomVideoStreamSink::Start"));
+//
+//  Without CVR_LOCK_STATS, LOCK_SITE yields an empty tag and the guards
+//  compile down to a plain Lock/Unlock.
+//////////////////////////////////////////////////////////////////////////
+
+namespace LockStats
+{
+    const uint32_t MaxSites = 64;
+    const uint32_t HistogramBuckets = 16;   // Bucket 0: < 1 us; bucket i: [2^(i-1), 2^i) us; the last bucket is open-ended.
+
+#ifdef CVR_LOCK_STATS
+
+    struct SiteId
+    {
+        explicit SiteId(uint32_t index = MaxSites) :
+            Index(index)
+        {
+        }
+
+        uint32_t Index;                     // MaxSites means "not recorded".
+    };
+
+    struct SiteSnapshot
+    {
+        const char* Name;
+        uint64_t    Acquires;
+        uint64_t    Contended;
+        uint64_t    WaitNs;                 // Total time spent waiting.
+        uint64_t    HoldNs;                 // Total time the lock was held.
+        uint64_t    WaitHistogram[HistogramBuckets];
+        uint64_t    HoldHistogram[HistogramBuckets];
+    };
+
+    // Registers a call site. Call once per site; LOCK_SITE caches the result.
+    SiteId RegisterSite(const char* name);
+
+    uint32_t GetSiteCount(void);
+
+    // Sums the counters of all threads for one site. Returns false if the
+    // index is out of range or the site is still being registered.
+    bool GetSiteSnapshot(uint32_t index, SiteSnapshot* pSnapshot);
+
+    uint64_t Now(void);                     // Monotonic time, in nanoseconds.
+
+    void RecordAcquire(SiteId site, bool contended, uint64_t waitNs);
+    void RecordRelease(SiteId site, uint64_t holdNs);
+
+#define LOCK_SITE(name) \
+    ([]() -> LockStats::SiteId { static const LockStats::SiteId s_site = LockStats::RegisterSite(name); return s_site; }())
+
+#else
+
+    struct SiteId
+    {
+    };
+
+#define LOCK_SITE(name) LockStats::SiteId()
+
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  CLockProbe
+//
+//  Description:
+//  Used by the lock guards to time one acquisition and release. Without
+//  CVR_LOCK_STATS it is empty and just forwards to the lock.
+//////////////////////////////////////////////////////////////////////////
+
+#ifdef CVR_LOCK_STATS
+
+class CLockProbe
+{
+public:
+    explicit CLockProbe(LockStats::SiteId site) :
+        m_site(site),
+        m_acquiredAt(0)
+    {
+    }
+
+    template <typename TryLockFn, typename LockFn>
+    void Enter(TryLockFn tryLock, LockFn lock)
+    {
+        if (tryLock())
+        {
+            m_acquiredAt = LockStats::Now();
+            LockStats::RecordAcquire(m_site, false, 0);
+        }
+        else
+        {
+            const uint64_t start = LockStats::Now();
+            lock();
+            m_acquiredAt = LockStats::Now();
+            LockStats::RecordAcquire(m_site, true, m_acquiredAt - start);
+        }
+    }
+
+    void Leave(void)
+    {
+        LockStats::RecordRelease(m_site, LockStats::Now() - m_acquiredAt);
+    }
+
+private:
+    LockStats::SiteId   m_site;
+    uint64_t            m_acquiredAt;
+};
+
+#else
+
+class CLockProbe
+{
+public:
+    explicit CLockProbe(LockStats::SiteId)
+    {
+    }
+
+    template <typename TryLockFn, typename LockFn>
+    void Enter(TryLockFn, LockFn lock)
+    {
+        lock();
+    }
+
+    void Leave(void)
+    {
+    }
+};
+
+#endif
@@ -0,0 +1,375 @@
+#pragma once
+#include "LockFreeQueue.h"
+#include <new>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <wrl/client.h>
+
+// Number of idle events a pool keeps. Events released while the pool is
+// full are freed instead.
+#define MEDIA_EVENT_POOL_CAPACITY 32
+
+class CMediaEventPool;
+
+//////////////////////////////////////////////////////////////////////////
+//  CPooledMediaEvent
+//
+//  Description:
+//  IMFMediaEvent that goes back to the pool that made it when its last
+//  reference is released. The attribute store is created once with the
+//  event and emptied on the way back, so handing an idle event out again
+//  allocates nothing.
+//
+//  While handed out the event holds a reference on its pool, so the pool
+//  is alive when the final Release returns the event. Idle events hold
+//  none. An event is only reused after its final Release, so nobody can
+//  still see the event it was.
+//////////////////////////////////////////////////////////////////////////
+
+class CPooledMediaEvent : public IMFMediaEvent
+{
+    friend class CMediaEventPool;
+
+public:
+
+    // IUnknown
+    STDMETHODIMP_(ULONG) AddRef(void)override
+    {
+        return InterlockedIncrement(&m_nRefCount);
+    }
+
+    STDMETHODIMP_(ULONG) Release(void)override;
+
+    STDMETHODIMP QueryInterface(REFIID iid, __RPC__deref_out _Result_nullonfailure_ void** ppv)override
+    {
+        if (!ppv)
+        {
+            return E_POINTER;
+        }
+        if (iid == IID_IUnknown || iid == __uuidof(IMFMediaEvent))
+        {
+            *ppv = static_cast<IMFMediaEvent*>(this);
+        }
+        else if (iid == __uuidof(IMFAttributes))
+        {
+            *ppv = static_cast<IMFAttributes*>(this);
+        }
+        else
+        {
+            *ppv = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    // IMFMediaEvent
+    STDMETHODIMP GetType(__RPC__out MediaEventType* pmet)override
+    {
+        if (pmet == NULL)
+        {
+            return E_POINTER;
+        }
+        *pmet = m_met;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetExtendedType(__RPC__out GUID* pguidExtendedType)override
+    {
+        if (pguidExtendedType == NULL)
+        {
+            return E_POINTER;
+        }
+        *pguidExtendedType = m_guidExtendedType;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetStatus(__RPC__out HRESULT* phrStatus)override
+    {
+        if (phrStatus == NULL)
+        {
+            return E_POINTER;
+        }
+        *phrStatus = m_hrStatus;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetValue(__RPC__out PROPVARIANT* pvValue)override
+    {
+        if (pvValue == NULL)
+        {
+            return E_POINTER;
+        }
+        return PropVariantCopy(pvValue, &m_value);
+    }
+
+    // IMFAttributes, delegated to the event's attribute store.
+    STDMETHODIMP GetItem(__RPC__in REFGUID guidKey, __RPC__inout_opt PROPVARIANT* pValue)override                                  { return m_pAttributes->GetItem(guidKey, pValue); }
+    STDMETHODIMP GetItemType(__RPC__in REFGUID guidKey, __RPC__out MF_ATTRIBUTE_TYPE* pType)override                               { return m_pAttributes->GetItemType(guidKey, pType); }
+    STDMETHODIMP CompareItem(__RPC__in REFGUID guidKey, __RPC__in REFPROPVARIANT Value, __RPC__out BOOL* pbResult)override         { return m_pAttributes->CompareItem(guidKey, Value, pbResult); }
+    STDMETHODIMP Compare(__RPC__in_opt IMFAttributes* pTheirs, MF_ATTRIBUTES_MATCH_TYPE MatchType, __RPC__out BOOL* pbResult)override { return m_pAttributes->Compare(pTheirs, MatchType, pbResult); }
+    STDMETHODIMP GetUINT32(__RPC__in REFGUID guidKey, __RPC__out UINT32* punValue)override                                         { return m_pAttributes->GetUINT32(guidKey, punValue); }
+    STDMETHODIMP GetUINT64(__RPC__in REFGUID guidKey, __RPC__out UINT64* punValue)override                                         { return m_pAttributes->GetUINT64(guidKey, punValue); }
+    STDMETHODIMP GetDouble(__RPC__in REFGUID guidKey, __RPC__out double* pfValue)override                                          { return m_pAttributes->GetDouble(guidKey, pfValue); }
+    STDMETHODIMP GetGUID(__RPC__in REFGUID guidKey, __RPC__out GUID* pguidValue)override                                           { return m_pAttributes->GetGUID(guidKey, pguidValue); }
+    STDMETHODIMP GetStringLength(__RPC__in REFGUID guidKey, __RPC__out UINT32* pcchLength)override                                 { return m_pAttributes->GetStringLength(guidKey, pcchLength); }
+    STDMETHODIMP GetString(__RPC__in REFGUID guidKey, __RPC__out_ecount_full(cchBufSize) LPWSTR pwszValue, UINT32 cchBufSize, __RPC__inout_opt UINT32* pcchLength)override { return m_pAttributes->GetString(guidKey, pwszValue, cchBufSize, pcchLength); }
+    STDMETHODIMP GetAllocatedString(__RPC__in REFGUID guidKey, __RPC__deref_out_ecount_full_opt((*pcchLength + 1)) LPWSTR* ppwszValue, __RPC__out UINT32* pcchLength)override { return m_pAttributes->GetAllocatedString(guidKey, ppwszValue, pcchLength); }
+    STDMETHODIMP GetBlobSize(__RPC__in REFGUID guidKey, __RPC__out UINT32* pcbBlobSize)override                                    { return m_pAttributes->GetBlobSize(guidKey, pcbBlobSize); }
+    STDMETHODIMP GetBlob(__RPC__in REFGUID guidKey, __RPC__out_ecount_full(cbBufSize) UINT8* pBuf, UINT32 cbBufSize, __RPC__inout_opt UINT32* pcbBlobSize)override { return m_pAttributes->GetBlob(guidKey, pBuf, cbBufSize, pcbBlobSize); }
+    STDMETHODIMP GetAllocatedBlob(__RPC__in REFGUID guidKey, __RPC__deref_out_ecount_full_opt(*pcbSize) UINT8** ppBuf, __RPC__out UINT32* pcbSize)override { return m_pAttributes->GetAllocatedBlob(guidKey, ppBuf, pcbSize); }
+    STDMETHODIMP GetUnknown(__RPC__in REFGUID guidKey, __RPC__in REFIID riid, __RPC__deref_out_opt LPVOID* ppv)override           { return m_pAttributes->GetUnknown(guidKey, riid, ppv); }
+    STDMETHODIMP SetItem(__RPC__in REFGUID guidKey, __RPC__in REFPROPVARIANT Value)override                                        { return m_pAttributes->SetItem(guidKey, Value); }
+    STDMETHODIMP DeleteItem(__RPC__in REFGUID guidKey)override                                                                     { return m_pAttributes->DeleteItem(guidKey); }
+    STDMETHODIMP DeleteAllItems(void)override                                                                                      { return m_pAttributes->DeleteAllItems(); }
+    STDMETHODIMP SetUINT32(__RPC__in REFGUID guidKey, UINT32 unValue)override                                                      { return m_pAttributes->SetUINT32(guidKey, unValue); }
+    STDMETHODIMP SetUINT64(__RPC__in REFGUID guidKey, UINT64 unValue)override                                                      { return m_pAttributes->SetUINT64(guidKey, unValue); }
+    STDMETHODIMP SetDouble(__RPC__in REFGUID guidKey, double fValue)override                                                       { return m_pAttributes->SetDouble(guidKey, fValue); }
+    STDMETHODIMP SetGUID(__RPC__in REFGUID guidKey, __RPC__in REFGUID guidValue)override                                           { return m_pAttributes->SetGUID(guidKey, guidValue); }
+    STDMETHODIMP SetString(__RPC__in REFGUID guidKey, __RPC__in_string LPCWSTR wszValue)override                                   { return m_pAttributes->SetString(guidKey, wszValue); }
+    STDMETHODIMP SetBlob(__RPC__in REFGUID guidKey, __RPC__in_ecount_full(cbBufSize) const UINT8* pBuf, UINT32 cbBufSize)override { return m_pAttributes->SetBlob(guidKey, pBuf, cbBufSize); }
+    STDMETHODIMP SetUnknown(__RPC__in REFGUID guidKey, __RPC__in_opt IUnknown* pUnknown)override                                   { return m_pAttributes->SetUnknown(guidKey, pUnknown); }
+    STDMETHODIMP LockStore(void)override                                                                                           { return m_pAttributes->LockStore(); }
+    STDMETHODIMP UnlockStore(void)override                                                                                         { return m_pAttributes->UnlockStore(); }
+    STDMETHODIMP GetCount(__RPC__out UINT32* pcItems)override                                                                      { return m_pAttributes->GetCount(pcItems); }
+    STDMETHODIMP GetItemByIndex(UINT32 unIndex, __RPC__out GUID* pguidKey, __RPC__inout_opt PROPVARIANT* pValue)override          { return m_pAttributes->GetItemByIndex(unIndex, pguidKey, pValue); }
+    STDMETHODIMP CopyAllItems(__RPC__in_opt IMFAttributes* pDest)override                                                          { return m_pAttributes->CopyAllItems(pDest); }
+
+private:
+
+    CPooledMediaEvent(CMediaEventPool* pPool) :
+        m_nRefCount(0),
+        m_pPool(pPool),
+        m_met(MEUnknown),
+        m_guidExtendedType(GUID_NULL),
+        m_hrStatus(S_OK)
+    {
+        PropVariantInit(&m_value);
+    }
+
+    virtual ~CPooledMediaEvent(void)
+    {
+        (void)PropVariantClear(&m_value);
+    }
+
+    HRESULT Initialize(void)
+    {
+        return MFCreateAttributes(&m_pAttributes, 0);
+    }
+
+    // Fills in a handed-out event. The event holds one reference.
+    HRESULT Set(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, const PROPVARIANT* pvValue)
+    {
+        m_nRefCount = 1;
+        m_met = met;
+        m_guidExtendedType = guidExtendedType;
+        m_hrStatus = hrStatus;
+
+        return (pvValue != NULL) ? PropVariantCopy(&m_value, pvValue) : S_OK;
+    }
+
+    // Drops what the last user left behind, before the event is idle.
+    void Clear(void)
+    {
+        (void)PropVariantClear(&m_value);
+        (void)m_pAttributes->DeleteAllItems();
+    }
+
+    long                                    m_nRefCount;
+    CMediaEventPool* const                  m_pPool;            // The pool the event goes back to.
+    MediaEventType                          m_met;
+    GUID                                    m_guidExtendedType;
+    HRESULT                                 m_hrStatus;
+    PROPVARIANT                             m_value;
+    Microsoft::WRL::ComPtr<IMFAttributes>   m_pAttributes;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//  CMediaEventPool
+//
+//  Description:
+//  Free list of CPooledMediaEvent objects, so the events a stream sends
+//  on every frame (MEStreamSinkRequestSample above all) are reused
+//  instead of allocated with MFCreateMediaEvent each time.
+//
+//  CreateMediaEvent takes an idle event from the free list, or makes a
+//  new one when the list is empty; the event's final Release puts it
+//  back. The free list is a CLockFreeQueue, so any thread may create and
+//  release events without a lock. The pool is reference counted and freed once
+//  its owners and every event it handed out have released it.
+//////////////////////////////////////////////////////////////////////////
+
+class CMediaEventPool
+{
+    friend class CPooledMediaEvent;
+
+public:
+
+    // Creates a pool with cPreallocate idle events.
+    static HRESULT CreateInstance(size_t cPreallocate, _COM_Outptr_ CMediaEventPool** ppPool)
+    {
+        if (ppPool == NULL)
+        {
+            return E_POINTER;
+        }
+
+        *ppPool = NULL;
+
+        CMediaEventPool* pPool = new (std::nothrow) CMediaEventPool(); // Created with ref count = 1.
+        if (pPool == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        HRESULT hr = S_OK;
+
+        for (size_t i = 0; SUCCEEDED(hr) && i < cPreallocate && i < MEDIA_EVENT_POOL_CAPACITY; i++)
+        {
+            CPooledMediaEvent* pEvent = NULL;
+            hr = pPool->AllocateEvent(&pEvent);
+
+            if (SUCCEEDED(hr))
+            {
+                (void)pPool->m_free.TryPush(pEvent);
+            }
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            *ppPool = pPool;
+        }
+        else
+        {
+            pPool->Release();
+        }
+
+        return hr;
+    }
+
+    ULONG AddRef(void)
+    {
+        return InterlockedIncrement(&m_nRefCount);
+    }
+
+    ULONG Release(void)
+    {
+        ULONG uCount = InterlockedDecrement(&m_nRefCount);
+        if (uCount == 0)
+        {
+            delete this;
+        }
+        // For thread safety, return a temporary variable.
+        return uCount;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: CreateMediaEvent
+    // Description: Same as MFCreateMediaEvent, but reuses an idle event
+    //              when there is one.
+    //-------------------------------------------------------------------
+
+    HRESULT CreateMediaEvent(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, _In_opt_ const PROPVARIANT* pvValue, _COM_Outptr_ IMFMediaEvent** ppEvent)
+    {
+        if (ppEvent == NULL)
+        {
+            return E_POINTER;
+        }
+
+        *ppEvent = NULL;
+
+        CPooledMediaEvent* pEvent = NULL;
+        HRESULT hr = S_OK;
+
+        if (!m_free.TryPop(&pEvent))
+        {
+            hr = AllocateEvent(&pEvent);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            AddRef();                   // Released when the event comes back in Recycle.
+            hr = pEvent->Set(met, guidExtendedType, hrStatus, pvValue);
+
+            if (SUCCEEDED(hr))
+            {
+                *ppEvent = pEvent;
+            }
+            else
+            {
+                pEvent->Release();
+            }
+        }
+
+        return hr;
+    }
+
+private:
+
+    CMediaEventPool(void) :
+        m_nRefCount(1)
+    {
+    }
+
+    ~CMediaEventPool(void)
+    {
+        CPooledMediaEvent* pEvent = NULL;
+        while (m_free.TryPop(&pEvent))
+        {
+            delete pEvent;
+        }
+    }
+
+    HRESULT AllocateEvent(_Out_ CPooledMediaEvent** ppEvent)
+    {
+        *ppEvent = NULL;
+
+        CPooledMediaEvent* pEvent = new (std::nothrow) CPooledMediaEvent(this);
+        if (pEvent == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        HRESULT hr = pEvent->Initialize();
+        if (SUCCEEDED(hr))
+        {
+            *ppEvent = pEvent;
+        }
+        else
+        {
+            delete pEvent;
+        }
+
+        return hr;
+    }
+
+    // Called from the event's final Release.
+    void Recycle(CPooledMediaEvent* pEvent)
+    {
+        pEvent->Clear();
+
+        if (!m_free.TryPush(pEvent))
+        {
+            delete pEvent;
+        }
+
+        Release();                      // The reference CreateMediaEvent took.
+    }
+
+    long                                                        m_nRefCount;
+    CLockFreeQueue<CPooledMediaEvent*, MEDIA_EVENT_POOL_CAPACITY> m_free;
+};
+
+
+inline STDMETHODIMP_(ULONG) CPooledMediaEvent::Release(void)
+{
+    ULONG uCount = InterlockedDecrement(&m_nRefCount);
+    if (uCount == 0)
+    {
+        // The event is no longer reachable; the pool may hand it out again
+        // as soon as it is back on the free list.
+        m_pPool->Recycle(this);
+    }
+    // For thread safety, return a temporary variable.
+    return uCount;
+}
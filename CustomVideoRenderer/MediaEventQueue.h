@@ -0,0 +1,430 @@
+#pragma once
+#include "LockFreeQueue.h"
+#include "MediaEventPool.h"
+#include <atomic>
+#include <new>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <Mferror.h>
+#include <wrl/client.h>
+
+// Number of events the queue holds before QueueEvent fails. A stream sink
+// has a handful of sample requests and control events in flight at most.
+#define MEDIA_EVENT_QUEUE_CAPACITY 64
+
+//////////////////////////////////////////////////////////////////////////
+//  CMediaEventQueue
+//
+//  Description:
+//  IMFMediaEventQueue replacement built on CLockFreeQueue. Producers
+//  (QueueEvent*) never take a lock, so event traffic does not contend
+//  with the sample path.
+//
+//  The queue has a single consumer at a time: either one pending
+//  BeginGetEvent or one GetEvent call. The pending BeginGetEvent is a
+//  one-slot "waiter" that whoever sees an event first claims with a CAS
+//  (the producer after pushing, or BeginGetEvent itself after arming),
+//  so exactly one thread pops the event and invokes the callback.
+//
+//  Semantics follow MFCreateEventQueue:
+//  - A second BeginGetEvent or GetEvent while one is pending fails with
+//    MF_E_MULTIPLE_BEGIN / MF_E_MULTIPLE_SUBSCRIBERS.
+//  - After Shutdown, every method fails with MF_E_SHUTDOWN and a pending
+//    BeginGetEvent callback completes with MF_E_SHUTDOWN.
+//
+//  Reset hands the queue over to a new consumer: the old one's pending
+//  BeginGetEvent completes with MF_E_OPERATION_CANCELLED and the events it
+//  did not collect are dropped.
+//
+//  QueueEventParamVar and QueueEventParamUnk take their events from a
+//  CMediaEventPool, so queueing an event normally allocates nothing.
+//////////////////////////////////////////////////////////////////////////
+
+class CMediaEventQueue : public IMFMediaEventQueue
+{
+public:
+
+    // cPreallocatedEvents is the number of events the pool starts with.
+    static HRESULT CreateInstance(size_t cPreallocatedEvents, _COM_Outptr_ CMediaEventQueue** ppQueue)
+    {
+        if (ppQueue == NULL)
+        {
+            return E_POINTER;
+        }
+
+        *ppQueue = NULL;
+
+        CMediaEventQueue* pQueue = new (std::nothrow) CMediaEventQueue(); // Created with ref count = 1.
+        if (pQueue == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        HRESULT hr = pQueue->Initialize(cPreallocatedEvents);
+        if (SUCCEEDED(hr))
+        {
+            *ppQueue = pQueue;
+        }
+        else
+        {
+            pQueue->Release();
+        }
+
+        return hr;
+    }
+
+    // IUnknown
+    STDMETHODIMP_(ULONG) AddRef(void)override
+    {
+        return InterlockedIncrement(&m_nRefCount);
+    }
+
+    STDMETHODIMP_(ULONG) Release(void)override
+    {
+        ULONG uCount = InterlockedDecrement(&m_nRefCount);
+        if (uCount == 0)
+        {
+            delete this;
+        }
+        // For thread safety, return a temporary variable.
+        return uCount;
+    }
+
+    STDMETHODIMP QueryInterface(REFIID iid, __RPC__deref_out _Result_nullonfailure_ void** ppv)override
+    {
+        if (!ppv)
+        {
+            return E_POINTER;
+        }
+        if (iid == IID_IUnknown || iid == __uuidof(IMFMediaEventQueue))
+        {
+            *ppv = static_cast<IMFMediaEventQueue*>(this);
+        }
+        else
+        {
+            *ppv = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    // IMFMediaEventQueue
+    STDMETHODIMP GetEvent(DWORD dwFlags, __RPC__deref_out_opt IMFMediaEvent** ppEvent)override
+    {
+        if (ppEvent == NULL)
+        {
+            return E_POINTER;
+        }
+
+        *ppEvent = NULL;
+
+        if (m_IsShutdown)
+        {
+            return MF_E_SHUTDOWN;
+        }
+
+        if (m_IsConsumerBusy.exchange(true, std::memory_order_acquire))
+        {
+            return MF_E_MULTIPLE_SUBSCRIBERS;
+        }
+
+        HRESULT hr = S_OK;
+
+        for (;;)
+        {
+            if (m_IsShutdown)
+            {
+                hr = MF_E_SHUTDOWN;
+                break;
+            }
+
+            if (m_events.TryPop(ppEvent))
+            {
+                break;
+            }
+
+            if (dwFlags & MF_EVENT_FLAG_NO_WAIT)
+            {
+                hr = MF_E_NO_EVENTS_AVAILABLE;
+                break;
+            }
+
+            // Announce the wait, then look again: a producer either sees
+            // the flag and signals, or pushed before we looked.
+            m_IsSyncWaiting.store(true, std::memory_order_seq_cst);
+            if (m_events.IsEmpty() && !m_IsShutdown)
+            {
+                WaitForSingleObject(m_hEventAvailable, INFINITE);
+            }
+            m_IsSyncWaiting.store(false, std::memory_order_relaxed);
+        }
+
+        m_IsConsumerBusy.store(false, std::memory_order_release);
+        return hr;
+    }
+
+    STDMETHODIMP BeginGetEvent(__RPC__in_opt IMFAsyncCallback* pCallback, __RPC__in_opt IUnknown* punkState)override
+    {
+        if (pCallback == NULL)
+        {
+            return E_POINTER;
+        }
+
+        if (m_IsShutdown)
+        {
+            return MF_E_SHUTDOWN;
+        }
+
+        if (m_IsConsumerBusy.exchange(true, std::memory_order_acquire))
+        {
+            return MF_E_MULTIPLE_BEGIN;
+        }
+
+        // The waiter fields are published by the release in ArmWaiter.
+        m_pWaitCallback = pCallback;
+        m_pWaitState = punkState;
+        ArmWaiter();
+
+        TryDispatch();
+        return S_OK;
+    }
+
+    STDMETHODIMP EndGetEvent(__RPC__in_opt IMFAsyncResult* pResult, _Out_ IMFMediaEvent** ppEvent)override
+    {
+        if (pResult == NULL || ppEvent == NULL)
+        {
+            return E_POINTER;
+        }
+
+        *ppEvent = NULL;
+
+        HRESULT hr = pResult->GetStatus();
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        Microsoft::WRL::ComPtr<IUnknown> pUnk;
+        hr = pResult->GetObject(&pUnk);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        return pUnk.CopyTo(ppEvent);
+    }
+
+    STDMETHODIMP QueueEvent(__RPC__in_opt IMFMediaEvent* pEvent)override
+    {
+        if (pEvent == NULL)
+        {
+            return E_POINTER;
+        }
+
+        if (m_IsShutdown)
+        {
+            return MF_E_SHUTDOWN;
+        }
+
+        pEvent->AddRef();               // Owned by the queue until popped.
+        if (!m_events.TryPush(pEvent))
+        {
+            pEvent->Release();
+            return MF_E_NOTACCEPTING;
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_IsSyncWaiting.load(std::memory_order_relaxed))
+        {
+            SetEvent(m_hEventAvailable);
+        }
+
+        TryDispatch();
+        return S_OK;
+    }
+
+    STDMETHODIMP QueueEventParamVar(MediaEventType met, __RPC__in REFGUID guidExtendedType, HRESULT hrStatus, __RPC__in_opt const PROPVARIANT* pvValue)override
+    {
+        Microsoft::WRL::ComPtr<IMFMediaEvent> pEvent;
+        HRESULT hr = m_pEventPool->CreateMediaEvent(met, guidExtendedType, hrStatus, pvValue, &pEvent);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = QueueEvent(pEvent.Get());
+        }
+
+        return hr;
+    }
+
+    STDMETHODIMP QueueEventParamUnk(MediaEventType met, __RPC__in REFGUID guidExtendedType, HRESULT hrStatus, __RPC__in_opt IUnknown* pUnk)override
+    {
+        PROPVARIANT var;
+        PropVariantInit(&var);
+        var.vt = VT_UNKNOWN;
+        var.punkVal = pUnk;             // The event copies the value.
+
+        return QueueEventParamVar(met, guidExtendedType, hrStatus, &var);
+    }
+
+    STDMETHODIMP Shutdown(void)override
+    {
+        if (m_IsShutdown.exchange(true))
+        {
+            return S_OK;
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // Complete a pending BeginGetEvent and wake a blocked GetEvent.
+        TryDispatch();
+        SetEvent(m_hEventAvailable);
+
+        DrainEvents();
+        return S_OK;
+    }
+
+    //-------------------------------------------------------------------
+    // Name: Reset
+    // Description: Cancels the pending BeginGetEvent and drops the queued
+    //              events. The caller makes sure that nothing queues
+    //              events meanwhile. A consumer that completes its
+    //              BeginGetEvent at the same time keeps its event.
+    //-------------------------------------------------------------------
+
+    void Reset(void)
+    {
+        bool expected = true;
+        if (m_IsWaiterArmed.compare_exchange_strong(expected, false, std::memory_order_acq_rel))
+        {
+            Dispatch(NULL, MF_E_OPERATION_CANCELLED);
+        }
+
+        DrainEvents();
+    }
+
+private:
+
+    CMediaEventQueue(void) :
+        m_nRefCount(1),
+        m_IsShutdown(false),
+        m_IsConsumerBusy(false),
+        m_IsWaiterArmed(false),
+        m_IsSyncWaiting(false),
+        m_hEventAvailable(NULL)
+    {
+    }
+
+    virtual ~CMediaEventQueue(void)
+    {
+        DrainEvents();
+
+        if (m_hEventAvailable != NULL)
+        {
+            CloseHandle(m_hEventAvailable);
+        }
+    }
+
+    HRESULT Initialize(size_t cPreallocatedEvents)
+    {
+        m_hEventAvailable = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (m_hEventAvailable == NULL)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        return CMediaEventPool::CreateInstance(cPreallocatedEvents, &m_pEventPool);
+    }
+
+    void ArmWaiter(void)
+    {
+        m_IsWaiterArmed.store(true, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    //-------------------------------------------------------------------
+    // Name: TryDispatch
+    // Description: If a BeginGetEvent is pending and there is an event
+    //              (or the queue is shut down), claims the waiter and
+    //              completes it. Safe to call from any thread.
+    //-------------------------------------------------------------------
+
+    void TryDispatch(void)
+    {
+        for (;;)
+        {
+            if (!m_IsShutdown && m_events.IsEmpty())
+            {
+                return;
+            }
+
+            bool expected = true;
+            if (!m_IsWaiterArmed.compare_exchange_strong(expected, false, std::memory_order_acq_rel))
+            {
+                return;     // Nobody waiting, or another thread claimed the waiter.
+            }
+
+            if (m_IsShutdown)
+            {
+                Dispatch(NULL, MF_E_SHUTDOWN);
+                return;
+            }
+
+            IMFMediaEvent* pEvent = NULL;
+            if (m_events.TryPop(&pEvent))
+            {
+                Dispatch(pEvent, S_OK);
+                return;
+            }
+
+            // Another claimer took the event we saw. Re-arm and look again.
+            ArmWaiter();
+        }
+    }
+
+    // Completes the claimed waiter. Takes over the queue's reference on pEvent.
+    void Dispatch(IMFMediaEvent* pEvent, HRESULT hrStatus)
+    {
+        Microsoft::WRL::ComPtr<IMFAsyncCallback> pCallback;
+        Microsoft::WRL::ComPtr<IUnknown> pState;
+        pCallback.Swap(m_pWaitCallback);
+        pState.Swap(m_pWaitState);
+
+        // The callback usually calls BeginGetEvent again from Invoke.
+        m_IsConsumerBusy.store(false, std::memory_order_release);
+
+        Microsoft::WRL::ComPtr<IMFAsyncResult> pResult;
+        HRESULT hr = MFCreateAsyncResult(pEvent, pCallback.Get(), pState.Get(), &pResult);
+
+        if (pEvent != NULL)
+        {
+            pEvent->Release();          // The result holds its own reference.
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            (void)pResult->SetStatus(hrStatus);
+            (void)MFInvokeCallback(pResult.Get());
+        }
+    }
+
+    void DrainEvents(void)
+    {
+        IMFMediaEvent* pEvent = NULL;
+        while (m_events.TryPop(&pEvent))
+        {
+            pEvent->Release();
+        }
+    }
+
+    long                                        m_nRefCount;
+    std::atomic<bool>                           m_IsShutdown;
+    std::atomic<bool>                           m_IsConsumerBusy;   // A BeginGetEvent or GetEvent is pending.
+    std::atomic<bool>                           m_IsWaiterArmed;    // The BeginGetEvent waiter can be claimed.
+    std::atomic<bool>                           m_IsSyncWaiting;    // GetEvent is blocked on m_hEventAvailable.
+    Microsoft::WRL::ComPtr<IMFAsyncCallback>    m_pWaitCallback;    // Waiter; owned by whoever claims it.
+    Microsoft::WRL::ComPtr<IUnknown>            m_pWaitState;
+    HANDLE                                      m_hEventAvailable;
+    Microsoft::WRL::ComPtr<CMediaEventPool>     m_pEventPool;       // Set in Initialize.
+    CLockFreeQueue<IMFMediaEvent*, MEDIA_EVENT_QUEUE_CAPACITY> m_events;
+};
@@ -0,0 +1,146 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+//////////////////////////////////////////////////////////////////////////
+//  Memory budget
+//
+//  CMemoryGovernor holds a byte budget shared by every renderer in the
+//  process. Each stream sink owns a CMemoryBudgetAccount and charges it
+//  with the bytes it holds: frames in flight (outstanding sample
+//  requests), each at the size PlanFrame gives a buffer of the format,
+//  and the pooled frame buffers.
+//
+//  The sink asks its account how many frames it may keep in flight
+//  (GetDepth). An account may always use its fair share, budget / number
+//  of accounts, and may use more while the budget as a whole has room.
+//  As the budget fills up, every sink's allowance falls back towards its
+//  fair share and queues shrink, but never below one frame, so playback
+//  continues.
+//
+//  A budget of 0 means unlimited: GetDepth then returns the maximum.
+//  All operations are lock-free. This header has no Windows
+//  dependencies.
+//////////////////////////////////////////////////////////////////////////
+
+class CMemoryGovernor
+{
+public:
+
+    explicit CMemoryGovernor(uint64_t cbBudget = 0) :
+        m_cbBudget(cbBudget),
+        m_cbCharged(0),
+        m_cAccounts(0)
+    {
+    }
+
+    // The governor shared by all renderers in this process.
+    static CMemoryGovernor& Process(void)
+    {
+        static CMemoryGovernor s_governor;
+        return s_governor;
+    }
+
+    void SetBudget(uint64_t cbBudget)
+    {
+        m_cbBudget.store(cbBudget, std::memory_order_relaxed);
+    }
+
+    uint64_t GetBudget(void) const
+    {
+        return m_cbBudget.load(std::memory_order_relaxed);
+    }
+
+    uint64_t GetCharged(void) const
+    {
+        return m_cbCharged.load(std::memory_order_relaxed);
+    }
+
+    uint32_t GetAccountCount(void) const
+    {
+        return m_cAccounts.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    friend class CMemoryBudgetAccount;
+
+    CMemoryGovernor(const CMemoryGovernor&) = delete;
+    CMemoryGovernor& operator=(const CMemoryGovernor&) = delete;
+
+    std::atomic<uint64_t> m_cbBudget;
+    std::atomic<uint64_t> m_cbCharged;
+    std::atomic<uint32_t> m_cAccounts;
+};
+
+
+class CMemoryBudgetAccount
+{
+public:
+
+    explicit CMemoryBudgetAccount(CMemoryGovernor& governor) :
+        m_governor(governor),
+        m_cbCharged(0)
+    {
+        m_governor.m_cAccounts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ~CMemoryBudgetAccount(void)
+    {
+        SetCharge(0);
+        m_governor.m_cAccounts.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Replaces this account's charge with cbCharge.
+    void SetCharge(uint64_t cbCharge)
+    {
+        const uint64_t cbOld = m_cbCharged.exchange(cbCharge, std::memory_order_relaxed);
+        m_governor.m_cbCharged.fetch_add(cbCharge - cbOld, std::memory_order_relaxed);     // Wraps correctly when shrinking.
+    }
+
+    uint64_t GetCharge(void) const
+    {
+        return m_cbCharged.load(std::memory_order_relaxed);
+    }
+
+    // Bytes this account may hold right now: its fair share, or its
+    // current charge plus the budget's headroom if that is more.
+    uint64_t GetAllowance(void) const
+    {
+        const uint64_t cbBudget = m_governor.GetBudget();
+        if (cbBudget == 0)
+        {
+            return UINT64_MAX;
+        }
+
+        const uint32_t cAccounts = std::max<uint32_t>(m_governor.GetAccountCount(), 1);
+        const uint64_t cbShare = cbBudget / cAccounts;
+
+        const uint64_t cbTotal = m_governor.GetCharged();
+        const uint64_t cbHeadroom = cbBudget > cbTotal ? cbBudget - cbTotal : 0;
+
+        return std::max(cbShare, GetCharge() + cbHeadroom);
+    }
+
+    // Number of frames of cbPerFrame bytes this account may hold, between
+    // 1 and cMaxDepth.
+    uint32_t GetDepth(uint64_t cbPerFrame, uint32_t cMaxDepth) const
+    {
+        if (cbPerFrame == 0 || cMaxDepth == 0)
+        {
+            return cMaxDepth;
+        }
+
+        const uint64_t cFrames = GetAllowance() / cbPerFrame;
+        return (uint32_t)std::min<uint64_t>(std::max<uint64_t>(cFrames, 1), cMaxDepth);
+    }
+
+private:
+
+    CMemoryBudgetAccount(const CMemoryBudgetAccount&) = delete;
+    CMemoryBudgetAccount& operator=(const CMemoryBudgetAccount&) = delete;
+
+    CMemoryGovernor& m_governor;
+    std::atomic<uint64_t> m_cbCharged;
+};
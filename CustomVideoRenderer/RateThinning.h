@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <climits>
+#include <cstdint>
+
+//////////////////////////////////////////////////////////////////////////
+//  CRateThinner
+//
+//  Description:
+//  Decides which frames the sink keeps when the clock runs faster than
+//  1x. At rate r the decoder hands over r times as many frames per
+//  second as at normal speed; showing them all would make the sink's
+//  work grow with the rate. The thinner keeps one frame per r frame
+//  durations of presentation time instead, so the sink converts frames
+//  at the stream's normal frame rate whatever the speed.
+//
+//  Distances are measured in presentation time in either direction, so
+//  reverse playback (negative rates, decreasing timestamps) is thinned
+//  the same way. At |r| <= 1 every frame is kept.
+//
+//  Called from the sample path only, one sample at a time; SetRate and
+//  Reset may come from the clock thread. This header has no Windows
+//  dependencies.
+//////////////////////////////////////////////////////////////////////////
+
+// Fastest rate the sink plays without thinning upstream. Beyond it the
+// decoder would decode several frames for each one the sink keeps, so
+// the player asks the session for key frames only (thinned playback).
+const float RATE_MAX_UNTHINNED = 8.0f;
+
+class CRateThinner
+{
+public:
+
+    CRateThinner(void) :
+        m_rate(1.0f),
+        m_hnsLastKept(LLONG_MIN)
+    {
+    }
+
+    void SetRate(float rate)
+    {
+        m_rate.store(rate, std::memory_order_relaxed);
+        Reset();
+    }
+
+    float GetRate(void) const
+    {
+        return m_rate.load(std::memory_order_relaxed);
+    }
+
+    // Forget the last kept frame, so the next one is kept. Call when the
+    // timeline jumps (start, seek, flush).
+    void Reset(void)
+    {
+        m_hnsLastKept.store(LLONG_MIN, std::memory_order_relaxed);
+    }
+
+    // True if the frame at hnsTime lasting hnsDuration should be dropped.
+    // A frame without a duration is always kept.
+    bool ShouldDrop(int64_t hnsTime, int64_t hnsDuration)
+    {
+        const float rate = GetRate();
+        const float speed = rate < 0 ? -rate : rate;
+
+        if (speed <= 1.0f || hnsDuration <= 0)
+        {
+            return false;
+        }
+
+        const int64_t hnsSpacing = (int64_t)(hnsDuration * speed);
+        const int64_t hnsLast = m_hnsLastKept.load(std::memory_order_relaxed);
+        int64_t hnsKept = hnsTime;
+
+        if (hnsLast != LLONG_MIN)
+        {
+            const int64_t hnsDistance = hnsTime > hnsLast ? hnsTime - hnsLast : hnsLast - hnsTime;
+
+            // Half a frame of slack absorbs timestamp jitter.
+            if (hnsDistance < hnsSpacing - hnsDuration / 2)
+            {
+                return true;
+            }
+
+            // Advance by the exact spacing rather than to the frame, so a
+            // fractional rate keeps the right share of frames on average.
+            // After a gap, start over from this frame.
+            if (hnsDistance < 2 * hnsSpacing)
+            {
+                hnsKept = hnsTime > hnsLast ? hnsLast + hnsSpacing : hnsLast - hnsSpacing;
+            }
+        }
+
+        m_hnsLastKept.store(hnsKept, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+
+    CRateThinner(const CRateThinner&) = delete;
+    CRateThinner& operator=(const CRateThinner&) = delete;
+
+    std::atomic<float> m_rate;
+    std::atomic<int64_t> m_hnsLastKept;
+};
@@ -0,0 +1,152 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+//////////////////////////////////////////////////////////////////////////
+//  CSampleRequestCredits
+//
+//  Description:
+//  Credit-based flow control for MEStreamSinkRequestSample.
+//
+//  Every request event the sink sends is backed by one credit. A credit is
+//  granted before the event is queued, consumed when the matching sample
+//  arrives in ProcessSample, and refunded when a flush voids the requests
+//  that are still outstanding. All operations are lock-free, so the
+//  scheduler thread, the decoder thread and control calls can race freely
+//  without the count drifting.
+//
+//  Credits are granted in an epoch, and Flush starts a new one. Credits
+//  that were granted but could not be sent are given back with Refund,
+//  naming the epoch they were granted in. If a flush came in between, it
+//  has already taken them back and Refund does nothing, so a credit is
+//  never returned twice.
+//
+//  Once all threads are quiescent:
+//
+//      TotalGranted() == TotalConsumed() + TotalRefunded() + Outstanding()
+//
+//  A sample that arrives without an outstanding credit is counted as
+//  unsolicited and does not change the balance.
+//
+//  This header has no Windows dependencies.
+//////////////////////////////////////////////////////////////////////////
+
+class CSampleRequestCredits
+{
+public:
+
+    CSampleRequestCredits(void) :
+        m_epochAndCount(0),
+        m_granted(0),
+        m_consumed(0),
+        m_refunded(0),
+        m_unsolicited(0)
+    {
+    }
+
+    // Grants as many credits as needed to bring the outstanding count up to
+    // cTarget, and returns that number. The deficit is computed and claimed
+    // in one step, so two callers racing never over-grant. *pEpoch receives
+    // the epoch the credits belong to.
+    uint32_t GrantUpTo(uint32_t cTarget, uint32_t* pEpoch)
+    {
+        uint64_t current = m_epochAndCount.load(std::memory_order_acquire);
+
+        do
+        {
+            *pEpoch = EpochOf(current);
+            if (CountOf(current) >= cTarget)
+            {
+                return 0;
+            }
+        } while (!m_epochAndCount.compare_exchange_weak(current, Pack(EpochOf(current), cTarget), std::memory_order_acq_rel, std::memory_order_acquire));
+
+        const uint32_t cGranted = cTarget - CountOf(current);
+        m_granted.fetch_add(cGranted, std::memory_order_relaxed);
+        return cGranted;
+    }
+
+    // Consumes one credit for an arriving sample. Returns false if no credit
+    // was outstanding.
+    bool Consume(void)
+    {
+        uint64_t current = m_epochAndCount.load(std::memory_order_acquire);
+
+        do
+        {
+            if (CountOf(current) == 0)
+            {
+                m_unsolicited.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!m_epochAndCount.compare_exchange_weak(current, current - 1, std::memory_order_acq_rel, std::memory_order_acquire));
+
+        m_consumed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Gives back cCredits credits granted in epoch that were never sent,
+    // and returns the number refunded. Does nothing if a flush has ended
+    // that epoch, because the flush took them back already.
+    uint32_t Refund(uint32_t cCredits, uint32_t epoch)
+    {
+        uint64_t current = m_epochAndCount.load(std::memory_order_acquire);
+        uint32_t cRefund = 0;
+
+        do
+        {
+            if (EpochOf(current) != epoch)
+            {
+                return 0;
+            }
+
+            cRefund = (CountOf(current) < cCredits) ? CountOf(current) : cCredits;
+            if (cRefund == 0)
+            {
+                return 0;
+            }
+        } while (!m_epochAndCount.compare_exchange_weak(current, current - cRefund, std::memory_order_acq_rel, std::memory_order_acquire));
+
+        m_refunded.fetch_add(cRefund, std::memory_order_relaxed);
+        return cRefund;
+    }
+
+    // Takes back every outstanding credit, because a flush voided their
+    // requests, and starts a new epoch. Returns the number refunded.
+    uint32_t Flush(void)
+    {
+        uint64_t current = m_epochAndCount.load(std::memory_order_acquire);
+
+        while (!m_epochAndCount.compare_exchange_weak(current, Pack(EpochOf(current) + 1, 0), std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+        }
+
+        const uint32_t cRefund = CountOf(current);
+        m_refunded.fetch_add(cRefund, std::memory_order_relaxed);
+        return cRefund;
+    }
+
+    uint32_t Outstanding(void) const
+    {
+        return CountOf(m_epochAndCount.load(std::memory_order_acquire));
+    }
+
+    uint64_t TotalGranted(void) const       { return m_granted.load(std::memory_order_relaxed); }
+    uint64_t TotalConsumed(void) const      { return m_consumed.load(std::memory_order_relaxed); }
+    uint64_t TotalRefunded(void) const      { return m_refunded.load(std::memory_order_relaxed); }
+    uint64_t TotalUnsolicited(void) const   { return m_unsolicited.load(std::memory_order_relaxed); }
+
+private:
+
+    // The epoch and the outstanding count change together, so they share
+    // one atomic: epoch in the high half, count in the low half.
+    static uint64_t Pack(uint32_t epoch, uint32_t count)  { return ((uint64_t)epoch << 32) | count; }
+    static uint32_t EpochOf(uint64_t value)                { return (uint32_t)(value >> 32); }
+    static uint32_t CountOf(uint64_t value)                { return (uint32_t)value; }
+
+    std::atomic<uint64_t>   m_epochAndCount;
+    std::atomic<uint64_t>   m_granted;
+    std::atomic<uint64_t>   m_consumed;
+    std::atomic<uint64_t>   m_refunded;
+    std::atomic<uint64_t>   m_unsolicited;
+};
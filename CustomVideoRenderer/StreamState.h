@@ -0,0 +1,347 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//////////////////////////////////////////////////////////////////////////
+//  Stream state machine
+//
+//  The stream sink's states and operations, and a constexpr transition
+//  table that says, for every (state, operation) pair, whether the
+//  operation is allowed, which state it leads to and which side effects
+//  (hooks) the sink must run afterwards.
+//
+//  This header has no Windows dependencies so that the table can be
+//  checked and exercised outside of Media Foundation.
+//////////////////////////////////////////////////////////////////////////
+
+
+// State enum: Defines the current state of the stream.
+enum class State : uint8_t
+{
+    State_TypeNotSet = 0,   // No media type is set
+    State_Ready,            // Media type is set, Start has never been called.
+    State_Started,
+    State_Paused,
+    State_Stopped,
+
+    State_Count             // Number of states
+};
+
+
+// StreamOperation: Defines various operations that can be performed on the stream.
+enum class StreamOperation : uint8_t
+{
+    OpSetMediaType = 0,
+    OpStart,
+    OpRestart,
+    OpPause,
+    OpStop,
+    OpProcessSample,
+    OpPlaceMarker,
+    OpReset,                // The renderer is taken out of its session to be reused.
+    OpStep,                 // Present one held frame (frame stepping).
+
+    Op_Count                // Number of operations
+};
+
+
+// TransitionHook: Side effects the sink runs after a transition is applied.
+// Hooks run in the order Flush, StopScheduler, StartScheduler.
+enum TransitionHook : uint8_t
+{
+    Hook_None           = 0x00,
+    Hook_Flush          = 0x01,     // Discard queued samples.
+    Hook_StopScheduler  = 0x02,     // Cancel the sample request work item.
+    Hook_StartScheduler = 0x04,     // Arm the sample request work item.
+};
+
+
+struct Transition
+{
+    bool        Allowed;
+    State       Next;
+    uint8_t     Hooks;              // Combination of TransitionHook flags.
+};
+
+
+namespace StreamStateTable
+{
+    constexpr Transition Deny(State current)
+    {
+        return Transition{ false, current, Hook_None };
+    }
+
+    constexpr Transition Allow(State next, uint8_t hooks = Hook_None)
+    {
+        return Transition{ true, next, hooks };
+    }
+
+    constexpr uint8_t Hook_Halt = Hook_StopScheduler | Hook_Flush;
+
+    constexpr State NotSet  = State::State_TypeNotSet;
+    constexpr State Ready   = State::State_Ready;
+    constexpr State Started = State::State_Started;
+    constexpr State Paused  = State::State_Paused;
+    constexpr State Stopped = State::State_Stopped;
+
+    constexpr Transition Table[(size_t)State::State_Count][(size_t)StreamOperation::Op_Count] =
+    {
+        // States:    Operations:
+        //             SetType                      Start                                 Restart                               Pause           Stop                        Sample           Marker           Reset                       Step
+        /* NotSet */ { Allow(Ready),                Deny(NotSet),                         Deny(NotSet),                         Deny(NotSet),   Deny(NotSet),               Deny(NotSet),    Deny(NotSet),    Allow(NotSet, Hook_Halt),   Deny(NotSet) },
+
+        /* Ready */  { Allow(Ready),                Allow(Started, Hook_StartScheduler),  Allow(Started, Hook_StartScheduler),  Allow(Paused),  Allow(Stopped, Hook_Halt),  Deny(Ready),     Allow(Ready),    Allow(Ready, Hook_Halt),    Deny(Ready) },
+
+        /* Start */  { Allow(Started, Hook_Flush),  Allow(Started, Hook_StartScheduler),  Deny(Started),                        Allow(Paused),  Allow(Stopped, Hook_Halt),  Allow(Started),  Allow(Started),  Allow(Ready, Hook_Halt),    Deny(Started) },
+
+        /* Pause */  { Allow(Paused, Hook_Flush),   Allow(Started, Hook_StartScheduler),  Allow(Started, Hook_StartScheduler),  Allow(Paused),  Allow(Stopped, Hook_Halt),  Allow(Paused),   Allow(Paused),   Allow(Ready, Hook_Halt),    Allow(Paused) },
+
+        /* Stop */   { Allow(Ready),                Allow(Started, Hook_StartScheduler),  Deny(Stopped),                        Deny(Stopped),  Allow(Stopped, Hook_Halt),  Deny(Stopped),   Allow(Stopped),  Allow(Ready, Hook_Halt),    Deny(Stopped) }
+
+        // Note about states:
+        // 1. OnClockRestart should only be called from paused state.
+        // 2. While paused, the sink accepts samples. In step mode it holds
+        //    them, and Step presents one at a time.
+        // 3. A format change while streaming flushes but keeps the state.
+        // 4. Reset keeps the media type, so a reset stream is Ready (or
+        //    still NotSet) for the next session.
+    };
+}
+
+
+constexpr Transition GetTransition(State state, StreamOperation op)
+{
+    return StreamStateTable::Table[(size_t)state][(size_t)op];
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Compile-time checks on the transition table.
+//////////////////////////////////////////////////////////////////////////
+
+namespace StreamStateTable
+{
+    static_assert(sizeof(Table) / sizeof(Table[0]) == (size_t)State::State_Count,
+        "One table row per State");
+    static_assert(sizeof(Table[0]) / sizeof(Table[0][0]) == (size_t)StreamOperation::Op_Count,
+        "One table column per StreamOperation");
+
+    // True if every allowed transition for the operation satisfies the check.
+    template <typename Check>
+    constexpr bool ForAllAllowed(StreamOperation op, Check check)
+    {
+        for (size_t s = 0; s < (size_t)State::State_Count; s++)
+        {
+            const Transition t = GetTransition((State)s, op);
+            if (t.Allowed && !check((State)s, t))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct EndsIn
+    {
+        State Expected;
+        constexpr bool operator()(State, const Transition& t) const { return t.Next == Expected; }
+    };
+
+    struct KeepsState
+    {
+        constexpr bool operator()(State s, const Transition& t) const { return t.Next == s && (t.Hooks & ~Hook_Flush) == 0; }
+    };
+
+    struct HasHooks
+    {
+        uint8_t Required;
+        constexpr bool operator()(State, const Transition& t) const { return (t.Hooks & Required) == Required; }
+    };
+
+    struct FromSetType
+    {
+        constexpr bool operator()(State s, const Transition& t) const { return (s == NotSet) ? t.Next == NotSet : t.Next == Ready; }
+    };
+
+    struct FromPaused
+    {
+        constexpr bool operator()(State s, const Transition&) const { return s == Paused; }
+    };
+
+    struct FromPausedOrReady
+    {
+        constexpr bool operator()(State s, const Transition&) const { return s == Paused || s == Ready; }
+    };
+
+    static_assert(ForAllAllowed(StreamOperation::OpStart, EndsIn{ Started }), "Start always ends in Started");
+    static_assert(ForAllAllowed(StreamOperation::OpStart, HasHooks{ Hook_StartScheduler }), "Start arms the scheduler");
+    static_assert(ForAllAllowed(StreamOperation::OpRestart, EndsIn{ Started }), "Restart always ends in Started");
+    static_assert(ForAllAllowed(StreamOperation::OpRestart, FromPausedOrReady{}), "Restart is only valid while paused, or ready before the first start");
+    static_assert(ForAllAllowed(StreamOperation::OpPause, EndsIn{ Paused }), "Pause always ends in Paused");
+    static_assert(ForAllAllowed(StreamOperation::OpStop, EndsIn{ Stopped }), "Stop always ends in Stopped");
+    static_assert(ForAllAllowed(StreamOperation::OpStop, HasHooks{ Hook_Halt }), "Stop halts the scheduler and flushes");
+    static_assert(ForAllAllowed(StreamOperation::OpProcessSample, KeepsState{}), "Samples never change the state");
+    static_assert(ForAllAllowed(StreamOperation::OpPlaceMarker, KeepsState{}), "Markers never change the state");
+    static_assert(ForAllAllowed(StreamOperation::OpReset, FromSetType{}), "Reset keeps the media type and forgets the rest");
+    static_assert(ForAllAllowed(StreamOperation::OpReset, HasHooks{ Hook_StopScheduler }), "Reset halts the scheduler");
+    static_assert(ForAllAllowed(StreamOperation::OpStep, KeepsState{}), "Stepping never changes the state");
+    static_assert(ForAllAllowed(StreamOperation::OpStep, FromPaused{}), "Stepping is only valid while paused");
+    static_assert(!GetTransition(NotSet, StreamOperation::OpProcessSample).Allowed, "No samples before a type is set");
+    static_assert(!GetTransition(Stopped, StreamOperation::OpProcessSample).Allowed, "No samples while stopped");
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  TransitionTrace [template]
+//
+//  Description:
+//  Fixed-size ring of the most recent state transitions, for post-mortem
+//  debugging. Record is wait-free: each entry is packed into a single
+//  64-bit atomic slot, so writers never tear and never block each other.
+//  A reader that races with writers may miss entries that are overwritten
+//  while it copies, but it never sees a torn one.
+//////////////////////////////////////////////////////////////////////////
+
+template <size_t N>
+class TransitionTrace
+{
+    static_assert(N != 0 && (N & (N - 1)) == 0, "TransitionTrace size must be a power of two");
+
+public:
+
+    struct Entry
+    {
+        uint32_t        Sequence;   // 1-based, increases with every Record.
+        State           From;
+        StreamOperation Op;
+        State           To;
+        bool            Allowed;
+    };
+
+    TransitionTrace(void) :
+        m_nextSequence(0)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            m_slots[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Record(State from, StreamOperation op, const Transition& t)
+    {
+        const uint32_t seq = m_nextSequence.fetch_add(1, std::memory_order_relaxed) + 1;
+
+        const uint64_t packed =
+            ((uint64_t)seq << 32) |
+            ((uint64_t)from << 24) |
+            ((uint64_t)op << 16) |
+            ((uint64_t)t.Next << 8) |
+            (t.Allowed ? 1u : 0u);
+
+        m_slots[(seq - 1) & (N - 1)].store(packed, std::memory_order_release);
+    }
+
+    // Copies up to cMax of the most recent entries into pEntries, oldest
+    // first, and returns the number copied.
+    size_t Snapshot(Entry* pEntries, size_t cMax) const
+    {
+        const uint32_t last = m_nextSequence.load(std::memory_order_acquire);
+        const uint32_t count = (uint32_t)((last < N) ? last : N);
+        size_t copied = 0;
+
+        for (uint32_t seq = last - count + 1; seq <= last && copied < cMax; seq++)
+        {
+            const uint64_t packed = m_slots[(seq - 1) & (N - 1)].load(std::memory_order_acquire);
+            if ((uint32_t)(packed >> 32) != seq)
+            {
+                // Overwritten by a newer entry, or not published yet.
+                continue;
+            }
+
+            Entry& e = pEntries[copied++];
+            e.Sequence = seq;
+            e.From = (State)((packed >> 24) & 0xFF);
+            e.Op = (StreamOperation)((packed >> 16) & 0xFF);
+            e.To = (State)((packed >> 8) & 0xFF);
+            e.Allowed = (packed & 1) != 0;
+        }
+
+        return copied;
+    }
+
+private:
+
+    std::atomic<uint32_t>   m_nextSequence;
+    std::atomic<uint64_t>   m_slots[N];
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//  IsSeekStart
+//
+//  Description:
+//  True if a clock start moves an active (started or paused) stream to a
+//  new position. That is a seek, and the stream is flushed first. The
+//  first start and a resume from a pause must not flush: the frames held
+//  for stepping are presented on resume, and the requests sent before
+//  the pause are still outstanding.
+//////////////////////////////////////////////////////////////////////////
+
+constexpr bool IsSeekStart(State current, bool bNewPosition)
+{
+    return bNewPosition && (current == State::State_Started || current == State::State_Paused);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  ApplyStreamTransition [template]
+//
+//  Description:
+//  Applies op to a stream: looks the transition up, records it in the
+//  trace, stores the next state and runs the hooks in the order
+//  Flush, StopScheduler, StartScheduler. The scheduler is not armed if
+//  the flush failed. The caller serializes calls.
+//
+//  THooks provides Flush() and StartScheduler(), which return an HRESULT
+//  (negative on failure), and StopScheduler(). Returns hrDenied if the
+//  table denies op, else the first failure of the hooks, or 0.
+//
+//  The sink and the state machine fuzz test both go through here, so
+//  the test exercises the sequence the sink runs.
+//////////////////////////////////////////////////////////////////////////
+
+template <class THooks, size_t N>
+int32_t ApplyStreamTransition(std::atomic<State>& state, StreamOperation op, TransitionTrace<N>& trace, THooks& hooks, int32_t hrDenied)
+{
+    const State current = state.load(std::memory_order_relaxed);
+    const Transition t = GetTransition(current, op);
+
+    trace.Record(current, op, t);
+
+    if (!t.Allowed)
+    {
+        return hrDenied;
+    }
+
+    state.store(t.Next, std::memory_order_release);
+
+    int32_t hr = 0;
+
+    if (t.Hooks & Hook_Flush)
+    {
+        hr = hooks.Flush();
+    }
+
+    if (t.Hooks & Hook_StopScheduler)
+    {
+        hooks.StopScheduler();
+    }
+
+    if (hr >= 0 && (t.Hooks & Hook_StartScheduler))
+    {
+        hr = hooks.StartScheduler();
+    }
+
+    return hr;
+}
@@ -0,0 +1,179 @@
+#include "BufferChain.h"
+#include "TestCheck.h"
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Buffer chain tests
+//
+//  Splits a frame across several buffers at chosen points, the way a
+//  multi-buffer sample arrives, and checks the view's range lookups and
+//  copies. MapFramePlanes must then read in place every plane that lies
+//  inside one buffer, gather only the others, and give back the same
+//  pixels as the unsplit frame.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    const uint32_t NV12 = MakeFourCC('N', 'V', '1', '2');
+    const uint32_t I420 = MakeFourCC('I', '4', '2', '0');
+    const uint32_t ARGB32 = 21;         // D3DFMT_A8R8G8B8
+
+    // A byte pattern no two nearby offsets share.
+    std::vector<uint8_t> MakeFrame(size_t cb)
+    {
+        std::vector<uint8_t> frame(cb);
+        for (size_t i = 0; i < cb; i++)
+        {
+            frame[i] = (uint8_t)(i * 131 + (i >> 8));
+        }
+        return frame;
+    }
+
+    // Copies frame into separate buffers, cut at the given offsets, and
+    // appends them to view.
+    void Split(const std::vector<uint8_t>& frame, const std::vector<size_t>& cuts, std::vector<std::vector<uint8_t>>* pBuffers, CBufferChainView* pView)
+    {
+        size_t begin = 0;
+        for (size_t i = 0; i <= cuts.size(); i++)
+        {
+            const size_t end = (i < cuts.size()) ? cuts[i] : frame.size();
+            pBuffers->emplace_back(frame.begin() + begin, frame.begin() + end);
+            begin = end;
+        }
+
+        pView->Clear();
+        for (std::vector<uint8_t>& buffer : *pBuffers)
+        {
+            CHECK(pView->Append(buffer.data(), buffer.size()));
+        }
+    }
+
+    bool IsInside(const uint8_t* p, const std::vector<std::vector<uint8_t>>& buffers)
+    {
+        for (const std::vector<uint8_t>& buffer : buffers)
+        {
+            if (p >= buffer.data() && p < buffer.data() + buffer.size())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Every row of every plane matches the unsplit frame.
+    bool MatchesFrame(const FrameLayout& layout, const FrameBufferPlan& source, const std::vector<uint8_t>& frame)
+    {
+        for (uint32_t i = 0; i < layout.cPlanes; i++)
+        {
+            const FramePlane& plane = layout.Planes[i];
+            for (uint32_t row = 0; row < plane.Rows; row++)
+            {
+                const uint8_t* pExpected = frame.data() + source.Offset[i] + (int64_t)source.Stride[i] * row;
+                const uint8_t* pActual = plane.pData + (int64_t)plane.Stride * row;
+                if (memcmp(pExpected, pActual, plane.RowBytes) != 0)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void CheckView(void)
+    {
+        const std::vector<uint8_t> frame = MakeFrame(100);
+        std::vector<std::vector<uint8_t>> buffers;
+        CBufferChainView view;
+        Split(frame, { 10, 10, 60 }, &buffers, &view);     // Includes an empty buffer.
+
+        CHECK(view.GetSegmentCount() == 4);
+        CHECK(view.GetTotalLength() == 100);
+
+        CHECK(view.GetContiguous(0, 10) == buffers[0].data());
+        CHECK(view.GetContiguous(0, 11) == nullptr);
+        CHECK(view.GetContiguous(10, 50) == buffers[2].data());
+        CHECK(view.GetContiguous(59, 1) == buffers[2].data() + 49);
+        CHECK(view.GetContiguous(59, 2) == nullptr);
+        CHECK(view.GetContiguous(60, 40) == buffers[3].data());
+        CHECK(view.GetContiguous(100, 1) == nullptr);
+
+        // A copy across every segment, and one that runs off the end.
+        uint8_t copy[100] = {};
+        CHECK(view.CopyTo(5, copy, 90) == 90);
+        CHECK(memcmp(copy, frame.data() + 5, 90) == 0);
+        CHECK(view.CopyTo(95, copy, 10) == 5);
+        CHECK(memcmp(copy, frame.data() + 95, 5) == 0);
+
+        // The view holds a fixed number of segments.
+        CBufferChainView full;
+        for (uint32_t i = 0; i < CBufferChainView::MaxSegments; i++)
+        {
+            CHECK(full.Append(copy, 1));
+        }
+        CHECK(!full.Append(copy, 1));
+    }
+
+    // Maps a frame of the given format cut at the given offsets. Returns
+    // the split plane mask, and checks the planes and their pixels.
+    uint32_t MapSplitFrame(uint32_t format, int32_t stride, uint32_t width, uint32_t height, const std::vector<size_t>& cuts)
+    {
+        const FrameFormatInfo* pInfo = FindFrameFormat(format);
+        FrameBufferPlan source = {};
+        FrameBufferPlan target = {};
+        CHECK(pInfo != nullptr);
+        CHECK(PlanFrame(*pInfo, false, stride, width, height, &source));
+        CHECK(PlanFrame(*pInfo, true, 0, width, height, &target));
+
+        const std::vector<uint8_t> frame = MakeFrame(source.cbSize);
+        std::vector<std::vector<uint8_t>> buffers;
+        CBufferChainView view;
+        Split(frame, cuts, &buffers, &view);
+
+        const uint32_t split = FindSplitPlanes(view, source);
+        std::vector<uint8_t> gather(split != 0 ? target.cbSize : 0);
+
+        FrameLayout layout;
+        MapFramePlanes(view, source, target, split != 0 ? gather.data() : nullptr, &layout);
+
+        CHECK(layout.cPlanes == source.cPlanes);
+        for (uint32_t i = 0; i < layout.cPlanes; i++)
+        {
+            const bool bGathered = (split & (1u << i)) != 0;
+            CHECK(IsInside(layout.Planes[i].pData, buffers) == !bGathered);
+            CHECK(layout.Planes[i].Stride == (bGathered ? target.Stride[i] : source.Stride[i]));
+        }
+        CHECK(MatchesFrame(layout, source, frame));
+
+        return split;
+    }
+
+    void CheckPlaneMapping(void)
+    {
+        // NV12 64x16, stride 64: luma [0, 1024), chroma [1024, 1536).
+        CHECK(MapSplitFrame(NV12, 64, 64, 16, {}) == 0);
+        CHECK(MapSplitFrame(NV12, 64, 64, 16, { 1024 }) == 0);          // Cut between the planes.
+        CHECK(MapSplitFrame(NV12, 64, 64, 16, { 1000 }) == 1);          // Cut inside a luma row.
+        CHECK(MapSplitFrame(NV12, 64, 64, 16, { 1280 }) == 2);          // Cut inside the chroma plane.
+        CHECK(MapSplitFrame(NV12, 64, 64, 16, { 512, 1280 }) == 3);
+
+        // The padding after a plane's last row may be cut off.
+        CHECK(MapSplitFrame(NV12, 96, 64, 16, { 96 * 15 + 64 }) == 0);
+
+        // I420 64x16: Y [0, 1024), U [1024, 1280), V [1280, 1536).
+        CHECK(MapSplitFrame(I420, 64, 64, 16, { 1024, 1280 }) == 0);
+        CHECK(MapSplitFrame(I420, 64, 64, 16, { 1100 }) == 2);
+
+        // Bottom-up RGB: the top row is the last in memory.
+        CHECK(MapSplitFrame(ARGB32, -64, 16, 8, {}) == 0);
+        CHECK(MapSplitFrame(ARGB32, -64, 16, 8, { 200 }) == 1);
+    }
+}
+
+int main(void)
+{
+    CheckView();
+    CheckPlaneMapping();
+
+    return TestResult("BufferChainTest");
+}
@@ -0,0 +1,266 @@
+#include "Coroutine.h"
+#include "TestCheck.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Coroutine core tests
+//
+//  A fake asynchronous source stands in for Media Foundation: Begin
+//  records the operation, and the test completes it later, from the same
+//  thread or another one, the way an MF callback would. The awaiter is
+//  built on Completion exactly like the ones in MFAwaitable.h.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    class CFakeAsyncSource
+    {
+    public:
+
+        struct Operation
+        {
+            Async::Completion<int> Done;
+        };
+
+        // Awaiter for one operation of the source.
+        class Awaiter
+        {
+        public:
+
+            Awaiter(CFakeAsyncSource& source) :
+                m_pOp(source.Begin())
+            {
+            }
+
+            bool await_ready(void) const noexcept
+            {
+                return m_pOp->Done.await_ready();
+            }
+
+            bool await_suspend(std::coroutine_handle<> h) noexcept
+            {
+                return m_pOp->Done.await_suspend(h);
+            }
+
+            int await_resume(void)
+            {
+                return m_pOp->Done.await_resume();
+            }
+
+        private:
+
+            std::shared_ptr<Operation> m_pOp;
+        };
+
+        Awaiter BeginAsync(void)
+        {
+            return Awaiter(*this);
+        }
+
+        // Completes the oldest pending operation. Returns false if there
+        // was none.
+        bool CompleteNext(int value)
+        {
+            std::shared_ptr<Operation> pOp;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                if (m_pending.empty())
+                {
+                    return false;
+                }
+                pOp = m_pending.front();
+                m_pending.erase(m_pending.begin());
+            }
+
+            if (pOp->Done.Claim())
+            {
+                pOp->Done.Complete(value);
+            }
+            return true;
+        }
+
+        std::shared_ptr<Operation> Peek(void)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_pending.empty() ? nullptr : m_pending.front();
+        }
+
+        size_t PendingCount(void)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_pending.size();
+        }
+
+    private:
+
+        std::shared_ptr<Operation> Begin(void)
+        {
+            auto pOp = std::make_shared<Operation>();
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_pending.push_back(pOp);
+            return pOp;
+        }
+
+        std::mutex m_lock;
+        std::vector<std::shared_ptr<Operation>> m_pending;
+    };
+
+    // Counts live coroutine frames that hold one.
+    std::atomic<int> g_cLiveFrames{ 0 };
+
+    struct FrameMarker
+    {
+        FrameMarker(void)  { g_cLiveFrames++; }
+        ~FrameMarker(void) { g_cLiveFrames--; }
+    };
+
+    Async::Task<int> ReadOne(CFakeAsyncSource& source)
+    {
+        FrameMarker marker;
+        const int value = co_await source.BeginAsync();
+        co_return value;
+    }
+
+    Async::Task<int> ReadTwo(CFakeAsyncSource& source, std::thread::id* pResumedOn, int* pResult)
+    {
+        FrameMarker marker;
+        const int a = co_await ReadOne(source);
+        const int b = co_await ReadOne(source);
+        *pResumedOn = std::this_thread::get_id();
+        *pResult = a + b;
+        co_return a + b;
+    }
+
+    // Completing before the coroutine reaches co_await must not suspend it.
+    void CheckCompletedBeforeAwait(void)
+    {
+        Async::Completion<int> done;
+        CHECK(done.Claim());
+        done.Complete(7);
+
+        int result = 0;
+        auto task = [](Async::Completion<int>& done, int* pResult) -> Async::Task<int>
+        {
+            *pResult = co_await done;
+            co_return 0;
+        }(done, &result);
+
+        std::move(task).Detach();
+        CHECK(result == 7);
+    }
+
+    // Completions from another thread resume the coroutine there, with no
+    // hop back to the starting thread.
+    void CheckCompletedOnOtherThread(void)
+    {
+        CFakeAsyncSource source;
+        std::thread::id resumedOn;
+        int result = 0;
+
+        ReadTwo(source, &resumedOn, &result).Detach();
+        CHECK(source.PendingCount() == 1);
+        CHECK(result == 0);
+
+        std::thread::id completer;
+        std::thread worker([&]()
+        {
+            completer = std::this_thread::get_id();
+            CHECK(source.CompleteNext(1));
+            CHECK(source.CompleteNext(2));
+        });
+        worker.join();
+
+        CHECK(result == 3);
+        CHECK(resumedOn == completer);
+        CHECK(g_cLiveFrames == 0);      // The detached task freed itself.
+    }
+
+    // The real completion and a cancellation race; only the one that
+    // claims the operation completes it, and the coroutine resumes once.
+    void CheckCancellationRace(int cRounds)
+    {
+        for (int i = 0; i < cRounds; i++)
+        {
+            CFakeAsyncSource source;
+            std::atomic<int> cResumed{ 0 };
+            int result = 0;
+
+            [](CFakeAsyncSource& source, std::atomic<int>& cResumed, int* pResult) -> Async::Task<int>
+            {
+                *pResult = co_await source.BeginAsync();
+                cResumed++;
+                co_return 0;
+            }(source, cResumed, &result).Detach();
+
+            std::shared_ptr<CFakeAsyncSource::Operation> pOp = source.Peek();
+            CHECK(pOp != nullptr);
+
+            std::thread cancel([&]()
+            {
+                if (pOp->Done.Claim())
+                {
+                    pOp->Done.Complete(-1);
+                }
+            });
+            (void)source.CompleteNext(1);
+            cancel.join();
+
+            CHECK(cResumed == 1);
+            CHECK(result == 1 || result == -1);
+        }
+    }
+
+    // Many tasks in flight at once, completed by several threads.
+    void CheckManyTasks(int cTasks)
+    {
+        CFakeAsyncSource source;
+        std::vector<std::thread::id> resumedOn(cTasks);
+        std::vector<int> results(cTasks, 0);
+
+        for (int i = 0; i < cTasks; i++)
+        {
+            ReadTwo(source, &resumedOn[i], &results[i]).Detach();
+        }
+
+        std::vector<std::thread> workers;
+        for (int t = 0; t < 4; t++)
+        {
+            workers.emplace_back([&]()
+            {
+                while (source.CompleteNext(5))
+                {
+                }
+            });
+        }
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+
+        // A worker may stop while another is still starting the second read.
+        while (source.CompleteNext(5))
+        {
+        }
+
+        for (int i = 0; i < cTasks; i++)
+        {
+            CHECK(results[i] == 10);
+        }
+        CHECK(g_cLiveFrames == 0);
+    }
+}
+
+int main(void)
+{
+    CheckCompletedBeforeAwait();
+    CheckCompletedOnOtherThread();
+    CheckCancellationRace(1000);
+    CheckManyTasks(200);
+
+    return TestResult("CoroutineTest");
+}
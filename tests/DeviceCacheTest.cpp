@@ -0,0 +1,169 @@
+#include "DeviceCache.h"
+#include "TestCheck.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Device cache tests
+//
+//  A fake factory hands out devices that are plain shared pointers, so
+//  the test can see when the cache and the leases let go of one. Checks
+//  that a device is created once per key and shared, that the last
+//  lease drops it, that a failed creation is not cached, and that
+//  concurrent first users wait for one creation.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    struct FakeDevice
+    {
+        std::shared_ptr<int> Handle;
+    };
+
+    typedef CDeviceCache<FakeDevice> FakeDeviceCache;
+
+    class CFakeFactory : public FakeDeviceCache::IFactory
+    {
+    public:
+
+        int32_t CreateDevice(const DeviceCacheKey& key, FakeDevice* pDevice) override
+        {
+            if (m_bFail)
+            {
+                return -1;      // E_FAIL, as far as the cache cares.
+            }
+
+            // The tests only use the default adapter.
+            CHECK(key.AdapterId == 0);
+
+            // Widen the window in which concurrent first users could each
+            // create a device.
+            std::this_thread::yield();
+
+            pDevice->Handle = std::make_shared<int>(++m_cCreated);
+            return 0;
+        }
+
+        std::atomic<bool> m_bFail{ false };
+        std::atomic<int> m_cCreated{ 0 };
+    };
+
+    const DeviceCacheKey Hardware = { 0, 1 };   // Default adapter, D3D_DRIVER_TYPE_HARDWARE.
+    const DeviceCacheKey Warp = { 0, 5 };       // Default adapter, D3D_DRIVER_TYPE_WARP.
+
+    void CheckSharing(void)
+    {
+        CFakeFactory factory;
+        FakeDeviceCache cache(&factory);
+
+        FakeDeviceCache::Lease first;
+        FakeDeviceCache::Lease second;
+        CHECK(cache.Acquire(Hardware, &first) == 0);
+        CHECK(cache.Acquire(Hardware, &second) == 0);
+
+        CHECK(first && second);
+        CHECK(first.Get().Handle == second.Get().Handle);
+        CHECK(cache.GetUserCount(Hardware) == 2);
+        CHECK(cache.GetCreateCount() == 1);
+
+        // Another key gets its own device.
+        FakeDeviceCache::Lease warp;
+        CHECK(cache.Acquire(Warp, &warp) == 0);
+        CHECK(warp.Get().Handle != first.Get().Handle);
+        CHECK(cache.GetCreateCount() == 2);
+    }
+
+    void CheckLastLeaseReleases(void)
+    {
+        CFakeFactory factory;
+        FakeDeviceCache cache(&factory);
+
+        FakeDeviceCache::Lease first;
+        FakeDeviceCache::Lease second;
+        CHECK(cache.Acquire(Hardware, &first) == 0);
+        CHECK(cache.Acquire(Hardware, &second) == 0);
+
+        std::weak_ptr<int> device = first.Get().Handle;
+
+        first.Reset();
+        CHECK(!first);
+        CHECK(!device.expired());
+        CHECK(cache.GetUserCount(Hardware) == 1);
+
+        // Moving a lease moves the share; it does not add one.
+        FakeDeviceCache::Lease moved(std::move(second));
+        CHECK(!second && moved);
+        CHECK(cache.GetUserCount(Hardware) == 1);
+
+        moved.Reset();
+        CHECK(device.expired());
+        CHECK(cache.GetUserCount(Hardware) == 0);
+
+        // The next user gets a fresh device.
+        FakeDeviceCache::Lease again;
+        CHECK(cache.Acquire(Hardware, &again) == 0);
+        CHECK(cache.GetCreateCount() == 2);
+    }
+
+    void CheckFailureNotCached(void)
+    {
+        CFakeFactory factory;
+        FakeDeviceCache cache(&factory);
+
+        factory.m_bFail = true;
+
+        FakeDeviceCache::Lease lease;
+        CHECK(cache.Acquire(Hardware, &lease) < 0);
+        CHECK(!lease);
+        CHECK(cache.GetUserCount(Hardware) == 0);
+        CHECK(cache.GetCreateCount() == 0);
+
+        factory.m_bFail = false;
+
+        CHECK(cache.Acquire(Hardware, &lease) == 0);
+        CHECK(lease && lease.Get().Handle != nullptr);
+        CHECK(cache.GetCreateCount() == 1);
+    }
+
+    void CheckConcurrentFirstUse(int cThreads)
+    {
+        CFakeFactory factory;
+        FakeDeviceCache cache(&factory);
+
+        std::vector<FakeDeviceCache::Lease> leases(cThreads);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < cThreads; t++)
+        {
+            threads.emplace_back([&, t]()
+            {
+                CHECK(cache.Acquire(t % 2 ? Hardware : Warp, &leases[t]) == 0);
+            });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        CHECK(factory.m_cCreated == 2);
+        CHECK(cache.GetUserCount(Hardware) == (uint32_t)cThreads / 2);
+        CHECK(cache.GetUserCount(Warp) == (uint32_t)(cThreads - cThreads / 2));
+
+        std::weak_ptr<int> device = leases[1].Get().Handle;
+        leases.clear();
+        CHECK(device.expired());
+        CHECK(cache.GetUserCount(Hardware) == 0);
+    }
+}
+
+int main(void)
+{
+    CheckSharing();
+    CheckLastLeaseReleases();
+    CheckFailureNotCached();
+    CheckConcurrentFirstUse(32);
+
+    return TestResult("DeviceCacheTest");
+}
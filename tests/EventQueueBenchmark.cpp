@@ -0,0 +1,132 @@
+#include "LockFreeQueue.h"
+#include "TestCheck.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Event queue benchmark
+//
+//  Models the stream sink's event traffic: several producers (the
+//  request scheduler, control calls, the clock) queue events while one
+//  consumer collects them, as BeginGetEvent does. Runs the traffic first
+//  through a queue under a lock, as the queue MFCreateEventQueue returns
+//  works, then through CLockFreeQueue, as CMediaEventQueue does. Prints
+//  the time per event for each, and checks that every event arrives
+//  once and each producer's events arrive in order.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    // Producer index in the high half, sequence number in the low half.
+    typedef uint64_t Event;
+
+    class CLockedQueue
+    {
+    public:
+
+        bool TryPush(const Event& value)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_events.push_back(value);
+            return true;
+        }
+
+        bool TryPop(Event* pValue)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_events.empty())
+            {
+                return false;
+            }
+            *pValue = m_events.front();
+            m_events.pop_front();
+            return true;
+        }
+
+    private:
+
+        std::mutex m_lock;
+        std::deque<Event> m_events;
+    };
+
+    template <class Queue>
+    double Run(int cProducers, uint32_t cEvents)
+    {
+        Queue queue;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> producers;
+        for (int p = 0; p < cProducers; p++)
+        {
+            producers.emplace_back([&queue, p, cEvents]()
+            {
+                for (uint32_t i = 0; i < cEvents; i++)
+                {
+                    while (!queue.TryPush(((uint64_t)p << 32) | i))
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        std::vector<uint32_t> next(cProducers, 0);
+        uint64_t cReceived = 0;
+        uint64_t cOutOfOrder = 0;
+
+        while (cReceived < (uint64_t)cProducers * cEvents)
+        {
+            Event event = 0;
+            if (!queue.TryPop(&event))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            const uint32_t p = (uint32_t)(event >> 32);
+            if ((uint32_t)event != next[p])
+            {
+                cOutOfOrder++;
+            }
+            next[p] = (uint32_t)event + 1;
+            cReceived++;
+        }
+
+        for (std::thread& producer : producers)
+        {
+            producer.join();
+        }
+
+        const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        Event extra = 0;
+        CHECK(!queue.TryPop(&extra));
+        CHECK(cOutOfOrder == 0);
+        for (int p = 0; p < cProducers; p++)
+        {
+            CHECK(next[p] == cEvents);
+        }
+        return ns / ((double)cProducers * cEvents);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t cEvents = argc > 1 ? (uint32_t)std::atoi(argv[1]) : 200000;
+    const int cProducers = 3;
+
+    const double nsLocked = Run<CLockedQueue>(cProducers, cEvents);
+    const double nsLockFree = Run<CLockFreeQueue<Event, 256>>(cProducers, cEvents);
+
+    std::printf("%d producers, %u events each, one consumer\n", cProducers, cEvents);
+    std::printf("  locked queue:    %8.1f ns per event\n", nsLocked);
+    std::printf("  lock-free queue: %8.1f ns per event\n", nsLockFree);
+
+    return TestResult("EventQueueBenchmark");
+}
@@ -0,0 +1,197 @@
+#include "FrameBufferPool.h"
+#include "TestCheck.h"
+
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Frame buffer pool tests
+//
+//  Warms the pool up the way SetCurrentMediaType does, then runs steady
+//  state frames, from several threads at once, inside a
+//  CNoAllocationScope: once warm, the pool must not allocate. Also
+//  checks alignment, the one-off fallback for an exhausted class,
+//  retiring the class of an old format, and that every byte is
+//  accounted for once the leases are gone.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    const uint32_t Width = 1920;
+    const uint32_t Height = 1080;
+    const uint32_t Depth = 3;           // SAMPLE_QUEUE_HIWATER_THRESHOLD
+
+    // Size of a padded NV12 frame, as SetCurrentMediaType reserves it.
+    size_t GetPaddedFrameSize(uint32_t width, uint32_t height)
+    {
+        FrameBufferPlan plan = {};
+        CHECK(PlanFrame(*FindFrameFormat(MakeFourCC('N', 'V', '1', '2')), true, 0, width, height, &plan));
+        return plan.cbSize;
+    }
+
+    void CheckSteadyStateDoesNotAllocate(int cThreads, int cFrames)
+    {
+        CFrameBufferPool pool;
+        const size_t cbFrame = GetPaddedFrameSize(Width, Height);
+
+        // Each thread holds at most two frames at a time.
+        CHECK(pool.Reserve(cbFrame, 2 * cThreads));
+        const uint64_t cbWarm = pool.GetBytesAllocated();
+
+        {
+            CNoAllocationScope scope(pool);
+
+            std::vector<std::thread> threads;
+            for (int t = 0; t < cThreads; t++)
+            {
+                threads.emplace_back([&pool, cbFrame, t, cFrames]()
+                {
+                    CFrameBufferPool::Lease previous;
+                    for (int i = 0; i < cFrames; i++)
+                    {
+                        CFrameBufferPool::Lease frame = pool.Acquire(cbFrame);
+                        CHECK(frame);
+                        CHECK(frame.Capacity() >= cbFrame);
+                        CHECK((uintptr_t)frame.Data() % CFrameBufferPool::Alignment == 0);
+
+                        // Stamp the frame; a buffer handed out twice would
+                        // show another thread's stamp.
+                        frame.Data()[0] = (uint8_t)t;
+                        frame.Data()[cbFrame - 1] = (uint8_t)i;
+                        std::this_thread::yield();
+                        CHECK(frame.Data()[0] == (uint8_t)t);
+                        CHECK(frame.Data()[cbFrame - 1] == (uint8_t)i);
+
+                        // A copy shares the buffer instead of taking one.
+                        previous = frame;
+                        CHECK(previous.Data() == frame.Data());
+                    }
+                });
+            }
+            for (std::thread& thread : threads)
+            {
+                thread.join();
+            }
+
+            CHECK(scope.AllocationCount() == 0);
+        }
+
+        CHECK(pool.GetBytesAllocated() == cbWarm);
+    }
+
+    void CheckExhaustedClassFallsBack(void)
+    {
+        CFrameBufferPool pool;
+        const size_t cbFrame = 64 * 1024;
+
+        CHECK(pool.Reserve(cbFrame, Depth));
+        const uint64_t cbWarm = pool.GetBytesAllocated();
+        const uint64_t cWarm = pool.GetAllocationCount();
+
+        std::vector<CFrameBufferPool::Lease> leases;
+        for (uint32_t i = 0; i < CFrameBufferPool::SlotsPerClass + 2; i++)
+        {
+            leases.push_back(pool.Acquire(cbFrame));
+            CHECK(leases.back());
+        }
+
+        // The class grew to its limit, and the last two are one-offs.
+        CHECK(pool.GetAllocationCount() == cWarm + CFrameBufferPool::SlotsPerClass - Depth + 2);
+
+        leases.clear();
+
+        // The one-offs are freed; the class keeps its buffers.
+        CHECK(pool.GetBytesAllocated() > cbWarm);
+        CHECK(pool.GetBytesAllocated() == cbWarm / Depth * CFrameBufferPool::SlotsPerClass);
+
+        {
+            CNoAllocationScope scope(pool);
+            for (uint32_t i = 0; i < CFrameBufferPool::SlotsPerClass; i++)
+            {
+                leases.push_back(pool.Acquire(cbFrame));
+            }
+            CHECK(scope.AllocationCount() == 0);
+            leases.clear();
+        }
+    }
+
+    // A retired class frees its idle buffers at once and its leased ones
+    // on release, and Acquire no longer hands it out.
+    void CheckRetire(void)
+    {
+        CFrameBufferPool pool;
+        const size_t cbOld = GetPaddedFrameSize(Width, Height);
+        const size_t cbNew = GetPaddedFrameSize(1280, 720);
+
+        CHECK(pool.Reserve(cbOld, Depth));
+        CFrameBufferPool::Lease leased = pool.Acquire(cbOld);
+        CHECK(leased);
+        const uint64_t cbBuffer = pool.GetBytesAllocated() / Depth;
+
+        pool.Retire(cbOld);
+        CHECK(pool.GetBytesAllocated() == cbBuffer);
+
+        // The smaller format must not land in the retired, larger class.
+        CHECK(pool.Reserve(cbNew, Depth));
+        const uint64_t cbNewClass = pool.GetBytesAllocated() - cbBuffer;
+        {
+            CNoAllocationScope scope(pool);
+            CFrameBufferPool::Lease frame = pool.Acquire(cbNew);
+            CHECK(frame && frame.Capacity() < cbOld);
+            CHECK(scope.AllocationCount() == 0);
+        }
+
+        leased.Reset();
+        CHECK(pool.GetBytesAllocated() == cbNewClass);
+    }
+
+    // Format changes past ClassCount distinct sizes: with the old class
+    // retired each time, Reserve keeps succeeding, the pool holds only
+    // the current format's buffers, and frames still do not allocate.
+    void CheckFormatChangesReuseClasses(void)
+    {
+        CFrameBufferPool pool;
+        size_t cbCurrent = 0;
+
+        for (uint32_t i = 0; i < 3 * CFrameBufferPool::ClassCount; i++)
+        {
+            const size_t cbFrame = GetPaddedFrameSize(640 + 64 * i, 480);
+
+            // A frame of the old format still in flight at the change.
+            CFrameBufferPool::Lease inFlight = (cbCurrent != 0) ? pool.Acquire(cbCurrent) : CFrameBufferPool::Lease();
+
+            if (cbCurrent != 0)
+            {
+                pool.Retire(cbCurrent);
+            }
+            CHECK(pool.Reserve(cbFrame, Depth));
+            cbCurrent = cbFrame;
+
+            inFlight.Reset();
+
+            CNoAllocationScope scope(pool);
+            {
+                CFrameBufferPool::Lease frame = pool.Acquire(cbFrame);
+                CHECK(frame && frame.Capacity() >= cbFrame);
+            }
+            CHECK(scope.AllocationCount() == 0);
+        }
+
+        const size_t cbClass = (cbCurrent + 4095) / 4096 * 4096;
+        CHECK(pool.GetBytesAllocated() >= Depth * cbClass);
+        CHECK(pool.GetBytesAllocated() < Depth * (cbClass + 4096));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int cFrames = argc > 1 ? std::atoi(argv[1]) : 2000;
+
+    CheckSteadyStateDoesNotAllocate(4, cFrames);
+    CheckExhaustedClassFallsBack();
+    CheckRetire();
+    CheckFormatChangesReuseClasses();
+
+    return TestResult("FrameBufferPoolTest");
+}
@@ -0,0 +1,234 @@
+#include "FrameLayout.h"
+#include "TestCheck.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+//////////////////////////////////////////////////////////////////////////
+//  Frame layout benchmark
+//
+//  Runs two kernels that read several rows of a plane at once over NV12
+//  frames 2048 and 4096 pixels wide: a vertical [1 2 1] filter and a bob
+//  deinterlace, which rebuilds the rows of one field from the rows of
+//  the other around them. Each runs once over the naive layout, where
+//  the stride is the row size, so rows alias at 4 KiB (every row at
+//  4096, every other row at 2048), and once over PlanFrame's padded
+//  layout. At 2048 only the plane stagger differs, since GetPaddedStride
+//  pads only a stride that is a multiple of 4 KiB. Prints the time per
+//  frame for each.
+//
+//  Checks the padded layout's invariants (strides a multiple of a cache
+//  line but never of 4 KiB, planes staggered within a page) and that
+//  both layouts produce the same pixels.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    const uint32_t NV12 = MakeFourCC('N', 'V', '1', '2');
+
+    // A page-aligned buffer laid out by a plan, as the frame pool hands
+    // them out.
+    class CFrame
+    {
+    public:
+
+        CFrame(const FrameBufferPlan& plan) :
+            m_pData(static_cast<uint8_t*>(::operator new(plan.cbSize, std::align_val_t(FrameAliasPeriod))))
+        {
+            ApplyFramePlan(plan, m_pData, &m_layout);
+        }
+
+        ~CFrame(void)
+        {
+            ::operator delete(m_pData, std::align_val_t(FrameAliasPeriod));
+        }
+
+        const FrameLayout& Layout(void) const
+        {
+            return m_layout;
+        }
+
+        void Fill(uint32_t seed)
+        {
+            for (uint32_t i = 0; i < m_layout.cPlanes; i++)
+            {
+                const FramePlane& plane = m_layout.Planes[i];
+                for (uint32_t row = 0; row < plane.Rows; row++)
+                {
+                    uint8_t* pRow = plane.pData + (int64_t)plane.Stride * row;
+                    for (uint32_t x = 0; x < plane.RowBytes; x++)
+                    {
+                        pRow[x] = (uint8_t)((x * 7 + row * 13 + i * 29 + seed) ^ (row >> 3));
+                    }
+                }
+            }
+        }
+
+        bool HasSamePixels(const CFrame& other) const
+        {
+            for (uint32_t i = 0; i < m_layout.cPlanes; i++)
+            {
+                const FramePlane& a = m_layout.Planes[i];
+                const FramePlane& b = other.m_layout.Planes[i];
+                for (uint32_t row = 0; row < a.Rows; row++)
+                {
+                    if (memcmp(a.pData + (int64_t)a.Stride * row, b.pData + (int64_t)b.Stride * row, a.RowBytes) != 0)
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+    private:
+
+        CFrame(const CFrame&) = delete;
+        CFrame& operator=(const CFrame&) = delete;
+
+        uint8_t* m_pData;
+        FrameLayout m_layout;
+    };
+
+    // out[y] = (in[y - 1] + 2 in[y] + in[y + 1]) / 4, edges clamped.
+    void VerticalFilter(const FramePlane& in, const FramePlane& out)
+    {
+        for (uint32_t y = 0; y < in.Rows; y++)
+        {
+            const uint8_t* pAbove = in.pData + (int64_t)in.Stride * (y > 0 ? y - 1 : 0);
+            const uint8_t* pRow = in.pData + (int64_t)in.Stride * y;
+            const uint8_t* pBelow = in.pData + (int64_t)in.Stride * (y + 1 < in.Rows ? y + 1 : y);
+            uint8_t* pOut = out.pData + (int64_t)out.Stride * y;
+
+            for (uint32_t x = 0; x < in.RowBytes; x++)
+            {
+                pOut[x] = (uint8_t)((pAbove[x] + 2 * pRow[x] + pBelow[x] + 2) >> 2);
+            }
+        }
+    }
+
+    // Keeps the top field and rebuilds each bottom-field row from the
+    // top-field rows above and below it.
+    void BobDeinterlace(const FramePlane& in, const FramePlane& out)
+    {
+        for (uint32_t y = 0; y < in.Rows; y++)
+        {
+            const uint8_t* pRow = in.pData + (int64_t)in.Stride * y;
+            uint8_t* pOut = out.pData + (int64_t)out.Stride * y;
+
+            if ((y % 2) == 0)
+            {
+                memcpy(pOut, pRow, in.RowBytes);
+                continue;
+            }
+
+            const uint8_t* pAbove = in.pData + (int64_t)in.Stride * (y - 1);
+            const uint8_t* pBelow = in.pData + (int64_t)in.Stride * (y + 1 < in.Rows ? y + 1 : y - 1);
+            for (uint32_t x = 0; x < in.RowBytes; x++)
+            {
+                pOut[x] = (uint8_t)((pAbove[x] + pBelow[x] + 1) >> 1);
+            }
+        }
+    }
+
+    typedef void (*Kernel)(const FramePlane& in, const FramePlane& out);
+
+    // Runs the kernel over every plane of cFrames frames; returns the
+    // time per frame.
+    double Run(Kernel kernel, const CFrame& in, const CFrame& out, int cFrames)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int f = 0; f < cFrames; f++)
+        {
+            for (uint32_t i = 0; i < in.Layout().cPlanes; i++)
+            {
+                kernel(in.Layout().Planes[i], out.Layout().Planes[i]);
+            }
+        }
+
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / cFrames;
+    }
+
+    void CheckPaddedPlan(const FrameBufferPlan& plan)
+    {
+        uint64_t pageOffsets[3] = {};
+
+        for (uint32_t i = 0; i < plan.cPlanes; i++)
+        {
+            CHECK(plan.Stride[i] > 0);
+            CHECK((uint32_t)plan.Stride[i] >= plan.RowBytes[i]);
+            CHECK(plan.Stride[i] % FrameRowAlign == 0);
+            CHECK(plan.Stride[i] % FrameAliasPeriod != 0);
+            CHECK(plan.Offset[i] % FrameRowAlign == 0);
+
+            // No two planes start at the same offset within a page.
+            pageOffsets[i] = (uint64_t)plan.Offset[i] % FrameAliasPeriod;
+            for (uint32_t j = 0; j < i; j++)
+            {
+                CHECK(pageOffsets[i] != pageOffsets[j]);
+            }
+
+            // The plane ends inside the buffer.
+            CHECK((uint64_t)plan.Offset[i] + (uint64_t)plan.Stride[i] * (plan.Rows[i] - 1) + plan.RowBytes[i] <= plan.cbSize);
+        }
+    }
+
+    void RunWidth(uint32_t width, uint32_t height, int cFrames)
+    {
+        const FrameFormatInfo* pInfo = FindFrameFormat(NV12);
+        CHECK(pInfo != nullptr);
+
+        FrameBufferPlan naive = {};
+        FrameBufferPlan padded = {};
+        CHECK(PlanFrame(*pInfo, false, (int32_t)width, width, height, &naive));
+        CHECK(PlanFrame(*pInfo, true, 0, width, height, &padded));
+
+        // The naive stride is the row size, which aliases at these widths.
+        CHECK((uint32_t)naive.Stride[0] * 2 % FrameAliasPeriod == 0);
+        CheckPaddedPlan(padded);
+
+        CFrame naiveIn(naive);
+        CFrame naiveOut(naive);
+        CFrame paddedIn(padded);
+        CFrame paddedOut(padded);
+        naiveIn.Fill(1);
+        paddedIn.Fill(1);
+        CHECK(naiveIn.HasSamePixels(paddedIn));
+
+        std::printf("NV12 %ux%u, naive stride %d, padded stride %d\n", width, height, naive.Stride[0], padded.Stride[0]);
+
+        static const struct
+        {
+            const char* Name;
+            Kernel Run;
+        } s_kernels[] =
+        {
+            { "vertical filter", VerticalFilter },
+            { "bob deinterlace", BobDeinterlace },
+        };
+
+        for (const auto& kernel : s_kernels)
+        {
+            const double nsNaive = Run(kernel.Run, naiveIn, naiveOut, cFrames);
+            const double nsPadded = Run(kernel.Run, paddedIn, paddedOut, cFrames);
+
+            // Only the layout differs, never the result.
+            CHECK(naiveOut.HasSamePixels(paddedOut));
+
+            std::printf("  %s: naive %10.0f ns/frame, padded %10.0f ns/frame (%.2fx)\n", kernel.Name, nsNaive, nsPadded, nsNaive / nsPadded);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int cFrames = argc > 1 ? std::atoi(argv[1]) : 2;
+
+    RunWidth(2048, 1080, cFrames);
+    RunWidth(4096, 2160, cFrames);
+
+    return TestResult("FrameLayoutBenchmark");
+}
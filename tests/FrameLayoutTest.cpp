@@ -0,0 +1,165 @@
+#include "FrameLayout.h"
+#include "TestCheck.h"
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Frame layout tests
+//
+//  Checks DescribeFrame against layouts worked out by hand: where each
+//  plane starts, its stride and size, for top-down and bottom-up frames,
+//  and that a frame is rejected when the buffer Lock2D returned is too
+//  short to hold it.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    const uint32_t NV12 = MakeFourCC('N', 'V', '1', '2');
+    const uint32_t I420 = MakeFourCC('I', '4', '2', '0');
+    const uint32_t YV12 = MakeFourCC('Y', 'V', '1', '2');
+    const uint32_t ARGB32 = 21;         // D3DFMT_A8R8G8B8
+    const uint32_t RGB24 = 20;          // D3DFMT_R8G8B8
+
+    bool IsPlane(const FramePlane& plane, const uint8_t* pData, int32_t stride, uint32_t rowBytes, uint32_t rows)
+    {
+        return plane.pData == pData && plane.Stride == stride && plane.RowBytes == rowBytes && plane.Rows == rows;
+    }
+
+    // A bottom-up RGB frame: Lock2D returns the top row, which is the last
+    // one in memory, and a negative stride.
+    void CheckBottomUpRgb(void)
+    {
+        const FrameFormatInfo* pInfo = FindFrameFormat(ARGB32);
+        CHECK(pInfo != nullptr && pInfo->BottomUpAllowed);
+
+        std::vector<uint8_t> buffer(4 * 16 * 3);
+        uint8_t* pTop = buffer.data() + 2 * 64;
+
+        FrameLayout layout;
+        CHECK(DescribeFrame(*pInfo, pTop, -64, 16, 3, buffer.data(), buffer.size(), &layout));
+        CHECK(layout.cPlanes == 1);
+        CHECK(IsPlane(layout.Planes[0], pTop, -64, 64, 3));
+
+        // The rows below the top one must still be inside the buffer.
+        CHECK(!DescribeFrame(*pInfo, buffer.data() + 64, -64, 16, 3, buffer.data(), buffer.size(), &layout));
+
+        // 24-bit RGB, with a stride wider than the row.
+        const FrameFormatInfo* pRgb24 = FindFrameFormat(RGB24);
+        CHECK(pRgb24 != nullptr);
+        std::vector<uint8_t> rgb24(64 * 2);
+        CHECK(DescribeFrame(*pRgb24, rgb24.data() + 64, -64, 20, 2, rgb24.data(), rgb24.size(), &layout));
+        CHECK(IsPlane(layout.Planes[0], rgb24.data() + 64, -64, 60, 2));
+
+        // YUV formats are never bottom-up.
+        const FrameFormatInfo* pNv12 = FindFrameFormat(NV12);
+        CHECK(pNv12 != nullptr && !pNv12->BottomUpAllowed);
+        CHECK(!DescribeFrame(*pNv12, buffer.data() + 64, -16, 16, 4, nullptr, 0, &layout));
+    }
+
+    // Planar 4:2:0: the chroma planes follow the luma plane at half the
+    // stride. YV12 is laid out like I420, but its first chroma plane is V.
+    void CheckPlanarOrder(void)
+    {
+        const FrameFormatInfo* pYv12 = FindFrameFormat(YV12);
+        const FrameFormatInfo* pI420 = FindFrameFormat(I420);
+        CHECK(pYv12 != nullptr && pI420 != nullptr);
+        CHECK(pYv12->Layout == FramePlaneLayout::Planar420);
+
+        std::vector<uint8_t> buffer(32 * 8 + 2 * 16 * 4);
+        uint8_t* pBase = buffer.data();
+
+        FrameLayout yv12;
+        CHECK(DescribeFrame(*pYv12, pBase, 32, 24, 8, pBase, buffer.size(), &yv12));
+        CHECK(yv12.cPlanes == 3);
+        CHECK(IsPlane(yv12.Planes[0], pBase, 32, 24, 8));
+        CHECK(IsPlane(yv12.Planes[1], pBase + 256, 16, 12, 4));         // V
+        CHECK(IsPlane(yv12.Planes[2], pBase + 256 + 64, 16, 12, 4));    // U
+
+        FrameLayout i420;
+        CHECK(DescribeFrame(*pI420, pBase, 32, 24, 8, pBase, buffer.size(), &i420));
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            CHECK(IsPlane(i420.Planes[i], yv12.Planes[i].pData, yv12.Planes[i].Stride, yv12.Planes[i].RowBytes, yv12.Planes[i].Rows));
+        }
+
+        // Planar chroma needs an even stride to be halved.
+        CHECK(!DescribeFrame(*pYv12, pBase, 31, 24, 8, nullptr, 0, &yv12));
+    }
+
+    // An odd height rounds the chroma rows up.
+    void CheckOddHeight(void)
+    {
+        const FrameFormatInfo* pNv12 = FindFrameFormat(NV12);
+        const FrameFormatInfo* pI420 = FindFrameFormat(I420);
+
+        std::vector<uint8_t> buffer(16 * 5 + 16 * 3);
+        uint8_t* pBase = buffer.data();
+
+        FrameLayout layout;
+        CHECK(DescribeFrame(*pNv12, pBase, 16, 16, 5, pBase, buffer.size(), &layout));
+        CHECK(layout.cPlanes == 2);
+        CHECK(IsPlane(layout.Planes[0], pBase, 16, 16, 5));
+        CHECK(IsPlane(layout.Planes[1], pBase + 80, 16, 16, 3));
+
+        CHECK(DescribeFrame(*pI420, pBase, 16, 16, 5, pBase, buffer.size(), &layout));
+        CHECK(IsPlane(layout.Planes[1], pBase + 80, 8, 8, 3));
+        CHECK(IsPlane(layout.Planes[2], pBase + 80 + 24, 8, 8, 3));
+    }
+
+    // The last row of the last plane only needs its RowBytes, not a whole
+    // stride; one byte less and the frame does not fit.
+    void CheckShortBuffer(void)
+    {
+        const FrameFormatInfo* pNv12 = FindFrameFormat(NV12);
+        const FrameFormatInfo* pArgb = FindFrameFormat(ARGB32);
+
+        std::vector<uint8_t> buffer(4096);
+        uint8_t* pBase = buffer.data();
+        FrameLayout layout;
+
+        // NV12 16x4, stride 32: luma 4 rows, chroma 2 rows.
+        const size_t cbNv12 = 32 * 4 + 32 + 16;
+        CHECK(DescribeFrame(*pNv12, pBase, 32, 16, 4, pBase, cbNv12, &layout));
+        CHECK(!DescribeFrame(*pNv12, pBase, 32, 16, 4, pBase, cbNv12 - 1, &layout));
+
+        // The buffer may start before the first row, but not after it.
+        CHECK(DescribeFrame(*pNv12, pBase + 8, 32, 16, 4, pBase, cbNv12 + 8, &layout));
+        CHECK(!DescribeFrame(*pNv12, pBase, 32, 16, 4, pBase + 1, cbNv12, &layout));
+
+        // Top-down ARGB 8x2, stride 64.
+        CHECK(DescribeFrame(*pArgb, pBase, 64, 8, 2, pBase, 64 + 32, &layout));
+        CHECK(!DescribeFrame(*pArgb, pBase, 64, 8, 2, pBase, 64 + 31, &layout));
+
+        // Without a buffer to check against, only the frame itself is.
+        CHECK(DescribeFrame(*pArgb, pBase, 64, 8, 2, nullptr, 0, &layout));
+    }
+
+    // Frames that cannot be described at all.
+    void CheckMalformed(void)
+    {
+        const FrameFormatInfo* pNv12 = FindFrameFormat(NV12);
+
+        std::vector<uint8_t> buffer(1024);
+        uint8_t* pBase = buffer.data();
+        FrameLayout layout;
+
+        CHECK(!DescribeFrame(*pNv12, nullptr, 16, 16, 4, nullptr, 0, &layout));
+        CHECK(!DescribeFrame(*pNv12, pBase, 8, 16, 4, nullptr, 0, &layout));     // Stride below the row.
+        CHECK(!DescribeFrame(*pNv12, pBase, 16, 15, 4, nullptr, 0, &layout));    // Odd width.
+        CHECK(!DescribeFrame(*pNv12, pBase, 16, 0, 4, nullptr, 0, &layout));
+        CHECK(!DescribeFrame(*pNv12, pBase, 16, 16, 0, nullptr, 0, &layout));
+
+        CHECK(FindFrameFormat(MakeFourCC('H', '2', '6', '4')) == nullptr);
+    }
+}
+
+int main(void)
+{
+    CheckBottomUpRgb();
+    CheckPlanarOrder();
+    CheckOddHeight();
+    CheckShortBuffer();
+    CheckMalformed();
+
+    return TestResult("FrameLayoutTest");
+}
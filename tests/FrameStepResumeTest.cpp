@@ -0,0 +1,317 @@
+#include "StreamState.h"
+#include "FrameStepQueue.h"
+#include "SampleCredits.h"
+#include "TestCheck.h"
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Frame step and resume tests
+//
+//  A model of the stream sink's pause, step and resume path, built on the
+//  same pieces: the transition table through ApplyStreamTransition, the
+//  step queue, the request credits, and IsSeekStart to decide whether a
+//  clock start flushes, as OnClockStart does. Frames are numbered in
+//  decode order, so the presented list shows both loss and reordering,
+//  and the credit totals show requests sent twice.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    const uint32_t QueueDepth = 3;          // SAMPLE_QUEUE_HIWATER_THRESHOLD
+    const size_t StepQueueSize = 3;         // STEP_QUEUE_SIZE
+    const int32_t E_Denied = -1;
+
+    class CStreamModel
+    {
+    public:
+
+        CStreamModel(void) :
+            m_state(State::State_Ready),
+            m_bStepMode(false),
+            m_bSchedulerActive(false),
+            m_nextFrame(0)
+        {
+        }
+
+        // OnClockStart followed by CustomVideoStreamSink::Start.
+        int32_t ClockStart(bool bNewPosition)
+        {
+            if (IsSeekStart(m_state.load(std::memory_order_acquire), bNewPosition))
+            {
+                (void)Flush();
+            }
+
+            if (bNewPosition)
+            {
+                m_StepQueue.Clear();
+            }
+
+            const int32_t hr = ApplyStreamTransition(m_state, StreamOperation::OpStart, m_trace, *this, E_Denied);
+            if (hr == 0)
+            {
+                PresentHeldFrames();
+                m_bStepMode = false;
+            }
+            return hr;
+        }
+
+        int32_t Stop(void)
+        {
+            return ApplyStreamTransition(m_state, StreamOperation::OpStop, m_trace, *this, E_Denied);
+        }
+
+        int32_t Pause(void)
+        {
+            return ApplyStreamTransition(m_state, StreamOperation::OpPause, m_trace, *this, E_Denied);
+        }
+
+        void SetStepMode(bool bStepMode)
+        {
+            if (!bStepMode)
+            {
+                PresentHeldFrames();
+            }
+            m_bStepMode = bStepMode;
+        }
+
+        // Returns true if a frame was presented.
+        bool Step(void)
+        {
+            CHECK(m_bStepMode);
+            CHECK(ApplyStreamTransition(m_state, StreamOperation::OpStep, m_trace, *this, E_Denied) == 0);
+
+            int frame = -1;
+            if (!m_StepQueue.Step(&frame))
+            {
+                return false;
+            }
+
+            m_presented.push_back(frame);
+            return true;
+        }
+
+        // The scheduler's RequestSamples: held frames count against the
+        // depth. Returns the number of requests sent.
+        uint32_t RequestSamples(void)
+        {
+            if (!m_bSchedulerActive)
+            {
+                return 0;
+            }
+
+            const uint32_t cHeld = m_StepQueue.GetCount();
+            uint32_t epoch = 0;
+            return m_credits.GrantUpTo(QueueDepth > cHeld ? QueueDepth - cHeld : 0, &epoch);
+        }
+
+        // The decoder answers one outstanding request.
+        void DeliverSample(void)
+        {
+            (void)m_credits.Consume();
+
+            int frame = m_nextFrame++;
+
+            if (m_bStepMode && m_state.load(std::memory_order_relaxed) == State::State_Paused)
+            {
+                if (m_StepQueue.Offer(frame) == FrameStepAction::Hold)
+                {
+                    return;
+                }
+            }
+
+            m_presented.push_back(frame);
+        }
+
+        // Transition hooks, called by ApplyStreamTransition. Flush is also
+        // the pipeline's IMFStreamSink::Flush.
+        int32_t Flush(void)
+        {
+            m_StepQueue.Clear();
+            (void)m_credits.Flush();
+            return 0;
+        }
+
+        void StopScheduler(void)
+        {
+            m_bSchedulerActive = false;
+        }
+
+        int32_t StartScheduler(void)
+        {
+            m_bSchedulerActive = true;
+            return 0;
+        }
+
+        const std::vector<int>& Presented(void) const   { return m_presented; }
+        uint32_t HeldCount(void) const                  { return m_StepQueue.GetCount(); }
+        const CSampleRequestCredits& Credits(void) const { return m_credits; }
+
+    private:
+
+        void PresentHeldFrames(void)
+        {
+            int frames[StepQueueSize];
+            const size_t cFrames = m_StepQueue.Take(frames, StepQueueSize);
+
+            m_presented.insert(m_presented.end(), frames, frames + cFrames);
+        }
+
+        std::atomic<State> m_state;
+        TransitionTrace<64> m_trace;
+        CFrameStepQueue<int, StepQueueSize> m_StepQueue;
+        CSampleRequestCredits m_credits;
+        bool m_bStepMode;
+        bool m_bSchedulerActive;
+        int m_nextFrame;
+        std::vector<int> m_presented;
+    };
+
+    // Answers every outstanding request.
+    void Decode(CStreamModel& stream)
+    {
+        while (stream.Credits().Outstanding() != 0)
+        {
+            stream.DeliverSample();
+        }
+    }
+
+    bool IsInOrder(const std::vector<int>& frames, int cExpected)
+    {
+        if ((int)frames.size() != cExpected)
+        {
+            return false;
+        }
+        for (int i = 0; i < cExpected; i++)
+        {
+            if (frames[i] != i)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Only a clock start that moves an active stream is a seek.
+    void CheckSeekStart(void)
+    {
+        CHECK(!IsSeekStart(State::State_Ready, true));
+        CHECK(!IsSeekStart(State::State_Stopped, true));
+        CHECK(!IsSeekStart(State::State_Paused, false));
+        CHECK(!IsSeekStart(State::State_Started, false));
+        CHECK(IsSeekStart(State::State_Paused, true));
+        CHECK(IsSeekStart(State::State_Started, true));
+    }
+
+    // Pause, step once, then resume from the current position: the frames
+    // still held are presented first, in decode order, and none is lost.
+    void CheckResumePresentsHeldFrames(void)
+    {
+        CStreamModel stream;
+
+        CHECK(stream.ClockStart(true) == 0);
+        CHECK(stream.RequestSamples() == QueueDepth);
+        Decode(stream);
+        CHECK(IsInOrder(stream.Presented(), 3));
+
+        CHECK(stream.Pause() == 0);
+        stream.SetStepMode(true);
+
+        // The scheduler keeps asking while paused, and the queue fills.
+        CHECK(stream.RequestSamples() == QueueDepth);
+        Decode(stream);
+        CHECK(stream.HeldCount() == 3);
+        CHECK(stream.RequestSamples() == 0);
+
+        CHECK(stream.Step());
+        CHECK(IsInOrder(stream.Presented(), 4));
+        CHECK(stream.HeldCount() == 2);
+
+        CHECK(stream.ClockStart(false) == 0);
+        CHECK(stream.HeldCount() == 0);
+        CHECK(IsInOrder(stream.Presented(), 6));
+
+        // Playback continues after the held frames.
+        CHECK(stream.RequestSamples() == QueueDepth);
+        Decode(stream);
+        CHECK(IsInOrder(stream.Presented(), 9));
+    }
+
+    // A step with nothing held presents the next frame to arrive.
+    void CheckStepBeforeFrameArrives(void)
+    {
+        CStreamModel stream;
+
+        CHECK(stream.ClockStart(true) == 0);
+        CHECK(stream.Pause() == 0);
+        stream.SetStepMode(true);
+
+        CHECK(!stream.Step());
+        CHECK(stream.RequestSamples() == QueueDepth);
+        stream.DeliverSample();
+        CHECK(IsInOrder(stream.Presented(), 1));
+        CHECK(stream.HeldCount() == 0);
+
+        Decode(stream);
+        CHECK(stream.HeldCount() == 2);
+
+        CHECK(stream.ClockStart(false) == 0);
+        CHECK(IsInOrder(stream.Presented(), 3));
+    }
+
+    // Seeking while paused drops the held frames: they belong to the old
+    // position.
+    void CheckSeekDropsHeldFrames(void)
+    {
+        CStreamModel stream;
+
+        CHECK(stream.ClockStart(true) == 0);
+        CHECK(stream.Pause() == 0);
+        stream.SetStepMode(true);
+        CHECK(stream.RequestSamples() == QueueDepth);
+        Decode(stream);
+        CHECK(stream.HeldCount() == 3);
+
+        CHECK(stream.ClockStart(true) == 0);
+        CHECK(stream.HeldCount() == 0);
+        CHECK(stream.Presented().empty());
+    }
+
+    // Pausing and resuming does not void the requests already sent, so it
+    // must not refund them: the stream would ask for up to the queue depth
+    // again on every resume. Stopping does void them.
+    void CheckPauseResumeKeepsCredits(void)
+    {
+        CStreamModel stream;
+
+        CHECK(stream.ClockStart(true) == 0);
+        CHECK(stream.RequestSamples() == QueueDepth);
+
+        for (int i = 0; i < 5; i++)
+        {
+            CHECK(stream.Pause() == 0);
+            CHECK(stream.RequestSamples() == 0);
+            CHECK(stream.ClockStart(false) == 0);
+            CHECK(stream.RequestSamples() == 0);
+        }
+
+        CHECK(stream.Credits().Outstanding() == QueueDepth);
+        CHECK(stream.Credits().TotalGranted() == QueueDepth);
+        CHECK(stream.Credits().TotalRefunded() == 0);
+
+        CHECK(stream.Stop() == 0);
+        CHECK(stream.Credits().Outstanding() == 0);
+        CHECK(stream.Credits().TotalRefunded() == QueueDepth);
+    }
+}
+
+int main(void)
+{
+    CheckSeekStart();
+    CheckResumePresentsHeldFrames();
+    CheckStepBeforeFrameArrives();
+    CheckSeekDropsHeldFrames();
+    CheckPauseResumeKeepsCredits();
+
+    return TestResult("FrameStepResumeTest");
+}
@@ -0,0 +1,147 @@
+#include "MemoryBudget.h"
+#include "FrameLayout.h"
+#include "TestCheck.h"
+
+//////////////////////////////////////////////////////////////////////////
+//  Memory budget tests
+//
+//  Several accounts share one governor, as the stream sinks of a process
+//  do. Checks that an account always gets its fair share, that it may
+//  go past it only while the budget has headroom, that depths stay
+//  between one frame and the maximum, and that charges add up. The frame
+//  sizes come from PlanFrame, as the sink charges them.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    const uint32_t MaxDepth = 3;        // SAMPLE_QUEUE_HIWATER_THRESHOLD
+    const uint64_t MiB = 1024 * 1024;
+
+    uint64_t GetFrameSize(uint32_t format, uint32_t width, uint32_t height)
+    {
+        const FrameFormatInfo* pInfo = FindFrameFormat(format);
+        FrameBufferPlan plan = {};
+        CHECK(pInfo != nullptr && PlanFrame(*pInfo, false, (int32_t)(width * pInfo->BitsPerPixel / 8), width, height, &plan));
+        return plan.cbSize;
+    }
+
+    // The sizes the sink charges per frame, by format.
+    void CheckFrameSizes(void)
+    {
+        CHECK(GetFrameSize(MakeFourCC('N', 'V', '1', '2'), 1920, 1080) == 1920 * 1080 * 3 / 2);
+        CHECK(GetFrameSize(MakeFourCC('P', '0', '1', '0'), 1920, 1080) == 1920 * 1080 * 3);
+        CHECK(GetFrameSize(MakeFourCC('A', 'Y', 'U', 'V'), 1920, 1080) == 1920 * 1080 * 4);
+        CHECK(GetFrameSize(MakeFourCC('Y', 'U', 'Y', '2'), 1920, 1080) == 1920 * 1080 * 2);
+        CHECK(GetFrameSize(MakeFourCC('I', '4', '2', '0'), 1920, 1081) == 1920 * 1081 + 2 * 960 * 541);
+    }
+
+    // A budget of 0 is unlimited.
+    void CheckUnlimited(void)
+    {
+        CMemoryGovernor governor;
+        CMemoryBudgetAccount account(governor);
+
+        account.SetCharge(100 * MiB);
+        CHECK(account.GetAllowance() == UINT64_MAX);
+        CHECK(account.GetDepth(50 * MiB, MaxDepth) == MaxDepth);
+    }
+
+    // Charges add up in the governor, and replacing one moves the total
+    // both ways.
+    void CheckCharges(void)
+    {
+        CMemoryGovernor governor(64 * MiB);
+        {
+            CMemoryBudgetAccount a(governor);
+            CMemoryBudgetAccount b(governor);
+            CHECK(governor.GetAccountCount() == 2);
+
+            a.SetCharge(10 * MiB);
+            b.SetCharge(20 * MiB);
+            CHECK(governor.GetCharged() == 30 * MiB);
+
+            a.SetCharge(4 * MiB);
+            CHECK(governor.GetCharged() == 24 * MiB);
+            CHECK(a.GetCharge() == 4 * MiB);
+        }
+
+        // Accounts give their charge back when they go away.
+        CHECK(governor.GetAccountCount() == 0);
+        CHECK(governor.GetCharged() == 0);
+    }
+
+    // With the budget full, each account still gets its fair share.
+    void CheckFairShare(void)
+    {
+        const uint64_t cbFrame = GetFrameSize(MakeFourCC('P', '0', '1', '0'), 1920, 1080);
+        CMemoryGovernor governor(4 * cbFrame);
+
+        CMemoryBudgetAccount greedy(governor);
+        CMemoryBudgetAccount late(governor);
+
+        // One account took the whole budget while it was alone in using it.
+        greedy.SetCharge(4 * cbFrame);
+        CHECK(late.GetAllowance() == 2 * cbFrame);
+        CHECK(late.GetDepth(cbFrame, MaxDepth) == 2);
+
+        // The greedy account keeps what it holds, but gets no more.
+        CHECK(greedy.GetAllowance() == 4 * cbFrame);
+        CHECK(greedy.GetDepth(cbFrame, MaxDepth) == MaxDepth);
+
+        // A third account shrinks every share.
+        CMemoryBudgetAccount third(governor);
+        CHECK(third.GetAllowance() == 4 * cbFrame / 3);
+        CHECK(third.GetDepth(cbFrame, MaxDepth) == 1);
+    }
+
+    // Below the budget an account may use its charge plus the headroom,
+    // even past its fair share; the headroom shrinks as others charge.
+    void CheckHeadroom(void)
+    {
+        const uint64_t cbFrame = GetFrameSize(MakeFourCC('N', 'V', '1', '2'), 3840, 2160);
+        CMemoryGovernor governor(12 * cbFrame);
+
+        CMemoryBudgetAccount a(governor);
+        CMemoryBudgetAccount b(governor);
+
+        a.SetCharge(cbFrame);
+        CHECK(a.GetAllowance() == 12 * cbFrame);
+        CHECK(a.GetDepth(cbFrame, 16) == 12);
+
+        b.SetCharge(8 * cbFrame);
+        CHECK(a.GetAllowance() == 6 * cbFrame);             // Fair share beats 1 + 3 frames.
+        CHECK(b.GetAllowance() == 11 * cbFrame);            // 8 held + 3 headroom.
+
+        // Over budget: no headroom, only the share or what is held.
+        b.SetCharge(14 * cbFrame);
+        CHECK(a.GetAllowance() == 6 * cbFrame);
+        CHECK(b.GetAllowance() == 14 * cbFrame);
+    }
+
+    // Depth stays between one frame and the maximum.
+    void CheckDepthLimits(void)
+    {
+        CMemoryGovernor governor(MiB);
+        CMemoryBudgetAccount account(governor);
+
+        CHECK(account.GetDepth(8 * MiB, MaxDepth) == 1);    // Never below one frame.
+        CHECK(account.GetDepth(1024, MaxDepth) == MaxDepth);
+        CHECK(account.GetDepth(0, MaxDepth) == MaxDepth);   // Unknown size.
+        CHECK(account.GetDepth(1024, 0) == 0);
+
+        governor.SetBudget(0);
+        CHECK(account.GetDepth(8 * MiB, MaxDepth) == MaxDepth);
+    }
+}
+
+int main(void)
+{
+    CheckFrameSizes();
+    CheckUnlimited();
+    CheckCharges();
+    CheckFairShare();
+    CheckHeadroom();
+    CheckDepthLimits();
+
+    return TestResult("MemoryBudgetTest");
+}
@@ -0,0 +1,94 @@
+#include "CritSec.h"
+#include "TestCheck.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Reader/writer lock contention benchmark
+//
+//  Models the sink getters: several threads read a small shared object
+//  and now and then one of them replaces it, first with every access
+//  under an exclusive CCritSec, then with the reads under a shared
+//  CRWLock. Prints the time per access for each, and checks that no
+//  reader ever saw a half-written object.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    // Both halves must always match; a torn read sees them differ.
+    struct SharedType
+    {
+        uint64_t Width;
+        uint64_t Height;
+    };
+
+    const int WritesPerThousand = 10;     // 1% writes, as after a format change.
+
+    template <class Read, class Write>
+    double Run(int cThreads, int cAccesses, SharedType& shared, Read read, Write write)
+    {
+        std::atomic<uint64_t> cTorn{ 0 };
+
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < cThreads; t++)
+        {
+            threads.emplace_back([&, t]()
+            {
+                for (int i = 0; i < cAccesses; i++)
+                {
+                    if ((i + t) % 1000 < WritesPerThousand)
+                    {
+                        write([&]() { shared.Width++; shared.Height++; });
+                    }
+                    else
+                    {
+                        SharedType copy = {};
+                        read([&]() { copy = shared; });
+                        if (copy.Width != copy.Height)
+                        {
+                            cTorn++;
+                        }
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        CHECK(cTorn == 0);
+        return ns / ((double)cThreads * cAccesses);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int cAccesses = argc > 1 ? std::atoi(argv[1]) : 200000;
+    const int cThreads = 4;
+
+    SharedType shared = {};
+
+    CCritSec cs;
+    const double nsCritSec = Run(cThreads, cAccesses, shared,
+        [&](auto body) { CAutoLock lock(&cs, LOCK_SITE("RWLockBenchmark read CCritSec")); body(); },
+        [&](auto body) { CAutoLock lock(&cs, LOCK_SITE("RWLockBenchmark write CCritSec")); body(); });
+
+    CRWLock rw;
+    const double nsRWLock = Run(cThreads, cAccesses, shared,
+        [&](auto body) { CAutoSharedLock lock(&rw, LOCK_SITE("RWLockBenchmark read CRWLock")); body(); },
+        [&](auto body) { CAutoExclusiveLock lock(&rw, LOCK_SITE("RWLockBenchmark write CRWLock")); body(); });
+
+    std::printf("%d threads, %d accesses each, %d%% writes\n", cThreads, cAccesses, WritesPerThousand / 10);
+    std::printf("  CCritSec: %8.1f ns per access\n", nsCritSec);
+    std::printf("  CRWLock:  %8.1f ns per access\n", nsRWLock);
+
+    return TestResult("RWLockBenchmark");
+}
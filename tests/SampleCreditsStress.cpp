@@ -0,0 +1,128 @@
+#include "SampleCredits.h"
+#include "TestCheck.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Sample request credit stress test
+//
+//  Scheduler threads grant credits and give back part of them as if some
+//  request events could not be sent, decoder threads consume them, and a
+//  control thread flushes. Once all threads have stopped the books must
+//  balance exactly:
+//
+//      granted == consumed + refunded + outstanding
+//
+//  The sequential checks first pin down the epoch rules.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    void CheckSequential(void)
+    {
+        CSampleRequestCredits credits;
+        uint32_t epoch = 0;
+
+        CHECK(credits.GrantUpTo(3, &epoch) == 3);
+        CHECK(credits.GrantUpTo(3, &epoch) == 0);
+        CHECK(credits.Consume());
+        CHECK(credits.Outstanding() == 2);
+
+        // Two of the three were never sent.
+        CHECK(credits.Refund(2, epoch) == 2);
+        CHECK(credits.Outstanding() == 0);
+        CHECK(!credits.Consume());
+        CHECK(credits.TotalUnsolicited() == 1);
+
+        // A flush between the grant and the refund has taken the credits
+        // back already; the late refund must not take the next epoch's.
+        uint32_t oldEpoch = 0;
+        CHECK(credits.GrantUpTo(3, &oldEpoch) == 3);
+        CHECK(credits.Flush() == 3);
+
+        uint32_t newEpoch = 0;
+        CHECK(credits.GrantUpTo(3, &newEpoch) == 3);
+        CHECK(newEpoch != oldEpoch);
+        CHECK(credits.Refund(3, oldEpoch) == 0);
+        CHECK(credits.Outstanding() == 3);
+
+        CHECK(credits.TotalGranted() == credits.TotalConsumed() + credits.TotalRefunded() + credits.Outstanding());
+    }
+
+    void CheckConcurrent(int msRun)
+    {
+        CSampleRequestCredits credits;
+        std::atomic<bool> bStop{ false };
+        std::vector<std::thread> threads;
+
+        for (int t = 0; t < 2; t++)
+        {
+            threads.emplace_back([&, t]()
+            {
+                uint32_t i = (uint32_t)t;
+                while (!bStop)
+                {
+                    uint32_t epoch = 0;
+                    const uint32_t cGranted = credits.GrantUpTo(3, &epoch);
+
+                    // Now and then only some of the events get queued.
+                    if (cGranted != 0 && (++i % 4) == 0)
+                    {
+                        (void)credits.Refund(cGranted - 1, epoch);
+                    }
+                }
+            });
+        }
+
+        for (int t = 0; t < 3; t++)
+        {
+            threads.emplace_back([&]()
+            {
+                while (!bStop)
+                {
+                    (void)credits.Consume();
+                    std::this_thread::yield();
+                }
+            });
+        }
+
+        threads.emplace_back([&]()
+        {
+            while (!bStop)
+            {
+                (void)credits.Flush();
+                std::this_thread::yield();
+            }
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(msRun));
+        bStop = true;
+
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        std::printf("granted %llu, consumed %llu, refunded %llu, outstanding %u, unsolicited %llu\n",
+            (unsigned long long)credits.TotalGranted(), (unsigned long long)credits.TotalConsumed(),
+            (unsigned long long)credits.TotalRefunded(), credits.Outstanding(),
+            (unsigned long long)credits.TotalUnsolicited());
+
+        CHECK(credits.TotalGranted() != 0);
+        CHECK(credits.Outstanding() <= 3);
+        CHECK(credits.TotalGranted() == credits.TotalConsumed() + credits.TotalRefunded() + credits.Outstanding());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int msRun = argc > 1 ? std::atoi(argv[1]) : 500;
+
+    CheckSequential();
+    CheckConcurrent(msRun);
+
+    return TestResult("SampleCreditsStress");
+}
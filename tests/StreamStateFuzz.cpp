@@ -0,0 +1,230 @@
+#include "StreamState.h"
+#include "CritSec.h"
+#include "TestCheck.h"
+
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+//  Stream state machine fuzz test
+//
+//  Several threads race Start, Stop, Pause, Restart, SetMediaType,
+//  Shutdown and ProcessSample against a model of the stream sink that
+//  applies transitions through ApplyStreamTransition, as the sink does:
+//  control operations under a lock, samples lock-free against the atomic
+//  state.
+//
+//  After every transition the model checks what the hooks must have
+//  left behind, and after every round the transition trace must form one
+//  unbroken chain of states.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    const int E_Denied = -1;
+    const int E_Shutdown = -2;
+
+    class CStreamModel
+    {
+    public:
+
+        CStreamModel(void) :
+            m_state(State::State_TypeNotSet),
+            m_bShutdown(false),
+            m_bSchedulerActive(false),
+            m_cQueued(0)
+        {
+        }
+
+        int Apply(StreamOperation op)
+        {
+            CAutoLock lock(&m_cs);
+
+            if (m_bShutdown)
+            {
+                return E_Shutdown;
+            }
+
+            // The same sequence the sink runs in ApplyTransition.
+            const int result = ApplyStreamTransition(m_state, op, m_trace, *this, E_Denied);
+            if (result == 0)
+            {
+                CheckInvariants();
+            }
+            return result;
+        }
+
+        // Transition hooks, called by ApplyStreamTransition under m_cs.
+        int32_t Flush(void)
+        {
+            m_cQueued = 0;
+            return 0;
+        }
+
+        void StopScheduler(void)
+        {
+            m_bSchedulerActive = false;
+        }
+
+        int32_t StartScheduler(void)
+        {
+            m_bSchedulerActive = true;
+            return 0;
+        }
+
+        void Shutdown(void)
+        {
+            CAutoLock lock(&m_cs);
+
+            m_bShutdown = true;
+            m_bSchedulerActive = false;
+            m_cQueued = 0;
+        }
+
+        // Lock-free, like CustomVideoStreamSink::ProcessSample.
+        int ProcessSample(void)
+        {
+            if (m_bShutdown.load(std::memory_order_acquire))
+            {
+                return E_Shutdown;
+            }
+
+            const State observed = m_state.load(std::memory_order_acquire);
+            if (!GetTransition(observed, StreamOperation::OpProcessSample).Allowed)
+            {
+                CHECK(observed == State::State_TypeNotSet || observed == State::State_Ready || observed == State::State_Stopped);
+                return E_Denied;
+            }
+
+            CHECK(observed == State::State_Started || observed == State::State_Paused);
+            m_cQueued++;
+            return 0;
+        }
+
+        bool IsShutdown(void) const
+        {
+            return m_bShutdown.load(std::memory_order_acquire);
+        }
+
+        // Allowed transitions must chain: each one starts in the state the
+        // previous one left. Denied ones must leave the state alone.
+        void CheckTrace(void) const
+        {
+            TransitionTrace<TraceSize>::Entry entries[TraceSize];
+            const size_t cEntries = m_trace.Snapshot(entries, TraceSize);
+
+            for (size_t i = 0; i < cEntries; i++)
+            {
+                CHECK(entries[i].Allowed || entries[i].To == entries[i].From);
+
+                if (i > 0 && entries[i].Sequence == entries[i - 1].Sequence + 1)
+                {
+                    CHECK(entries[i].From == entries[i - 1].To);
+                }
+            }
+        }
+
+    private:
+
+        static const size_t TraceSize = 1024;
+
+        // Caller holds m_cs.
+        void CheckInvariants(void) const
+        {
+            const State state = m_state.load(std::memory_order_relaxed);
+
+            if (state == State::State_Started)
+            {
+                CHECK(m_bSchedulerActive);
+            }
+            if (state == State::State_TypeNotSet || state == State::State_Ready || state == State::State_Stopped)
+            {
+                CHECK(!m_bSchedulerActive);
+            }
+        }
+
+        CCritSec m_cs;
+        std::atomic<State> m_state;
+        std::atomic<bool> m_bShutdown;
+        bool m_bSchedulerActive;                // Written under m_cs.
+        std::atomic<uint64_t> m_cQueued;
+        TransitionTrace<TraceSize> m_trace;
+    };
+
+    // xorshift32: cheap, and reproducible from the seed.
+    uint32_t NextRandom(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    void RunThread(CStreamModel& stream, uint32_t seed, int cOperations)
+    {
+        static const StreamOperation s_ops[] =
+        {
+            StreamOperation::OpSetMediaType,
+            StreamOperation::OpStart,
+            StreamOperation::OpRestart,
+            StreamOperation::OpPause,
+            StreamOperation::OpStop,
+            StreamOperation::OpPlaceMarker,
+            StreamOperation::OpStep,
+        };
+        const uint32_t cOps = sizeof(s_ops) / sizeof(s_ops[0]);
+
+        for (int i = 0; i < cOperations; i++)
+        {
+            const uint32_t r = NextRandom(seed);
+
+            if (r % 4096 == 0)
+            {
+                stream.Shutdown();
+                continue;
+            }
+
+            // Half of the calls are samples, as on a playing stream.
+            if (r % 2 == 0)
+            {
+                (void)stream.ProcessSample();
+                continue;
+            }
+
+            const bool bWasShutdown = stream.IsShutdown();
+            const int result = stream.Apply(s_ops[(r >> 1) % cOps]);
+            if (bWasShutdown)
+            {
+                CHECK(result == E_Shutdown);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int cRounds = argc > 1 ? std::atoi(argv[1]) : 200;
+    const int cThreads = 4;
+    const int cOperations = 2000;
+
+    for (int round = 0; round < cRounds; round++)
+    {
+        CStreamModel stream;
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < cThreads; t++)
+        {
+            const uint32_t seed = 0x9E3779B9u * (uint32_t)(round * cThreads + t + 1);
+            threads.emplace_back([&stream, seed, cOperations]() { RunThread(stream, seed, cOperations); });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        stream.CheckTrace();
+    }
+
+    return TestResult("StreamStateFuzz");
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+
+//////////////////////////////////////////////////////////////////////////
+//  Test checks
+//
+//  CHECK reports a failed condition and lets the test go on, so one run
+//  shows every failure. A test's main returns TestResult().
+//////////////////////////////////////////////////////////////////////////
+
+inline std::atomic<int>& TestFailures(void)
+{
+    static std::atomic<int> s_cFailures{ 0 };
+    return s_cFailures;
+}
+
+#define CHECK(expr) \
+    do \
+    { \
+        if (!(expr)) \
+        { \
+            std::fprintf(stderr, "%s(%d): CHECK failed: %s\n", __FILE__, __LINE__, #expr); \
+            TestFailures()++; \
+        } \
+    } while (0)
+
+inline int TestResult(const char* name)
+{
+    const int cFailures = TestFailures().load();
+    std::printf("%s: %s (%d failed checks)\n", name, cFailures == 0 ? "passed" : "FAILED", cFailures);
+    return cFailures == 0 ? 0 : 1;
+}